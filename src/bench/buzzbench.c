@@ -0,0 +1,307 @@
+#include "buzzbench.h"
+#include <buzz/buzzdarray.h>
+#include <buzz/config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+
+/****************************************/
+/****************************************/
+
+volatile uint64_t buzzbench_sink = 0;
+
+/*
+ * The results of a benchmark.
+ */
+struct buzzbench_result_s {
+   char* group;
+   char* name;
+   uint32_t size;
+   /* Iterations per sample */
+   uint64_t iters;
+   struct buzzbench_summary_s s;
+};
+
+struct buzzbench_s {
+   /* Samples per benchmark */
+   uint32_t samples;
+   /* Minimum sample duration, in ns */
+   uint64_t mintime;
+   /* Name filter, or NULL */
+   const char* filter;
+   /* Results, as struct buzzbench_result_s */
+   buzzdarray_t results;
+   /* Time of the last start of the timer */
+   uint64_t start;
+   /* Time accumulated by the timer */
+   uint64_t elapsed;
+};
+
+/****************************************/
+/****************************************/
+
+static uint64_t now() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void buzzbench_result_destroy(uint32_t pos, void* data, void* params) {
+   struct buzzbench_result_s* r = (struct buzzbench_result_s*)data;
+   free(r->group);
+   free(r->name);
+}
+
+/****************************************/
+/****************************************/
+
+buzzbench_t buzzbench_new(uint32_t samples,
+                          uint64_t mintime,
+                          const char* filter) {
+   buzzbench_t b = (buzzbench_t)calloc(1, sizeof(struct buzzbench_s));
+   b->samples = samples > 1 ? samples : 2;
+   b->mintime = mintime;
+   b->filter = filter;
+   b->results = buzzdarray_new(64,
+                               sizeof(struct buzzbench_result_s),
+                               buzzbench_result_destroy);
+   return b;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzbench_destroy(buzzbench_t* b) {
+   buzzdarray_destroy(&(*b)->results);
+   free(*b);
+   *b = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzbench_pause(buzzbench_t b) {
+   b->elapsed += now() - b->start;
+}
+
+void buzzbench_resume(buzzbench_t b) {
+   b->start = now();
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Times a sample.
+ * Returns the time per operation, or -1 if the benchmark failed, and the
+ * total time in *elapsed.
+ */
+static double buzzbench_sample(buzzbench_t b,
+                               uint32_t size,
+                               buzzbench_setupp setup,
+                               buzzbench_runp run,
+                               buzzbench_teardownp teardown,
+                               void* params,
+                               uint64_t iters,
+                               uint64_t* elapsed) {
+   void* state = setup ? setup(size, params) : NULL;
+   b->elapsed = 0;
+   b->start = now();
+   uint64_t ops = run(b, state, iters);
+   buzzbench_pause(b);
+   if(teardown) teardown(state);
+   *elapsed = b->elapsed;
+   return ops ? (double)b->elapsed / ops : -1.0;
+}
+
+static int buzzbench_dblcmp(const void* a, const void* b) {
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+   return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double buzzbench_median(const double* x, uint32_t n) {
+   return (n % 2) ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2.0;
+}
+
+/*
+ * Summarizes the samples. The samples are sorted in the process.
+ */
+static void buzzbench_summarize(double* x,
+                                uint32_t n,
+                                struct buzzbench_summary_s* s) {
+   uint32_t i;
+   qsort(x, n, sizeof(double), buzzbench_dblcmp);
+   s->min = x[0];
+   s->max = x[n - 1];
+   s->median = buzzbench_median(x, n);
+   s->mean = 0.0;
+   for(i = 0; i < n; ++i) s->mean += x[i];
+   s->mean /= n;
+   s->stddev = 0.0;
+   for(i = 0; i < n; ++i) s->stddev += (x[i] - s->mean) * (x[i] - s->mean);
+   s->stddev = sqrt(s->stddev / (n - 1));
+   /* Normal approximation of the confidence interval */
+   s->ci95 = 1.96 * s->stddev / sqrt(n);
+   double* d = (double*)malloc(n * sizeof(double));
+   for(i = 0; i < n; ++i) d[i] = fabs(x[i] - s->median);
+   qsort(d, n, sizeof(double), buzzbench_dblcmp);
+   s->mad = buzzbench_median(d, n);
+   free(d);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzbench_add(buzzbench_t b,
+                   const char* group,
+                   const char* name,
+                   uint32_t size,
+                   buzzbench_setupp setup,
+                   buzzbench_runp run,
+                   buzzbench_teardownp teardown,
+                   void* params) {
+   /* Filter the benchmark */
+   char full[512];
+   snprintf(full, sizeof(full), "%s/%s/%" PRIu32, group, name, size);
+   if(b->filter && !strstr(full, b->filter)) return;
+   /* Find the number of iterations, which also warms up */
+   uint64_t iters = 1, elapsed;
+   while(1) {
+      if(buzzbench_sample(b, size, setup, run, teardown, params, iters, &elapsed) < 0.0) {
+         fprintf(stderr, "%-40s failed\n", full);
+         return;
+      }
+      if(elapsed >= b->mintime || iters >= ((uint64_t)1 << 40)) break;
+      double f = elapsed ? 1.4 * b->mintime / elapsed : 100.0;
+      if(f < 2.0)   f = 2.0;
+      if(f > 100.0) f = 100.0;
+      iters = (uint64_t)(iters * f);
+   }
+   /* Take the samples */
+   double* x = (double*)malloc(b->samples * sizeof(double));
+   uint32_t i;
+   for(i = 0; i < b->samples; ++i) {
+      x[i] = buzzbench_sample(b, size, setup, run, teardown, params, iters, &elapsed);
+      if(x[i] < 0.0) {
+         fprintf(stderr, "%-40s failed\n", full);
+         free(x);
+         return;
+      }
+   }
+   struct buzzbench_result_s r;
+   r.group = strdup(group);
+   r.name = strdup(name);
+   r.size = size;
+   r.iters = iters;
+   buzzbench_summarize(x, b->samples, &r.s);
+   free(x);
+   buzzdarray_push(b->results, &r);
+   fprintf(stderr, "%-40s %12.1f ns/op  +/- %.1f\n", full, r.s.median, r.s.mad);
+}
+
+/****************************************/
+/****************************************/
+
+static void json_string(FILE* f, const char* s) {
+   fputc('"', f);
+   for(; *s; ++s) {
+      if(*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+      else if((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+      else fputc(*s, f);
+   }
+   fputc('"', f);
+}
+
+int buzzbench_write_json(buzzbench_t b,
+                         FILE* f) {
+   char date[32];
+   time_t t = time(NULL);
+   strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+   fprintf(f, "{\n");
+   fprintf(f, "  \"buzz_version\": \"%s\",\n", BUZZ_VERSION);
+   fprintf(f, "  \"date\": \"%s\",\n", date);
+   fprintf(f, "  \"samples\": %" PRIu32 ",\n", b->samples);
+   fprintf(f, "  \"min_time_ns\": %" PRIu64 ",\n", b->mintime);
+   fprintf(f, "  \"unit\": \"ns/op\",\n");
+   fprintf(f, "  \"benchmarks\": [");
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(b->results); ++i) {
+      const struct buzzbench_result_s* r =
+         &buzzdarray_get(b->results, i, struct buzzbench_result_s);
+      fprintf(f, "%s\n    {\"group\": ", i ? "," : "");
+      json_string(f, r->group);
+      fprintf(f, ", \"name\": ");
+      json_string(f, r->name);
+      fprintf(f, ", \"size\": %" PRIu32 ", \"iterations\": %" PRIu64, r->size, r->iters);
+      fprintf(f, ", \"min\": %.3f, \"max\": %.3f, \"mean\": %.3f, \"median\": %.3f"
+              ", \"stddev\": %.3f, \"mad\": %.3f, \"ci95\": %.3f}",
+              r->s.min, r->s.max, r->s.mean, r->s.median,
+              r->s.stddev, r->s.mad, r->s.ci95);
+   }
+   fprintf(f, "\n  ]\n}\n");
+   return ferror(f) ? -1 : 0;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzbench_compare(buzzbench_t b,
+                      const char* fname,
+                      double threshold,
+                      FILE* f) {
+   FILE* in = fopen(fname, "r");
+   if(!in) return -1;
+   /* Read the medians of the previous run */
+   buzzdarray_t old = buzzdarray_new(64,
+                                     sizeof(struct buzzbench_result_s),
+                                     buzzbench_result_destroy);
+   char line[1024], group[256], name[256];
+   struct buzzbench_result_s r;
+   memset(&r, 0, sizeof(r));
+   while(fgets(line, sizeof(line), in)) {
+      const char* m = strstr(line, "\"median\": ");
+      if(sscanf(line, " {\"group\": \"%255[^\"]\", \"name\": \"%255[^\"]\", \"size\": %" SCNu32,
+                group, name, &r.size) == 3 &&
+         m && sscanf(m, "\"median\": %lf", &r.s.median) == 1) {
+         r.group = strdup(group);
+         r.name = strdup(name);
+         buzzdarray_push(old, &r);
+      }
+   }
+   fclose(in);
+   /* Compare */
+   int regressions = 0;
+   uint32_t i, j;
+   fprintf(f, "%-40s %12s %12s %8s\n", "benchmark", "before", "after", "change");
+   for(i = 0; i < buzzdarray_size(b->results); ++i) {
+      const struct buzzbench_result_s* x =
+         &buzzdarray_get(b->results, i, struct buzzbench_result_s);
+      for(j = 0; j < buzzdarray_size(old); ++j) {
+         const struct buzzbench_result_s* y =
+            &buzzdarray_get(old, j, struct buzzbench_result_s);
+         if(x->size == y->size &&
+            strcmp(x->group, y->group) == 0 &&
+            strcmp(x->name, y->name) == 0) break;
+      }
+      if(j == buzzdarray_size(old)) continue;
+      const struct buzzbench_result_s* y =
+         &buzzdarray_get(old, j, struct buzzbench_result_s);
+      double change = y->s.median > 0.0 ?
+         100.0 * (x->s.median - y->s.median) / y->s.median :
+         0.0;
+      int bad = change > threshold && x->s.min > y->s.median;
+      regressions += bad;
+      snprintf(line, sizeof(line), "%s/%s/%" PRIu32, x->group, x->name, x->size);
+      fprintf(f, "%-40s %12.1f %12.1f %+7.1f%%%s\n",
+              line, y->s.median, x->s.median, change,
+              bad ? "  REGRESSION" : "");
+   }
+   buzzdarray_destroy(&old);
+   return regressions;
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,161 @@
+#ifndef BUZZBENCH_H
+#define BUZZBENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * The benchmark runner.
+    *
+    * A benchmark is a function that repeats an operation a given number
+    * of times. The runner first finds how many iterations fill the
+    * minimum sample time, then times a number of samples of that many
+    * iterations, and summarizes the time per operation across the
+    * samples. Each sample gets a fresh state from the setup function,
+    * which is not timed.
+    */
+   typedef struct buzzbench_s* buzzbench_t;
+
+   /*
+    * Creates the state of a sample.
+    * @param size The size parameter of the benchmark.
+    * @param params The parameters given to buzzbench_add().
+    * @return The state.
+    */
+   typedef void* (*buzzbench_setupp)(uint32_t size,
+                                     void* params);
+
+   /*
+    * Runs the operation of a benchmark.
+    * @param b The runner, to pause the timer.
+    * @param state The state made by the setup function.
+    * @param iters The number of iterations.
+    * @return The number of operations done.
+    */
+   typedef uint64_t (*buzzbench_runp)(buzzbench_t b,
+                                      void* state,
+                                      uint64_t iters);
+
+   /*
+    * Destroys the state of a sample.
+    * @param state The state.
+    */
+   typedef void (*buzzbench_teardownp)(void* state);
+
+   /*
+    * Summary of the time per operation across the samples, in ns.
+    */
+   struct buzzbench_summary_s {
+      double min;
+      double max;
+      double mean;
+      double median;
+      /* Standard deviation */
+      double stddev;
+      /* Median absolute deviation */
+      double mad;
+      /* Half-width of the 95% confidence interval of the mean */
+      double ci95;
+   };
+
+   /*
+    * Creates a new runner.
+    * @param samples The number of samples per benchmark.
+    * @param mintime The minimum duration of a sample, in ns.
+    * @param filter Only the benchmarks whose full name contains this
+    * string are run, or NULL to run them all.
+    * @return The runner.
+    */
+   extern buzzbench_t buzzbench_new(uint32_t samples,
+                                    uint64_t mintime,
+                                    const char* filter);
+
+   /*
+    * Destroys a runner.
+    * @param b The runner.
+    */
+   extern void buzzbench_destroy(buzzbench_t* b);
+
+   /*
+    * Adds a benchmark and runs it.
+    * The full name of the benchmark is group/name/size.
+    * @param b The runner.
+    * @param group The group, usually the module being measured.
+    * @param name The operation.
+    * @param size The size parameter given to the setup function.
+    * @param setup The setup function, or NULL.
+    * @param run The benchmark function.
+    * @param teardown The teardown function, or NULL.
+    * @param params The parameters given to the setup function.
+    */
+   extern void buzzbench_add(buzzbench_t b,
+                             const char* group,
+                             const char* name,
+                             uint32_t size,
+                             buzzbench_setupp setup,
+                             buzzbench_runp run,
+                             buzzbench_teardownp teardown,
+                             void* params);
+
+   /*
+    * Stops the timer, e.g. to refill a container between iterations.
+    * @param b The runner.
+    */
+   extern void buzzbench_pause(buzzbench_t b);
+
+   /*
+    * Restarts the timer.
+    * @param b The runner.
+    */
+   extern void buzzbench_resume(buzzbench_t b);
+
+   /*
+    * Writes the results as JSON.
+    * Each benchmark is written on its own line, which is what
+    * buzzbench_compare() expects.
+    * @param b The runner.
+    * @param f The file to write into.
+    * @return 0 on success, -1 on error.
+    */
+   extern int buzzbench_write_json(buzzbench_t b,
+                                   FILE* f);
+
+   /*
+    * Compares the results with those of a previous run.
+    * A benchmark regresses when its median is more than 'threshold'
+    * percent slower than in the previous run, and its fastest sample is
+    * slower than the previous median.
+    * @param b The runner.
+    * @param fname The JSON file of the previous run.
+    * @param threshold The tolerated slowdown, in percent.
+    * @param f The file to write the comparison into.
+    * @return The number of regressions, or -1 if the file can't be read.
+    */
+   extern int buzzbench_compare(buzzbench_t b,
+                                const char* fname,
+                                double threshold,
+                                FILE* f);
+
+   /*
+    * Sink for the results of the benchmarks, so that the compiler does
+    * not optimize the operations away.
+    */
+   extern volatile uint64_t buzzbench_sink;
+
+   /*
+    * The benchmarks, by module.
+    */
+   extern void buzzbench_containers(buzzbench_t b);
+   extern void buzzbench_heap(buzzbench_t b);
+   extern void buzzbench_vm(buzzbench_t b,
+                            const char* fname);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
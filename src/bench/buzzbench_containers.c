@@ -0,0 +1,277 @@
+#include "buzzbench.h"
+#include <buzz/buzzdict.h>
+#include <buzz/buzzdarray.h>
+#include <buzz/buzzstrman.h>
+#include <stdlib.h>
+
+/****************************************/
+/****************************************/
+
+static const uint32_t SIZES[] = { 16, 256, 4096, 65536 };
+#define NSIZES (sizeof(SIZES) / sizeof(uint32_t))
+
+/*
+ * Spreads consecutive integers over the key space, so that the keys do
+ * not hit the buckets in order.
+ */
+#define KEY(i) ((int32_t)((uint32_t)(i) * 2654435761u))
+
+/*
+ * Simple random number generator for the access patterns.
+ */
+static uint32_t rnd(uint32_t* s) {
+   *s ^= *s << 13;
+   *s ^= *s >> 17;
+   *s ^= *s << 5;
+   return *s;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * buzzdict
+ */
+
+struct dict_s {
+   buzzdict_t dt;
+   uint32_t size;
+};
+
+static buzzdict_t dict_new(uint32_t size) {
+   return buzzdict_new(size / 4 + 1,
+                       sizeof(int32_t),
+                       sizeof(int32_t),
+                       buzzdict_int32keyhash,
+                       buzzdict_int32keycmp,
+                       NULL);
+}
+
+static void dict_fill(buzzdict_t dt, uint32_t size) {
+   uint32_t i;
+   for(i = 0; i < size; ++i) {
+      int32_t k = KEY(i);
+      buzzdict_set(dt, &k, &i);
+   }
+}
+
+static void* dict_setup(uint32_t size, void* params) {
+   struct dict_s* d = (struct dict_s*)malloc(sizeof(struct dict_s));
+   d->dt = dict_new(size);
+   d->size = size;
+   if(params) dict_fill(d->dt, size);
+   return d;
+}
+
+static void dict_teardown(void* state) {
+   struct dict_s* d = (struct dict_s*)state;
+   buzzdict_destroy(&d->dt);
+   free(d);
+}
+
+/* Inserts 'size' keys into an empty dictionary */
+static uint64_t dict_insert(buzzbench_t b, void* state, uint64_t iters) {
+   struct dict_s* d = (struct dict_s*)state;
+   uint64_t n;
+   for(n = 0; n < iters; ++n) {
+      buzzbench_pause(b);
+      buzzdict_destroy(&d->dt);
+      d->dt = dict_new(d->size);
+      buzzbench_resume(b);
+      dict_fill(d->dt, d->size);
+   }
+   return iters * d->size;
+}
+
+/* Looks up random keys in a dictionary of 'size' keys */
+static uint64_t dict_lookup(buzzbench_t b, void* state, uint64_t iters) {
+   struct dict_s* d = (struct dict_s*)state;
+   uint32_t s = 2463534242u;
+   uint64_t n, x = 0;
+   for(n = 0; n < iters; ++n) {
+      int32_t k = KEY(rnd(&s) % d->size);
+      x += *buzzdict_get(d->dt, &k, int32_t);
+   }
+   buzzbench_sink += x;
+   return iters;
+}
+
+/* Looks up keys that are not in a dictionary of 'size' keys */
+static uint64_t dict_miss(buzzbench_t b, void* state, uint64_t iters) {
+   struct dict_s* d = (struct dict_s*)state;
+   uint32_t s = 2463534242u;
+   uint64_t n, x = 0;
+   for(n = 0; n < iters; ++n) {
+      int32_t k = KEY(d->size + rnd(&s) % d->size);
+      x += buzzdict_exists(d->dt, &k);
+   }
+   buzzbench_sink += x;
+   return iters;
+}
+
+/* Removes all the keys of a dictionary of 'size' keys */
+static uint64_t dict_remove(buzzbench_t b, void* state, uint64_t iters) {
+   struct dict_s* d = (struct dict_s*)state;
+   uint64_t n;
+   uint32_t i;
+   for(n = 0; n < iters; ++n) {
+      buzzbench_pause(b);
+      dict_fill(d->dt, d->size);
+      buzzbench_resume(b);
+      for(i = 0; i < d->size; ++i) {
+         int32_t k = KEY(i);
+         buzzdict_remove(d->dt, &k);
+      }
+   }
+   return iters * d->size;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * buzzdarray
+ */
+
+struct darray_s {
+   buzzdarray_t da;
+   uint32_t size;
+};
+
+static void* darray_setup(uint32_t size, void* params) {
+   struct darray_s* d = (struct darray_s*)malloc(sizeof(struct darray_s));
+   d->da = buzzdarray_new(1, sizeof(void*), NULL);
+   d->size = size;
+   void* p = NULL;
+   uint32_t i;
+   if(params)
+      for(i = 0; i < size; ++i) buzzdarray_push(d->da, &p);
+   return d;
+}
+
+static void darray_teardown(void* state) {
+   struct darray_s* d = (struct darray_s*)state;
+   buzzdarray_destroy(&d->da);
+   free(d);
+}
+
+/* Pushes 'size' elements, then pops them */
+static uint64_t darray_pushpop(buzzbench_t b, void* state, uint64_t iters) {
+   struct darray_s* d = (struct darray_s*)state;
+   uint64_t n;
+   uint32_t i;
+   for(n = 0; n < iters; ++n) {
+      for(i = 0; i < d->size; ++i) buzzdarray_push(d->da, &d);
+      for(i = 0; i < d->size; ++i) buzzdarray_pop(d->da);
+   }
+   return 2 * iters * d->size;
+}
+
+/* Inserts an element at the front of an array of 'size' elements and
+ * removes it */
+static uint64_t darray_front(buzzbench_t b, void* state, uint64_t iters) {
+   struct darray_s* d = (struct darray_s*)state;
+   uint64_t n;
+   for(n = 0; n < iters; ++n) {
+      buzzdarray_insert(d->da, 0, &d);
+      buzzdarray_remove(d->da, 0);
+   }
+   return 2 * iters;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * buzzstrman
+ */
+
+struct strman_s {
+   buzzstrman_t sm;
+   char** strs;
+   uint32_t size;
+};
+
+static void* strman_setup(uint32_t size, void* params) {
+   struct strman_s* s = (struct strman_s*)malloc(sizeof(struct strman_s));
+   s->sm = buzzstrman_new();
+   s->size = size;
+   s->strs = (char**)malloc(size * sizeof(char*));
+   uint32_t i;
+   for(i = 0; i < size; ++i) {
+      s->strs[i] = (char*)malloc(16);
+      snprintf(s->strs[i], 16, "str%08x", (uint32_t)KEY(i));
+      if(params) buzzstrman_register(s->sm, s->strs[i], 0);
+   }
+   return s;
+}
+
+static void strman_teardown(void* state) {
+   struct strman_s* s = (struct strman_s*)state;
+   uint32_t i;
+   for(i = 0; i < s->size; ++i) free(s->strs[i]);
+   free(s->strs);
+   buzzstrman_destroy(&s->sm);
+   free(s);
+}
+
+/* Registers 'size' new strings */
+static uint64_t strman_new(buzzbench_t b, void* state, uint64_t iters) {
+   struct strman_s* s = (struct strman_s*)state;
+   uint64_t n;
+   uint32_t i;
+   for(n = 0; n < iters; ++n) {
+      buzzbench_pause(b);
+      buzzstrman_destroy(&s->sm);
+      s->sm = buzzstrman_new();
+      buzzbench_resume(b);
+      for(i = 0; i < s->size; ++i)
+         buzzbench_sink += buzzstrman_register(s->sm, s->strs[i], 0);
+   }
+   return iters * s->size;
+}
+
+/* Registers strings that are already among 'size' strings */
+static uint64_t strman_existing(buzzbench_t b, void* state, uint64_t iters) {
+   struct strman_s* s = (struct strman_s*)state;
+   uint32_t r = 2463534242u;
+   uint64_t n, x = 0;
+   for(n = 0; n < iters; ++n)
+      x += buzzstrman_register(s->sm, s->strs[rnd(&r) % s->size], 0);
+   buzzbench_sink += x;
+   return iters;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzbench_containers(buzzbench_t b) {
+   static int FULL = 1;
+   uint32_t i;
+   for(i = 0; i < NSIZES; ++i) {
+      buzzbench_add(b, "buzzdict", "insert", SIZES[i],
+                    dict_setup, dict_insert, dict_teardown, NULL);
+      buzzbench_add(b, "buzzdict", "lookup", SIZES[i],
+                    dict_setup, dict_lookup, dict_teardown, &FULL);
+      buzzbench_add(b, "buzzdict", "miss", SIZES[i],
+                    dict_setup, dict_miss, dict_teardown, &FULL);
+      buzzbench_add(b, "buzzdict", "remove", SIZES[i],
+                    dict_setup, dict_remove, dict_teardown, NULL);
+   }
+   for(i = 0; i < NSIZES; ++i) {
+      buzzbench_add(b, "buzzdarray", "push_pop", SIZES[i],
+                    darray_setup, darray_pushpop, darray_teardown, NULL);
+      buzzbench_add(b, "buzzdarray", "insert_remove_front", SIZES[i],
+                    darray_setup, darray_front, darray_teardown, &FULL);
+   }
+   /* String ids are 16 bits */
+   for(i = 0; i < NSIZES - 1; ++i) {
+      buzzbench_add(b, "buzzstrman", "register_new", SIZES[i],
+                    strman_setup, strman_new, strman_teardown, NULL);
+      buzzbench_add(b, "buzzstrman", "register_existing", SIZES[i],
+                    strman_setup, strman_existing, strman_teardown, &FULL);
+   }
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,185 @@
+#include "buzzbench.h"
+#include <buzz/buzzvm.h>
+#include <buzz/buzzmsg.h>
+#include <stdlib.h>
+
+/****************************************/
+/****************************************/
+
+/*
+ * Live set sizes for the collections. The table that holds the live
+ * objects has an entry per two objects.
+ */
+static const uint32_t LIVE[] = { 256, 4096, 65536 };
+#define NLIVE (sizeof(LIVE) / sizeof(uint32_t))
+
+/*
+ * Table sizes for serialization. Tables are serialized with an 8-bit
+ * size, so they hold at most 255 entries. Size 0 is a float.
+ */
+static const uint32_t ENTRIES[] = { 0, 16, 128 };
+#define NENTRIES (sizeof(ENTRIES) / sizeof(uint32_t))
+
+/****************************************/
+/****************************************/
+
+/*
+ * Object allocation
+ */
+
+static void* vm_setup(uint32_t size, void* params) {
+   return buzzvm_new(1);
+}
+
+static void vm_teardown(void* state) {
+   buzzvm_t vm = (buzzvm_t)state;
+   buzzvm_destroy(&vm);
+}
+
+static uint64_t heap_newobj(buzzbench_t b, void* state, uint64_t iters, uint16_t type) {
+   buzzvm_t vm = (buzzvm_t)state;
+   uint64_t n;
+   for(n = 0; n < iters; ++n) buzzheap_newobj(vm, type);
+   return iters;
+}
+
+static uint64_t heap_newint(buzzbench_t b, void* state, uint64_t iters) {
+   return heap_newobj(b, state, iters, BUZZTYPE_INT);
+}
+
+static uint64_t heap_newtable(buzzbench_t b, void* state, uint64_t iters) {
+   return heap_newobj(b, state, iters, BUZZTYPE_TABLE);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Garbage collection
+ */
+
+struct gc_s {
+   buzzvm_t vm;
+   uint32_t size;
+};
+
+static void* gc_setup(uint32_t size, void* params) {
+   struct gc_s* g = (struct gc_s*)malloc(sizeof(struct gc_s));
+   g->vm = buzzvm_new(1);
+   g->size = size;
+   /* Keep size/2 integer pairs alive in a global table */
+   buzzvm_t vm = g->vm;
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "live", 1));
+   buzzvm_pusht(vm);
+   int32_t i;
+   for(i = 0; i < (int32_t)size / 2; ++i) {
+      buzzvm_dup(vm);
+      buzzvm_pushi(vm, i);
+      buzzvm_pushi(vm, i);
+      buzzvm_tput(vm);
+   }
+   buzzvm_gstore(vm);
+   return g;
+}
+
+static void gc_teardown(void* state) {
+   struct gc_s* g = (struct gc_s*)state;
+   buzzvm_destroy(&g->vm);
+   free(g);
+}
+
+/* A collection with 'size' live objects and as many dead ones */
+static uint64_t gc_collect(buzzbench_t b, void* state, uint64_t iters) {
+   struct gc_s* g = (struct gc_s*)state;
+   uint64_t n;
+   uint32_t i;
+   for(n = 0; n < iters; ++n) {
+      buzzbench_pause(b);
+      for(i = 0; i < g->size; ++i) buzzheap_newobj(g->vm, BUZZTYPE_INT);
+      g->vm->heap->max_objs = 0;
+      buzzbench_resume(b);
+      buzzheap_gc(g->vm);
+   }
+   return iters;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Serialization
+ */
+
+struct ser_s {
+   buzzvm_t vm;
+   buzzobj_t obj;
+   buzzmsg_payload_t buf;
+};
+
+static void* ser_setup(uint32_t size, void* params) {
+   struct ser_s* s = (struct ser_s*)malloc(sizeof(struct ser_s));
+   s->vm = buzzvm_new(1);
+   s->buf = buzzmsg_payload_new(64);
+   buzzvm_t vm = s->vm;
+   if(size == 0) {
+      buzzvm_pushf(vm, 3.14f);
+   }
+   else {
+      /* Integer keys, and float and string values */
+      buzzvm_pusht(vm);
+      uint32_t i;
+      char str[16];
+      for(i = 0; i < size; ++i) {
+         buzzvm_dup(vm);
+         buzzvm_pushi(vm, i);
+         if(i % 2) {
+            snprintf(str, sizeof(str), "value%u", i);
+            buzzvm_pushs(vm, buzzvm_string_register(vm, str, 1));
+         }
+         else buzzvm_pushf(vm, i * 0.5f);
+         buzzvm_tput(vm);
+      }
+   }
+   s->obj = buzzvm_stack_at(vm, 1);
+   return s;
+}
+
+static void ser_teardown(void* state) {
+   struct ser_s* s = (struct ser_s*)state;
+   buzzmsg_payload_destroy(&s->buf);
+   buzzvm_destroy(&s->vm);
+   free(s);
+}
+
+/* Serializes an object and deserializes it back */
+static uint64_t ser_roundtrip(buzzbench_t b, void* state, uint64_t iters) {
+   struct ser_s* s = (struct ser_s*)state;
+   buzzobj_t o;
+   uint64_t n;
+   for(n = 0; n < iters; ++n) {
+      buzzdarray_clear(s->buf, 64);
+      buzzobj_serialize(s->buf, s->obj);
+      buzzbench_sink += buzzobj_deserialize(&o, s->buf, 0, s->vm);
+   }
+   return iters;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzbench_heap(buzzbench_t b) {
+   uint32_t i;
+   buzzbench_add(b, "buzzheap", "newobj_int", 0,
+                 vm_setup, heap_newint, vm_teardown, NULL);
+   buzzbench_add(b, "buzzheap", "newobj_table", 0,
+                 vm_setup, heap_newtable, vm_teardown, NULL);
+   for(i = 0; i < NLIVE; ++i)
+      buzzbench_add(b, "buzzheap", "gc", LIVE[i],
+                    gc_setup, gc_collect, gc_teardown, NULL);
+   for(i = 0; i < NENTRIES; ++i)
+      buzzbench_add(b, "buzzobj", "serialize_roundtrip", ENTRIES[i],
+                    ser_setup, ser_roundtrip, ser_teardown, NULL);
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,97 @@
+#include "buzzbench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void usage(const char* path, int status) {
+   fprintf(stderr, "Usage:\n\t%s [options] [file.bo ...]\n\n", path);
+   fprintf(stderr, "Times the Buzz runtime primitives, and the functions named bench_*() in the\n");
+   fprintf(stderr, "given scripts, and writes the results as JSON.\n\n");
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, "\t--output FILE               write the results into FILE (default: stdout)\n");
+   fprintf(stderr, "\t--filter STR                only run the benchmarks whose name contains STR\n");
+   fprintf(stderr, "\t--samples N                 samples per benchmark (default: 20)\n");
+   fprintf(stderr, "\t--min-time MS               minimum duration of a sample in ms (default: 10)\n");
+   fprintf(stderr, "\t--baseline FILE             compare the results with those in FILE, and fail\n");
+   fprintf(stderr, "\t                            if a benchmark is slower\n");
+   fprintf(stderr, "\t--threshold PCT             slowdown tolerated by --baseline (default: 10)\n");
+   fprintf(stderr, "\t--no-runtime                only run the scripts\n\n");
+   exit(status);
+}
+
+int main(int argc, char** argv) {
+   /* The output file name, NULL for stdout */
+   char* outfname = NULL;
+   /* The file to compare with, NULL to skip the comparison */
+   char* basefname = NULL;
+   /* Benchmark parameters */
+   char* filter = NULL;
+   unsigned long samples = 20;
+   unsigned long mintime = 10;
+   double threshold = 10.0;
+   int runtime = 1;
+   /* Parse command line */
+   int i;
+   for(i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; ++i) {
+      if(i + 1 < argc && strcmp(argv[i], "--output") == 0) {
+         outfname = argv[++i];
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--filter") == 0) {
+         filter = argv[++i];
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--samples") == 0) {
+         samples = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--min-time") == 0) {
+         mintime = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--baseline") == 0) {
+         basefname = argv[++i];
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--threshold") == 0) {
+         threshold = strtod(argv[++i], NULL);
+      }
+      else if(strcmp(argv[i], "--no-runtime") == 0) {
+         runtime = 0;
+      }
+      else if(strcmp(argv[i], "--help") == 0) {
+         usage(argv[0], 0);
+      }
+      else {
+         fprintf(stderr, "error: %s: unrecognized option '%s'\n", argv[0], argv[i]);
+         usage(argv[0], 1);
+      }
+   }
+   /* Run the benchmarks */
+   buzzbench_t b = buzzbench_new(samples, (uint64_t)mintime * 1000000, filter);
+   if(runtime) {
+      buzzbench_containers(b);
+      buzzbench_heap(b);
+   }
+   for(; i < argc; ++i) buzzbench_vm(b, argv[i]);
+   /* Write the results */
+   int retval = 0;
+   FILE* f = outfname ? fopen(outfname, "w") : stdout;
+   if(!f || buzzbench_write_json(b, f) != 0) {
+      perror(outfname ? outfname : "stdout");
+      retval = 1;
+   }
+   if(f && outfname && fclose(f) != 0) {
+      perror(outfname);
+      retval = 1;
+   }
+   /* Compare with the baseline */
+   if(basefname) {
+      int r = buzzbench_compare(b, basefname, threshold, stderr);
+      if(r < 0) {
+         perror(basefname);
+         retval = 1;
+      }
+      else if(r > 0) {
+         fprintf(stderr, "%d benchmark%s slower than in %s\n", r, r > 1 ? "s are" : " is", basefname);
+         retval = 1;
+      }
+   }
+   buzzbench_destroy(&b);
+   return retval;
+}
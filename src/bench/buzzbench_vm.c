@@ -0,0 +1,168 @@
+#include "buzzbench.h"
+#include <buzz/buzzvm.h>
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************/
+/****************************************/
+
+/*
+ * Prefix of the kernel functions in the benchmark scripts.
+ */
+#define KERNEL_PREFIX "bench_"
+
+/*
+ * A function of a benchmark script.
+ */
+struct kernel_s {
+   const uint8_t* bcode;
+   uint32_t size;
+   const char* fname;
+};
+
+/*
+ * The state of a sample.
+ */
+struct script_s {
+   buzzvm_t vm;
+   const char* fname;
+};
+
+static buzzvm_t script_vm(const uint8_t* bcode, uint32_t size) {
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, bcode, size);
+   buzzvm_execute_script(vm);
+   return vm;
+}
+
+static void* script_setup(uint32_t size, void* params) {
+   struct kernel_s* k = (struct kernel_s*)params;
+   struct script_s* s = (struct script_s*)malloc(sizeof(struct script_s));
+   s->vm = script_vm(k->bcode, k->size);
+   s->fname = k->fname;
+   return s;
+}
+
+static void script_teardown(void* state) {
+   struct script_s* s = (struct script_s*)state;
+   buzzvm_destroy(&s->vm);
+   free(s);
+}
+
+/*
+ * Calls a function of the script.
+ * Kernels that return an integer report the number of operations they
+ * did, and the time is then given per operation.
+ */
+static uint64_t script_call(buzzbench_t b, void* state, uint64_t iters) {
+   struct script_s* s = (struct script_s*)state;
+   buzzvm_t vm = s->vm;
+   uint64_t n, ops = 0;
+   for(n = 0; n < iters; ++n) {
+      if(buzzvm_function_call(vm, s->fname, 0) != BUZZVM_STATE_READY) {
+         fprintf(stderr, "%s(): %s\n", s->fname,
+                 vm->errormsg ? vm->errormsg : buzzvm_error_desc[vm->error]);
+         return 0;
+      }
+      buzzobj_t r = buzzvm_stack_at(vm, 1);
+      ops += (r->o.type == BUZZTYPE_INT && r->i.value > 0) ? r->i.value : 1;
+      buzzvm_pop(vm);
+   }
+   return ops;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Finds the kernels of a script.
+ */
+
+struct find_s {
+   buzzvm_t vm;
+   /* Function names, as char* */
+   buzzdarray_t names;
+   /* Whether the script has a nop() function */
+   int nop;
+};
+
+static void find_kernel(const void* key, void* data, void* params) {
+   struct find_s* f = (struct find_s*)params;
+   const char* sym = buzzvm_string_get(f->vm, *(int32_t*)key);
+   buzzobj_t o = *(buzzobj_t*)data;
+   if(!sym || o->o.type != BUZZTYPE_CLOSURE || !o->c.value.isnative) return;
+   if(strncmp(sym, KERNEL_PREFIX, strlen(KERNEL_PREFIX)) == 0) {
+      char* name = strdup(sym);
+      buzzdarray_push(f->names, &name);
+   }
+   else if(strcmp(sym, "nop") == 0) f->nop = 1;
+}
+
+static int find_cmp(const void* a, const void* b) {
+   return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void find_destroy(uint32_t pos, void* data, void* params) {
+   free(*(char**)data);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzbench_vm(buzzbench_t b,
+                  const char* fname) {
+   /* Read the bytecode */
+   FILE* f = fopen(fname, "rb");
+   if(!f) {
+      perror(fname);
+      return;
+   }
+   fseek(f, 0, SEEK_END);
+   uint32_t size = ftell(f);
+   rewind(f);
+   uint8_t* bcode = (uint8_t*)malloc(size);
+   if(fread(bcode, 1, size, f) < size) {
+      perror(fname);
+      fclose(f);
+      free(bcode);
+      return;
+   }
+   fclose(f);
+   /* Find the kernels */
+   struct find_s fk;
+   fk.vm = script_vm(bcode, size);
+   fk.names = buzzdarray_new(8, sizeof(char*), find_destroy);
+   fk.nop = 0;
+   if(fk.vm->state == BUZZVM_STATE_ERROR) {
+      fprintf(stderr, "%s: %s\n", fname,
+              fk.vm->errormsg ? fk.vm->errormsg : buzzvm_error_desc[fk.vm->error]);
+   }
+   else buzzdict_foreach(fk.vm->gsyms, find_kernel, &fk);
+   buzzvm_destroy(&fk.vm);
+   buzzdarray_sort(fk.names, find_cmp);
+   /* The group is the script name without directory and extension */
+   const char* base = strrchr(fname, '/');
+   char* group = strdup(base ? base + 1 : fname);
+   char* ext = strrchr(group, '.');
+   if(ext) *ext = 0;
+   /* Calls from the host, as in the control step of the integrations */
+   struct kernel_s k = { bcode, size, NULL };
+   if(fk.nop) {
+      k.fname = "nop";
+      buzzbench_add(b, "buzzvm", "call", 0,
+                    script_setup, script_call, script_teardown, &k);
+   }
+   /* Kernels */
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(fk.names); ++i) {
+      k.fname = buzzdarray_get(fk.names, i, char*);
+      buzzbench_add(b, group, k.fname + strlen(KERNEL_PREFIX), 0,
+                    script_setup, script_call, script_teardown, &k);
+   }
+   free(group);
+   buzzdarray_destroy(&fk.names);
+   free(bcode);
+}
+
+/****************************************/
+/****************************************/
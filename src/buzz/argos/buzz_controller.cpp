@@ -4,65 +4,55 @@
 #include <cstdlib>
 #include <fstream>
 #include <cerrno>
+#include <mutex>
 #include <argos3/core/utility/logging/argos_log.h>
 
 /****************************************/
 /****************************************/
 
-pthread_mutex_t CBuzzController::TRAJECTORY_MUTEX;
-CSet<CBuzzController*> CBuzzController::TRAJECTORY_CONTROLLERS;
-
-/*
- * A class used to trick the linker to initialize the trajectory mutex
- * during static initialization.
- */
-class CBuzzControllerMutexInitializer {
-public:
-   CBuzzControllerMutexInitializer() {
-      pthread_mutex_init(&CBuzzController::TRAJECTORY_MUTEX, NULL);
-   }
-} __cBuzzControllerMutexInitializer;
-
-/****************************************/
-/****************************************/
-
 int BuzzLOG (buzzvm_t vm) {
-   LOG << "BUZZ: ";
+   /* Get pointer to controller user data */
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "controller", 1));
+   buzzvm_gload(vm);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_USERDATA);
+   CBuzzController& cContr = *reinterpret_cast<CBuzzController*>(buzzvm_stack_at(vm, 1)->u.value);
+   /* Write into the controller buffer, the shared log is not thread-safe */
+   std::ostream& cLog = cContr.GetLogBuffer();
+   cLog << "BUZZ: ";
    for(UInt32 i = 1; i < buzzdarray_size(vm->lsyms->syms); ++i) {
       buzzvm_lload(vm, i);
       buzzobj_t o = buzzvm_stack_at(vm, 1);
       buzzvm_pop(vm);
       switch(o->o.type) {
          case BUZZTYPE_NIL:
-            LOG << "[nil]";
+            cLog << "[nil]";
             break;
          case BUZZTYPE_INT:
-            LOG << o->i.value;
+            cLog << o->i.value;
             break;
          case BUZZTYPE_FLOAT:
-            LOG << o->f.value;
+            cLog << o->f.value;
             break;
          case BUZZTYPE_TABLE:
-            LOG << "[table with " << (buzzdict_size(o->t.value)) << " elems]";
+            cLog << "[table with " << (buzzdict_size(o->t.value)) << " elems]";
             break;
          case BUZZTYPE_CLOSURE:
             if(o->c.value.isnative)
-               LOG << "[n-closure @" << o->c.value.ref << "]";
+               cLog << "[n-closure @" << o->c.value.ref << "]";
             else
-               LOG << "[c-closure @" << o->c.value.ref << "]";
+               cLog << "[c-closure @" << o->c.value.ref << "]";
             break;
          case BUZZTYPE_STRING:
-            LOG << o->s.value.str;
+            cLog << o->s.value.str;
             break;
          case BUZZTYPE_USERDATA:
-            LOG << "[userdata @" << o->u.value << "]";
+            cLog << "[userdata @" << o->u.value << "]";
             break;
          default:
             break;
       }
    }
-   LOG << std::endl;
-   LOG.Flush();
+   cLog << std::endl;
    return buzzvm_ret0(vm);
 }
 
@@ -198,7 +188,7 @@ int BuzzDebugTrajectoryEnable(buzzvm_t vm) {
       buzzvm_seterror(vm, BUZZVM_ERROR_LNUM, "expected 4, 3, or 1 arguments, but %" PRId64 " were passed", buzzvm_lnum(vm));
    }
    /* Call method */
-   CBuzzController::DebugTrajectoryEnable(pcContr, nMaxPoints);
+   pcContr->GetARGoSDebugInfo().TrajectoryEnable(nMaxPoints);
    return buzzvm_ret0(vm);
 }
 
@@ -214,7 +204,7 @@ int BuzzDebugTrajectoryDisable(buzzvm_t vm) {
    buzzvm_type_assert(vm, 1, BUZZTYPE_USERDATA);
    CBuzzController* pcContr = reinterpret_cast<CBuzzController*>(buzzvm_stack_at(vm, 1)->u.value);
    /* Call method */
-   CBuzzController::DebugTrajectoryDisable(pcContr);
+   pcContr->GetARGoSDebugInfo().TrajectoryDisable();
    return buzzvm_ret0(vm);
 }
 
@@ -429,7 +419,13 @@ CBuzzController::CBuzzController() :
    m_pcBattery(NULL),
    m_tBuzzVM(NULL),
    m_tBuzzDbgInfo(NULL),
-   m_pcRNG(NULL) {}
+   m_pcRNG(NULL),
+   m_bLazySensors(false),
+   m_bSnapshotReset(false),
+   m_tBuzzSnapshot(NULL),
+   m_tBuzzProf(NULL),
+   m_bProfilePprof(false),
+   m_bStats(false) {}
 
 /****************************************/
 /****************************************/
@@ -462,6 +458,32 @@ void CBuzzController::Init(TConfigurationNode& t_node) {
       /* Get the script name */
       std::string strDbgFName;
       GetNodeAttributeOrDefault(t_node, "debug_file", strDbgFName, strDbgFName);
+      /* Whether to fill the sensor tables only when the script uses them */
+      GetNodeAttributeOrDefault(t_node, "lazy_sensors", m_bLazySensors, m_bLazySensors);
+      /* Whether Reset() goes back to a snapshot taken after init() */
+      GetNodeAttributeOrDefault(t_node, "snapshot_reset", m_bSnapshotReset, m_bSnapshotReset);
+      /* Profiling parameters */
+      GetNodeAttributeOrDefault(t_node, "profile", m_strProfileFName, m_strProfileFName);
+      if(m_strProfileFName != "") {
+         std::string strMode = "instructions";
+         GetNodeAttributeOrDefault(t_node, "profile_mode", strMode, strMode);
+         UInt32 unPeriod = 1000;
+         GetNodeAttributeOrDefault(t_node, "profile_period", unPeriod, unPeriod);
+         std::string strFormat = "folded";
+         GetNodeAttributeOrDefault(t_node, "profile_format", strFormat, strFormat);
+         if(strMode != "instructions" && strMode != "timer") {
+            THROW_ARGOSEXCEPTION("Unknown profiling mode \"" << strMode << "\"");
+         }
+         if(strFormat != "folded" && strFormat != "pprof") {
+            THROW_ARGOSEXCEPTION("Unknown profile format \"" << strFormat << "\"");
+         }
+         m_bProfilePprof = (strFormat == "pprof");
+         int nMode = (strMode == "timer") ? BUZZPROF_TIMER : BUZZPROF_INSTRUCTIONS;
+         m_tBuzzProf = buzzprof_new(nMode, unPeriod);
+         RegisterProfile(nMode, unPeriod);
+      }
+      /* Whether to count the executed instructions and functions */
+      GetNodeAttributeOrDefault(t_node, "stats", m_bStats, m_bStats);
       /* Initialize the rest */
       bool bIDSuccess = false;
       m_unRobotId = 0;
@@ -488,6 +510,7 @@ void CBuzzController::Init(TConfigurationNode& t_node) {
          SetBytecode(strBCFName, strDbgFName);
       else {
          m_tBuzzVM = buzzvm_new(m_unRobotId);
+         AttachProfiler();
          UpdateSensors();
       }
       /* Set initial robot message (id and then all zeros) */
@@ -521,8 +544,11 @@ void CBuzzController::Reset() {
    m_sDebug.TrajectoryDisable();
    m_sDebug.RayClear();
    try {
-      /* Set the bytecode again */
-      if(m_strBytecodeFName != "" && m_strDbgInfoFName != "")
+      /* Go back to the state after init(), or set the bytecode again,
+         which runs init() with the reset sensors */
+      if(m_tBuzzSnapshot)
+         ForkSnapshot();
+      else if(m_strBytecodeFName != "" && m_strDbgInfoFName != "")
          SetBytecode(m_strBytecodeFName, m_strDbgInfoFName);
       else
          UpdateSensors();
@@ -542,13 +568,13 @@ void CBuzzController::ControlStep() {
       const CCI_PositioningSensor::SReading& sPosRead = m_pcPos->GetReading();
       m_sDebug.TrajectoryAdd(sPosRead.Position);
    }
+   /* Write out the log of the last step, unless the loop functions did */
+   FlushLog();
    /* Take care of the rest */
    if(m_tBuzzVM && m_tBuzzVM->state == BUZZVM_STATE_READY) {
       ProcessInMsgs();
       UpdateSensors();
       if(buzzvm_function_call(m_tBuzzVM, "step", 0) != BUZZVM_STATE_READY) {
-         LOG.Flush();
-         LOGERR.Flush();
          fprintf(stderr, "[ROBOT %u] %s: execution terminated abnormally: %s\n\n",
                  m_tBuzzVM->robot,
                  m_strBytecodeFName.c_str(),
@@ -575,9 +601,23 @@ void CBuzzController::Destroy() {
    /* Get rid of the VM */
    if(m_tBuzzVM) {
       buzzvm_function_call(m_tBuzzVM, "destroy", 0);
+      if(m_tBuzzProf) WriteProfile();
       buzzvm_destroy(&m_tBuzzVM);
       if(m_tBuzzDbgInfo) buzzdebug_destroy(&m_tBuzzDbgInfo);
    }
+   if(m_tBuzzSnapshot) buzzvm_snapshot_destroy(&m_tBuzzSnapshot);
+   if(m_tBuzzProf) buzzprof_destroy(&m_tBuzzProf);
+   FlushLog();
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::FlushLog() {
+   if(m_cLog.tellp() > 0) {
+      LOG << m_cLog.str();
+      m_cLog.str("");
+   }
 }
 
 /****************************************/
@@ -587,7 +627,13 @@ void CBuzzController::SetBytecode(const std::string& str_bc_fname,
                                   const std::string& str_dbg_fname) {
    /* Reset the BuzzVM */
    if(m_tBuzzVM) buzzvm_destroy(&m_tBuzzVM);
+   if(m_tBuzzSnapshot) buzzvm_snapshot_destroy(&m_tBuzzSnapshot);
    m_tBuzzVM = buzzvm_new(m_unRobotId);
+   AttachProfiler();
+   /* The sensor tables belonged to the old VM */
+   m_vecSensors.clear();
+   m_mapSensorKeys.clear();
+   m_vecSensorIdx.clear();
    /* Get rid of debug info */
    if(m_tBuzzDbgInfo) buzzdebug_destroy(&m_tBuzzDbgInfo);
    m_tBuzzDbgInfo = buzzdebug_new();
@@ -643,6 +689,121 @@ void CBuzzController::SetBytecode(const std::string& str_bc_fname,
    }
    /* Remove useless return value from stack */
    buzzvm_pop(m_tBuzzVM);
+   /* Keep this state for Reset() */
+   if(m_bSnapshotReset) TakeSnapshot();
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::TakeSnapshot() {
+   m_tBuzzSnapshot = buzzvm_snapshot(m_tBuzzVM);
+   m_vecSnapshotSensors = m_vecSensors;
+   m_mapSnapshotSensorKeys = m_mapSensorKeys;
+   m_vecSnapshotSensorIdx = m_vecSensorIdx;
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::ForkSnapshot() {
+   buzzvm_destroy(&m_tBuzzVM);
+   m_tBuzzVM = buzzvm_fork(m_tBuzzSnapshot);
+   AttachProfiler();
+   /* Find the sensor tables and keys in the new VM */
+   m_vecSensors.clear();
+   for(size_t i = 0; i < m_vecSnapshotSensors.size(); ++i) {
+      m_vecSensors.push_back(
+         std::make_pair(buzzvm_snapshot_obj(m_tBuzzSnapshot, m_tBuzzVM, m_vecSnapshotSensors[i].first),
+                        m_vecSnapshotSensors[i].second));
+   }
+   m_mapSensorKeys.clear();
+   for(std::map<std::string, buzzobj_t>::iterator it = m_mapSnapshotSensorKeys.begin();
+       it != m_mapSnapshotSensorKeys.end();
+       ++it) {
+      m_mapSensorKeys[it->first] = buzzvm_snapshot_obj(m_tBuzzSnapshot, m_tBuzzVM, it->second);
+   }
+   m_vecSensorIdx.clear();
+   for(size_t i = 0; i < m_vecSnapshotSensorIdx.size(); ++i) {
+      m_vecSensorIdx.push_back(buzzvm_snapshot_obj(m_tBuzzSnapshot, m_tBuzzVM, m_vecSnapshotSensorIdx[i]));
+   }
+   UpdateSensors();
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * The merged profiles, by file name.
+ */
+struct SBuzzSharedProfile {
+   /* The samples of the controllers destroyed so far */
+   buzzprof_t Prof;
+   /* Number of controllers that still have to add their samples */
+   UInt32 Pending;
+};
+static std::map<std::string, SBuzzSharedProfile> BUZZ_PROFILES;
+static std::mutex BUZZ_PROFILES_MUTEX;
+
+void CBuzzController::AttachProfiler() {
+   if(m_tBuzzProf) buzzprof_attach(m_tBuzzVM, m_tBuzzProf);
+   if(m_bStats && !buzzvm_stats_enable(m_tBuzzVM, 1)) {
+      LOGERR << "[WARNING] Buzz was compiled without BUZZ_STATS, "
+             << "the execution counters are disabled"
+             << std::endl;
+      m_bStats = false;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::RegisterProfile(int n_mode,
+                                      UInt32 un_period) {
+   std::lock_guard<std::mutex> cLock(BUZZ_PROFILES_MUTEX);
+   std::map<std::string, SBuzzSharedProfile>::iterator it =
+      BUZZ_PROFILES.find(m_strProfileFName);
+   if(it == BUZZ_PROFILES.end()) {
+      SBuzzSharedProfile sProf;
+      sProf.Prof = buzzprof_new(n_mode, un_period);
+      sProf.Pending = 0;
+      it = BUZZ_PROFILES.insert(std::make_pair(m_strProfileFName, sProf)).first;
+   }
+   ++it->second.Pending;
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::WriteProfile() {
+   buzzprof_attach(m_tBuzzVM, NULL);
+   std::lock_guard<std::mutex> cLock(BUZZ_PROFILES_MUTEX);
+   std::map<std::string, SBuzzSharedProfile>::iterator it =
+      BUZZ_PROFILES.find(m_strProfileFName);
+   /* Add the samples of this controller */
+   buzzprof_merge(it->second.Prof, m_tBuzzProf);
+   if(it->second.Pending > 1) {
+      --it->second.Pending;
+      return;
+   }
+   /* Last controller: write the file */
+   FILE* ptFile = fopen(m_strProfileFName.c_str(), m_bProfilePprof ? "wb" : "w");
+   int nErr = ptFile ? 0 : -1;
+   if(ptFile) {
+      nErr = m_bProfilePprof ?
+         buzzprof_write_pprof(it->second.Prof, m_tBuzzVM, m_tBuzzDbgInfo, ptFile) :
+         buzzprof_write_folded(it->second.Prof, m_tBuzzVM, m_tBuzzDbgInfo, ptFile);
+      if(fclose(ptFile) != 0) nErr = -1;
+   }
+   if(nErr) {
+      LOGERR << "[WARNING] Can't write the Buzz profile \""
+             << m_strProfileFName
+             << "\": "
+             << strerror(errno)
+             << std::endl;
+   }
+   buzzprof_destroy(&it->second.Prof);
+   BUZZ_PROFILES.erase(it);
 }
 
 /****************************************/
@@ -708,6 +869,11 @@ buzzvm_state CBuzzController::RegisterFunctions() {
    buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "set_color", 1));
    buzzvm_pushcc(m_tBuzzVM, buzzvm_function_register(m_tBuzzVM, BuzzDebugSetColor));
    buzzvm_tput(m_tBuzzVM);
+   /* debug.stats() */
+   buzzvm_dup(m_tBuzzVM);
+   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "stats", 1));
+   buzzvm_pushcc(m_tBuzzVM, buzzvm_function_register(m_tBuzzVM, buzzvm_stats_table));
+   buzzvm_tput(m_tBuzzVM);
    /* Initialize debug.rays table */
    buzzvm_dup(m_tBuzzVM);
    buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "rays", 1));
@@ -749,6 +915,13 @@ buzzvm_state CBuzzController::RegisterFunctions() {
    }
    /* Finalize debug table */
    buzzvm_gstore(m_tBuzzVM);
+   /*
+    * Sensor tables
+    */
+   if(m_pcPos != NULL)
+      RegisterSensor("pose", &CBuzzController::FillPose);
+   if(m_pcBattery != NULL)
+      RegisterSensor("battery", &CBuzzController::FillBattery);
    return m_tBuzzVM->state;
 }
 
@@ -799,39 +972,21 @@ void CBuzzController::ProcessOutMsgs() {
    /* Send robot id */
    CByteArray cData;
    cData << m_tBuzzVM->robot;
-   /* Send messages from FIFO */
-   do {
-      /* Are there more messages? */
-      if(buzzoutmsg_queue_isempty(m_tBuzzVM)) break;
-      /* Get first message */
-      buzzmsg_payload_t m = buzzoutmsg_queue_first(m_tBuzzVM);
-      /* Make sure the message is smaller than the data buffer
-       * Without this check, large messages would clog the queue forever
-       */
-      size_t unMsgSize = buzzmsg_payload_size(m) + sizeof(UInt16);
-      if(unMsgSize < m_pcRABA->GetSize() - sizeof(UInt16)) {
-         /* Make sure the next message fits the data buffer */
-         if(cData.Size() + unMsgSize > m_pcRABA->GetSize()) {
-            buzzmsg_payload_destroy(&m);
-            break;
-         }
-         /* Add message length to data buffer */
-         cData << static_cast<UInt16>(buzzmsg_payload_size(m));
-         /* Add payload to data buffer */
-         cData.AddBuffer(reinterpret_cast<UInt8*>(m->data), buzzmsg_payload_size(m));
-      }
-      else {
-         RLOGERR << "Discarded oversize message ("
-                 << unMsgSize
-                 << " bytes). Max size is "
-                 << m_pcRABA->GetSize() - sizeof(UInt16)
-                 << " bytes."
-                 << std::endl;
-      }
-      /* Get rid of message */
-      buzzoutmsg_queue_next(m_tBuzzVM);
-      buzzmsg_payload_destroy(&m);
-   } while(1);
+   /* Messages that can never fit the data buffer are discarded by the
+      scheduler, otherwise they would clog the queue forever */
+   buzzoutmsg_queue_set_mtu(m_tBuzzVM, m_pcRABA->GetSize() - cData.Size() - sizeof(UInt16));
+   /* Fill the data buffer with the messages picked by the scheduler */
+   buzzmsg_payload_t m;
+   while(cData.Size() + sizeof(UInt16) < m_pcRABA->GetSize() &&
+         (m = buzzoutmsg_queue_pop(m_tBuzzVM,
+                                   m_pcRABA->GetSize() - cData.Size() - sizeof(UInt16))) != NULL) {
+      /* Add message length to data buffer */
+      cData << static_cast<UInt16>(buzzmsg_payload_size(m));
+      /* Add payload to data buffer */
+      cData.AddBuffer(reinterpret_cast<UInt8*>(m->data), buzzmsg_payload_size(m));
+      /* Give the buffer back to the queue */
+      buzzoutmsg_queue_recycle(m_tBuzzVM, &m);
+   }
    /* Pad the rest of the data with zeroes */
    while(cData.Size() < m_pcRABA->GetSize()) cData << static_cast<UInt8>(0);
    /* Send message */
@@ -856,11 +1011,24 @@ void CBuzzController::ProcessOutMsgs() {
    /* Set debug.msgqueue.vstig */
    TablePut(tMsgQueue,
             "vstig",
-            static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_PUT])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_QUERY])));
+            static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_PUT])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_QUERY])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_DIGEST])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_VSTIG_REQUEST])));
    /* Set debug.msgqueue.swarm */
    TablePut(tMsgQueue,
             "swarm",
-            static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_SWARM_JOIN])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_SWARM_LEAVE])));
+            static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_SWARM_JOIN])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_SWARM_LEAVE])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_SWARM_HEARTBEAT])) + static_cast<SInt32>(buzzdarray_size(m_tBuzzVM->outmsgs->queues[BUZZMSG_SWARM_REQUEST])));
+   /* Set debug.msgqueue.sent, the bytes sent so far for each class */
+   const struct buzzoutmsg_class_s* psClasses = m_tBuzzVM->outmsgs->classes;
+   buzzobj_t tSent = buzzheap_newobj(m_tBuzzVM, BUZZTYPE_TABLE);
+   TablePut(tSent,
+            "broadcast",
+            static_cast<SInt32>(psClasses[BUZZMSG_BROADCAST].sent_bytes));
+   TablePut(tSent,
+            "vstig",
+            static_cast<SInt32>(psClasses[BUZZMSG_VSTIG_PUT].sent_bytes + psClasses[BUZZMSG_VSTIG_QUERY].sent_bytes + psClasses[BUZZMSG_VSTIG_DIGEST].sent_bytes + psClasses[BUZZMSG_VSTIG_REQUEST].sent_bytes));
+   TablePut(tSent,
+            "swarm",
+            static_cast<SInt32>(psClasses[BUZZMSG_SWARM_LIST].sent_bytes + psClasses[BUZZMSG_SWARM_JOIN].sent_bytes + psClasses[BUZZMSG_SWARM_LEAVE].sent_bytes + psClasses[BUZZMSG_SWARM_HEARTBEAT].sent_bytes + psClasses[BUZZMSG_SWARM_REQUEST].sent_bytes));
+   TablePut(tMsgQueue, "sent", tSent);
    /* Save table */
    buzzvm_push(m_tBuzzVM, tMsgQueue);
    buzzvm_tput(m_tBuzzVM);
@@ -870,35 +1038,206 @@ void CBuzzController::ProcessOutMsgs() {
 /****************************************/
 
 void CBuzzController::UpdateSensors() {
-   /*
-    * Update positioning sensor
-    */
-   if(m_pcPos != NULL) {
-      /* Get positioning readings */
-      const CCI_PositioningSensor::SReading& sPosRead = m_pcPos->GetReading();
-      /* Create empty positioning data table */
-      buzzobj_t tPose = buzzheap_newobj(m_tBuzzVM, BUZZTYPE_TABLE);
-      /* Store position data */
-      TablePut(tPose, "position", sPosRead.Position);
-      /* Store orientation data */
-      TablePut(tPose, "orientation", sPosRead.Orientation);
-      /* Register positioning data table as global symbol */
-      Register("pose", tPose);
+   buzzvm_hostsyms_update(m_tBuzzVM, m_bLazySensors);
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::FillPose(buzzobj_t t_table) {
+   /* Get positioning readings */
+   const CCI_PositioningSensor::SReading& sPosRead = m_pcPos->GetReading();
+   /* Store position data */
+   SensorPut(t_table, SensorKey("position"), sPosRead.Position);
+   /* Store orientation data */
+   SensorPut(t_table, SensorKey("orientation"), sPosRead.Orientation);
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::FillBattery(buzzobj_t t_table) {
+   /* Get battery readings */
+   const CCI_BatterySensor::SReading& sBatRead = m_pcBattery->GetReading();
+   /* Store charge data */
+   SensorPut(t_table, SensorKey("available_charge"), sBatRead.AvailableCharge);
+   /* Store time data */
+   SensorPut(t_table, SensorKey("time_left"), sBatRead.TimeLeft);
+}
+
+/****************************************/
+/****************************************/
+
+static void BuzzFillSensor(buzzvm_t vm,
+                           buzzobj_t t_table,
+                           void* pv_controller) {
+   reinterpret_cast<CBuzzController*>(pv_controller)->FillSensor(t_table);
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t CBuzzController::RegisterSensor(const std::string& str_key,
+                                          TSensorFill t_fill) {
+   buzzobj_t tTable = buzzheap_newobj(m_tBuzzVM, BUZZTYPE_TABLE);
+   buzzvm_hostsym_register(m_tBuzzVM,
+                           buzzvm_string_register(m_tBuzzVM, str_key.c_str(), 1),
+                           tTable,
+                           BuzzFillSensor,
+                           this);
+   m_vecSensors.push_back(std::make_pair(tTable, t_fill));
+   return tTable;
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::FillSensor(buzzobj_t t_table) {
+   for(size_t i = 0; i < m_vecSensors.size(); ++i) {
+      if(m_vecSensors[i].first == t_table) {
+         (this->*m_vecSensors[i].second)(t_table);
+         return;
+      }
    }
-   /*
-    * Update the battery sensor
-    */
-   if(m_pcBattery != NULL) {
-      /* Get battery readings */
-      const CCI_BatterySensor::SReading& sBatRead = m_pcBattery->GetReading();
-      /* Create empty battery data table */
-      buzzobj_t tBattery = buzzheap_newobj(m_tBuzzVM, BUZZTYPE_TABLE);
-      /* Store charge data */
-      TablePut(tBattery, "available_charge", sBatRead.AvailableCharge);
-      /* Store time data */
-      TablePut(tBattery, "time_left", sBatRead.TimeLeft);
-      /* Register battery data table as global symbol */
-      Register("battery", tBattery);
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t CBuzzController::SensorKey(const std::string& str_key) {
+   std::map<std::string, buzzobj_t>::iterator it = m_mapSensorKeys.find(str_key);
+   if(it != m_mapSensorKeys.end()) return it->second;
+   buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, str_key.c_str(), 1));
+   buzzobj_t tKey = buzzvm_stack_at(m_tBuzzVM, 1);
+   buzzvm_pop(m_tBuzzVM);
+   buzzvm_pin(m_tBuzzVM, tKey);
+   m_mapSensorKeys[str_key] = tKey;
+   return tKey;
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t CBuzzController::SensorKey(SInt32 n_idx) {
+   while(m_vecSensorIdx.size() <= static_cast<size_t>(n_idx)) {
+      buzzvm_pushi(m_tBuzzVM, m_vecSensorIdx.size());
+      buzzobj_t tKey = buzzvm_stack_at(m_tBuzzVM, 1);
+      buzzvm_pop(m_tBuzzVM);
+      buzzvm_pin(m_tBuzzVM, tKey);
+      m_vecSensorIdx.push_back(tKey);
+   }
+   return m_vecSensorIdx[n_idx];
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t CBuzzController::SensorTable(buzzobj_t t_table,
+                                       buzzobj_t t_key) {
+   /* Reuse the sub-table of the last step, if it is still there */
+   buzzvm_push(m_tBuzzVM, t_table);
+   buzzvm_push(m_tBuzzVM, t_key);
+   buzzvm_tget(m_tBuzzVM);
+   buzzobj_t tSub = buzzvm_stack_at(m_tBuzzVM, 1);
+   buzzvm_pop(m_tBuzzVM);
+   if(tSub->o.type == BUZZTYPE_TABLE) return tSub;
+   /* Make a new one */
+   buzzvm_push(m_tBuzzVM, t_table);
+   buzzvm_push(m_tBuzzVM, t_key);
+   buzzvm_pusht(m_tBuzzVM);
+   tSub = buzzvm_stack_at(m_tBuzzVM, 1);
+   buzzvm_tput(m_tBuzzVM);
+   return tSub;
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::SensorPut(buzzobj_t t_table,
+                                buzzobj_t t_key,
+                                SInt32 n_value) {
+   buzzvm_push(m_tBuzzVM, t_table);
+   buzzvm_push(m_tBuzzVM, t_key);
+   buzzvm_pushi(m_tBuzzVM, n_value);
+   buzzvm_tput(m_tBuzzVM);
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::SensorPut(buzzobj_t t_table,
+                                buzzobj_t t_key,
+                                Real f_value) {
+   buzzvm_push(m_tBuzzVM, t_table);
+   buzzvm_push(m_tBuzzVM, t_key);
+   buzzvm_pushf(m_tBuzzVM, f_value);
+   buzzvm_tput(m_tBuzzVM);
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::SensorPut(buzzobj_t t_table,
+                                buzzobj_t t_key,
+                                const CRadians& c_angle) {
+   SensorPut(t_table, t_key, c_angle.GetValue());
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::SensorPut(buzzobj_t t_table,
+                                buzzobj_t t_key,
+                                const CVector3& c_vec) {
+   buzzobj_t tVecTable = SensorTable(t_table, t_key);
+   SensorPut(tVecTable, SensorKey("x"), c_vec.GetX());
+   SensorPut(tVecTable, SensorKey("y"), c_vec.GetY());
+   SensorPut(tVecTable, SensorKey("z"), c_vec.GetZ());
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::SensorPut(buzzobj_t t_table,
+                                buzzobj_t t_key,
+                                const CQuaternion& c_quat) {
+   buzzobj_t tQuatTable = SensorTable(t_table, t_key);
+   CRadians cYaw, cPitch, cRoll;
+   c_quat.ToEulerAngles(cYaw, cPitch, cRoll);
+   SensorPut(tQuatTable, SensorKey("yaw"), cYaw);
+   SensorPut(tQuatTable, SensorKey("pitch"), cPitch);
+   SensorPut(tQuatTable, SensorKey("roll"), cRoll);
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::SensorPut(buzzobj_t t_table,
+                                buzzobj_t t_key,
+                                const CColor& c_color) {
+   buzzobj_t tColorTable = SensorTable(t_table, t_key);
+   SensorPut(tColorTable, SensorKey("red"), c_color.GetRed());
+   SensorPut(tColorTable, SensorKey("green"), c_color.GetGreen());
+   SensorPut(tColorTable, SensorKey("blue"), c_color.GetBlue());
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzController::SensorTrim(buzzobj_t t_table,
+                                 SInt32 n_size) {
+   /* Erase the entries past the new size, up to the first missing one */
+   for(SInt32 i = n_size; ; ++i) {
+      buzzvm_push(m_tBuzzVM, t_table);
+      buzzvm_push(m_tBuzzVM, SensorKey(i));
+      buzzvm_tget(m_tBuzzVM);
+      bool bFound = (buzzvm_stack_at(m_tBuzzVM, 1)->o.type != BUZZTYPE_NIL);
+      buzzvm_pop(m_tBuzzVM);
+      if(!bFound) return;
+      buzzvm_push(m_tBuzzVM, t_table);
+      buzzvm_push(m_tBuzzVM, SensorKey(i));
+      buzzvm_pushnil(m_tBuzzVM);
+      buzzvm_tput(m_tBuzzVM);
    }
 }
 
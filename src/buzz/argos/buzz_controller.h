@@ -9,12 +9,17 @@
 #include <argos3/plugins/robots/generic/control_interface/ci_range_and_bearing_sensor.h>
 #include <argos3/plugins/robots/generic/control_interface/ci_battery_sensor.h>
 #include <argos3/core/utility/math/ray3.h>
-#include <argos3/core/utility/datatypes/set.h>
 #include <argos3/core/utility/math/rng.h>
 #include <buzz/buzzvm.h>
+#include <buzz/buzzsnapshot.h>
 #include <buzz/buzzdebug.h>
+#include <buzz/buzzprof.h>
+#include <buzz/buzzstats.h>
 #include <string>
 #include <list>
+#include <sstream>
+#include <map>
+#include <vector>
 
 using namespace argos;
 
@@ -87,6 +92,10 @@ public:
       return m_strDbgInfoFName;
    }
 
+   inline UInt16 GetRobotId() const {
+      return m_unRobotId;
+   }
+
    virtual void SetBytecode(const std::string& str_bc_fname,
                             const std::string& str_dbg_fname);
 
@@ -116,6 +125,20 @@ public:
 
    std::string ErrorInfo();
 
+   /*
+    * The text logged by the script.
+    * Controllers may step in parallel, so log() writes into a buffer
+    * per controller. FlushLog() moves the buffer into the ARGoS log. The
+    * Buzz loop functions call it for all the robots in PostStep(), in
+    * numeric robot id order, and a controller whose buffer was not collected
+    * flushes it at the start of its next step.
+    */
+   inline std::ostream& GetLogBuffer() {
+      return m_cLog;
+   }
+
+   void FlushLog();
+
    typedef std::map<size_t, bool> TBuzzRobots;
    static TBuzzRobots& BUZZ_ROBOTS() {
       static TBuzzRobots tBuzzRobots;
@@ -199,6 +222,56 @@ public:
                          SInt32 n_idx,
                          const CColor& c_color);
 
+   /*
+    * Sensor tables.
+    * A sensor table is made once, when the functions are registered, and it
+    * is bound to its global symbol for the whole life of the VM. At every
+    * step the fill function overwrites its fields. With lazy_sensors="true",
+    * the fill function runs only when the script first loads the symbol in
+    * the step.
+    */
+
+   typedef void (CBuzzController::*TSensorFill)(buzzobj_t t_table);
+
+   buzzobj_t RegisterSensor(const std::string& str_key,
+                            TSensorFill t_fill);
+
+   void FillSensor(buzzobj_t t_table);
+
+   buzzobj_t SensorKey(const std::string& str_key);
+
+   buzzobj_t SensorKey(SInt32 n_idx);
+
+   buzzobj_t SensorTable(buzzobj_t t_table,
+                         buzzobj_t t_key);
+
+   void SensorPut(buzzobj_t t_table,
+                  buzzobj_t t_key,
+                  SInt32 n_value);
+
+   void SensorPut(buzzobj_t t_table,
+                  buzzobj_t t_key,
+                  Real f_value);
+
+   void SensorPut(buzzobj_t t_table,
+                  buzzobj_t t_key,
+                  const CRadians& c_angle);
+
+   void SensorPut(buzzobj_t t_table,
+                  buzzobj_t t_key,
+                  const CVector3& c_vec);
+
+   void SensorPut(buzzobj_t t_table,
+                  buzzobj_t t_key,
+                  const CQuaternion& c_quat);
+
+   void SensorPut(buzzobj_t t_table,
+                  buzzobj_t t_key,
+                  const CColor& c_color);
+
+   void SensorTrim(buzzobj_t t_table,
+                   SInt32 n_size);
+
 protected:
 
    virtual buzzvm_state RegisterFunctions();
@@ -208,6 +281,30 @@ protected:
 
    virtual void UpdateSensors();
 
+   /*
+    * Snapshot of the VM right after init(), with snapshot_reset="true".
+    * Reset() forks it instead of loading the script again, so init() is
+    * not run again and the script keeps the sensor readings it saw then.
+    */
+   void TakeSnapshot();
+   void ForkSnapshot();
+
+   /*
+    * Profiling.
+    * Each controller samples its own VM. At the end of the experiment,
+    * the samples of all the controllers writing the same file are
+    * merged, and the last controller to be destroyed writes the file.
+    * AttachProfiler() also enables the execution counters of the VM,
+    * which the script reads with debug.stats().
+    */
+   void AttachProfiler();
+   void RegisterProfile(int n_mode,
+                        UInt32 un_period);
+   void WriteProfile();
+
+   void FillPose(buzzobj_t t_table);
+   void FillBattery(buzzobj_t t_table);
+
 protected:
 
    /* Pointer to the range and bearing actuator */
@@ -235,28 +332,33 @@ protected:
    SDebug m_sDebug;
    /* The random number generator */
    CRandom::CRNG* m_pcRNG;
+   /* Text logged by the script since the last flush */
+   std::ostringstream m_cLog;
+   /* Whether sensor tables are filled on first use */
+   bool m_bLazySensors;
+   /* Sensor tables and their fill functions */
+   std::vector<std::pair<buzzobj_t, TSensorFill> > m_vecSensors;
+   /* Keys of the sensor table fields */
+   std::map<std::string, buzzobj_t> m_mapSensorKeys;
+   /* Keys of the sensor table indices */
+   std::vector<buzzobj_t> m_vecSensorIdx;
+   /* Whether Reset() forks the snapshot instead of reloading the script */
+   bool m_bSnapshotReset;
+   /* State of the VM right after init() */
+   buzzvm_snapshot_t m_tBuzzSnapshot;
+   /* Sensor tables and keys at the time of the snapshot */
+   std::vector<std::pair<buzzobj_t, TSensorFill> > m_vecSnapshotSensors;
+   std::map<std::string, buzzobj_t> m_mapSnapshotSensorKeys;
+   std::vector<buzzobj_t> m_vecSnapshotSensorIdx;
+   /* Sampling profiler, NULL if disabled */
+   buzzprof_t m_tBuzzProf;
+   /* Name of the profile file */
+   std::string m_strProfileFName;
+   /* Whether the profile is written in the pprof format */
+   bool m_bProfilePprof;
+   /* Whether the execution counters are enabled */
+   bool m_bStats;
 
-public:
-   
-   /* Mutex for trajectory tracking */
-   static pthread_mutex_t TRAJECTORY_MUTEX;
-   /* List of controllers with trajectory tracking enabled */
-   static CSet<CBuzzController*> TRAJECTORY_CONTROLLERS;
-   /* Enables trajectory tracking in controllers */
-   static void DebugTrajectoryEnable(CBuzzController* pc_cntr,
-                                SInt32 n_max_points) {
-      pc_cntr->GetARGoSDebugInfo().TrajectoryEnable(n_max_points);
-      pthread_mutex_lock(&TRAJECTORY_MUTEX);
-      TRAJECTORY_CONTROLLERS.insert(pc_cntr);
-      pthread_mutex_unlock(&TRAJECTORY_MUTEX);
-   }
-   /* Disables trajectory tracking in controllers */
-   static void DebugTrajectoryDisable(CBuzzController* pc_cntr) {
-      pc_cntr->GetARGoSDebugInfo().TrajectoryDisable();
-      pthread_mutex_lock(&TRAJECTORY_MUTEX);
-      TRAJECTORY_CONTROLLERS.erase(pc_cntr);
-      pthread_mutex_unlock(&TRAJECTORY_MUTEX);
-   }
 };
 
 #include <argos3/core/utility/plugins/vtable.h>
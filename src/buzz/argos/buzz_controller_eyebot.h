@@ -16,7 +16,6 @@ public:
    virtual ~CBuzzControllerEyeBot();
 
    virtual void Init(TConfigurationNode& t_node);
-   virtual void UpdateSensors();
 
    bool TakeOff();
    bool Land();
@@ -31,6 +30,8 @@ protected:
 
    virtual buzzvm_state RegisterFunctions();
 
+   void FillBlobs(buzzobj_t t_table);
+
 protected:
 
    /* Pointer to the position actuator */
@@ -328,107 +328,65 @@ void CBuzzControllerFootBot::Init(TConfigurationNode& t_node) {
 /****************************************/
 /****************************************/
 
-void CBuzzControllerFootBot::UpdateSensors() {
-   /*
-    * Update generic sensors
-    */
-   CBuzzController::UpdateSensors();
-   /*
-    * Update proximity sensor table
-    */
-   if(m_pcProximity != NULL) {
-      /* Create empty proximity table */
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "proximity", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tProxTable = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
-      /* Get proximity readings */
-      const CCI_FootBotProximitySensor::TReadings& tProxReads = m_pcProximity->GetReadings();
-      /* Fill into the proximity table */
-      buzzobj_t tProxRead;
-      for(size_t i = 0; i < tProxReads.size(); ++i) {
-         /* Create table for i-th read */
-         buzzvm_pusht(m_tBuzzVM);
-         tProxRead = buzzvm_stack_at(m_tBuzzVM, 1);
-         buzzvm_pop(m_tBuzzVM);
-         /* Fill in the read */
-         TablePut(tProxRead, "value", tProxReads[i].Value);
-         TablePut(tProxRead, "angle", tProxReads[i].Angle);
-         /* Store read table in the proximity table */
-         TablePut(tProxTable, i, tProxRead);
-      }
-   }
-   /*
-    * Update proximity sensor table
-    */
-   if(m_pcLight) {
-      /* Create empty light table */
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "light", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tLightTable = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
-      /* Get light readings */
-      const CCI_FootBotLightSensor::TReadings& tLightReads = m_pcLight->GetReadings();
-      /* Fill into the light table */
-      buzzobj_t tLightRead;
-      for(size_t i = 0; i < tLightReads.size(); ++i) {
-         /* Create table for i-th read */
-         buzzvm_pusht(m_tBuzzVM);
-         tLightRead = buzzvm_stack_at(m_tBuzzVM, 1);
-         buzzvm_pop(m_tBuzzVM);
-         /* Fill in the read */
-         TablePut(tLightRead, "value", tLightReads[i].Value);
-         TablePut(tLightRead, "angle", tLightReads[i].Angle);
-         /* Store read table in the light table */
-         TablePut(tLightTable, i, tLightRead);
-      }
+void CBuzzControllerFootBot::FillProximity(buzzobj_t t_table) {
+   /* Get proximity readings */
+   const CCI_FootBotProximitySensor::TReadings& tProxReads = m_pcProximity->GetReadings();
+   /* Fill into the proximity table */
+   for(size_t i = 0; i < tProxReads.size(); ++i) {
+      /* Get table for i-th read */
+      buzzobj_t tProxRead = SensorTable(t_table, SensorKey(i));
+      /* Fill in the read */
+      SensorPut(tProxRead, SensorKey("value"), tProxReads[i].Value);
+      SensorPut(tProxRead, SensorKey("angle"), tProxReads[i].Angle);
    }
-   /*
-    * Camera
-    */
-   if(m_pcCamera) {
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "blobs", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tBlobs = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
-      const CCI_ColoredBlobOmnidirectionalCameraSensor::SReadings& sBlobs = m_pcCamera->GetReadings();
-      for(size_t i = 0; i < sBlobs.BlobList.size(); ++i) {
-         buzzvm_pusht(m_tBuzzVM);
-         buzzobj_t tEntry = buzzvm_stack_at(m_tBuzzVM, 1);
-         buzzvm_pop(m_tBuzzVM);
-         TablePut(tBlobs, i, tEntry);
-         TablePut(tEntry, "distance", sBlobs.BlobList[i]->Distance);
-         TablePut(tEntry, "angle",    sBlobs.BlobList[i]->Angle);
-         TablePut(tEntry, "color",    sBlobs.BlobList[i]->Color);
-      }
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzControllerFootBot::FillLight(buzzobj_t t_table) {
+   /* Get light readings */
+   const CCI_FootBotLightSensor::TReadings& tLightReads = m_pcLight->GetReadings();
+   /* Fill into the light table */
+   for(size_t i = 0; i < tLightReads.size(); ++i) {
+      /* Get table for i-th read */
+      buzzobj_t tLightRead = SensorTable(t_table, SensorKey(i));
+      /* Fill in the read */
+      SensorPut(tLightRead, SensorKey("value"), tLightReads[i].Value);
+      SensorPut(tLightRead, SensorKey("angle"), tLightReads[i].Angle);
    }
-   /*
-    * Differential steering sensor
-    */
-   if(m_pcWheelsS) {
-      /* Make "wheels" table */
-      const CCI_DifferentialSteeringSensor::SReading& sWheels = m_pcWheelsS->GetReading();
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "wheels", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tWheels = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
-      /* Make "velocity" table */
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tVelocity = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_pop(m_tBuzzVM);
-      TablePut(tWheels, "velocity", tVelocity);
-      TablePut(tVelocity, "left", sWheels.VelocityLeftWheel);
-      TablePut(tVelocity, "right", sWheels.VelocityRightWheel);
-      /* Make "covered_distance" table */
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tCoveredDistance = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_pop(m_tBuzzVM);
-      TablePut(tWheels, "covered_distance", tCoveredDistance);
-      TablePut(tCoveredDistance, "left", sWheels.CoveredDistanceLeftWheel);
-      TablePut(tCoveredDistance, "right", sWheels.CoveredDistanceRightWheel);
-      /* Axis length */
-      TablePut(tWheels, "axis_length", sWheels.WheelAxisLength);
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzControllerFootBot::FillBlobs(buzzobj_t t_table) {
+   const CCI_ColoredBlobOmnidirectionalCameraSensor::SReadings& sBlobs = m_pcCamera->GetReadings();
+   for(size_t i = 0; i < sBlobs.BlobList.size(); ++i) {
+      buzzobj_t tEntry = SensorTable(t_table, SensorKey(i));
+      SensorPut(tEntry, SensorKey("distance"), sBlobs.BlobList[i]->Distance);
+      SensorPut(tEntry, SensorKey("angle"),    sBlobs.BlobList[i]->Angle);
+      SensorPut(tEntry, SensorKey("color"),    sBlobs.BlobList[i]->Color);
    }
+   /* The number of blobs changes from step to step */
+   SensorTrim(t_table, sBlobs.BlobList.size());
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzControllerFootBot::FillWheels(buzzobj_t t_table) {
+   const CCI_DifferentialSteeringSensor::SReading& sWheels = m_pcWheelsS->GetReading();
+   /* Fill "velocity" table */
+   buzzobj_t tVelocity = SensorTable(t_table, SensorKey("velocity"));
+   SensorPut(tVelocity, SensorKey("left"), sWheels.VelocityLeftWheel);
+   SensorPut(tVelocity, SensorKey("right"), sWheels.VelocityRightWheel);
+   /* Fill "covered_distance" table */
+   buzzobj_t tCoveredDistance = SensorTable(t_table, SensorKey("covered_distance"));
+   SensorPut(tCoveredDistance, SensorKey("left"), sWheels.CoveredDistanceLeftWheel);
+   SensorPut(tCoveredDistance, SensorKey("right"), sWheels.CoveredDistanceRightWheel);
+   /* Axis length */
+   SensorPut(t_table, SensorKey("axis_length"), sWheels.WheelAxisLength);
 }
 
 /****************************************/
@@ -581,6 +539,15 @@ void CBuzzControllerFootBot::TurretSet(Real f_rotation) {
 buzzvm_state CBuzzControllerFootBot::RegisterFunctions() {
    /* Register base functions */
    CBuzzController::RegisterFunctions();
+   /* Sensor tables */
+   if(m_pcProximity)
+      RegisterSensor("proximity", static_cast<TSensorFill>(&CBuzzControllerFootBot::FillProximity));
+   if(m_pcLight)
+      RegisterSensor("light", static_cast<TSensorFill>(&CBuzzControllerFootBot::FillLight));
+   if(m_pcCamera)
+      RegisterSensor("blobs", static_cast<TSensorFill>(&CBuzzControllerFootBot::FillBlobs));
+   if(m_pcWheelsS)
+      RegisterSensor("wheels", static_cast<TSensorFill>(&CBuzzControllerFootBot::FillWheels));
    if(m_pcWheelsA) {
       /* BuzzSetWheels */
       buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "set_wheels", 1));
@@ -48,8 +48,6 @@ public:
 
    virtual void Init(TConfigurationNode& t_node);
 
-   virtual void UpdateSensors();
-
    void SetWheels(Real f_left_speed, Real f_right_speed);
    void SetWheelSpeedsFromVector(const CVector2& c_heading);
    void SetLEDs(const CColor& c_color);
@@ -66,6 +64,11 @@ protected:
 
    virtual buzzvm_state RegisterFunctions();
 
+   void FillProximity(buzzobj_t t_table);
+   void FillLight(buzzobj_t t_table);
+   void FillBlobs(buzzobj_t t_table);
+   void FillWheels(buzzobj_t t_table);
+
 protected:
 
    /* Pointer to the differential steering actuator */
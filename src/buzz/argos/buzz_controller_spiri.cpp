@@ -166,30 +166,16 @@ void CBuzzControllerSpiri::Init(TConfigurationNode& t_node) {
 /****************************************/
 /****************************************/
 
-void CBuzzControllerSpiri::UpdateSensors() {
-   /*
-    * Update generic sensors
-    */
-   CBuzzController::UpdateSensors();
-   /*
-    * Camera
-    */
-   if(m_pcCamera) {
-      buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "blobs", 1));
-      buzzvm_pusht(m_tBuzzVM);
-      buzzobj_t tBlobs = buzzvm_stack_at(m_tBuzzVM, 1);
-      buzzvm_gstore(m_tBuzzVM);
-      const CCI_ColoredBlobPerspectiveCameraSensor::SReadings& sBlobs = m_pcCamera->GetReadings();
-      for(size_t i = 0; i < sBlobs.BlobList.size(); ++i) {
-         buzzvm_pusht(m_tBuzzVM);
-         buzzobj_t tEntry = buzzvm_stack_at(m_tBuzzVM, 1);
-         buzzvm_pop(m_tBuzzVM);
-         TablePut(tBlobs, i, tEntry);
-         TablePut(tEntry, "px",    sBlobs.BlobList[i]->X);
-         TablePut(tEntry, "py",    sBlobs.BlobList[i]->Y);
-         TablePut(tEntry, "color", sBlobs.BlobList[i]->Color);
-      }
+void CBuzzControllerSpiri::FillBlobs(buzzobj_t t_table) {
+   const CCI_ColoredBlobPerspectiveCameraSensor::SReadings& sBlobs = m_pcCamera->GetReadings();
+   for(size_t i = 0; i < sBlobs.BlobList.size(); ++i) {
+      buzzobj_t tEntry = SensorTable(t_table, SensorKey(i));
+      SensorPut(tEntry, SensorKey("px"),    sBlobs.BlobList[i]->X);
+      SensorPut(tEntry, SensorKey("py"),    sBlobs.BlobList[i]->Y);
+      SensorPut(tEntry, SensorKey("color"), sBlobs.BlobList[i]->Color);
    }
+   /* The number of blobs changes from step to step */
+   SensorTrim(t_table, sBlobs.BlobList.size());
 }
 
 /****************************************/
@@ -254,6 +240,9 @@ buzzvm_state CBuzzControllerSpiri::RegisterFunctions() {
    /* Register base functions */
    if(CBuzzController::RegisterFunctions() != BUZZVM_STATE_READY)
       return m_tBuzzVM->state;
+   /* Sensor tables */
+   if(m_pcCamera)
+      RegisterSensor("blobs", static_cast<TSensorFill>(&CBuzzControllerSpiri::FillBlobs));
    /* BuzzTakeOff */
    if(m_pcPropellers && m_pcPos) {
       buzzvm_pushs(m_tBuzzVM, buzzvm_string_register(m_tBuzzVM, "takeoff", 1));
@@ -15,7 +15,6 @@ public:
    virtual ~CBuzzControllerSpiri();
 
    virtual void Init(TConfigurationNode& t_node);
-   virtual void UpdateSensors();
 
    bool TakeOff();
    bool Land();
@@ -28,6 +27,8 @@ protected:
 
    virtual buzzvm_state RegisterFunctions();
 
+   void FillBlobs(buzzobj_t t_table);
+
 protected:
 
    /* Pointer to the position actuator */
@@ -1,5 +1,11 @@
 #include "buzz_loop_functions.h"
 #include "buzz_controller.h"
+#include <argos3/core/utility/string_utilities.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 /****************************************/
 /****************************************/
@@ -223,8 +229,221 @@ void BuzzTableCloseNested(buzzvm_t t_vm) {
 /****************************************/
 /****************************************/
 
+/*
+ * Returns the id of a string of a probe in the given VM, or -1 if the VM
+ * does not know the string.
+ * The bound id is used if it means the same string in the VM.
+ */
+static int32_t BuzzProbeStringId(buzzvm_t t_vm,
+                                 const std::string& str_str,
+                                 int n_id) {
+   const char* pchStr = n_id >= 0 ? buzzvm_string_get(t_vm, n_id) : NULL;
+   if(pchStr && strcmp(pchStr, str_str.c_str()) == 0) return n_id;
+   return buzzvm_string_find(t_vm, str_str.c_str());
+}
+
+/****************************************/
+/****************************************/
+
+CBuzzProbe::CBuzzProbe(const std::string& str_path,
+                       buzzvm_t t_vm) :
+   m_strPath(str_path),
+   m_bBound(false) {
+   /* Split the path at the dots */
+   size_t unStart = 0;
+   size_t unEnd;
+   do {
+      unEnd = str_path.find('.', unStart);
+      SPart sPart;
+      sPart.Str = str_path.substr(unStart, unEnd - unStart);
+      sPart.IsInt = unStart > 0 && !sPart.Str.empty() &&
+         sPart.Str.find_first_not_of("0123456789") == std::string::npos;
+      sPart.Int = sPart.IsInt ? atoi(sPart.Str.c_str()) : 0;
+      sPart.Id = -1;
+      m_vecParts.push_back(sPart);
+      unStart = unEnd + 1;
+   } while(unEnd != std::string::npos);
+   if(t_vm) Bind(t_vm);
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzProbe::Bind(buzzvm_t t_vm) {
+   for(size_t i = 0; i < m_vecParts.size(); ++i) {
+      if(!m_vecParts[i].IsInt)
+         m_vecParts[i].Id = buzzvm_string_register(t_vm, m_vecParts[i].Str.c_str(), 1);
+   }
+   m_bBound = true;
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t CBuzzProbe::Get(buzzvm_t t_vm) const {
+   /* Look up the variable */
+   int32_t nId = BuzzProbeStringId(t_vm, m_vecParts[0].Str, m_vecParts[0].Id);
+   if(nId < 0) return NULL;
+   const buzzobj_t* ptVal = buzzdict_get(t_vm->gsyms, &nId, buzzobj_t);
+   if(!ptVal) return NULL;
+   buzzobj_t tVal = *ptVal;
+   /* Follow the table keys, with keys that live on the C stack */
+   union buzzobj_u tKeyObj;
+   buzzobj_t tKey = &tKeyObj;
+   for(size_t i = 1; i < m_vecParts.size(); ++i) {
+      if(!buzzobj_istable(tVal)) return NULL;
+      const SPart& sPart = m_vecParts[i];
+      if(sPart.IsInt) {
+         tKeyObj.i.type = BUZZTYPE_INT;
+         tKeyObj.i.value = sPart.Int;
+      }
+      else {
+         /* A string the VM does not know can't be a key */
+         int32_t nKey = BuzzProbeStringId(t_vm, sPart.Str, sPart.Id);
+         if(nKey < 0) return NULL;
+         tKeyObj.s.type = BUZZTYPE_STRING;
+         tKeyObj.s.value.sid = nKey;
+         tKeyObj.s.value.str = buzzvm_string_get(t_vm, tKeyObj.s.value.sid);
+      }
+      ptVal = buzzdict_get(tVal->t.value, &tKey, buzzobj_t);
+      if(!ptVal) return NULL;
+      tVal = *ptVal;
+   }
+   return tVal;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Converts a number to a float.
+ */
+static float BuzzToFloat(buzzobj_t t_val,
+                         float f_default) {
+   if(t_val && t_val->o.type == BUZZTYPE_FLOAT) return t_val->f.value;
+   if(t_val && t_val->o.type == BUZZTYPE_INT) return t_val->i.value;
+   return f_default;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * The VM counters that can be recorded
+ */
+static const char* BUZZ_TELEMETRY_COUNTERS[] = {
+   "heap", "stack", "inmsgs", "outmsgs", "neighbors", "state", NULL
+};
+
+static SInt32 BuzzTelemetryCounter(buzzvm_t t_vm,
+                                   UInt32 un_counter) {
+   switch(un_counter) {
+      case 0: return buzzdarray_size(t_vm->heap->objs);
+      case 1: return buzzdarray_size(t_vm->stack);
+      case 2: return buzzinmsg_queue_size(t_vm->inmsgs);
+      case 3: return buzzoutmsg_queue_size(t_vm);
+      case 4: return t_vm->neighbors->size;
+      default: return t_vm->state;
+   }
+}
+
+/****************************************/
+/****************************************/
+
 void CBuzzLoopFunctions::Init(TConfigurationNode& t_tree) {
    BuzzRegisterVMs();
+   if(!NodeExists(t_tree, "telemetry")) return;
+   try {
+      TConfigurationNode& tNode = GetNode(t_tree, "telemetry");
+      std::string strFile, strVars, strCounters;
+      GetNodeAttribute(tNode, "file", strFile);
+      GetNodeAttributeOrDefault(tNode, "period", m_unTelemetryPeriod, m_unTelemetryPeriod);
+      GetNodeAttributeOrDefault(tNode, "variables", strVars, strVars);
+      GetNodeAttributeOrDefault(tNode, "counters", strCounters, strCounters);
+      if(m_unTelemetryPeriod == 0) m_unTelemetryPeriod = 1;
+      /* Make the columns */
+      std::vector<std::string> vecVars, vecCounters;
+      Tokenize(strVars, vecVars, ", ");
+      Tokenize(strCounters, vecCounters, ", ");
+      std::vector<buzzrec_column_s> vecCols;
+      buzzrec_column_s sCol;
+      sCol.type = BUZZREC_INT;
+      sCol.name = "step";
+      vecCols.push_back(sCol);
+      sCol.name = "robot";
+      vecCols.push_back(sCol);
+      sCol.type = BUZZREC_FLOAT;
+      for(size_t i = 0; i < vecVars.size(); ++i) {
+         m_vecTelemetryProbes.push_back(
+            CBuzzProbe(vecVars[i],
+                       m_vecBuzzControllers.empty() ? NULL : m_vecBuzzControllers[0]->GetBuzzVM()));
+         sCol.name = vecVars[i].c_str();
+         vecCols.push_back(sCol);
+      }
+      sCol.type = BUZZREC_INT;
+      for(size_t i = 0; i < vecCounters.size(); ++i) {
+         UInt32 j = 0;
+         while(BUZZ_TELEMETRY_COUNTERS[j] && vecCounters[i] != BUZZ_TELEMETRY_COUNTERS[j]) ++j;
+         if(!BUZZ_TELEMETRY_COUNTERS[j])
+            THROW_ARGOSEXCEPTION("Unknown Buzz VM counter \"" << vecCounters[i] << "\"");
+         m_vecTelemetryCounters.push_back(j);
+         sCol.name = BUZZ_TELEMETRY_COUNTERS[j];
+         vecCols.push_back(sCol);
+      }
+      m_vecTelemetryRow.resize(vecCols.size());
+      /* Start the recorder */
+      m_tTelemetry = buzzrec_open(strFile.c_str(), &vecCols[0], vecCols.size(), 0);
+      if(!m_tTelemetry)
+         THROW_ARGOSEXCEPTION("Can't create telemetry file \"" << strFile << "\": " << strerror(errno));
+   }
+   catch(CARGoSException& ex) {
+      THROW_ARGOSEXCEPTION_NESTED("Error initializing the Buzz telemetry", ex);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzLoopFunctions::Destroy() {
+   if(m_tTelemetry && buzzrec_close(&m_tTelemetry) != 0)
+      LOGERR << "[WARNING] The Buzz telemetry file is incomplete" << std::endl;
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzLoopFunctions::PostStep() {
+   for(size_t i = 0; i < m_vecBuzzControllers.size(); ++i) {
+      m_vecBuzzControllers[i]->FlushLog();
+   }
+   if(m_tTelemetry && GetSpace().GetSimulationClock() % m_unTelemetryPeriod == 0)
+      RecordTelemetry();
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzLoopFunctions::RecordTelemetry() {
+   /* Bind the probes that had no VM at construction */
+   if(!m_vecBuzzControllers.empty()) {
+      for(size_t j = 0; j < m_vecTelemetryProbes.size(); ++j)
+         if(!m_vecTelemetryProbes[j].IsBound())
+            m_vecTelemetryProbes[j].Bind(m_vecBuzzControllers[0]->GetBuzzVM());
+   }
+   buzzrec_value_t* psRow = &m_vecTelemetryRow[0];
+   for(size_t i = 0; i < m_vecBuzzControllers.size(); ++i) {
+      buzzvm_t tVM = m_vecBuzzControllers[i]->GetBuzzVM();
+      size_t unCol = 0;
+      psRow[unCol++].i = GetSpace().GetSimulationClock();
+      psRow[unCol++].i = tVM->robot;
+      for(size_t j = 0; j < m_vecTelemetryProbes.size(); ++j) {
+         psRow[unCol++].f = BuzzToFloat(m_vecTelemetryProbes[j].Get(tVM), 0.0f);
+      }
+      for(size_t j = 0; j < m_vecTelemetryCounters.size(); ++j) {
+         psRow[unCol++].i = BuzzTelemetryCounter(tVM, m_vecTelemetryCounters[j]);
+      }
+      buzzrec_push(m_tTelemetry, psRow);
+   }
 }
 
 /****************************************/
@@ -238,13 +457,18 @@ buzzvm_t CBuzzLoopFunctions::BuzzGetVM(const std::string& str_robot_id) {
 /****************************************/
 /****************************************/
 
+buzzvm_t CBuzzLoopFunctions::BuzzGetVM(size_t un_idx) {
+   return m_vecBuzzControllers[un_idx]->GetBuzzVM();
+}
+
+/****************************************/
+/****************************************/
+
 void CBuzzLoopFunctions::BuzzForeachVM(
    std::function<void(const std::string& str_robot_id,
                       buzzvm_t)> c_function) {
-   for(std::map<std::string, CBuzzController*>::iterator it = m_mapBuzzVMs.begin();
-       it != m_mapBuzzVMs.end();
-       ++it) {
-      c_function(it->first, it->second->GetBuzzVM());
+   for(size_t i = 0; i < m_vecBuzzControllers.size(); ++i) {
+      c_function(m_vecBuzzRobotIds[i], m_vecBuzzControllers[i]->GetBuzzVM());
    }
 }
 
@@ -253,16 +477,93 @@ void CBuzzLoopFunctions::BuzzForeachVM(
 
 void CBuzzLoopFunctions::BuzzForeachVM(
    CBuzzLoopFunctions::COperation& c_operation) {
-   for(std::map<std::string, CBuzzController*>::iterator it = m_mapBuzzVMs.begin();
-       it != m_mapBuzzVMs.end();
-       ++it) {
-      c_operation(it->first, it->second->GetBuzzVM());
+   for(size_t i = 0; i < m_vecBuzzControllers.size(); ++i) {
+      c_operation(m_vecBuzzRobotIds[i], m_vecBuzzControllers[i]->GetBuzzVM());
    }
 }
 
 /****************************************/
 /****************************************/
 
+void CBuzzLoopFunctions::BuzzForeachVMParallel(
+   std::function<void(const std::string& str_robot_id,
+                      buzzvm_t)> c_function,
+   UInt32 un_threads) {
+   size_t unVMs = m_vecBuzzControllers.size();
+   if(un_threads == 0) un_threads = std::thread::hardware_concurrency();
+   if(un_threads == 0) un_threads = 1;
+   if(un_threads > unVMs) un_threads = unVMs;
+   if(un_threads <= 1) {
+      BuzzForeachVM(c_function);
+      return;
+   }
+   /* Each thread gets a contiguous block of VMs, the caller takes the last one */
+   std::vector<std::thread> vecThreads;
+   size_t unBlock = (unVMs + un_threads - 1) / un_threads;
+   for(size_t unStart = 0; unStart < unVMs; unStart += unBlock) {
+      size_t unEnd = std::min(unStart + unBlock, unVMs);
+      auto fBlock = [this, &c_function, unStart, unEnd]() {
+         for(size_t i = unStart; i < unEnd; ++i) {
+            c_function(m_vecBuzzRobotIds[i], m_vecBuzzControllers[i]->GetBuzzVM());
+         }
+      };
+      if(unEnd < unVMs) vecThreads.push_back(std::thread(fBlock));
+      else fBlock();
+   }
+   for(size_t i = 0; i < vecThreads.size(); ++i) {
+      vecThreads[i].join();
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzLoopFunctions::BuzzRead(CBuzzProbe& c_probe,
+                                  std::vector<float>& vec_values,
+                                  float f_default) {
+   vec_values.resize(m_vecBuzzControllers.size());
+   if(!c_probe.IsBound() && !m_vecBuzzControllers.empty())
+      c_probe.Bind(m_vecBuzzControllers[0]->GetBuzzVM());
+   for(size_t i = 0; i < m_vecBuzzControllers.size(); ++i) {
+      vec_values[i] = BuzzToFloat(c_probe.Get(m_vecBuzzControllers[i]->GetBuzzVM()), f_default);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void CBuzzLoopFunctions::BuzzRead(CBuzzProbe& c_probe,
+                                  std::vector<int>& vec_values,
+                                  int n_default) {
+   vec_values.resize(m_vecBuzzControllers.size());
+   if(!c_probe.IsBound() && !m_vecBuzzControllers.empty())
+      c_probe.Bind(m_vecBuzzControllers[0]->GetBuzzVM());
+   for(size_t i = 0; i < m_vecBuzzControllers.size(); ++i) {
+      buzzobj_t tVal = c_probe.Get(m_vecBuzzControllers[i]->GetBuzzVM());
+      if(tVal && tVal->o.type == BUZZTYPE_INT)
+         vec_values[i] = tVal->i.value;
+      else if(tVal && tVal->o.type == BUZZTYPE_FLOAT)
+         vec_values[i] = tVal->f.value;
+      else
+         vec_values[i] = n_default;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Orders the controllers by numeric robot id.
+ * Robots with the same id keep the order of their entity id.
+ */
+static bool BuzzRobotIdLess(const std::pair<std::string, CBuzzController*>& c_a,
+                            const std::pair<std::string, CBuzzController*>& c_b) {
+   return c_a.second->GetRobotId() < c_b.second->GetRobotId();
+}
+
+/****************************************/
+/****************************************/
+
 void CBuzzLoopFunctions::BuzzRegisterVMs() {
    /* Start with an empty VM map to handle removals since the last call */
    /* Additions are handled implicitly in the for loop that follows */
@@ -281,7 +582,19 @@ void CBuzzLoopFunctions::BuzzRegisterVMs() {
          m_mapBuzzVMs[pcControllable->GetRootEntity().GetId()] = pcBuzzController;
       }
    }
+   /* Keep a contiguous copy for the loops, sorted by numeric robot id */
+   std::vector<std::pair<std::string, CBuzzController*> > vecVMs(m_mapBuzzVMs.begin(),
+                                                                 m_mapBuzzVMs.end());
+   std::stable_sort(vecVMs.begin(), vecVMs.end(), BuzzRobotIdLess);
+   m_vecBuzzControllers.clear();
+   m_vecBuzzRobotIds.clear();
+   for(size_t i = 0; i < vecVMs.size(); ++i) {
+      m_vecBuzzRobotIds.push_back(vecVMs[i].first);
+      m_vecBuzzControllers.push_back(vecVMs[i].second);
+   }
 }
 
 /****************************************/
 /****************************************/
+
+REGISTER_LOOP_FUNCTIONS(CBuzzLoopFunctions, "buzz_loop_functions");
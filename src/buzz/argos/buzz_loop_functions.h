@@ -3,9 +3,12 @@
 
 #include <argos3/core/simulator/loop_functions.h>
 #include <buzz/buzzvm.h>
+#include <buzz/buzzrec.h>
 
 #include <functional>
 #include <map>
+#include <string>
+#include <vector>
 
 using namespace argos;
 
@@ -266,16 +269,138 @@ void BuzzTableCloseNested(buzzvm_t t_vm);
 /****************************************/
 /****************************************/
 
+/**
+ * A precompiled path to a value stored in the Buzz VMs.
+ *
+ * The path is the name of a global variable, optionally followed by table
+ * keys separated by dots, such as "count" or "state.pos.x". Keys made of
+ * digits are looked up as integers. The path is parsed once, and the id of
+ * the variable name is resolved once with Bind(), so reading the value does
+ * not register strings or touch the VM stack.
+ *
+ * VMs that run the same script with the same host functions share string
+ * ids, so a probe bound to one VM is fast on all of them. The ids are checked
+ * before use, so reading a VM with different ids still works, only slower.
+ */
+class CBuzzProbe {
+
+public:
+
+   /**
+    * Class constructor.
+    * The string ids are resolved once here when a VM is given, and otherwise
+    * on the first BuzzRead().
+    * @param str_path The path, such as "state.pos.x".
+    * @param t_vm A Buzz VM to bind the probe to, or NULL.
+    */
+   CBuzzProbe(const std::string& str_path,
+              buzzvm_t t_vm = NULL);
+
+   /**
+    * Returns the path.
+    * @return The path.
+    */
+   inline const std::string& GetPath() const {
+      return m_strPath;
+   }
+
+   /**
+    * Resolves the ids of the variable name and of the string keys in the
+    * given VM.
+    * @param t_vm The Buzz VM.
+    */
+   void Bind(buzzvm_t t_vm);
+
+   /**
+    * Returns true if the string ids have been resolved.
+    * @return true if the string ids have been resolved.
+    */
+   inline bool IsBound() const {
+      return m_bBound;
+   }
+
+   /**
+    * Gets the value at the end of the path.
+    *
+    * NOTE: the returned variable might become invalid when the VM is executed
+    * due to garbage collection.
+    *
+    * This method modifies neither the probe nor the VM, so several threads
+    * can use it on different VMs at once.
+    *
+    * @param t_vm The Buzz VM.
+    * @return The value as a Buzz object, or NULL if the path does not exist.
+    */
+   buzzobj_t Get(buzzvm_t t_vm) const;
+
+private:
+
+   /** A part of the path */
+   struct SPart {
+      /* True for integer table keys */
+      bool IsInt;
+      /* The integer key */
+      int Int;
+      /* The variable name or string key */
+      std::string Str;
+      /* The id of Str, -1 when not bound */
+      int Id;
+   };
+
+   /** The path */
+   std::string m_strPath;
+   /** The variable name followed by the table keys */
+   std::vector<SPart> m_vecParts;
+   /** True when the string ids have been resolved */
+   bool m_bBound;
+};
+
+/****************************************/
+/****************************************/
+
 class CBuzzLoopFunctions : public CLoopFunctions {
 
 public:
 
-   CBuzzLoopFunctions() {}
+   CBuzzLoopFunctions() :
+      m_tTelemetry(NULL),
+      m_unTelemetryPeriod(1) {}
 
    virtual ~CBuzzLoopFunctions() {}
 
+   /**
+    * Registers the VMs and starts the telemetry recorder, if configured.
+    *
+    * The recorder is configured with an optional node:
+    *
+    * <telemetry file="run.bzr" period="10"
+    *            variables="count,state.pos.x"
+    *            counters="heap,outmsgs" />
+    *
+    * Every 'period' steps, a row is stored for every VM, with the step, the
+    * robot id, the variables (as floats, see CBuzzProbe) and the counters.
+    * The counters are: heap (objects in the heap), stack (values on the
+    * stack), inmsgs and outmsgs (queued messages), neighbors and state (the
+    * VM state). Use bzzrec to read the file.
+    *
+    * If you override this method, call CBuzzLoopFunctions::Init() in it.
+    */
    virtual void Init(TConfigurationNode& t_tree);
 
+   /**
+    * Stops the telemetry recorder.
+    * If you override this method, call CBuzzLoopFunctions::Destroy() in it.
+    */
+   virtual void Destroy();
+
+   /**
+    * Writes the log of every Buzz controller, in numeric robot id order, and
+    * records the telemetry.
+    * Controllers may step in parallel, so they buffer their log. If you
+    * override this method, call CBuzzLoopFunctions::PostStep() in it.
+    */
+   virtual void PostStep();
+
 public:
 
    /**
@@ -297,15 +422,77 @@ public:
    buzzvm_t BuzzGetVM(const std::string& str_robot_id);
 
    /**
-    * Loops through all the VMs and executes the given function.
+    * Loops through all the VMs, in numeric robot id order, and executes the
+    * given function.
     */
    void BuzzForeachVM(std::function<void(const std::string&, buzzvm_t)> c_function);
 
    /**
-    * Loops through all the VMs and executes the given operation.
+    * Loops through all the VMs, in numeric robot id order, and executes the
+    * given operation.
     */
    void BuzzForeachVM(COperation& c_operation);
 
+   /**
+    * Loops through all the VMs in parallel and executes the given function.
+    * The VMs are split into contiguous blocks, one per thread, and each VM is
+    * handled by a single thread. The function must only touch the VM it is
+    * given and data that is safe to share between threads.
+    * @param c_function The function.
+    * @param un_threads The number of threads, 0 for one per processor.
+    */
+   void BuzzForeachVMParallel(std::function<void(const std::string&, buzzvm_t)> c_function,
+                              UInt32 un_threads = 0);
+
+   /**
+    * Reads a value from all the VMs.
+    * After the call, vec_values[i] holds the value of the i-th VM, in numeric
+    * robot id order. Integers are converted to floats.
+    * @param c_probe The probe.
+    * @param vec_values The values.
+    * @param f_default The value stored when the path is missing or not a number.
+    */
+   void BuzzRead(CBuzzProbe& c_probe,
+                 std::vector<float>& vec_values,
+                 float f_default = 0.0f);
+
+   /**
+    * Reads a value from all the VMs.
+    * After the call, vec_values[i] holds the value of the i-th VM, in numeric
+    * robot id order. Floats are truncated.
+    * @param c_probe The probe.
+    * @param vec_values The values.
+    * @param n_default The value stored when the path is missing or not a number.
+    */
+   void BuzzRead(CBuzzProbe& c_probe,
+                 std::vector<int>& vec_values,
+                 int n_default = 0);
+
+   /**
+    * Returns the number of registered VMs.
+    * @return The number of registered VMs.
+    */
+   inline size_t BuzzGetNumVMs() const {
+      return m_vecBuzzControllers.size();
+   }
+
+   /**
+    * Returns the id of the robot at the given position, in numeric robot id
+    * order.
+    * @param un_idx The position.
+    * @return The robot id.
+    */
+   inline const std::string& BuzzGetRobotId(size_t un_idx) const {
+      return m_vecBuzzRobotIds[un_idx];
+   }
+
+   /**
+    * Returns the VM at the given position, in numeric robot id order.
+    * @param un_idx The position.
+    * @return The Buzz VM.
+    */
+   buzzvm_t BuzzGetVM(size_t un_idx);
+
    /**
     * Registers the BuzzVMs, so the BuzzForeachVM methods can do their work.
     * @see BuzzForeachVM
@@ -320,6 +507,26 @@ public:
 protected:
 
    std::map<std::string, CBuzzController*> m_mapBuzzVMs;
+   /** The controllers and the robot ids, in numeric robot id order */
+   std::vector<CBuzzController*> m_vecBuzzControllers;
+   std::vector<std::string> m_vecBuzzRobotIds;
+private:
+
+   /** Records a telemetry row for every VM */
+   void RecordTelemetry();
+
+private:
+
+   /** The telemetry recorder, NULL if disabled */
+   buzzrec_t m_tTelemetry;
+   /** Steps between telemetry rows */
+   UInt32 m_unTelemetryPeriod;
+   /** The recorded variables */
+   std::vector<CBuzzProbe> m_vecTelemetryProbes;
+   /** The recorded counters */
+   std::vector<UInt32> m_vecTelemetryCounters;
+   /** The row being recorded */
+   std::vector<buzzrec_value_t> m_vecTelemetryRow;
 };
 
 /****************************************/
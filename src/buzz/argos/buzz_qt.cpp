@@ -1,6 +1,9 @@
 #include "buzz_qt.h"
 #include "buzz_qt_main_window.h"
 #include <argos3/plugins/simulator/visualizations/qt-opengl/qtopengl_main_window.h>
+#include <argos3/core/simulator/simulator.h>
+#include <argos3/core/simulator/space/space.h>
+#include <argos3/core/simulator/entity/controllable_entity.h>
 
 /****************************************/
 /****************************************/
@@ -64,7 +67,7 @@ void CBuzzQT::Draw(CBuzzController& c_contr) {
 void CBuzzQT::Call(CEntity& c_entity) {
    TThunk t_thunk = m_cThunks[c_entity.GetTag()];
    if(t_thunk) (this->*t_thunk)(c_entity);
-   else if(CBuzzController::BUZZ_ROBOTS()[c_entity.GetTag()]) {
+   else if(CBuzzController::BUZZ_ROBOTS().count(c_entity.GetTag()) > 0) {
       Draw(dynamic_cast<CBuzzController&>(
               dynamic_cast<CComposableEntity&>(c_entity).
               GetComponent<CControllableEntity>("controller").
@@ -76,13 +79,15 @@ void CBuzzQT::Call(CEntity& c_entity) {
 /****************************************/
 
 void CBuzzQT::DrawInWorld() {
-   /* Go through all the Buzz controllers with trajectory enabled */
-   for(CSet<CBuzzController*>::iterator it = CBuzzController::TRAJECTORY_CONTROLLERS.begin();
-       it != CBuzzController::TRAJECTORY_CONTROLLERS.end();
-       ++it) {
-      CBuzzController::SDebug& sDebug = (*it)->GetARGoSDebugInfo();
+   /* Go through all the Buzz controllers with trajectory enabled. The
+      controllers are not stepping while the scene is drawn. */
+   CControllableEntity::TVector& tControllables = CSimulator::GetInstance().GetSpace().GetControllableEntityVector();
+   for(size_t i = 0; i < tControllables.size(); ++i) {
+      CBuzzController* pcContr = dynamic_cast<CBuzzController*>(&tControllables[i]->GetController());
+      if(!pcContr) continue;
+      CBuzzController::SDebug& sDebug = pcContr->GetARGoSDebugInfo();
       /* Draw trajectory if at least 2 points were saved */
-      if(sDebug.Trajectory.Data.size() > 1) {
+      if(sDebug.Trajectory.Tracking && sDebug.Trajectory.Data.size() > 1) {
          /* These iterators point to the two extrema of each waypoint segment */
          std::list<CVector3>::iterator it1 = sDebug.Trajectory.Data.begin();
          std::list<CVector3>::iterator it2 = it1;
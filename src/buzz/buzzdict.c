@@ -239,3 +239,21 @@ buzzdict_intkeyhash(uint32);
 
 /****************************************/
 /****************************************/
+
+uint32_t buzzdict_ptrkeyhash(const void* key) {
+   /* The low bits are the same for all the blocks returned by malloc() */
+   uint64_t p = (uintptr_t)(*(void**)key);
+   p ^= p >> 33;
+   p *= 0xff51afd7ed558ccdULL;
+   p ^= p >> 33;
+   return (uint32_t)p;
+}
+
+int buzzdict_ptrkeycmp(const void* a, const void* b) {
+   if((uintptr_t)(*(void**)a) < (uintptr_t)(*(void**)b)) return -1;
+   if((uintptr_t)(*(void**)a) > (uintptr_t)(*(void**)b)) return  1;
+   return 0;
+}
+
+/****************************************/
+/****************************************/
@@ -196,6 +196,21 @@ extern "C" {
     */
    int buzzdict_uint32keycmp(const void* a, const void* b);
 
+   /*
+    * Hash functions for pointers.
+    * @param key The key to hash, cast to void*.
+    * @return A hash for the given key.
+    */
+   uint32_t buzzdict_ptrkeyhash(const void* key);
+
+   /*
+    * Comparison function for pointer keys.
+    * @param a The first key, cast to void*.
+    * @param b The second key, cast to void*.
+    * @return -1 if a < b; 1 if a > b; 0 if a == b.
+    */
+   int buzzdict_ptrkeycmp(const void* a, const void* b);
+
 #ifdef __cplusplus
 }
 #endif
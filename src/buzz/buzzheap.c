@@ -1,5 +1,7 @@
 #include "buzzheap.h"
 #include "buzzvm.h"
+#include "buzzstats.h"
+#include <buzz/config.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -51,6 +53,10 @@ buzzobj_t buzzheap_newobj(buzzvm_t vm,
    o->o.marker = vm->heap->marker;
    /* Add object to list */
    buzzdarray_push(vm->heap->objs, &o);
+#ifdef BUZZ_STATS
+   /* Count the allocation */
+   if(vm->stats && type < BUZZVM_STATS_TYPES) ++vm->stats->allocs[type];
+#endif
    /* All done */
    return o;
 }
@@ -183,6 +189,16 @@ void buzzheap_vstig_mark(const void* key, void* data, void* params) {
       buzzheap_obj_mark(vstig->onconflict, params);
    if(vstig->onconflictlost)
       buzzheap_obj_mark(vstig->onconflictlost, params);
+   if(vstig->limits.priority)
+      buzzheap_obj_mark(vstig->limits.priority, params);
+   if(vstig->aggs) {
+      uint32_t i;
+      for(i = 0; i < buzzdarray_size(vstig->aggs); ++i) {
+         buzzvstig_agg_t a = buzzdarray_get(vstig->aggs, i, buzzvstig_agg_t);
+         buzzstrman_gc_mark(((buzzvm_t)params)->strings, a->name);
+         if(a->filter) buzzheap_obj_mark(a->filter, params);
+      }
+   }
    buzzvstig_foreach_elem(vstig,
                           buzzheap_vstigobj_mark,
                           params);
@@ -193,12 +209,22 @@ void buzzheap_listener_mark(const void* key, void* data, void* params) {
    buzzheap_obj_mark(*(buzzobj_t*)data, params);
 }
 
+void buzzheap_neighbors_mark(buzzvm_t vm) {
+   uint32_t i;
+   for(i = 0; i < vm->neighbors->size; ++i)
+      if(vm->neighbors->data[i])
+         buzzheap_obj_mark(vm->neighbors->data[i], vm);
+   for(i = 0; i < vm->neighbors->nmethods; ++i)
+      buzzheap_obj_mark(vm->neighbors->mname[i], vm);
+}
+
 void buzzheap_gsymobj_mark(const void* key, void* data, void* params) {
    buzzheap_obj_mark(*(buzzobj_t*)data, params);
 }
 
 void buzzheap_gc(struct buzzvm_s* vm) {
    buzzheap_t h = vm->heap;
+   int64_t i;
    /* Is GC necessary? */
    if(buzzdarray_size(h->objs) < h->max_objs) return;
    /* Increase the marker */
@@ -215,10 +241,14 @@ void buzzheap_gc(struct buzzvm_s* vm) {
    buzzdict_foreach(vm->vstigs, buzzheap_vstig_mark, vm);
    /* Go through all the objects in the listeners and mark them */
    buzzdict_foreach(vm->listeners, buzzheap_listener_mark, vm);
-   /* Go through all the objects in the out message queue and mark them */
-   buzzoutmsg_gc(vm);
+   /* Go through the neighbor data tables and method names and mark them */
+   buzzheap_neighbors_mark(vm);
+   /* Go through the host symbols and pinned objects and mark them */
+   for(i = 0; i < buzzdarray_size(vm->hostsyms); ++i)
+      buzzheap_obj_mark(((buzzvm_hostsym_t)vm->hostsyms->data + i)->o, vm);
+   buzzdarray_foreach(vm->pins, buzzheap_darrayobj_mark, vm);
    /* Go through all the objects in the object list and delete the unmarked ones */
-   int64_t i = buzzdarray_size(h->objs) - 1;
+   i = buzzdarray_size(h->objs) - 1;
    while(i >= 0) {
       /* Check whether the marker is set to the latest value */
       if(buzzdarray_get(h->objs, i, buzzobj_t)->o.marker != h->marker) {
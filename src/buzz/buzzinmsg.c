@@ -2,71 +2,201 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <arpa/inet.h>
-#include <math.h>
+
+/*
+ * The head and tail counters are accessed with acquire/release semantics,
+ * so that in SPSC mode the producer only writes the tail and the consumer
+ * only writes the head.
+ */
+#define counter_load(c)     __atomic_load_n(&(c), __ATOMIC_ACQUIRE)
+#define counter_store(c, v) __atomic_store_n(&(c), (v), __ATOMIC_RELEASE)
+
+/****************************************/
+/****************************************/
+
+static uint32_t round_pow2(uint32_t n) {
+   uint32_t p = 1;
+   while(p < n && p < 0x80000000u) p <<= 1;
+   return p;
+}
+
+/*
+ * Frees the payload of an entry, unless it is shared.
+ */
+static void buzzinmsg_release(struct buzzinmsg_s* m) {
+   if(!m->shared) buzzmsg_payload_destroy(&m->payload);
+}
+
+/****************************************/
+/****************************************/
+
+buzzinmsg_queue_t buzzinmsg_queue_new() {
+   buzzinmsg_queue_t q = (buzzinmsg_queue_t)malloc(sizeof(struct buzzinmsg_queue_s));
+   q->capacity = BUZZINMSG_QUEUE_SLOTS;
+   q->limit = BUZZINMSG_QUEUE_CAPACITY;
+   q->slots = (struct buzzinmsg_s*)malloc(q->capacity * sizeof(struct buzzinmsg_s));
+   q->head = 0;
+   q->tail = 0;
+   q->policy = BUZZINMSG_DROP_OLDEST;
+   q->spsc = 0;
+   q->dropped = 0;
+   return q;
+}
 
 /****************************************/
 /****************************************/
 
-void buzzvm_inmsg_queue_destroy_entry(const void* key, void* data, void* param) {
-   free((void*)key);
-   buzzdarray_destroy((buzzdarray_t*)data);
-   free(data);
+void buzzinmsg_queue_destroy(buzzinmsg_queue_t* msgq) {
+   uint32_t i;
+   for(i = (*msgq)->head; i != (*msgq)->tail; ++i)
+      buzzinmsg_release((*msgq)->slots + (i & ((*msgq)->capacity - 1)));
+   free((*msgq)->slots);
+   free(*msgq);
+   *msgq = NULL;
 }
 
 /****************************************/
 /****************************************/
 
-void buzzinmsg_queue_append(buzzvm_t vm,
-                            uint16_t rid,
-                            buzzmsg_payload_t payload) {
-   /* Check if id is already present */
-   if(!buzzdict_exists(vm->inmsgs, &rid)) {
-      /* Not present, create a new queue */
-      buzzdarray_t q = buzzdarray_new(1, sizeof(buzzmsg_payload_t), NULL);
-      /* Add it to the dict */
-      buzzdict_set(vm->inmsgs, &rid, &q);
+buzzinmsg_queue_t buzzinmsg_queue_clone(buzzinmsg_queue_t msgq) {
+   buzzinmsg_queue_t q = (buzzinmsg_queue_t)malloc(sizeof(struct buzzinmsg_queue_s));
+   *q = *msgq;
+   q->slots = (struct buzzinmsg_s*)malloc(q->capacity * sizeof(struct buzzinmsg_s));
+   uint32_t i;
+   for(i = msgq->head; i != msgq->tail; ++i) {
+      struct buzzinmsg_s* m = msgq->slots + (i & (msgq->capacity - 1));
+      struct buzzinmsg_s* x = q->slots + (i & (q->capacity - 1));
+      x->robot = m->robot;
+      x->shared = 0;
+      x->payload = buzzdarray_clone(m->payload);
    }
-   /* Get queue corresponding to given robot id */
-   buzzdarray_t* q = (buzzdarray_t*)buzzdict_rawget(vm->inmsgs, &rid);
-   /* Append payload to queue */
-   buzzdarray_push(*q, &payload);
+   return q;
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzinmsg_queue_size(buzzinmsg_queue_t msgq) {
+   return counter_load(msgq->tail) - counter_load(msgq->head);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Changes the number of slots, dropping the oldest messages that do not
+ * fit.
+ */
+static void buzzinmsg_queue_resize(buzzinmsg_queue_t msgq,
+                                   uint32_t capacity) {
+   /* Drop the oldest messages that do not fit */
+   while(msgq->tail - msgq->head > capacity) {
+      buzzinmsg_release(msgq->slots + (msgq->head & (msgq->capacity - 1)));
+      ++msgq->head;
+      ++msgq->dropped;
+   }
+   /* Copy the messages in order into the new slots */
+   struct buzzinmsg_s* slots = (struct buzzinmsg_s*)malloc(capacity * sizeof(struct buzzinmsg_s));
+   uint32_t n = msgq->tail - msgq->head;
+   uint32_t i;
+   for(i = 0; i < n; ++i)
+      slots[i] = msgq->slots[(msgq->head + i) & (msgq->capacity - 1)];
+   free(msgq->slots);
+   msgq->slots = slots;
+   msgq->capacity = capacity;
+   msgq->head = 0;
+   msgq->tail = n;
+}
+
+void buzzinmsg_queue_set_capacity(buzzinmsg_queue_t msgq,
+                                  uint32_t capacity) {
+   capacity = round_pow2(capacity);
+   msgq->limit = capacity;
+   buzzinmsg_queue_resize(msgq, capacity);
 }
 
 /****************************************/
 /****************************************/
 
-struct buzzdict_entry_s {
-   void* key;
-   void* data;
-};
+void buzzinmsg_queue_set_policy(buzzinmsg_queue_t msgq,
+                                int policy) {
+   msgq->policy = policy;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzinmsg_queue_set_spsc(buzzinmsg_queue_t msgq,
+                              int spsc) {
+   if(spsc && msgq->capacity < msgq->limit)
+      buzzinmsg_queue_resize(msgq, msgq->limit);
+   msgq->spsc = spsc;
+}
+
+/****************************************/
+/****************************************/
+
+static int buzzinmsg_queue_push(buzzvm_t vm,
+                                uint16_t rid,
+                                buzzmsg_payload_t payload,
+                                uint8_t shared) {
+   buzzinmsg_queue_t q = vm->inmsgs;
+   /* Make room if the queue is full and can grow */
+   if(!q->spsc &&
+      q->tail - q->head >= q->capacity &&
+      q->capacity < q->limit)
+      buzzinmsg_queue_resize(q, q->capacity * 2);
+   uint32_t tail = q->tail;
+   /* Is the queue full? */
+   if(tail - counter_load(q->head) >= q->capacity) {
+      if(q->spsc || q->policy == BUZZINMSG_DROP_NEWEST) {
+         /* Drop the arriving message */
+         if(!shared) buzzmsg_payload_destroy(&payload);
+         ++q->dropped;
+         return 0;
+      }
+      /* Drop the oldest message */
+      buzzinmsg_release(q->slots + (q->head & (q->capacity - 1)));
+      counter_store(q->head, q->head + 1);
+      ++q->dropped;
+   }
+   /* Fill the slot and publish it */
+   q->slots[tail & (q->capacity - 1)].robot = rid;
+   q->slots[tail & (q->capacity - 1)].shared = shared;
+   q->slots[tail & (q->capacity - 1)].payload = payload;
+   counter_store(q->tail, tail + 1);
+   return 1;
+}
+
+int buzzinmsg_queue_append(buzzvm_t vm,
+                           uint16_t rid,
+                           buzzmsg_payload_t payload) {
+   return buzzinmsg_queue_push(vm, rid, payload, 0);
+}
+
+int buzzinmsg_queue_append_shared(buzzvm_t vm,
+                                  uint16_t rid,
+                                  buzzmsg_payload_t payload) {
+   return buzzinmsg_queue_push(vm, rid, payload, 1);
+}
+
+/****************************************/
+/****************************************/
 
 int buzzinmsg_queue_extract(buzzvm_t vm,
                             uint16_t* rid,
                             buzzmsg_payload_t* payload) {
+   buzzinmsg_queue_t q = vm->inmsgs;
+   uint32_t head = q->head;
    /* Nothing to do if queue is empty */
-   if(buzzinmsg_queue_isempty(vm->inmsgs)) return 0;
-   /* Look for (id,queue) in first non-empty bucket in dict */
-   buzzdarray_t q = NULL;
-   for(uint32_t i = 0; i < vm->inmsgs->num_buckets; ++i) {
-      if(vm->inmsgs->buckets[i]) {
-         const struct buzzdict_entry_s* e =
-            &buzzdarray_get(vm->inmsgs->buckets[i],
-                            0,
-                            struct buzzdict_entry_s);
-         *rid = *(uint16_t*)(e->key);
-         q = *(buzzdarray_t*)(e->data);
-         break;
-      }
-   }
-   /* Extract payload from array */
-   *payload = buzzdarray_last(q, buzzmsg_payload_t);
-   buzzdarray_pop(q);
-   /* If array is empty, remove (id,array entry) from dict */
-   if(buzzdarray_isempty(q))
-      buzzdict_remove(vm->inmsgs, rid);
+   if(head == counter_load(q->tail)) return 0;
+   /* Take the oldest message and free its slot */
+   *rid = q->slots[head & (q->capacity - 1)].robot;
+   *payload = q->slots[head & (q->capacity - 1)].payload;
+   int shared = q->slots[head & (q->capacity - 1)].shared;
+   counter_store(q->head, head + 1);
    /* All done */
-   return 1;
+   return shared ? BUZZINMSG_SHARED : BUZZINMSG_OWNED;
 }
 
 /****************************************/
@@ -10,10 +10,133 @@ struct buzzvm_s;
 extern "C" {
 #endif
 
+   /*
+    * Default capacity of a message queue.
+    */
+#define BUZZINMSG_QUEUE_CAPACITY 1024
+
+   /*
+    * Number of slots a new message queue starts with. The slots double
+    * as needed up to the capacity.
+    */
+#define BUZZINMSG_QUEUE_SLOTS 16
+
+   /*
+    * What to do when a message arrives and the queue is full.
+    */
+   typedef enum {
+      BUZZINMSG_DROP_OLDEST = 0, // Discard the oldest queued message
+      BUZZINMSG_DROP_NEWEST      // Discard the arriving message
+   } buzzinmsg_drop_policy_e;
+
+   /*
+    * Values returned by buzzinmsg_queue_extract().
+    */
+#define BUZZINMSG_OWNED  1 // The payload is yours to free
+#define BUZZINMSG_SHARED 2 // The payload is shared, do not free or modify it
+
+   /*
+    * An entry of the message queue.
+    */
+   struct buzzinmsg_s {
+      /* The id of the robot who sent the message */
+      uint16_t robot;
+      /* 1 if the payload is shared with other receivers, 0 if owned */
+      uint8_t shared;
+      /* The message payload */
+      buzzmsg_payload_t payload;
+   };
+
    /*
     * Data of a Buzz message queue.
+    * The queue is a ring buffer. Messages are extracted in order of
+    * arrival. The counters grow indefinitely and wrap around; the slot of
+    * a counter is (counter & (capacity - 1)).
+    */
+   struct buzzinmsg_queue_s {
+      /* The slots */
+      struct buzzinmsg_s* slots;
+      /* The number of slots, a power of two */
+      uint32_t capacity;
+      /* The maximum number of slots, a power of two */
+      uint32_t limit;
+      /* Counter of the next message to extract */
+      uint32_t head;
+      /* Counter of the next free slot */
+      uint32_t tail;
+      /* The drop policy */
+      int policy;
+      /* Whether the queue is in single-producer/single-consumer mode */
+      int spsc;
+      /* The number of messages dropped so far */
+      uint32_t dropped;
+   };
+   typedef struct buzzinmsg_queue_s* buzzinmsg_queue_t;
+
+   /*
+    * Creates a new message queue.
+    * The queue has capacity BUZZINMSG_QUEUE_CAPACITY and drops the oldest
+    * message when full. It starts with BUZZINMSG_QUEUE_SLOTS slots, so
+    * that idle VMs stay small.
+    * @return A new message queue.
+    */
+   extern buzzinmsg_queue_t buzzinmsg_queue_new();
+
+   /*
+    * Destroys a message queue.
+    * The queued payloads are destroyed too, except the shared ones.
+    * @param msgq The message queue.
+    */
+   extern void buzzinmsg_queue_destroy(buzzinmsg_queue_t* msgq);
+
+   /*
+    * Clones a message queue.
+    * The clone owns copies of all the payloads, including the shared ones.
+    * The queue must not be written while it is cloned.
+    * @param msgq The message queue.
+    * @return A new message queue.
+    */
+   extern buzzinmsg_queue_t buzzinmsg_queue_clone(buzzinmsg_queue_t msgq);
+
+   /*
+    * Returns the number of messages in the queue.
+    * @param msgq The message queue.
+    * @return The number of messages in the queue.
+    */
+   extern uint32_t buzzinmsg_queue_size(buzzinmsg_queue_t msgq);
+
+   /*
+    * Sets the capacity of the queue.
+    * The capacity is rounded up to a power of two, and the slots are
+    * allocated at once. If the queue holds more messages than the new
+    * capacity, the oldest are dropped.
+    * Do not call this function while another thread uses the queue.
+    * @param msgq The message queue.
+    * @param capacity The new capacity.
+    */
+   extern void buzzinmsg_queue_set_capacity(buzzinmsg_queue_t msgq,
+                                            uint32_t capacity);
+
+   /*
+    * Sets what to do when a message arrives and the queue is full.
+    * @param msgq The message queue.
+    * @param policy BUZZINMSG_DROP_OLDEST or BUZZINMSG_DROP_NEWEST.
     */
-   typedef buzzdict_t buzzinmsg_queue_t;
+   extern void buzzinmsg_queue_set_policy(buzzinmsg_queue_t msgq,
+                                          int policy);
+
+   /*
+    * Sets the single-producer/single-consumer mode.
+    * In this mode, one thread can append messages while another extracts
+    * them, without locks. Since only the consumer can remove messages,
+    * arriving messages are dropped when the queue is full, regardless of
+    * the drop policy. The slots are allocated up to the capacity when the
+    * mode is enabled, since they cannot grow afterwards.
+    * @param msgq The message queue.
+    * @param spsc 1 to enable the mode, 0 to disable it.
+    */
+   extern void buzzinmsg_queue_set_spsc(buzzinmsg_queue_t msgq,
+                                        int spsc);
 
    /*
     * Appends a message to the queue.
@@ -22,69 +145,50 @@ extern "C" {
     * @param vm The Buzz VM.
     * @param id The id of the robot who sent the message.
     * @param payload The message payload.
+    * @return 1 if the message was queued; 0 if it was dropped.
     */
-   extern void buzzinmsg_queue_append(struct buzzvm_s* vm,
-                                      uint16_t id,
-                                      buzzmsg_payload_t payload);
+   extern int buzzinmsg_queue_append(struct buzzvm_s* vm,
+                                     uint16_t id,
+                                     buzzmsg_payload_t payload);
 
    /*
-    * Extracts a message from the queue.
-    * You are in charge of freeing both the message data and the payload.
+    * Appends a shared message to the queue.
+    * The payload is not copied, and the queue never frees or modifies it.
+    * This lets co-located VMs receive the same payload without copying
+    * it, as long as the payload outlives the queued message. The caller
+    * is expected to process the queue before the payload goes away.
+    * The VM still deserializes the payload into its own objects.
+    * @param vm The Buzz VM.
+    * @param id The id of the robot who sent the message.
+    * @param payload The message payload.
+    * @return 1 if the message was queued; 0 if it was dropped.
+    */
+   extern int buzzinmsg_queue_append_shared(struct buzzvm_s* vm,
+                                            uint16_t id,
+                                            buzzmsg_payload_t payload);
+
+   /*
+    * Extracts the oldest message from the queue.
+    * Unless the payload is shared, you are in charge of freeing it.
     * If the queue is empty, the values of *id and *payload are left untouched.
     * @param vm The Buzz VM.
     * @param id The id of the robot who sent the message.
     * @param payload The message payload.
-    * @return 1 if the extraction was successful; 0 if no messages are left
+    * @return BUZZINMSG_OWNED or BUZZINMSG_SHARED if the extraction was successful; 0 if no messages are left
     */
    extern int buzzinmsg_queue_extract(struct buzzvm_s* vm,
                                       uint16_t* id,
                                       buzzmsg_payload_t* payload);
 
-   /**
-    * Internally used to cleanup a queue entry.
-    * @param key A pointer to the robot id (uint16_t)
-    * @param data A pointer to buzzdarray_t
-    * @param param Unused
-    */
-   extern void buzzvm_inmsg_queue_destroy_entry(const void* key,
-                                                void* data,
-                                                void* param);
-
 #ifdef __cplusplus
 }
 #endif
 
-/*
- * Create a new message queue.
- */
-#define buzzinmsg_queue_new() buzzdict_new(20, sizeof(uint16_t), sizeof(buzzmsg_payload_t), buzzdict_uint16keyhash, buzzdict_uint16keycmp, buzzvm_inmsg_queue_destroy_entry)
-
-/*
- * Destroys a message queue.
- * @param msgq The message queue.
- */
-#define buzzinmsg_queue_destroy(msgq) buzzdict_destroy(msgq)
-
-/*
- * Returns the size of a message queue.
- * @param msgq The message queue.
- * @return The size of a message queue.
- */
-#define buzzinmsg_queue_size(msgq) buzzdict_size(msgq)
-
 /*
  * Returns <tt>true</tt> if the message queue is empty.
  * @param msgq The message queue.
  * @return <tt>true</tt> if the message queue is empty.
  */
-#define buzzinmsg_queue_isempty(msgq) buzzdict_isempty(msgq)
-
-/*
- * Returns the message at the given position in the queue.
- * @param msg The message queue.
- * @param pos The position.
- * @return The message at the given position.
- */
-#define buzzinmsg_queue_get(msg, pos) buzzdict_get(msg, pos, buzzmsg_payload_t)
+#define buzzinmsg_queue_isempty(msgq) (buzzinmsg_queue_size(msgq) == 0)
 
 #endif
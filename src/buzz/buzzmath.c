@@ -31,7 +31,7 @@ void mt_setseed(buzzvm_t vm,
 
 uint32_t mt_uniform32(buzzvm_t vm) {
    uint32_t y;
-   static uint32_t mag01[2] = { 0x0UL, MATRIX_A };
+   static const uint32_t mag01[2] = { 0x0UL, MATRIX_A };
    /* mag01[x] = x * MATRIX_A  for x=0,1 */
    if (vm->rngidx >= N) { /* generate N words at one time */
       int32_t kk;
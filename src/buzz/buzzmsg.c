@@ -8,7 +8,7 @@
 /****************************************/
 /****************************************/
 
-static int32_t MAX_MANTISSA = 2147483646; // 2 << 31 - 2;
+static const int32_t MAX_MANTISSA = 2147483646; // 2 << 31 - 2;
 
 /****************************************/
 /****************************************/
@@ -18,6 +18,10 @@ extern "C" {
       BUZZMSG_VSTIG_QUERY,   // Virtual stigmergy QUERY
       BUZZMSG_SWARM_JOIN,    // Swarm joining
       BUZZMSG_SWARM_LEAVE,   // Swarm leaving
+      BUZZMSG_VSTIG_DIGEST,  // Virtual stigmergy anti-entropy digest
+      BUZZMSG_VSTIG_REQUEST, // Virtual stigmergy anti-entropy request
+      BUZZMSG_SWARM_HEARTBEAT, // Swarm membership version and hash
+      BUZZMSG_SWARM_REQUEST, // Swarm listing request
       BUZZMSG_TYPE_COUNT     // How many Buzz message types have been defined
    } buzzmsg_payload_type_e;
 
@@ -1,7 +1,11 @@
 #include "buzzneighbors.h"
 #include "buzzvm.h"
+#include "buzzutils.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
 
 /****************************************/
 /****************************************/
@@ -11,34 +15,382 @@
 /****************************************/
 /****************************************/
 
-struct neighbor_filter_s {
-   buzzvm_t vm;
-   int32_t swarm_id;
-   buzzdict_t result;
-};
-
-/****************************************/
-/****************************************/
-
 #define function_register(TABLE, FNAME, FPOINTER)               \
    buzzvm_push(vm, (TABLE));                                    \
    buzzvm_pushs(vm, buzzvm_string_register(vm, (FNAME), 1));    \
    buzzvm_pushcc(vm, buzzvm_function_register(vm, (FPOINTER))); \
    buzzvm_tput(vm);
 
-static int make_table(buzzvm_t vm, buzzobj_t* t) {
+/*
+ * The methods of every neighbor structure.
+ */
+static const struct {
+   const char* name;
+   buzzvm_funp fun;
+} NEIGHBORS_METHODS[] = {
+   { "get",                buzzneighbors_get },
+   { "filter",             buzzneighbors_filter },
+   { "kin",                buzzneighbors_kin },
+   { "nonkin",             buzzneighbors_nonkin },
+   { "foreach",            buzzneighbors_foreach },
+   { "map",                buzzneighbors_map },
+   { "reduce",             buzzneighbors_reduce },
+   { "count",              buzzneighbors_count },
+   { "vecsum",             buzzneighbors_vecsum },
+   { "lennard_jones",      buzzneighbors_lennard_jones },
+   { "centroid",           buzzneighbors_centroid },
+   { "count_within",       buzzneighbors_count_within },
+   { "nearest",            buzzneighbors_nearest },
+   { "within",             buzzneighbors_within },
+   { "sector",             buzzneighbors_sector },
+   { "sorted_by_distance", buzzneighbors_sorted_by_distance }
+};
+#define NEIGHBORS_METHOD_NUM (sizeof(NEIGHBORS_METHODS) / sizeof(NEIGHBORS_METHODS[0]))
+
+/*
+ * Makes a neighbor structure with the given data, which is either a table
+ * (robot id, data) or a view on the neighbor store.
+ * The neighbor structure without data is the "neighbors" global symbol,
+ * whose data is the whole neighbor store.
+ * The methods are bound directly, because neighbor structures are made
+ * often.
+ */
+static buzzobj_t make_table(buzzvm_t vm, buzzobj_t data) {
+   buzzneighbors_store_t s = vm->neighbors;
    /* Make new table */
-   *t = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   buzzobj_t t = buzzheap_newobj(vm, BUZZTYPE_TABLE);
    /* Add methods */
-   function_register(*t, "get",     buzzneighbors_get);
-   function_register(*t, "filter",  buzzneighbors_filter);
-   function_register(*t, "kin",     buzzneighbors_kin);
-   function_register(*t, "nonkin",  buzzneighbors_nonkin);
-   function_register(*t, "foreach", buzzneighbors_foreach);
-   function_register(*t, "map",     buzzneighbors_map);
-   function_register(*t, "reduce",  buzzneighbors_reduce);
-   function_register(*t, "count",   buzzneighbors_count);
-   return vm->state;
+   uint32_t i;
+   for(i = 0; i < s->nmethods; ++i) {
+      buzzobj_t c = buzzheap_newobj(vm, BUZZTYPE_CLOSURE);
+      c->c.value.isnative = 0;
+      c->c.value.ref = s->mfun[i];
+      buzzdarray_push(c->c.value.actrec, &t);
+      buzzdict_set(t->t.value, &s->mname[i], &c);
+   }
+   /* Add data */
+   if(data) {
+      buzzvm_push(vm, t);
+      buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
+      buzzvm_push(vm, data);
+      buzzvm_tput(vm);
+   }
+   return t;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * A selection of neighbors of the current step.
+ * The neighbors are identified by their position in the store; the robot
+ * ids find them again when the store has changed since the view was made.
+ */
+struct neighbors_view_s {
+   /* The epoch of the store the positions refer to */
+   uint32_t epoch;
+   /* The number of neighbors */
+   uint32_t size;
+   /* The positions in the store */
+   uint32_t* pos;
+   /* The robot ids */
+   uint16_t* id;
+};
+
+static struct neighbors_view_s* neighbors_view_new(uint32_t capacity) {
+   struct neighbors_view_s* v = (struct neighbors_view_s*)malloc(
+      sizeof(struct neighbors_view_s) +
+      capacity * (sizeof(uint32_t) + sizeof(uint16_t)));
+   v->epoch = 0;
+   v->size = 0;
+   v->pos = (uint32_t*)(v + 1);
+   v->id = (uint16_t*)(v->pos + capacity);
+   return v;
+}
+
+static void neighbors_view_destroy(void* v) {
+   free(v);
+}
+
+static void* neighbors_view_clone(void* v) {
+   struct neighbors_view_s* o = (struct neighbors_view_s*)v;
+   struct neighbors_view_s* x = neighbors_view_new(o->size);
+   x->epoch = o->epoch;
+   x->size = o->size;
+   memcpy(x->pos, o->pos, o->size * sizeof(uint32_t));
+   memcpy(x->id, o->id, o->size * sizeof(uint16_t));
+   return x;
+}
+
+/*
+ * Brings the positions of a view up to date, dropping the robots that are
+ * no longer neighbors.
+ */
+static void neighbors_view_update(buzzneighbors_store_t s,
+                                  struct neighbors_view_s* v) {
+   if(v->epoch == s->epoch) return;
+   uint32_t i, j = 0;
+   for(i = 0; i < v->size; ++i) {
+      int64_t p = buzzneighbors_store_find(s, v->id[i]);
+      if(p < 0) continue;
+      v->pos[j] = p;
+      v->id[j] = v->id[i];
+      ++j;
+   }
+   v->size = j;
+   v->epoch = s->epoch;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * The neighbors of a neighbor structure: the whole neighbor store (both
+ * fields are NULL), a view on it, or a table (robot id, data).
+ */
+struct neighbors_src_s {
+   buzzobj_t poses;
+   struct neighbors_view_s* view;
+};
+
+/*
+ * Gets the neighbors of the neighbor structure passed as self.
+ */
+static void neighbors_src(buzzvm_t vm,
+                          struct neighbors_src_s* src) {
+   src->poses = NULL;
+   src->view = NULL;
+   buzzvm_lload(vm, 0);
+   if(buzzvm_stack_at(vm, 1)->o.type != BUZZTYPE_TABLE) {
+      buzzvm_pop(vm);
+      return;
+   }
+   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
+   buzzvm_tget(vm);
+   buzzobj_t data = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   if(data->o.type == BUZZTYPE_TABLE) {
+      src->poses = data;
+   }
+   else if(data->o.type == BUZZTYPE_USERDATA &&
+           data->u.destroy == neighbors_view_destroy) {
+      src->view = (struct neighbors_view_s*)data->u.value;
+      neighbors_view_update(vm->neighbors, src->view);
+   }
+}
+
+/*
+ * Returns the number of neighbors of a neighbor structure.
+ */
+static uint32_t neighbors_src_size(buzzvm_t vm,
+                                   const struct neighbors_src_s* src) {
+   if(src->poses) return buzzdict_size(src->poses->t.value);
+   if(src->view) return src->view->size;
+   return vm->neighbors->size;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * The function called for each neighbor. The position is that of the
+ * neighbor in the store, or -1 for the neighbors in a table.
+ */
+typedef void (*neighbors_fun)(buzzvm_t vm,
+                              buzzobj_t rid,
+                              buzzobj_t data,
+                              int64_t pos,
+                              void* params);
+
+struct neighbors_each_s {
+   buzzvm_t vm;
+   neighbors_fun fun;
+   void* params;
+};
+
+static void neighbors_each_entry(const void* key, void* data, void* params) {
+   struct neighbors_each_s* e = (struct neighbors_each_s*)params;
+   if(e->vm->state != BUZZVM_STATE_READY) return;
+   e->fun(e->vm, *(buzzobj_t*)key, *(buzzobj_t*)data, -1, e->params);
+}
+
+/*
+ * Calls a function for each neighbor of a neighbor structure.
+ */
+static void neighbors_each(buzzvm_t vm,
+                           const struct neighbors_src_s* src,
+                           neighbors_fun fun,
+                           void* params) {
+   if(src->poses) {
+      struct neighbors_each_s e = {
+         .vm = vm,
+         .fun = fun,
+         .params = params
+      };
+      buzzdict_foreach(src->poses->t.value, neighbors_each_entry, &e);
+   }
+   else {
+      uint32_t n = src->view ? src->view->size : vm->neighbors->size;
+      uint32_t i;
+      for(i = 0; i < n && vm->state == BUZZVM_STATE_READY; ++i) {
+         uint32_t p = src->view ? src->view->pos[i] : i;
+         buzzobj_t rid = buzzheap_newobj(vm, BUZZTYPE_INT);
+         rid->i.value = vm->neighbors->id[p];
+         fun(vm, rid, buzzneighbors_data(vm, p), p, params);
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * A selection of the neighbors of a neighbor structure, which becomes a
+ * new neighbor structure. A selection of neighbors of the current step is
+ * a view; a selection of neighbors in a table is a table.
+ */
+struct neighbors_sel_s {
+   buzzobj_t poses;
+   struct neighbors_view_s* view;
+};
+
+/*
+ * Starts a selection and pushes the neighbor structure that will hold it,
+ * so that it is safe from garbage collection.
+ */
+static void neighbors_sel_new(buzzvm_t vm,
+                              const struct neighbors_src_s* src,
+                              struct neighbors_sel_s* sel) {
+   buzzobj_t data;
+   if(src->poses) {
+      sel->view = NULL;
+      sel->poses = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+      data = sel->poses;
+   }
+   else {
+      sel->poses = NULL;
+      sel->view = neighbors_view_new(neighbors_src_size(vm, src));
+      sel->view->epoch = vm->neighbors->epoch;
+      data = buzzheap_newobj(vm, BUZZTYPE_USERDATA);
+      data->u.value = sel->view;
+      data->u.destroy = neighbors_view_destroy;
+      data->u.clone = neighbors_view_clone;
+   }
+   buzzvm_push(vm, make_table(vm, data));
+}
+
+static void neighbors_sel_add(buzzvm_t vm,
+                              struct neighbors_sel_s* sel,
+                              buzzobj_t rid,
+                              buzzobj_t data,
+                              int64_t pos) {
+   if(sel->poses) {
+      buzzdict_set(sel->poses->t.value, &rid, &data);
+   }
+   else {
+      sel->view->pos[sel->view->size] = pos;
+      sel->view->id[sel->view->size] = vm->neighbors->id[pos];
+      ++sel->view->size;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+buzzneighbors_store_t buzzneighbors_store_new() {
+   return (buzzneighbors_store_t)calloc(1, sizeof(struct buzzneighbors_store_s));
+}
+
+/****************************************/
+/****************************************/
+
+void buzzneighbors_store_destroy(buzzneighbors_store_t* s) {
+   free((*s)->id);
+   free((*s)->distance);
+   free((*s)->azimuth);
+   free((*s)->elevation);
+   free((*s)->age);
+   free((*s)->data);
+   free((*s)->order);
+   free((*s)->mname);
+   free((*s)->mfun);
+   free(*s);
+   *s = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+int64_t buzzneighbors_store_find(buzzneighbors_store_t s,
+                                 uint16_t robot) {
+   uint32_t i;
+   for(i = 0; i < s->size; ++i)
+      if(s->id[i] == robot) return i;
+   return -1;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Sorts the given positions by distance.
+ * Insertion sort is fast for the usual number of neighbors, and the
+ * positions are often sorted already.
+ */
+static void neighbors_sort(const float* distance,
+                           uint32_t* pos,
+                           uint32_t n) {
+   uint32_t i, j, p;
+   for(i = 1; i < n; ++i) {
+      p = pos[i];
+      for(j = i; j > 0 && distance[pos[j - 1]] > distance[p]; --j)
+         pos[j] = pos[j - 1];
+      pos[j] = p;
+   }
+}
+
+const uint32_t* buzzneighbors_store_order(buzzneighbors_store_t s) {
+   if(!s->sorted) {
+      uint32_t i;
+      for(i = 0; i < s->size; ++i) s->order[i] = i;
+      neighbors_sort(s->distance, s->order, s->size);
+      s->sorted = 1;
+   }
+   return s->order;
+}
+
+/*
+ * Marks the neighbor store as changed.
+ */
+static void neighbors_changed(buzzneighbors_store_t s) {
+   ++s->epoch;
+   s->sorted = 0;
+}
+
+/****************************************/
+/****************************************/
+
+static void neighbors_data_put(buzzvm_t vm,
+                               buzzobj_t t,
+                               uint16_t sid,
+                               float value) {
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, sid);
+   buzzvm_pushf(vm, value);
+   buzzvm_tput(vm);
+}
+
+buzzobj_t buzzneighbors_data(buzzvm_t vm,
+                             uint32_t i) {
+   buzzneighbors_store_t s = vm->neighbors;
+   if(!s->data[i]) {
+      buzzobj_t t = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+      neighbors_data_put(vm, t, s->sdistance,  s->distance[i]);
+      neighbors_data_put(vm, t, s->sazimuth,   s->azimuth[i]);
+      neighbors_data_put(vm, t, s->selevation, s->elevation[i]);
+      s->data[i] = t;
+   }
+   return s->data[i];
 }
 
 /****************************************/
@@ -46,14 +398,32 @@ static int make_table(buzzvm_t vm, buzzobj_t* t) {
 
 int buzzneighbors_new(buzzvm_t vm) {
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   buzzneighbors_store_t s = vm->neighbors;
+   /* Register the field names of the data tables */
+   s->sdistance  = buzzvm_string_register(vm, "distance", 1);
+   s->sazimuth   = buzzvm_string_register(vm, "azimuth", 1);
+   s->selevation = buzzvm_string_register(vm, "elevation", 1);
+   /* Register the methods of the neighbor structures */
+   if(!s->mname) {
+      s->nmethods = NEIGHBORS_METHOD_NUM;
+      s->mname = (buzzobj_t*)malloc(s->nmethods * sizeof(buzzobj_t));
+      s->mfun = (uint32_t*)malloc(s->nmethods * sizeof(uint32_t));
+   }
+   uint32_t i;
+   for(i = 0; i < s->nmethods; ++i) {
+      buzzvm_pushs(vm, buzzvm_string_register(vm, NEIGHBORS_METHODS[i].name, 1));
+      s->mname[i] = buzzvm_stack_at(vm, 1);
+      buzzvm_pop(vm);
+      s->mfun[i] = buzzvm_function_register(vm, NEIGHBORS_METHODS[i].fun);
+   }
    /* Make new table */
-   buzzobj_t t;
-   vm->state = make_table(vm, &t);
-   if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   buzzobj_t t = make_table(vm, NULL);
    /* Add extra methods */
    function_register(t, "broadcast", buzzneighbors_broadcast);
    function_register(t, "listen",    buzzneighbors_listen);
    function_register(t, "ignore",    buzzneighbors_ignore);
+   function_register(t, "broadcast_priority", buzzneighbors_broadcast_priority);
+   function_register(t, "broadcast_mode",     buzzneighbors_broadcast_mode);
    /* Register table as global symbol */
    buzzvm_pushs(vm, buzzvm_string_register(vm, "neighbors", 1));
    buzzvm_push(vm, t);
@@ -66,14 +436,9 @@ int buzzneighbors_new(buzzvm_t vm) {
 
 int buzzneighbors_reset(buzzvm_t vm) {
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
-   /* Get "neighbors" table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "neighbors", 1));
-   buzzvm_gload(vm);
-   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   /* Make a new POSES table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_pusht(vm);
-   buzzvm_tput(vm);
+   /* Forget the neighbors; the arrays are kept for the next step */
+   vm->neighbors->size = 0;
+   neighbors_changed(vm->neighbors);
    return vm->state;
 }
 
@@ -86,47 +451,55 @@ int buzzneighbors_add(buzzvm_t vm,
                       float azimuth,
                       float elevation) {
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
-   /* Get "neighbors" table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "neighbors", 1));
-   buzzvm_gload(vm);
-   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   buzzobj_t nbr = buzzvm_stack_at(vm, 1);
-   /* Get POSES field */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   if(buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_NIL) {
-      /* Empty data, create a new table */
-      buzzvm_pop(vm);
-      buzzvm_push(vm, nbr);
-      buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-      buzzvm_pusht(vm);
-      buzzobj_t data = buzzvm_stack_at(vm, 1);
-      buzzvm_tput(vm);
-      buzzvm_push(vm, data);
+   buzzneighbors_store_t s = vm->neighbors;
+   /* Look for the robot, in case it was added already */
+   int64_t i = buzzneighbors_store_find(s, robot);
+   if(i < 0) {
+      /* New neighbor, make room for it */
+      if(s->size == s->capacity) {
+         s->capacity = s->capacity ? 2 * s->capacity : 16;
+         s->id        = (uint16_t*)realloc(s->id,        s->capacity * sizeof(uint16_t));
+         s->distance  = (float*)realloc(s->distance,     s->capacity * sizeof(float));
+         s->azimuth   = (float*)realloc(s->azimuth,      s->capacity * sizeof(float));
+         s->elevation = (float*)realloc(s->elevation,    s->capacity * sizeof(float));
+         s->age       = (uint32_t*)realloc(s->age,       s->capacity * sizeof(uint32_t));
+         s->data      = (buzzobj_t*)realloc(s->data,     s->capacity * sizeof(buzzobj_t));
+         s->order     = (uint32_t*)realloc(s->order,     s->capacity * sizeof(uint32_t));
+      }
+      i = s->size++;
+      s->id[i] = robot;
    }
-   /* When we get here, the POSES table is on top of the stack */
-   /* Push robot id */
-   buzzvm_pushi(vm, robot);
-   /* Create entry table */
-   buzzobj_t entry = buzzheap_newobj(vm, BUZZTYPE_TABLE);
-   /* Insert distance */
-   buzzvm_push(vm, entry);
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "distance", 1));
-   buzzvm_pushf(vm, distance);
-   buzzvm_tput(vm);
-   /* Insert azimuth */
-   buzzvm_push(vm, entry);
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "azimuth", 1));
-   buzzvm_pushf(vm, azimuth);
-   buzzvm_tput(vm);
-   /* Insert elevation */
-   buzzvm_push(vm, entry);
-   buzzvm_pushs(vm, buzzvm_string_register(vm, "elevation", 1));
-   buzzvm_pushf(vm, elevation);
-   buzzvm_tput(vm);
-   /* Save entry into data table */
-   buzzvm_push(vm, entry);
-   buzzvm_tput(vm);
+   s->distance[i] = distance;
+   s->azimuth[i] = azimuth;
+   s->elevation[i] = elevation;
+   s->age[i] = 0;
+   /* The data table is made if a script asks for it */
+   s->data[i] = NULL;
+   neighbors_changed(s);
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_age(buzzvm_t vm,
+                      uint32_t maxage) {
+   if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   buzzneighbors_store_t s = vm->neighbors;
+   /* Keep the neighbors that are young enough, in the same order */
+   uint32_t i, j = 0;
+   for(i = 0; i < s->size; ++i) {
+      if(++s->age[i] > maxage) continue;
+      s->id[j]        = s->id[i];
+      s->distance[j]  = s->distance[i];
+      s->azimuth[j]   = s->azimuth[i];
+      s->elevation[j] = s->elevation[i];
+      s->age[j]       = s->age[i];
+      s->data[j]      = s->data[i];
+      ++j;
+   }
+   s->size = j;
+   neighbors_changed(s);
    return vm->state;
 }
 
@@ -151,6 +524,55 @@ int buzzneighbors_broadcast(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
+int buzzneighbors_broadcast_priority(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   /* Get value id argument */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
+   /* Get priority argument */
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   /* Make sure the topic string is never collected */
+   uint16_t sid = buzzvm_string_register(
+      vm, buzzvm_stack_at(vm, 2)->s.value.str, 1);
+   /* Set the priority */
+   buzzoutmsg_queue_set_priority(vm, sid, buzzvm_stack_at(vm, 1)->i.value);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_broadcast_mode(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   /* Get value id argument */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
+   /* Get mode argument */
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
+   const char* mode = buzzvm_stack_at(vm, 1)->s.value.str;
+   int latest;
+   if(strcmp(mode, "latest") == 0) latest = 1;
+   else if(strcmp(mode, "every") == 0) latest = 0;
+   else {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_TYPE,
+                      "unknown broadcast mode '%s', expected 'latest' or 'every'",
+                      mode);
+      return vm->state;
+   }
+   /* Make sure the topic string is never collected */
+   uint16_t sid = buzzvm_string_register(
+      vm, buzzvm_stack_at(vm, 2)->s.value.str, 1);
+   /* Set the mode */
+   buzzoutmsg_queue_set_latest(vm, sid, latest);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
 int buzzneighbors_listen(buzzvm_t vm) {
    buzzvm_lnum_assert(vm, 2);
    /* Get value id argument */
@@ -185,26 +607,11 @@ int buzzneighbors_ignore(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
-void neighbor_filter_kin(const void* key, void* data, void* params) {
-   buzzobj_t rid = *(buzzobj_t*)key;
-   struct neighbor_filter_s* fdata = (struct neighbor_filter_s*)params;
-   /*
-    * If no swarm id was specified (<0) OR
-    * It was specified and the robot is in that swarm,
-    * add the robot data to the swarm
-    */
-   if(fdata->swarm_id < 0 ||
-      (fdata->swarm_id >= 0 &&
-       buzzswarm_members_isrobotin(fdata->vm->swarmmembers,
-                                   rid->i.value,
-                                   fdata->swarm_id))) {
-      /* Add entry to the return table */
-      buzzdict_set(fdata->result, &rid, (buzzobj_t*)data);
-   }
-}
-
-int buzzneighbors_kin(buzzvm_t vm) {
-   buzzvm_lnum_assert(vm, 0);
+/*
+ * Returns the id of the swarm the current closure runs in, or -1 if it is
+ * not known.
+ */
+static int32_t neighbors_swarmid(buzzvm_t vm) {
    /* Initialize the swarm id to 'unknown' */
    int32_t swarmid = -1;
    /* If the swarm stack is not empty, look for the swarm id */
@@ -219,97 +626,79 @@ int buzzneighbors_kin(buzzvm_t vm) {
                                   buzzdarray_size(vm->swarmstack) - sstackpos,
                                   uint16_t);
    }
-   /* Get the self table */
-   buzzvm_lload(vm, 0);
-   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   /* Get the data table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
-   /* Create a new table as return value */
-   buzzobj_t t;
-   vm->state = make_table(vm, &t);
-   if(vm->state != BUZZVM_STATE_READY) return vm->state;
-   /* If data is available, filter it */
-   if(data->o.type == BUZZTYPE_TABLE) {
-      /* Create a new data table */
-      buzzobj_t kindata = buzzheap_newobj(vm, BUZZTYPE_TABLE);
-      /* Filter the neighbors in data and add them to kindata */
-      struct neighbor_filter_s fdata = { .vm = vm, .swarm_id = swarmid, .result = kindata->t.value };
-      buzzdict_foreach(data->t.value, neighbor_filter_kin, &fdata);
-      /* Add kindata as the POSES field in t */
-      buzzvm_push(vm, t);
-      buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-      buzzvm_push(vm, kindata);
-      buzzvm_tput(vm);
+   return swarmid;
+}
+
+struct neighbor_filter_s {
+   int32_t swarm_id;
+   struct neighbors_sel_s sel;
+};
+
+static void neighbor_filter_kin(buzzvm_t vm,
+                                buzzobj_t rid,
+                                buzzobj_t data,
+                                int64_t pos,
+                                void* params) {
+   struct neighbor_filter_s* fdata = (struct neighbor_filter_s*)params;
+   /*
+    * If no swarm id was specified (<0) OR
+    * It was specified and the robot is in that swarm,
+    * add the robot data to the swarm
+    */
+   if(fdata->swarm_id < 0 ||
+      (fdata->swarm_id >= 0 &&
+       buzzswarm_members_isrobotin(vm->swarmmembers,
+                                   rid->i.value,
+                                   fdata->swarm_id))) {
+      /* Add entry to the selection */
+      neighbors_sel_add(vm, &fdata->sel, rid, data, pos);
    }
-   /* Return the table */
-   buzzvm_push(vm, t);
+}
+
+int buzzneighbors_kin(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 0);
+   struct neighbors_src_s src;
+   neighbors_src(vm, &src);
+   /* Filter the neighbors into a new neighbor structure */
+   struct neighbor_filter_s fdata = { .swarm_id = neighbors_swarmid(vm) };
+   neighbors_sel_new(vm, &src, &fdata.sel);
+   neighbors_each(vm, &src, neighbor_filter_kin, &fdata);
+   /* Return the neighbor structure */
    return buzzvm_ret1(vm);
 }
 
 /****************************************/
 /****************************************/
 
-void neighbor_filter_nonkin(const void* key, void* data, void* params) {
-   buzzobj_t rid = *(buzzobj_t*)key;
+static void neighbor_filter_nonkin(buzzvm_t vm,
+                                   buzzobj_t rid,
+                                   buzzobj_t data,
+                                   int64_t pos,
+                                   void* params) {
    struct neighbor_filter_s* fdata = (struct neighbor_filter_s*)params;
    /*
     * If the robot is in the specified swarm,
     * add the robot data to the swarm
     */
-   if(!buzzswarm_members_isrobotin(fdata->vm->swarmmembers,
+   if(!buzzswarm_members_isrobotin(vm->swarmmembers,
                                    rid->i.value,
                                    fdata->swarm_id)) {
-      /* Add entry to the return table */
-      buzzdict_set(fdata->result, &rid, (buzzobj_t*)data);
+      /* Add entry to the selection */
+      neighbors_sel_add(vm, &fdata->sel, rid, data, pos);
    }
 }
 
 int buzzneighbors_nonkin(buzzvm_t vm) {
    buzzvm_lnum_assert(vm, 0);
-   /* Initialize the swarm id to 'unknown' */
-   int32_t swarmid = -1;
-   /* If the swarm stack is not empty, look for the swarm id */
-   if(!buzzdarray_isempty(vm->swarmstack)) {
-      /* Get position in swarm stack */
-      uint16_t sstackpos = 1;
-      if(buzzdarray_size(vm->lsyms->syms) > 1)
-         sstackpos = buzzdarray_get(vm->lsyms->syms, 1, buzzobj_t)->i.value;
-      /* Get swarm id */
-      if(sstackpos <= buzzdarray_size(vm->swarmstack))
-         swarmid = buzzdarray_get(vm->swarmstack,
-                                  buzzdarray_size(vm->swarmstack) - sstackpos,
-                                  uint16_t);
-   }
-   /* Create a new table as return value */
-   buzzobj_t t;
-   vm->state = make_table(vm, &t);
-   if(vm->state != BUZZVM_STATE_READY) return vm->state;
-   /* If the swarm id is known, continue */
-   if(swarmid >= 0) {
-      /* Get the self table */
-      buzzvm_lload(vm, 0);
-      /* Get the data table */
-      buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-      buzzvm_tget(vm);
-      buzzobj_t data = buzzvm_stack_at(vm, 1);
-      /* If data is available, filter it */
-      if(data->o.type == BUZZTYPE_TABLE) {
-         /* Create a new data table */
-         buzzobj_t nonkindata = buzzheap_newobj(vm, BUZZTYPE_TABLE);
-         /* Filter the neighbors in data and add them to nonkindata */
-         struct neighbor_filter_s fdata = { .vm = vm, .swarm_id = swarmid, .result = nonkindata->t.value };
-         buzzdict_foreach(data->t.value, neighbor_filter_nonkin, &fdata);
-         /* Add nonkindata as the POSES field in t */
-         buzzvm_push(vm, t);
-         buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-         buzzvm_push(vm, nonkindata);
-         buzzvm_tput(vm);
-      }
-   }
-   /* Return the table */
-   buzzvm_push(vm, t);
+   struct neighbors_src_s src;
+   neighbors_src(vm, &src);
+   /* Filter the neighbors into a new neighbor structure */
+   struct neighbor_filter_s fdata = { .swarm_id = neighbors_swarmid(vm) };
+   neighbors_sel_new(vm, &src, &fdata.sel);
+   /* If the swarm id is unknown, there are no non-kin */
+   if(fdata.swarm_id >= 0)
+      neighbors_each(vm, &src, neighbor_filter_nonkin, &fdata);
+   /* Return the neighbor structure */
    return buzzvm_ret1(vm);
 }
 
@@ -318,20 +707,34 @@ int buzzneighbors_nonkin(buzzvm_t vm) {
 
 int buzzneighbors_get(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 1);
-   /* Get self table */
-   buzzvm_lload(vm, 0);
-   /* Get data field */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   if(buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_NIL) {
-      /* No data */
-      buzzvm_pushnil(vm);
+   struct neighbors_src_s src;
+   neighbors_src(vm, &src);
+   if(src.poses) {
+      /* Look for the robot id in the data table */
+      buzzvm_push(vm, src.poses);
+      buzzvm_lload(vm, 1);
+      buzzvm_tget(vm);
    }
    else {
-      /* Get robot id */
+      /* Look for the robot id in the neighbor store */
       buzzvm_lload(vm, 1);
-      /* Get data to return */
-      buzzvm_tget(vm);
+      buzzobj_t rid = buzzvm_stack_at(vm, 1);
+      int64_t i = -1;
+      if(rid->o.type == BUZZTYPE_INT) {
+         if(src.view) {
+            uint32_t j;
+            for(j = 0; j < src.view->size; ++j)
+               if(src.view->id[j] == rid->i.value) {
+                  i = src.view->pos[j];
+                  break;
+               }
+         }
+         else {
+            i = buzzneighbors_store_find(vm->neighbors, rid->i.value);
+         }
+      }
+      if(i >= 0) buzzvm_push(vm, buzzneighbors_data(vm, i));
+      else buzzvm_pushnil(vm);
    }
    /* Return value */
    return buzzvm_ret1(vm);
@@ -340,45 +743,29 @@ int buzzneighbors_get(struct buzzvm_s* vm) {
 /****************************************/
 /****************************************/
 
-struct neighbor_for_each_s {
-   buzzvm_t vm;
-   buzzobj_t closure;
-};
-
-void neighbor_for_each(const void* key, void* data, void* params) {
-   /* Cast params */
-   struct neighbor_for_each_s* d = (struct neighbor_for_each_s*)params;
-   if(d->vm->state != BUZZVM_STATE_READY) return;
+static void neighbor_for_each(buzzvm_t vm,
+                              buzzobj_t rid,
+                              buzzobj_t data,
+                              int64_t pos,
+                              void* params) {
    /* Push closure and params (key and value) */
-   buzzvm_push(d->vm, d->closure);
-   buzzvm_push(d->vm, *(buzzobj_t*)key);
-   buzzvm_push(d->vm, *(buzzobj_t*)data);
+   buzzvm_push(vm, (buzzobj_t)params);
+   buzzvm_push(vm, rid);
+   buzzvm_push(vm, data);
    /* Call closure */
-   d->vm->state = buzzvm_closure_call(d->vm, 2);
+   vm->state = buzzvm_closure_call(vm, 2);
 }
 
 int buzzneighbors_foreach(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 1);
-   /* Get self table */
-   buzzvm_lload(vm, 0);
-   /* Get data field */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
-   if(buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_TABLE) {
-      /* Get closure */
-      buzzvm_lload(vm, 1);
-      buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
-      buzzobj_t closure = buzzvm_stack_at(vm, 1);
-      /* Go through elements */
-      struct neighbor_for_each_s edata = {
-         .vm = vm,
-         .closure = closure
-      };
-      buzzdict_foreach(data->t.value,
-                       neighbor_for_each,
-                       &edata);
-   }
+   struct neighbors_src_s src;
+   neighbors_src(vm, &src);
+   /* Get closure */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
+   buzzobj_t closure = buzzvm_stack_at(vm, 1);
+   /* Go through elements */
+   neighbors_each(vm, &src, neighbor_for_each, closure);
    return buzzvm_ret0(vm);
 }
 
@@ -386,74 +773,58 @@ int buzzneighbors_foreach(struct buzzvm_s* vm) {
 /****************************************/
 
 struct neighbor_map_each_s {
-   buzzvm_t vm;
    buzzobj_t closure;
    buzzdict_t result;
 };
 
-void neighbor_map_each(const void* key, void* data, void* params) {
+static void neighbor_map_each(buzzvm_t vm,
+                              buzzobj_t rid,
+                              buzzobj_t data,
+                              int64_t pos,
+                              void* params) {
    struct neighbor_map_each_s* d = (struct neighbor_map_each_s*)params;
-   if(d->vm->state != BUZZVM_STATE_READY) return;
-   buzzobj_t rid = *(buzzobj_t*)key;
    /* Save current stack size */
-   uint32_t ss = buzzvm_stack_top(d->vm);
+   uint32_t ss = buzzvm_stack_top(vm);
    /* Push closure and params (key, value) */
-   buzzvm_push(d->vm, d->closure);
-   buzzvm_push(d->vm, rid);
-   buzzvm_push(d->vm, *(buzzobj_t*)data);
+   buzzvm_push(vm, d->closure);
+   buzzvm_push(vm, rid);
+   buzzvm_push(vm, data);
    /* Call closure */
-   d->vm->state = buzzvm_closure_call(d->vm, 2);
-   if(d->vm->state != BUZZVM_STATE_READY) return;
+   vm->state = buzzvm_closure_call(vm, 2);
+   if(vm->state != BUZZVM_STATE_READY) return;
    /* Make sure a value was returned */
-   if(buzzvm_stack_top(d->vm) <= ss) {
+   if(buzzvm_stack_top(vm) <= ss) {
       /* Error */
-      buzzvm_seterror(d->vm,
+      buzzvm_seterror(vm,
                       BUZZVM_ERROR_STACK,
                       "neighbors.map(function) expects the function to return a value");
       return;
    }
    /* Add entry to the return table */
-   buzzobj_t retval = buzzvm_stack_at(d->vm, 1);
+   buzzobj_t retval = buzzvm_stack_at(vm, 1);
    buzzdict_set(d->result, &rid, &retval);
    /* Get rid of return value */
-   buzzvm_pop(d->vm);
+   buzzvm_pop(vm);
 }
 
 int buzzneighbors_map(buzzvm_t vm) {
    buzzvm_lnum_assert(vm, 1);
-   /* Get the self table */
-   buzzvm_lload(vm, 0);
-   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   /* Get the data table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
+   struct neighbors_src_s src;
+   neighbors_src(vm, &src);
+   /* Get closure */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
+   buzzobj_t closure = buzzvm_stack_at(vm, 1);
    /* Create a new table as return value and put it on the stack */
-   buzzobj_t t;
-   vm->state = make_table(vm, &t);
-   if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   buzzobj_t mapdata = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   buzzobj_t t = make_table(vm, mapdata);
    buzzvm_push(vm, t);
-   /* If data is available, go through it */
-   if(data->o.type == BUZZTYPE_TABLE) {
-      /* Get closure */
-      buzzvm_lload(vm, 1);
-      buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
-      buzzobj_t closure = buzzvm_stack_at(vm, 1);
-      /* Create a new data table */
-      buzzobj_t mapdata = buzzheap_newobj(vm, BUZZTYPE_TABLE);
-      /* Add mapdata as the POSES field in t */
-      buzzvm_push(vm, t);
-      buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-      buzzvm_push(vm, mapdata);
-      buzzvm_tput(vm);
-      /* Go through the neighbors in data */
-      struct neighbor_map_each_s fdata = {
-         .vm = vm,
-         .closure = closure,
-         .result = mapdata->t.value
-      };
-      buzzdict_foreach(data->t.value, neighbor_map_each, &fdata);
-   }
+   /* Go through the neighbors */
+   struct neighbor_map_each_s fdata = {
+      .closure = closure,
+      .result = mapdata->t.value
+   };
+   neighbors_each(vm, &src, neighbor_map_each, &fdata);
    /* Return the table */
    buzzvm_push(vm, t);
    return buzzvm_ret1(vm);
@@ -462,32 +833,28 @@ int buzzneighbors_map(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
-struct neighbor_reduce_s {
-   buzzvm_t vm;
-   buzzobj_t closure;
-};
-
-void neighbor_reduce(const void* key, void* data, void* params) {
-   /* Cast params */
-   struct neighbor_reduce_s* d = (struct neighbor_reduce_s*)params;
-   if(d->vm->state != BUZZVM_STATE_READY) return;
+static void neighbor_reduce(buzzvm_t vm,
+                            buzzobj_t rid,
+                            buzzobj_t data,
+                            int64_t pos,
+                            void* params) {
    /* Save and pop accumulator from the stack */
-   buzzobj_t accum = buzzvm_stack_at(d->vm, 1);
-   buzzvm_pop(d->vm);
+   buzzobj_t accum = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
    /* Save current stack size */
-   uint32_t ss = buzzvm_stack_top(d->vm);
+   uint32_t ss = buzzvm_stack_top(vm);
    /* Push closure and params (key, value, accumulator) */
-   buzzvm_push(d->vm, d->closure);
-   buzzvm_push(d->vm, *(buzzobj_t*)key);
-   buzzvm_push(d->vm, *(buzzobj_t*)data);
-   buzzvm_push(d->vm, accum);
+   buzzvm_push(vm, (buzzobj_t)params);
+   buzzvm_push(vm, rid);
+   buzzvm_push(vm, data);
+   buzzvm_push(vm, accum);
    /* Call closure - the accumulator is left on the stack */
-   d->vm->state = buzzvm_closure_call(d->vm, 3);
-   if(d->vm->state != BUZZVM_STATE_READY) return;
+   vm->state = buzzvm_closure_call(vm, 3);
+   if(vm->state != BUZZVM_STATE_READY) return;
    /* Make sure a value was returned */
-   if(buzzvm_stack_top(d->vm) <= ss) {
+   if(buzzvm_stack_top(vm) <= ss) {
       /* Error */
-      buzzvm_seterror(d->vm,
+      buzzvm_seterror(vm,
                       BUZZVM_ERROR_STACK,
                       "neighbors.reduce(function) expects the function to return a value");
       return;
@@ -496,33 +863,17 @@ void neighbor_reduce(const void* key, void* data, void* params) {
 
 int buzzneighbors_reduce(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 2);
-   /* Get self table */
-   buzzvm_lload(vm, 0);
-   /* Get data field */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
-   /* Get accumulator */
+   struct neighbors_src_s src;
+   neighbors_src(vm, &src);
+   /* Get closure */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
+   buzzobj_t closure = buzzvm_stack_at(vm, 1);
+   /* Put accumulator on the stack */
    buzzvm_lload(vm, 2);
-   buzzobj_t accum = buzzvm_stack_at(vm, 1);
-   if(data->o.type == BUZZTYPE_TABLE) {
-      /* Get closure */
-      buzzvm_lload(vm, 1);
-      buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
-      buzzobj_t closure = buzzvm_stack_at(vm, 1);
-      /* Put accumulator on the stack */
-      buzzvm_push(vm, accum);
-      /* Go through elements */
-      struct neighbor_reduce_s edata = {
-         .vm = vm,
-         .closure = closure
-      };
-      buzzdict_foreach(data->t.value,
-                       neighbor_reduce,
-                       &edata);
-      /* The final value of the accumulator is on the stack */
-   }
-   /* Return value */
+   /* Go through elements */
+   neighbors_each(vm, &src, neighbor_reduce, closure);
+   /* The final value of the accumulator is on the stack */
    return buzzvm_ret1(vm);
 }
 
@@ -530,100 +881,432 @@ int buzzneighbors_reduce(struct buzzvm_s* vm) {
 /****************************************/
 
 struct neighbor_filter_each_s {
-   buzzvm_t vm;
    buzzobj_t closure;
-   buzzdict_t result;
+   struct neighbors_sel_s sel;
 };
 
-void neighbor_filter_each(const void* key, void* data, void* params) {
+static void neighbor_filter_each(buzzvm_t vm,
+                                 buzzobj_t rid,
+                                 buzzobj_t data,
+                                 int64_t pos,
+                                 void* params) {
    struct neighbor_filter_each_s* d = (struct neighbor_filter_each_s*)params;
-   if(d->vm->state != BUZZVM_STATE_READY) return;
-   buzzobj_t rid = *(buzzobj_t*)key;
    /* Save current stack size */
-   uint32_t ss = buzzvm_stack_top(d->vm);
+   uint32_t ss = buzzvm_stack_top(vm);
    /* Push closure and params (key, value) */
-   buzzvm_push(d->vm, d->closure);
-   buzzvm_push(d->vm, rid);
-   buzzvm_push(d->vm, *(buzzobj_t*)data);
+   buzzvm_push(vm, d->closure);
+   buzzvm_push(vm, rid);
+   buzzvm_push(vm, data);
    /* Call closure */
-   d->vm->state = buzzvm_closure_call(d->vm, 2);
-   if(d->vm->state != BUZZVM_STATE_READY) return;
+   vm->state = buzzvm_closure_call(vm, 2);
+   if(vm->state != BUZZVM_STATE_READY) return;
    /* Make sure a value was returned */
-   if(buzzvm_stack_top(d->vm) <= ss) {
+   if(buzzvm_stack_top(vm) <= ss) {
       /* Error */
-      buzzvm_seterror(d->vm,
+      buzzvm_seterror(vm,
                       BUZZVM_ERROR_STACK,
                       "neighbors.filter(function) expects the function to return a value");
       return;
    }
    /* Check return value */
-   buzzobj_t retval = buzzvm_stack_at(d->vm, 1);
+   buzzobj_t retval = buzzvm_stack_at(vm, 1);
    if(retval->o.type != BUZZTYPE_NIL &&
       (retval->o.type != BUZZTYPE_INT ||
        retval->i.value != 0)) {
-      buzzdict_set(d->result, &rid, data);
+      neighbors_sel_add(vm, &d->sel, rid, data, pos);
    }
    /* Get rid of return value */
-   buzzvm_pop(d->vm);
+   buzzvm_pop(vm);
 }
 
 int buzzneighbors_filter(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 1);
-   /* Get the self table */
-   buzzvm_lload(vm, 0);
-   buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
-   /* Get the data table */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   buzzobj_t data = buzzvm_stack_at(vm, 1);
-   /* Create a new table as return value and put it on the stack */
-   buzzobj_t t;
-   vm->state = make_table(vm, &t);
-   if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   struct neighbors_src_s src;
+   neighbors_src(vm, &src);
+   /* Get closure */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
+   /* Filter the neighbors into a new neighbor structure */
+   struct neighbor_filter_each_s fdata = { .closure = buzzvm_stack_at(vm, 1) };
+   neighbors_sel_new(vm, &src, &fdata.sel);
+   buzzobj_t t = buzzvm_stack_at(vm, 1);
+   neighbors_each(vm, &src, neighbor_filter_each, &fdata);
+   /* Return the neighbor structure */
    buzzvm_push(vm, t);
-   /* If data is available, go through it */
-   if(data->o.type == BUZZTYPE_TABLE) {
-      /* Get closure */
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_count(struct buzzvm_s* vm) {
+   buzzvm_lnum_assert(vm, 0);
+   struct neighbors_src_s src;
+   neighbors_src(vm, &src);
+   buzzvm_pushi(vm, neighbors_src_size(vm, &src));
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * The positions of the neighbors of a neighbor structure, as parallel
+ * arrays. For the whole neighbor store, the arrays are those of the store;
+ * otherwise, they are gathered.
+ */
+struct neighbors_arrays_s {
+   struct neighbors_src_s src;
+   uint32_t size;
+   const float* distance;
+   const float* azimuth;
+   const float* elevation;
+   /* The positions in the store (NULL for the whole store and tables) */
+   const uint32_t* pos;
+   /* The robot ids and data tables (tables only) */
+   buzzobj_t* rid;
+   buzzobj_t* data;
+   /* Gathered positions */
+   float* buf;
+};
+
+static void neighbors_gather(buzzvm_t vm,
+                             buzzobj_t rid,
+                             buzzobj_t data,
+                             int64_t pos,
+                             void* params) {
+   struct neighbors_arrays_s* a = (struct neighbors_arrays_s*)params;
+   /* Skip the neighbors without position, such as those made by map() */
+   if(data->o.type != BUZZTYPE_TABLE) return;
+   buzzobj_t d = buzztable_sget(vm, data, "distance");
+   buzzobj_t az = buzztable_sget(vm, data, "azimuth");
+   buzzobj_t el = buzztable_sget(vm, data, "elevation");
+   if(!d || !buzzobj_isnumber(d) || !az || !buzzobj_isnumber(az)) return;
+   uint32_t n = a->size++;
+   a->buf[3 * n]     = buzzobj_tofloat(vm, d);
+   a->buf[3 * n + 1] = buzzobj_tofloat(vm, az);
+   a->buf[3 * n + 2] = el && buzzobj_isnumber(el) ? buzzobj_tofloat(vm, el) : 0.0f;
+   a->rid[n] = rid;
+   a->data[n] = data;
+}
+
+/*
+ * Gets the positions of the neighbors of the neighbor structure passed as
+ * self. Release the arrays with neighbors_arrays_done().
+ */
+static void neighbors_arrays(buzzvm_t vm,
+                             struct neighbors_arrays_s* a) {
+   memset(a, 0, sizeof(struct neighbors_arrays_s));
+   neighbors_src(vm, &a->src);
+   buzzneighbors_store_t s = vm->neighbors;
+   uint32_t i;
+   if(a->src.view) {
+      /* Gather the positions of the neighbors in the view */
+      struct neighbors_view_s* v = a->src.view;
+      a->size = v->size;
+      a->pos  = v->pos;
+      a->buf  = (float*)malloc(3 * v->size * sizeof(float) + 1);
+      for(i = 0; i < v->size; ++i) {
+         a->buf[i]               = s->distance[v->pos[i]];
+         a->buf[v->size + i]     = s->azimuth[v->pos[i]];
+         a->buf[2 * v->size + i] = s->elevation[v->pos[i]];
+      }
+      a->distance  = a->buf;
+      a->azimuth   = a->buf + v->size;
+      a->elevation = a->buf + 2 * v->size;
+      return;
+   }
+   if(!a->src.poses) {
+      a->size      = s->size;
+      a->distance  = s->distance;
+      a->azimuth   = s->azimuth;
+      a->elevation = s->elevation;
+      return;
+   }
+   /* Gather the positions as [ distance, azimuth, elevation ] triplets */
+   uint32_t n = buzzdict_size(a->src.poses->t.value);
+   if(n == 0) return;
+   a->buf  = (float*)malloc(3 * n * sizeof(float));
+   a->rid  = (buzzobj_t*)malloc(n * sizeof(buzzobj_t));
+   a->data = (buzzobj_t*)malloc(n * sizeof(buzzobj_t));
+   neighbors_each(vm, &a->src, neighbors_gather, a);
+   /* Split the triplets into arrays */
+   float* d = (float*)malloc(3 * a->size * sizeof(float) + 1);
+   for(i = 0; i < a->size; ++i) {
+      d[i]               = a->buf[3 * i];
+      d[a->size + i]     = a->buf[3 * i + 1];
+      d[2 * a->size + i] = a->buf[3 * i + 2];
+   }
+   free(a->buf);
+   a->buf       = d;
+   a->distance  = d;
+   a->azimuth   = d + a->size;
+   a->elevation = d + 2 * a->size;
+}
+
+static void neighbors_arrays_done(struct neighbors_arrays_s* a) {
+   free(a->buf);
+   free(a->rid);
+   free(a->data);
+}
+
+/*
+ * Adds the i-th neighbor of the arrays to a selection.
+ */
+static void neighbors_arrays_select(buzzvm_t vm,
+                                    struct neighbors_arrays_s* a,
+                                    struct neighbors_sel_s* sel,
+                                    uint32_t i) {
+   if(a->rid) neighbors_sel_add(vm, sel, a->rid[i], a->data[i], -1);
+   else neighbors_sel_add(vm, sel, NULL, NULL, a->pos ? a->pos[i] : i);
+}
+
+/*
+ * Returns the indices of the neighbors of the arrays sorted by distance.
+ * Free the result with free().
+ */
+static uint32_t* neighbors_arrays_sorted(buzzvm_t vm,
+                                         struct neighbors_arrays_s* a) {
+   uint32_t* idx = (uint32_t*)malloc(a->size * sizeof(uint32_t) + 1);
+   if(!a->src.poses && !a->src.view) {
+      /* The neighbor store keeps its neighbors sorted */
+      memcpy(idx, buzzneighbors_store_order(vm->neighbors), a->size * sizeof(uint32_t));
+   }
+   else {
+      uint32_t i;
+      for(i = 0; i < a->size; ++i) idx[i] = i;
+      neighbors_sort(a->distance, idx, a->size);
+   }
+   return idx;
+}
+
+/*
+ * Returns a new table with the given x, y and, if z is not NULL, z.
+ */
+static buzzobj_t neighbors_vector(buzzvm_t vm,
+                                  float x,
+                                  float y,
+                                  const float* z) {
+   buzzobj_t t = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   buzztable_sset_float(vm, t, "x", x);
+   buzztable_sset_float(vm, t, "y", y);
+   if(z) buzztable_sset_float(vm, t, "z", *z);
+   return t;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_vecsum(buzzvm_t vm) {
+   if(buzzvm_lnum(vm) > 1) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "neighbors.vecsum(): expected 0 or 1 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   /* Get the exponent of the distance */
+   float e = 1.0f;
+   if(buzzvm_lnum(vm) == 1) {
       buzzvm_lload(vm, 1);
-      buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
-      buzzobj_t closure = buzzvm_stack_at(vm, 1);
-      /* Create a new data table */
-      buzzobj_t mapdata = buzzheap_newobj(vm, BUZZTYPE_TABLE);
-      /* Add mapdata as the POSES field in t */
-      buzzvm_push(vm, t);
-      buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-      buzzvm_push(vm, mapdata);
-      buzzvm_tput(vm);
-      /* Go through the neighbors in data */
-      struct neighbor_map_each_s fdata = {
-         .vm = vm,
-         .closure = closure,
-         .result = mapdata->t.value
-      };
-      buzzdict_foreach(data->t.value, neighbor_filter_each, &fdata);
+      buzzvm_type_assert_number(vm, 1);
+      e = buzzobj_tofloat(vm, buzzvm_stack_at(vm, 1));
    }
-   /* Return the table */
-   buzzvm_push(vm, t);
+   struct neighbors_arrays_s a;
+   neighbors_arrays(vm, &a);
+   float x = 0.0f, y = 0.0f;
+   uint32_t i;
+   if(e == 1.0f) {
+      for(i = 0; i < a.size; ++i) {
+         x += a.distance[i] * cosf(a.azimuth[i]);
+         y += a.distance[i] * sinf(a.azimuth[i]);
+      }
+   }
+   else {
+      for(i = 0; i < a.size; ++i) {
+         /* Negative exponents are undefined at distance zero */
+         if(a.distance[i] <= 0.0f && e < 0.0f) continue;
+         float m = powf(a.distance[i], e);
+         x += m * cosf(a.azimuth[i]);
+         y += m * sinf(a.azimuth[i]);
+      }
+   }
+   neighbors_arrays_done(&a);
+   buzzvm_push(vm, neighbors_vector(vm, x, y, NULL));
    return buzzvm_ret1(vm);
 }
 
 /****************************************/
 /****************************************/
 
-int buzzneighbors_count(struct buzzvm_s* vm) {
+int buzzneighbors_lennard_jones(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   /* Get the target distance and the depth of the well */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert_number(vm, 1);
+   float target = buzzobj_tofloat(vm, buzzvm_stack_at(vm, 1));
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert_number(vm, 1);
+   float epsilon = buzzobj_tofloat(vm, buzzvm_stack_at(vm, 1));
+   struct neighbors_arrays_s a;
+   neighbors_arrays(vm, &a);
+   float x = 0.0f, y = 0.0f;
+   uint32_t i;
+   for(i = 0; i < a.size; ++i) {
+      if(a.distance[i] <= 0.0f) continue;
+      float r = target / a.distance[i];
+      float r2 = r * r;
+      float m = -(epsilon / a.distance[i]) * (r2 * r2 - r2);
+      x += m * cosf(a.azimuth[i]);
+      y += m * sinf(a.azimuth[i]);
+   }
+   neighbors_arrays_done(&a);
+   buzzvm_push(vm, neighbors_vector(vm, x, y, NULL));
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_centroid(buzzvm_t vm) {
    buzzvm_lnum_assert(vm, 0);
-   /* Get self table */
-   buzzvm_lload(vm, 0);
-   /* Get data field */
-   buzzvm_pushs(vm, buzzvm_string_register(vm, POSES, 1));
-   buzzvm_tget(vm);
-   int32_t count = 0;
-   if(buzzvm_stack_at(vm, 1)->o.type != BUZZTYPE_NIL) {
-      count = buzzdarray_size(buzzvm_stack_at(vm, 1)->t.value);
+   struct neighbors_arrays_s a;
+   neighbors_arrays(vm, &a);
+   float x = 0.0f, y = 0.0f, z = 0.0f;
+   uint32_t i;
+   for(i = 0; i < a.size; ++i) {
+      float dxy = a.distance[i] * cosf(a.elevation[i]);
+      x += dxy * cosf(a.azimuth[i]);
+      y += dxy * sinf(a.azimuth[i]);
+      z += a.distance[i] * sinf(a.elevation[i]);
    }
+   if(a.size > 0) {
+      x /= a.size;
+      y /= a.size;
+      z /= a.size;
+   }
+   neighbors_arrays_done(&a);
+   buzzvm_push(vm, neighbors_vector(vm, x, y, &z));
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_count_within(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert_number(vm, 1);
+   float r = buzzobj_tofloat(vm, buzzvm_stack_at(vm, 1));
+   struct neighbors_arrays_s a;
+   neighbors_arrays(vm, &a);
+   int32_t count = 0;
+   uint32_t i;
+   for(i = 0; i < a.size; ++i)
+      count += a.distance[i] <= r;
+   neighbors_arrays_done(&a);
    buzzvm_pushi(vm, count);
    return buzzvm_ret1(vm);
 }
 
 /****************************************/
 /****************************************/
+
+int buzzneighbors_nearest(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   int32_t k = buzzvm_stack_at(vm, 1)->i.value;
+   struct neighbors_arrays_s a;
+   neighbors_arrays(vm, &a);
+   if(k < 0) k = 0;
+   if((uint32_t)k > a.size) k = a.size;
+   /* Select the first k neighbors by distance */
+   uint32_t* idx = neighbors_arrays_sorted(vm, &a);
+   struct neighbors_sel_s sel;
+   neighbors_sel_new(vm, &a.src, &sel);
+   int32_t i;
+   for(i = 0; i < k; ++i)
+      neighbors_arrays_select(vm, &a, &sel, idx[i]);
+   free(idx);
+   neighbors_arrays_done(&a);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_within(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 1);
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert_number(vm, 1);
+   float r = buzzobj_tofloat(vm, buzzvm_stack_at(vm, 1));
+   struct neighbors_arrays_s a;
+   neighbors_arrays(vm, &a);
+   struct neighbors_sel_s sel;
+   neighbors_sel_new(vm, &a.src, &sel);
+   uint32_t i;
+   for(i = 0; i < a.size; ++i)
+      if(a.distance[i] <= r)
+         neighbors_arrays_select(vm, &a, &sel, i);
+   neighbors_arrays_done(&a);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the given angle in [0,2pi).
+ */
+static float neighbors_angle(float a) {
+   a = fmodf(a, 2.0f * (float)M_PI);
+   if(a < 0.0f) a += 2.0f * (float)M_PI;
+   return a;
+}
+
+int buzzneighbors_sector(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert_number(vm, 1);
+   float amin = buzzobj_tofloat(vm, buzzvm_stack_at(vm, 1));
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert_number(vm, 1);
+   float amax = buzzobj_tofloat(vm, buzzvm_stack_at(vm, 1));
+   /* The width of the sector, going counterclockwise from amin; a span
+    * of 2pi or more is the full circle */
+   int full = amax - amin >= 2.0f * (float)M_PI;
+   float span = neighbors_angle(amax - amin);
+   struct neighbors_arrays_s a;
+   neighbors_arrays(vm, &a);
+   struct neighbors_sel_s sel;
+   neighbors_sel_new(vm, &a.src, &sel);
+   uint32_t i;
+   for(i = 0; i < a.size; ++i) {
+      if(full || neighbors_angle(a.azimuth[i] - amin) <= span)
+         neighbors_arrays_select(vm, &a, &sel, i);
+   }
+   neighbors_arrays_done(&a);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzneighbors_sorted_by_distance(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 0);
+   struct neighbors_arrays_s a;
+   neighbors_arrays(vm, &a);
+   uint32_t* idx = neighbors_arrays_sorted(vm, &a);
+   struct neighbors_sel_s sel;
+   neighbors_sel_new(vm, &a.src, &sel);
+   uint32_t i;
+   for(i = 0; i < a.size; ++i)
+      neighbors_arrays_select(vm, &a, &sel, idx[i]);
+   free(idx);
+   neighbors_arrays_done(&a);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
@@ -2,6 +2,7 @@
 #define BUZZNEIGHBORS_H
 
 #include <buzz/buzzdict.h>
+#include <buzz/buzztype.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -13,6 +14,85 @@ extern "C" {
     */
    struct buzzvm_s;
 
+   /*
+    * The neighbors of the current step, stored as parallel arrays.
+    * The Buzz table with the data of a neighbor is made only when a script
+    * asks for it, and kept until the neighbor is updated or reset.
+    */
+   struct buzzneighbors_store_s {
+      /* The number of neighbors */
+      uint32_t size;
+      /* The allocated size of the arrays */
+      uint32_t capacity;
+      /* The robot ids */
+      uint16_t* id;
+      /* The distances */
+      float* distance;
+      /* The angles on the XY plane */
+      float* azimuth;
+      /* The angles between the XY plane and the robots */
+      float* elevation;
+      /* The steps since the last reading */
+      uint32_t* age;
+      /* The data tables (NULL until requested) */
+      buzzobj_t* data;
+      /* The positions of the neighbors sorted by distance */
+      uint32_t* order;
+      /* Whether order is up to date */
+      int sorted;
+      /* Incremented whenever the neighbors change */
+      uint32_t epoch;
+      /* The string ids of the fields of the data tables */
+      uint16_t sdistance;
+      uint16_t sazimuth;
+      uint16_t selevation;
+      /* The methods of the neighbor structures, as names (string objects)
+       * and positions in the function list */
+      buzzobj_t* mname;
+      uint32_t* mfun;
+      uint32_t nmethods;
+   };
+   typedef struct buzzneighbors_store_s* buzzneighbors_store_t;
+
+   /*
+    * Creates an empty neighbor store.
+    * @return A new neighbor store.
+    */
+   extern buzzneighbors_store_t buzzneighbors_store_new();
+
+   /*
+    * Destroys a neighbor store.
+    * @param s The neighbor store.
+    */
+   extern void buzzneighbors_store_destroy(buzzneighbors_store_t* s);
+
+   /*
+    * Returns the position of a robot in a neighbor store.
+    * @param s The neighbor store.
+    * @param robot The id of the robot.
+    * @return The position of the robot, or -1 if the robot is not a neighbor.
+    */
+   extern int64_t buzzneighbors_store_find(buzzneighbors_store_t s,
+                                           uint16_t robot);
+
+   /*
+    * Returns the positions of the neighbors sorted by distance.
+    * The order is computed once after every change of the neighbors.
+    * @param s The neighbor store.
+    * @return The positions of the neighbors, nearest first.
+    */
+   extern const uint32_t* buzzneighbors_store_order(buzzneighbors_store_t s);
+
+   /*
+    * Returns the data table of a neighbor, making it if necessary.
+    * The table contains the distance, azimuth and elevation.
+    * @param vm The Buzz VM data.
+    * @param i The position of the neighbor in the store.
+    * @return The data table.
+    */
+   extern buzzobj_t buzzneighbors_data(struct buzzvm_s* vm,
+                                       uint32_t i);
+
    /*
     * Creates the neighbor structure.
     * Add new neighbor data with buzzneighbor_add().
@@ -46,7 +126,20 @@ extern "C" {
                                 float distance,
                                 float azimuth,
                                 float elevation);
-   
+
+   /*
+    * Ages the neighbors by one step and forgets those not updated for more
+    * than the given number of steps.
+    * Use it instead of buzzneighbors_reset() to keep neighbors whose
+    * readings are occasionally lost.
+    * @param vm The Buzz VM data.
+    * @param maxage The maximum age of a neighbor, in steps.
+    * @return The updated VM state.
+    * @see buzzneighbor_add()
+    */
+   extern int buzzneighbors_age(struct buzzvm_s* vm,
+                                uint32_t maxage);
+
    /*
     * Broadcasts a value across the neighbors.
     * @param vm The Buzz VM data.
@@ -54,6 +147,21 @@ extern "C" {
     */
    extern int buzzneighbors_broadcast(struct buzzvm_s* vm);
 
+   /*
+    * Sets the priority of a broadcast topic.
+    * Messages on topics with higher priority are sent first.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_broadcast_priority(struct buzzvm_s* vm);
+
+   /*
+    * Sets whether a broadcast topic sends every value or only the latest.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_broadcast_mode(struct buzzvm_s* vm);
+
    /*
     * Installs a listener for a value across the neighbors.
     * @param vm The Buzz VM data.
@@ -124,6 +232,73 @@ extern "C" {
     */
    extern int buzzneighbors_count(struct buzzvm_s* vm);
 
+   /*
+    * Pushes the sum of the vectors to the neighbors on the XY plane, as a
+    * table with x and y.
+    * The optional argument is the exponent k of the distance: each vector
+    * has length distance^k (1 by default, 0 for unit vectors).
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_vecsum(struct buzzvm_s* vm);
+
+   /*
+    * Pushes the sum of the Lennard-Jones interactions with the neighbors on
+    * the XY plane, as a table with x and y.
+    * The arguments are the target distance and the depth of the well.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_lennard_jones(struct buzzvm_s* vm);
+
+   /*
+    * Pushes the average position of the neighbors, as a table with x, y
+    * and z.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_centroid(struct buzzvm_s* vm);
+
+   /*
+    * Pushes the number of neighbors within the given distance.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_count_within(struct buzzvm_s* vm);
+
+   /*
+    * Pushes a neighbor structure with the k nearest neighbors, nearest
+    * first.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_nearest(struct buzzvm_s* vm);
+
+   /*
+    * Pushes a neighbor structure with the neighbors within the given
+    * distance.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_within(struct buzzvm_s* vm);
+
+   /*
+    * Pushes a neighbor structure with the neighbors whose azimuth is
+    * between the given angles, going counterclockwise.
+    * A sector that spans 2pi or more is the full circle.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_sector(struct buzzvm_s* vm);
+
+   /*
+    * Pushes a neighbor structure with the neighbors sorted by distance,
+    * nearest first.
+    * @param vm The Buzz VM data.
+    * @return The updated VM state.
+    */
+   extern int buzzneighbors_sorted_by_distance(struct buzzvm_s* vm);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,18 +5,24 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <math.h>
-#include <string.h>
 
 /****************************************/
 /****************************************/
 
+/*
+ * Messages are serialized when they are queued. The payload of a message
+ * is stored in the common header; the rest of the message data is only
+ * what is necessary to manage duplicates.
+ */
+
 /*
  * Broadcast message data
  */
 struct buzzoutmsg_broadcast_s {
    int type;
-   buzzobj_t topic;
-   buzzobj_t value;
+   buzzmsg_payload_t pl;
+   int32_t prio;
+   uint16_t topic;
 };
 
 /*
@@ -24,18 +30,36 @@ struct buzzoutmsg_broadcast_s {
  */
 struct buzzoutmsg_swarm_s {
    int type;
+   buzzmsg_payload_t pl;
    uint16_t* ids;
    uint16_t size;
+   uint16_t version;
+   uint32_t hash;
 };
 
 /*
  * Virtual stigmergy message data
+ * The serialized key starts at BUZZOUTMSG_VSTIG_KEYPOS in the payload.
  */
 struct buzzoutmsg_vstig_s {
    int type;
+   buzzmsg_payload_t pl;
+   uint16_t id;
+   uint16_t timestamp;
+   uint32_t keyhash;
+   uint32_t keylen;
+};
+
+/*
+ * Virtual stigmergy anti-entropy message data
+ */
+struct buzzoutmsg_vsync_s {
+   int type;
+   buzzmsg_payload_t pl;
    uint16_t id;
-   buzzobj_t key;
-   buzzvstig_elem_t data;
+   uint16_t robot;
+   uint16_t node;
+   uint8_t level;
 };
 
 /*
@@ -43,41 +67,68 @@ struct buzzoutmsg_vstig_s {
  */
 union buzzoutmsg_u {
    int type;
+   struct {
+      int type;
+      buzzmsg_payload_t pl;
+   } hd;
    struct buzzoutmsg_broadcast_s bc;
    struct buzzoutmsg_swarm_s     sw;
    struct buzzoutmsg_vstig_s     vs;
+   struct buzzoutmsg_vsync_s     sy;
 };
 typedef union buzzoutmsg_u* buzzoutmsg_t;
 
+/*
+ * Scaling factor for the virtual time of the fair scheduler
+ */
+#define BUZZOUTMSG_VTIME_SCALE 1024
+
+/*
+ * Position of the key in a serialized vstig message (type + vstig id)
+ */
+#define BUZZOUTMSG_VSTIG_KEYPOS 3
+
+/*
+ * Maximum number of payload buffers kept for reuse
+ */
+#define BUZZOUTMSG_POOL_MAX 64
+
 /****************************************/
 /****************************************/
 
-uint32_t buzzoutmsg_obj_hash(const void* key) {
-   return buzzobj_hash(*(buzzobj_t*)key);
+uint32_t buzzoutmsg_vstig_keyhash(const void* key) {
+   return (*(buzzoutmsg_t*)key)->vs.keyhash;
 }
 
-int buzzoutmsg_obj_cmp(const void* a, const void* b) {
-   return buzzobj_cmp(*(const buzzobj_t*)a, *(const buzzobj_t*)b);
+int buzzoutmsg_vstig_keycmp(const void* a, const void* b) {
+   const struct buzzoutmsg_vstig_s* ma = &(*(buzzoutmsg_t*)a)->vs;
+   const struct buzzoutmsg_vstig_s* mb = &(*(buzzoutmsg_t*)b)->vs;
+   if(ma->keylen < mb->keylen) return -1;
+   if(ma->keylen > mb->keylen) return  1;
+   return memcmp((uint8_t*)ma->pl->data + BUZZOUTMSG_VSTIG_KEYPOS,
+                 (uint8_t*)mb->pl->data + BUZZOUTMSG_VSTIG_KEYPOS,
+                 ma->keylen);
 }
 
 void buzzoutmsg_destroy(uint32_t pos, void* data, void* params) {
    buzzoutmsg_t m = *(buzzoutmsg_t*)data;
    switch(m->type) {
-      case BUZZMSG_BROADCAST:
-         break;
       case BUZZMSG_SWARM_JOIN:
       case BUZZMSG_SWARM_LEAVE:
       case BUZZMSG_SWARM_LIST:
-         if(m->sw.size > 0) free(m->sw.ids);
-         break;
-      case BUZZMSG_VSTIG_PUT:
-      case BUZZMSG_VSTIG_QUERY:
-         free(m->vs.data);
+      case BUZZMSG_SWARM_HEARTBEAT:
+      case BUZZMSG_SWARM_REQUEST:
+         free(m->sw.ids);
          break;
    }
+   if(m->hd.pl) buzzmsg_payload_destroy(&m->hd.pl);
    free(m);
 }
 
+void buzzoutmsg_payload_destroy(uint32_t pos, void* data, void* params) {
+   buzzmsg_payload_destroy((buzzmsg_payload_t*)data);
+}
+
 void buzzoutmsg_vstig_destroy(const void* key, void* data, void* params) {
    free((void*)key);
    buzzdict_destroy((buzzdict_t*)data);
@@ -93,6 +144,45 @@ int buzzoutmsg_vstig_cmp(const void* a, const void* b) {
 /****************************************/
 /****************************************/
 
+static buzzmsg_payload_t buzzoutmsg_payload_alloc(buzzvm_t vm) {
+   buzzdarray_t pool = vm->outmsgs->pool;
+   /* Reuse a buffer if possible */
+   if(!buzzdarray_isempty(pool)) {
+      buzzmsg_payload_t m = buzzdarray_last(pool, buzzmsg_payload_t);
+      --pool->size;
+      return m;
+   }
+   return buzzmsg_payload_new(16);
+}
+
+void buzzoutmsg_queue_recycle(buzzvm_t vm,
+                              buzzmsg_payload_t* m) {
+   if(!*m) return;
+   if(buzzdarray_size(vm->outmsgs->pool) < BUZZOUTMSG_POOL_MAX) {
+      /* Empty the buffer, keeping its memory */
+      (*m)->size = 0;
+      buzzdarray_push(vm->outmsgs->pool, m);
+   }
+   else {
+      buzzmsg_payload_destroy(m);
+   }
+   *m = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzoutmsg_queue_remove(buzzvm_t vm,
+                                    int type,
+                                    uint32_t idx) {
+   buzzoutmsg_t m = buzzdarray_get(vm->outmsgs->queues[type], idx, buzzoutmsg_t);
+   buzzoutmsg_queue_recycle(vm, &m->hd.pl);
+   buzzdarray_remove(vm->outmsgs->queues[type], idx);
+}
+
+/****************************************/
+/****************************************/
+
 buzzoutmsg_queue_t buzzoutmsg_queue_new() {
    buzzoutmsg_queue_t q = (buzzoutmsg_queue_t)malloc(sizeof(struct buzzoutmsg_queue_s));
    q->queues[BUZZMSG_BROADCAST]   = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
@@ -101,12 +191,40 @@ buzzoutmsg_queue_t buzzoutmsg_queue_new() {
    q->queues[BUZZMSG_SWARM_LEAVE] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
    q->queues[BUZZMSG_VSTIG_PUT]   = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
    q->queues[BUZZMSG_VSTIG_QUERY] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_VSTIG_DIGEST]  = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_VSTIG_REQUEST] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_SWARM_HEARTBEAT] = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
+   q->queues[BUZZMSG_SWARM_REQUEST]   = buzzdarray_new(1, sizeof(buzzoutmsg_t), buzzoutmsg_destroy);
    q->vstig = buzzdict_new(10,
                            sizeof(uint16_t),
                            sizeof(buzzdict_t),
                            buzzdict_uint16keyhash,
                            buzzdict_uint16keycmp,
                            buzzoutmsg_vstig_destroy);
+   q->topics = buzzdict_new(10,
+                            sizeof(uint16_t),
+                            sizeof(struct buzzoutmsg_topic_s),
+                            buzzdict_uint16keyhash,
+                            buzzdict_uint16keycmp,
+                            NULL);
+   q->bcast = buzzdict_new(10,
+                           sizeof(uint16_t),
+                           sizeof(buzzoutmsg_t),
+                           buzzdict_uint16keyhash,
+                           buzzdict_uint16keycmp,
+                           NULL);
+   q->pool = buzzdarray_new(BUZZOUTMSG_POOL_MAX,
+                            sizeof(buzzmsg_payload_t),
+                            buzzoutmsg_payload_destroy);
+   /* All classes get the same share and no rate limit by default */
+   int i;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      memset(&q->classes[i], 0, sizeof(struct buzzoutmsg_class_s));
+      q->classes[i].weight = 1;
+   }
+   q->vclock = 0;
+   q->mtu = 0;
+   q->sched = buzzoutmsg_sched_fair;
    return q;
 }
 
@@ -120,13 +238,115 @@ void buzzoutmsg_queue_destroy(buzzoutmsg_queue_t* msgq) {
    buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_LEAVE]));
    buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_PUT]));
    buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_QUERY]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_DIGEST]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_VSTIG_REQUEST]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_HEARTBEAT]));
+   buzzdarray_destroy(&((*msgq)->queues[BUZZMSG_SWARM_REQUEST]));
    buzzdict_destroy(&((*msgq)->vstig));
+   buzzdict_destroy(&((*msgq)->topics));
+   buzzdict_destroy(&((*msgq)->bcast));
+   buzzdarray_destroy(&((*msgq)->pool));
    free(*msgq);
 }
 
 /****************************************/
 /****************************************/
 
+/*
+ * Data to rebuild the indices of a cloned queue
+ */
+struct buzzoutmsg_clone_s {
+   /* Original message -> cloned message */
+   buzzdict_t msgs;
+   /* The index being rebuilt */
+   buzzdict_t dst;
+};
+
+static buzzoutmsg_t buzzoutmsg_clone_msg(const buzzoutmsg_t m) {
+   buzzoutmsg_t x = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   memcpy(x, m, sizeof(union buzzoutmsg_u));
+   if(m->hd.pl) x->hd.pl = buzzdarray_clone(m->hd.pl);
+   switch(m->type) {
+      case BUZZMSG_SWARM_JOIN:
+      case BUZZMSG_SWARM_LEAVE:
+      case BUZZMSG_SWARM_LIST:
+      case BUZZMSG_SWARM_HEARTBEAT:
+      case BUZZMSG_SWARM_REQUEST:
+         if(m->sw.ids) {
+            x->sw.ids = (uint16_t*)malloc((m->sw.size ? m->sw.size : 1) * sizeof(uint16_t));
+            memcpy(x->sw.ids, m->sw.ids, m->sw.size * sizeof(uint16_t));
+         }
+         break;
+   }
+   return x;
+}
+
+static void buzzoutmsg_clone_topic(const void* key, void* data, void* params) {
+   buzzdict_set((buzzdict_t)params, key, data);
+}
+
+static void buzzoutmsg_clone_bcast(const void* key, void* data, void* params) {
+   struct buzzoutmsg_clone_s* c = (struct buzzoutmsg_clone_s*)params;
+   buzzdict_set(c->dst, key, buzzdict_rawget(c->msgs, data));
+}
+
+static void buzzoutmsg_clone_vstigmsg(const void* key, void* data, void* params) {
+   struct buzzoutmsg_clone_s* c = (struct buzzoutmsg_clone_s*)params;
+   const buzzoutmsg_t* m = buzzdict_get(c->msgs, data, buzzoutmsg_t);
+   buzzdict_set(c->dst, m, m);
+}
+
+static void buzzoutmsg_clone_vstig(const void* key, void* data, void* params) {
+   struct buzzoutmsg_clone_s* c = (struct buzzoutmsg_clone_s*)params;
+   buzzdict_t orig = *(buzzdict_t*)data;
+   buzzdict_t vs = buzzdict_new(orig->num_buckets,
+                                sizeof(buzzoutmsg_t),
+                                sizeof(buzzoutmsg_t),
+                                buzzoutmsg_vstig_keyhash,
+                                buzzoutmsg_vstig_keycmp,
+                                NULL);
+   struct buzzoutmsg_clone_s cv = { .msgs = c->msgs, .dst = vs };
+   buzzdict_foreach(orig, buzzoutmsg_clone_vstigmsg, &cv);
+   buzzdict_set(c->dst, key, &vs);
+}
+
+buzzoutmsg_queue_t buzzoutmsg_queue_clone(buzzoutmsg_queue_t msgq) {
+   buzzoutmsg_queue_t q = buzzoutmsg_queue_new();
+   struct buzzoutmsg_clone_s c;
+   c.msgs = buzzdict_new(16,
+                         sizeof(buzzoutmsg_t),
+                         sizeof(buzzoutmsg_t),
+                         buzzdict_ptrkeyhash,
+                         buzzdict_ptrkeycmp,
+                         NULL);
+   /* Copy the queued messages, keeping track of the copies */
+   uint32_t i, j;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      for(j = 0; j < buzzdarray_size(msgq->queues[i]); ++j) {
+         buzzoutmsg_t m = buzzdarray_get(msgq->queues[i], j, buzzoutmsg_t);
+         buzzoutmsg_t x = buzzoutmsg_clone_msg(m);
+         buzzdarray_push(q->queues[i], &x);
+         buzzdict_set(c.msgs, &m, &x);
+      }
+   }
+   /* Rebuild the indices on the copies */
+   buzzdict_foreach(msgq->topics, buzzoutmsg_clone_topic, q->topics);
+   c.dst = q->bcast;
+   buzzdict_foreach(msgq->bcast, buzzoutmsg_clone_bcast, &c);
+   c.dst = q->vstig;
+   buzzdict_foreach(msgq->vstig, buzzoutmsg_clone_vstig, &c);
+   buzzdict_destroy(&c.msgs);
+   /* Copy the scheduler state */
+   memcpy(q->classes, msgq->classes, sizeof(q->classes));
+   q->vclock = msgq->vclock;
+   q->mtu = msgq->mtu;
+   q->sched = msgq->sched;
+   return q;
+}
+
+/****************************************/
+/****************************************/
+
 uint32_t buzzoutmsg_queue_size(buzzvm_t vm) {
    return
       buzzdarray_size(vm->outmsgs->queues[BUZZMSG_BROADCAST]) +
@@ -134,7 +354,11 @@ uint32_t buzzoutmsg_queue_size(buzzvm_t vm) {
       buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN]) +
       buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE]) +
       buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT]) +
-      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY]);
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_DIGEST]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_VSTIG_REQUEST]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_HEARTBEAT]) +
+      buzzdarray_size(vm->outmsgs->queues[BUZZMSG_SWARM_REQUEST]);
 }
 
 /****************************************/
@@ -143,13 +367,40 @@ uint32_t buzzoutmsg_queue_size(buzzvm_t vm) {
 void buzzoutmsg_queue_append_broadcast(buzzvm_t vm,
                                        buzzobj_t topic,
                                        buzzobj_t value) {
+   /* Get the topic settings */
+   uint16_t sid = topic->s.value.sid;
+   const struct buzzoutmsg_topic_s* t = buzzdict_get(vm->outmsgs->topics,
+                                                     &sid,
+                                                     struct buzzoutmsg_topic_s);
+   if(t && t->latest) {
+      /* Latest-only topic; is a message already queued? */
+      const buzzoutmsg_t* e = buzzdict_get(vm->outmsgs->bcast, &sid, buzzoutmsg_t);
+      if(e) {
+         /* Yes, replace its value and keep its position */
+         (*e)->bc.pl->size = 0;
+         buzzmsg_serialize_u8((*e)->bc.pl, BUZZMSG_BROADCAST);
+         buzzobj_serialize((*e)->bc.pl, topic);
+         buzzobj_serialize((*e)->bc.pl, value);
+         return;
+      }
+   }
    /* Make a new BROADCAST message */
    buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
    m->bc.type = BUZZMSG_BROADCAST;
-   m->bc.topic = buzzheap_clone(vm, topic);
-   m->bc.value = buzzheap_clone(vm, value);
-   /* Queue it */
-   buzzdarray_push(vm->outmsgs->queues[BUZZMSG_BROADCAST], &m);   
+   m->bc.pl = buzzoutmsg_payload_alloc(vm);
+   m->bc.topic = sid;
+   m->bc.prio = t ? t->prio : 0;
+   buzzmsg_serialize_u8(m->bc.pl, BUZZMSG_BROADCAST);
+   buzzobj_serialize(m->bc.pl, topic);
+   buzzobj_serialize(m->bc.pl, value);
+   /* Queue it after the messages with the same or higher priority */
+   buzzdarray_t q = vm->outmsgs->queues[BUZZMSG_BROADCAST];
+   int64_t i = buzzdarray_size(q);
+   while(i > 0 && buzzdarray_get(q, i-1, buzzoutmsg_t)->bc.prio < m->bc.prio)
+      --i;
+   buzzdarray_insert(q, i, &m);
+   /* Keep track of the message for coalescing */
+   if(t && t->latest) buzzdict_set(vm->outmsgs->bcast, &sid, &m);
 }
 
 /****************************************/
@@ -179,16 +430,40 @@ void dict_to_array(const void* key, void* data, void* params) {
    }
 }
 
+static void buzzoutmsg_swarm_serialize(buzzvm_t vm,
+                                       buzzoutmsg_t m) {
+   uint16_t i;
+   if(m->sw.pl) m->sw.pl->size = 0;
+   else m->sw.pl = buzzoutmsg_payload_alloc(vm);
+   buzzmsg_serialize_u8(m->sw.pl, m->sw.type);
+   if(m->sw.type == BUZZMSG_SWARM_LIST) {
+      buzzmsg_serialize_u16(m->sw.pl, m->sw.version);
+      buzzmsg_serialize_u16(m->sw.pl, m->sw.size);
+      for(i = 0; i < m->sw.size; ++i) {
+         buzzmsg_serialize_u16(m->sw.pl, m->sw.ids[i]);
+      }
+   }
+   else if(m->sw.type == BUZZMSG_SWARM_HEARTBEAT) {
+      buzzmsg_serialize_u16(m->sw.pl, m->sw.version);
+      buzzmsg_serialize_u32(m->sw.pl, m->sw.hash);
+   }
+   else {
+      buzzmsg_serialize_u16(m->sw.pl, m->sw.ids[0]);
+   }
+}
+
 void buzzoutmsg_queue_append_swarm_list(buzzvm_t vm,
-                                        const buzzdict_t ids) {
+                                        const buzzdict_t ids,
+                                        uint16_t version) {
    /* Invariants:
     * - Only one list message can be queued at any time;
     * - If a list message is already queued, join/leave messages are not
     */
-   /* Delete every existing SWARM related message */
+   /* Delete every existing SWARM related message, the list supersedes them */
    buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], 1);
    buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN], 1);
    buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], 1);
+   buzzdarray_clear(vm->outmsgs->queues[BUZZMSG_SWARM_HEARTBEAT], 1);
    /* Make an array of current swarm id dictionary */
    struct dict_to_array_s da = {
       .count = 0,
@@ -199,10 +474,13 @@ void buzzoutmsg_queue_append_swarm_list(buzzvm_t vm,
    /* Make a new LIST message */
    buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
    m->sw.type = BUZZMSG_SWARM_LIST;
+   m->sw.pl = NULL;
+   m->sw.version = version;
    m->sw.size = da.count;
    m->sw.ids = (uint16_t*)malloc(m->sw.size * sizeof(uint16_t));
    memcpy(m->sw.ids, da.data, m->sw.size * sizeof(uint16_t));
    free(da.data);
+   buzzoutmsg_swarm_serialize(vm, m);
    /* Queue the new LIST message */
    buzzdarray_push(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], &m);
 }
@@ -210,47 +488,35 @@ void buzzoutmsg_queue_append_swarm_list(buzzvm_t vm,
 /****************************************/
 /****************************************/
 
-static void append_to_swarm_queue(buzzdarray_t q, uint16_t id, int type) {
-   /* Is the queue empty? */
-   if(buzzdarray_isempty(q)) {
-      /* Yes, add the element at the end */
-      buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
-      m->sw.type = type;
-      m->sw.size = 1;
-      m->sw.ids = (uint16_t*)malloc(sizeof(uint16_t));
-      m->sw.ids[0] = id;
-      buzzdarray_push(q, &m);
-   }
-   else {
-      /* Queue not empty - look for a message with the same id */
-      int found = 0;
-      uint32_t i;
-      for(i = 0; i < buzzdarray_size(q) && !found; ++i) {
-         found = buzzdarray_get(q, i, buzzoutmsg_t)->sw.ids[0] == id;
-      }
-      /* Message found? */
-      if(!found) {
-         /* No, append a new message the passed id */
-         buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
-         m->sw.type = type;
-         m->sw.size = 1;
-         m->sw.ids = (uint16_t*)malloc(sizeof(uint16_t));
-         m->sw.ids[0] = id;
-         buzzdarray_push(q, &m);
-      }
+static void append_to_swarm_queue(buzzvm_t vm, uint16_t id, int type) {
+   buzzdarray_t q = vm->outmsgs->queues[type];
+   /* Look for a message with the same id */
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(q); ++i) {
+      if(buzzdarray_get(q, i, buzzoutmsg_t)->sw.ids[0] == id) return;
    }
+   /* Not found, append a new message with the passed id */
+   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   m->sw.type = type;
+   m->sw.pl = NULL;
+   m->sw.size = 1;
+   m->sw.ids = (uint16_t*)malloc(sizeof(uint16_t));
+   m->sw.ids[0] = id;
+   buzzoutmsg_swarm_serialize(vm, m);
+   buzzdarray_push(q, &m);
 }
 
-static void remove_from_swarm_queue(buzzdarray_t q, uint16_t id) {
-   /* Is the queue empty? If so, nothing to do */
-   if(buzzdarray_isempty(q)) return;
-   /* Queue not empty - look for a message with the same id */
+static void remove_from_swarm_queue(buzzvm_t vm, uint16_t id, int type) {
+   buzzdarray_t q = vm->outmsgs->queues[type];
+   /* Look for a message with the same id */
    uint32_t i;
    for(i = 0; i < buzzdarray_size(q); ++i) {
-      if(buzzdarray_get(q, i, buzzoutmsg_t)->sw.ids[0] == id) break;
+      if(buzzdarray_get(q, i, buzzoutmsg_t)->sw.ids[0] == id) {
+         /* Message found, remove it */
+         buzzoutmsg_queue_remove(vm, type, i);
+         return;
+      }
    }
-   /* Message found? If so, remove it */
-   if(i < buzzdarray_size(q)) buzzdarray_remove(q, i);
 }
 
 void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
@@ -274,6 +540,7 @@ void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
             /* Yes: remove it from the list */
             --(l->sw.size);
             memmove(l->sw.ids+i, l->sw.ids+i+1, (l->sw.size-i) * sizeof(uint16_t));
+            buzzoutmsg_swarm_serialize(vm, l);
          }
          /* If the message is a JOIN, there's nothing to do */
       }
@@ -284,6 +551,7 @@ void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
             ++(l->sw.size);
             l->sw.ids = realloc(l->sw.ids, l->sw.size * sizeof(uint16_t));
             l->sw.ids[l->sw.size-1] = id;
+            buzzoutmsg_swarm_serialize(vm, l);
          }
          /* If the message is a LEAVE, there's nothing to do */
       }
@@ -292,15 +560,15 @@ void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
       /* No LIST message present - send an individual message */
       if(type == BUZZMSG_SWARM_JOIN) {
          /* Look for a duplicate in the JOIN queue - if not add one  */
-         append_to_swarm_queue(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN], id, BUZZMSG_SWARM_JOIN);
+         append_to_swarm_queue(vm, id, BUZZMSG_SWARM_JOIN);
          /* Look for an entry in the LEAVE queue and remove it  */
-         remove_from_swarm_queue(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], id);
+         remove_from_swarm_queue(vm, id, BUZZMSG_SWARM_LEAVE);
       }
       else if(type == BUZZMSG_SWARM_LEAVE) {
          /* Look for an entry in the JOIN queue and remove it */
-         remove_from_swarm_queue(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN], id);
+         remove_from_swarm_queue(vm, id, BUZZMSG_SWARM_JOIN);
          /* Look for a duplicate in the LEAVE queue - if not add one  */
-         append_to_swarm_queue(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], id, BUZZMSG_SWARM_LEAVE);
+         append_to_swarm_queue(vm, id, BUZZMSG_SWARM_LEAVE);
       }
    }
 }
@@ -308,211 +576,454 @@ void buzzoutmsg_queue_append_swarm_joinleave(buzzvm_t vm,
 /****************************************/
 /****************************************/
 
-void buzzoutmsg_queue_append_vstig(buzzvm_t vm,
-                                   int type,
-                                   uint16_t id,
-                                   const buzzobj_t key,
-                                   const buzzvstig_elem_t data) {
-   /* Look for a duplicate message in the dictionary */
-   const struct buzzoutmsg_vstig_s** e = NULL;
+void buzzoutmsg_queue_append_swarm_heartbeat(buzzvm_t vm,
+                                             uint16_t version,
+                                             uint32_t hash) {
+   /* A queued list says more than a heartbeat */
+   if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LIST])) return;
+   /* A queued heartbeat is refreshed in place */
+   buzzoutmsg_t m;
+   if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_HEARTBEAT])) {
+      m = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_HEARTBEAT], 0, buzzoutmsg_t);
+   }
+   else {
+      m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+      m->sw.type = BUZZMSG_SWARM_HEARTBEAT;
+      m->sw.pl = NULL;
+      m->sw.ids = NULL;
+      m->sw.size = 0;
+      buzzdarray_push(vm->outmsgs->queues[BUZZMSG_SWARM_HEARTBEAT], &m);
+   }
+   m->sw.version = version;
+   m->sw.hash = hash;
+   buzzoutmsg_swarm_serialize(vm, m);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_append_swarm_request(buzzvm_t vm,
+                                           uint16_t robot) {
+   /* Duplicate requests are discarded */
+   append_to_swarm_queue(vm, robot, BUZZMSG_SWARM_REQUEST);
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzoutmsg_queue_append_vstig(buzzvm_t vm,
+                                       int type,
+                                       uint16_t id,
+                                       const buzzobj_t key,
+                                       const buzzvstig_elem_t data) {
+   /* Create a new message */
+   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   m->vs.type = type;
+   m->vs.pl = buzzoutmsg_payload_alloc(vm);
+   m->vs.id = id;
+   m->vs.timestamp = data->timestamp;
+   /* Serialize it, taking note of where the key is */
+   buzzmsg_serialize_u8(m->vs.pl, type);
+   buzzmsg_serialize_u16(m->vs.pl, id);
+   buzzvstig_elem_serialize(m->vs.pl, key, data);
+   buzzmsg_payload_t k = buzzoutmsg_payload_alloc(vm);
+   buzzobj_serialize(k, key);
+   m->vs.keylen = buzzmsg_payload_size(k);
+   buzzoutmsg_queue_recycle(vm, &k);
+   /* FNV-1a hash of the serialized key */
+   uint32_t i;
+   m->vs.keyhash = 2166136261u;
+   for(i = 0; i < m->vs.keylen; ++i) {
+      m->vs.keyhash ^= buzzmsg_payload_get(m->vs.pl, BUZZOUTMSG_VSTIG_KEYPOS + i);
+      m->vs.keyhash *= 16777619u;
+   }
    /* Virtual stigmergy to actually use */
    buzzdict_t vs = NULL;
    /* Look for the virtual stigmergy */
    const buzzdict_t* tvs = buzzdict_get(vm->outmsgs->vstig, &id, buzzdict_t);
    if(tvs) {
-      /* Virtual stigmergy found, look for the key */
       vs = *tvs;
-      e = buzzdict_get(vs, &key, struct buzzoutmsg_vstig_s*);
    }
    else {
       /* Virtual stigmergy not found, create it */
       vs = buzzdict_new(10,
-                        sizeof(buzzobj_t),
-                        sizeof(struct buzzoutmsg_vstig_s*),
-                        buzzoutmsg_obj_hash,
-                        buzzoutmsg_obj_cmp,
+                        sizeof(buzzoutmsg_t),
+                        sizeof(buzzoutmsg_t),
+                        buzzoutmsg_vstig_keyhash,
+                        buzzoutmsg_vstig_keycmp,
                         NULL);
       buzzdict_set(vm->outmsgs->vstig, &id, &vs);
    }
-   /* Do we have a more recent duplicate? */
-   int etype = -1, eidx = -1; /* No message to remove from the queue */
+   /* Look for a duplicate message in the dictionary */
+   const buzzoutmsg_t* e = buzzdict_get(vs, &m, buzzoutmsg_t);
    if(e) {
-      /* Yes; if the duplicate is newer than the passed message, nothing to do */
-      if((*e)->data->timestamp >= data->timestamp) return;
-      /* The duplicate is older, store data to remove it later */
-      etype = (*e)->type;
-      eidx = buzzdarray_find(vm->outmsgs->queues[etype], buzzoutmsg_vstig_cmp, e);
-   }
-   /* Create a new message */
-   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
-   m->vs.type = type;
-   m->vs.id = id;
-   m->vs.key = buzzheap_clone(vm, key);
-   m->vs.data = buzzvstig_elem_clone(vm, data);
-   /* Update the dictionary - this also invalidates e */
-   buzzdict_set(vs, &m->vs.key, &m);
-   if(etype > -1) {
-      /* Remove the entry from the queue */
-      buzzdarray_remove(vm->outmsgs->queues[etype], eidx);
+      /* If the duplicate is newer than the passed message, nothing to do */
+      if((*e)->vs.timestamp >= m->vs.timestamp) {
+         buzzoutmsg_queue_recycle(vm, &m->vs.pl);
+         free(m);
+         return 0;
+      }
+      /* The duplicate is older, remove it */
+      buzzoutmsg_t o = *e;
+      buzzdict_remove(vs, &m);
+      buzzoutmsg_queue_remove(
+         vm,
+         o->type,
+         buzzdarray_find(vm->outmsgs->queues[o->type], buzzoutmsg_vstig_cmp, &o));
    }
+   /* Update the dictionary */
+   buzzdict_set(vs, &m, &m);
    /* Add a new message to the queue */
    buzzdarray_push(vm->outmsgs->queues[type], &m);
+   return buzzmsg_payload_size(m->vs.pl);
 }
 
 /****************************************/
 /****************************************/
 
-buzzmsg_payload_t buzzoutmsg_queue_first(buzzvm_t vm) {
-   if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_BROADCAST])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_BROADCAST],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_BROADCAST);
-      buzzobj_serialize(m, f->bc.topic);
-      buzzobj_serialize(m, f->bc.value);
-      /* Return message */
-      return m;
+static buzzoutmsg_t buzzoutmsg_vsync_find(buzzvm_t vm,
+                                          int type,
+                                          uint16_t id,
+                                          uint16_t robot,
+                                          uint8_t level,
+                                          uint16_t node) {
+   buzzdarray_t q = vm->outmsgs->queues[type];
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(q); ++i) {
+      buzzoutmsg_t m = buzzdarray_get(q, i, buzzoutmsg_t);
+      if(m->sy.id == id && m->sy.robot == robot &&
+         m->sy.level == level && m->sy.node == node)
+         return m;
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LIST])) {
-      uint16_t i;
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_LIST],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_SWARM_LIST);
-      buzzmsg_serialize_u16(m, f->sw.size);
-      for(i = 0; i < f->sw.size; ++i) {
-         buzzmsg_serialize_u16(m, f->sw.ids[i]);
-      }
-      /* Return message */
-      return m;      
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_PUT);
-      buzzmsg_serialize_u16(m, f->vs.id);
-      buzzvstig_elem_serialize(m, f->vs.key, f->vs.data);
-      /* Return message */
-      return m;
+   return NULL;
+}
+
+uint32_t buzzoutmsg_queue_append_vstig_digest(buzzvm_t vm,
+                                              uint16_t id,
+                                              uint8_t level,
+                                              uint16_t node,
+                                              const uint32_t* hashes,
+                                              const uint16_t* counts) {
+   /* A queued digest of the same node is refreshed in place */
+   buzzoutmsg_t m = buzzoutmsg_vsync_find(vm, BUZZMSG_VSTIG_DIGEST,
+                                          id, vm->robot, level, node);
+   uint32_t sz = 0;
+   if(m) {
+      sz = buzzmsg_payload_size(m->sy.pl);
+      m->sy.pl->size = 0;
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(10);
-      buzzmsg_serialize_u8(m, BUZZMSG_VSTIG_QUERY);
-      buzzmsg_serialize_u16(m, f->vs.id);
-      buzzvstig_elem_serialize(m, f->vs.key, f->vs.data);
-      /* Return message */
-      return m;
+   else {
+      m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+      m->sy.type = BUZZMSG_VSTIG_DIGEST;
+      m->sy.pl = buzzoutmsg_payload_alloc(vm);
+      m->sy.id = id;
+      m->sy.robot = vm->robot;
+      m->sy.level = level;
+      m->sy.node = node;
+      buzzdarray_push(vm->outmsgs->queues[BUZZMSG_VSTIG_DIGEST], &m);
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(5);
-      buzzmsg_serialize_u8(m, BUZZMSG_SWARM_JOIN);
-      buzzmsg_serialize_u16(m, f->sw.ids[0]);
-      /* Return message */
-      return m;      
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE],
-                                      0, buzzoutmsg_t);
-      /* Make a new message */
-      buzzmsg_payload_t m = buzzmsg_payload_new(5);
-      buzzmsg_serialize_u8(m, BUZZMSG_SWARM_LEAVE);
-      buzzmsg_serialize_u16(m, f->sw.ids[0]);
-      /* Return message */
-      return m;      
-   }
-   /* Empty queue */
-   return NULL;
+   /* Serialize the digest */
+   buzzmsg_serialize_u8(m->sy.pl, BUZZMSG_VSTIG_DIGEST);
+   buzzmsg_serialize_u16(m->sy.pl, id);
+   buzzmsg_serialize_u8(m->sy.pl, level);
+   buzzmsg_serialize_u16(m->sy.pl, node);
+   int i;
+   for(i = 0; i < BUZZVSTIG_SYNC_FANOUT; ++i) {
+      buzzmsg_serialize_u32(m->sy.pl, hashes[i]);
+      buzzmsg_serialize_u16(m->sy.pl, counts[i]);
+   }
+   /* Refreshed digests cost nothing more */
+   return sz ? 0 : buzzmsg_payload_size(m->sy.pl);
 }
 
 /****************************************/
 /****************************************/
 
-void buzzoutmsg_queue_next(buzzvm_t vm) {
-   if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_BROADCAST])) {
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_BROADCAST], 0);
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LIST])) {
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_SWARM_LIST], 0);
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT],
-                                      0, buzzoutmsg_t);
-      /* Remove the element in the vstig dictionary */
-      buzzdict_remove(
-         *buzzdict_get(vm->outmsgs->vstig, &f->vs.id, buzzdict_t),
-         &f->vs.key);
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT], 0);
-   }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY])) {
-      /* Take the first message in the queue */
-      buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY],
-                                      0, buzzoutmsg_t);
+uint32_t buzzoutmsg_queue_append_vstig_request(buzzvm_t vm,
+                                               uint16_t id,
+                                               uint16_t robot,
+                                               uint8_t level,
+                                               uint16_t node) {
+   /* Nothing to do if the same request is already queued */
+   if(buzzoutmsg_vsync_find(vm, BUZZMSG_VSTIG_REQUEST,
+                            id, robot, level, node))
+      return 0;
+   buzzoutmsg_t m = (buzzoutmsg_t)malloc(sizeof(union buzzoutmsg_u));
+   m->sy.type = BUZZMSG_VSTIG_REQUEST;
+   m->sy.pl = buzzoutmsg_payload_alloc(vm);
+   m->sy.id = id;
+   m->sy.robot = robot;
+   m->sy.level = level;
+   m->sy.node = node;
+   buzzmsg_serialize_u8(m->sy.pl, BUZZMSG_VSTIG_REQUEST);
+   buzzmsg_serialize_u16(m->sy.pl, id);
+   buzzmsg_serialize_u16(m->sy.pl, robot);
+   buzzmsg_serialize_u8(m->sy.pl, level);
+   buzzmsg_serialize_u16(m->sy.pl, node);
+   buzzdarray_push(vm->outmsgs->queues[BUZZMSG_VSTIG_REQUEST], &m);
+   return buzzmsg_payload_size(m->sy.pl);
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzoutmsg_queue_head_size(buzzvm_t vm,
+                                    int type) {
+   if(buzzdarray_isempty(vm->outmsgs->queues[type])) return 0;
+   return buzzmsg_payload_size(
+      buzzdarray_get(vm->outmsgs->queues[type], 0, buzzoutmsg_t)->hd.pl);
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzoutmsg_queue_remove_head(buzzvm_t vm,
+                                         int type,
+                                         buzzmsg_payload_t* pl) {
+   buzzoutmsg_t f = buzzdarray_get(vm->outmsgs->queues[type],
+                                   0, buzzoutmsg_t);
+   if(type == BUZZMSG_BROADCAST) {
+      /* Stop coalescing on the message */
+      const buzzoutmsg_t* e = buzzdict_get(vm->outmsgs->bcast,
+                                           &f->bc.topic,
+                                           buzzoutmsg_t);
+      if(e && *e == f)
+         buzzdict_remove(vm->outmsgs->bcast, &f->bc.topic);
+   }
+   else if(type == BUZZMSG_VSTIG_PUT || type == BUZZMSG_VSTIG_QUERY) {
       /* Remove the element in the vstig dictionary */
       buzzdict_remove(
          *buzzdict_get(vm->outmsgs->vstig, &f->vs.id, buzzdict_t),
-         &f->vs.key);
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY], 0);
+         &f);
+   }
+   /* Hand out the payload if requested */
+   if(pl) {
+      *pl = f->hd.pl;
+      f->hd.pl = NULL;
+   }
+   /* Remove the first message in the queue */
+   buzzoutmsg_queue_remove(vm, type, 0);
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzoutmsg_queue_drop_oversize(buzzvm_t vm) {
+   if(vm->outmsgs->mtu == 0) return;
+   int i;
+   uint32_t sz;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      while((sz = buzzoutmsg_queue_head_size(vm, i)) > vm->outmsgs->mtu) {
+         fprintf(stderr, "[WARNING] [ROBOT %u] Discarded oversize message (%u bytes). Max size is %u bytes.\n", vm->robot, sz, vm->outmsgs->mtu);
+         ++vm->outmsgs->classes[i].dropped;
+         buzzoutmsg_queue_remove_head(vm, i, NULL);
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+static int buzzoutmsg_class_ready(buzzvm_t vm,
+                                  int type,
+                                  uint32_t sz) {
+   const struct buzzoutmsg_class_s* c = vm->outmsgs->classes + type;
+   /* Empty queue? */
+   if(sz == 0) return 0;
+   /* No rate limit? */
+   if(c->rate == 0) return 1;
+   /* A message larger than the bucket is sent when the bucket is full */
+   return c->tokens >= (sz < c->burst ? sz : c->burst);
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzoutmsg_class_account(buzzvm_t vm,
+                                     int type,
+                                     uint32_t sz) {
+   struct buzzoutmsg_class_s* c = vm->outmsgs->classes + type;
+   /* Consume tokens */
+   if(c->rate > 0)
+      c->tokens = (c->tokens > sz) ? (c->tokens - sz) : 0;
+   /* Advance virtual time */
+   uint64_t start = (c->vtime > vm->outmsgs->vclock) ? c->vtime : vm->outmsgs->vclock;
+   vm->outmsgs->vclock = start;
+   c->vtime = start + (uint64_t)sz * BUZZOUTMSG_VTIME_SCALE / c->weight;
+   /* Update statistics */
+   c->sent_bytes += sz;
+   ++c->sent_msgs;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzoutmsg_sched_fair(buzzvm_t vm,
+                          uint32_t avail) {
+   int i;
+   /* Most entitled class, regardless of the available space */
+   int fair = -1;
+   uint64_t fairstart = 0;
+   /* Largest message that fits the available space */
+   int fit = -1;
+   uint32_t fitsz = 0;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      uint32_t sz = buzzoutmsg_queue_head_size(vm, i);
+      if(!buzzoutmsg_class_ready(vm, i, sz)) continue;
+      /* Start tag of the message */
+      uint64_t start = vm->outmsgs->classes[i].vtime;
+      if(start < vm->outmsgs->vclock) start = vm->outmsgs->vclock;
+      if(fair < 0 || start < fairstart) {
+         fair = i;
+         fairstart = start;
+      }
+      if(sz <= avail && sz > fitsz) {
+         fit = i;
+         fitsz = sz;
+      }
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN])) {
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_SWARM_JOIN], 0);
+   /* Prefer the most entitled class, otherwise fill the frame */
+   if(fair >= 0 && buzzoutmsg_queue_head_size(vm, fair) <= avail)
+      return fair;
+   return fit;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzoutmsg_sched_fixed(buzzvm_t vm,
+                           uint32_t avail) {
+   int i;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      uint32_t sz = buzzoutmsg_queue_head_size(vm, i);
+      if(buzzoutmsg_class_ready(vm, i, sz) && sz <= avail)
+         return i;
    }
-   else if(!buzzdarray_isempty(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE])) {
-      /* Remove the first message in the queue */
-      buzzdarray_remove(vm->outmsgs->queues[BUZZMSG_SWARM_LEAVE], 0);
+   return -1;
+}
+
+/****************************************/
+/****************************************/
+
+buzzmsg_payload_t buzzoutmsg_queue_first(buzzvm_t vm) {
+   buzzoutmsg_queue_drop_oversize(vm);
+   int type = vm->outmsgs->sched(vm, UINT32_MAX);
+   if(type < 0) return NULL;
+   return buzzdarray_clone(
+      buzzdarray_get(vm->outmsgs->queues[type], 0, buzzoutmsg_t)->hd.pl);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_next(buzzvm_t vm) {
+   buzzoutmsg_queue_drop_oversize(vm);
+   int type = vm->outmsgs->sched(vm, UINT32_MAX);
+   if(type < 0) return;
+   buzzoutmsg_class_account(vm, type, buzzoutmsg_queue_head_size(vm, type));
+   buzzoutmsg_queue_remove_head(vm, type, NULL);
+}
+
+/****************************************/
+/****************************************/
+
+buzzmsg_payload_t buzzoutmsg_queue_pop(buzzvm_t vm,
+                                       uint32_t avail) {
+   buzzoutmsg_queue_drop_oversize(vm);
+   int type = vm->outmsgs->sched(vm, avail);
+   if(type < 0) return NULL;
+   /* Take ownership of the serialized message */
+   buzzmsg_payload_t m;
+   buzzoutmsg_class_account(vm, type, buzzoutmsg_queue_head_size(vm, type));
+   buzzoutmsg_queue_remove_head(vm, type, &m);
+   return m;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_refill(buzzvm_t vm) {
+   int i;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i) {
+      struct buzzoutmsg_class_s* c = vm->outmsgs->classes + i;
+      if(c->rate == 0) continue;
+      c->tokens += c->rate;
+      if(c->tokens > c->burst) c->tokens = c->burst;
    }
 }
 
 /****************************************/
 /****************************************/
 
-void buzzoutmsg_broadcast_mark(uint32_t pos, void* data, void* params) {
-   struct buzzoutmsg_broadcast_s* msg = *(struct buzzoutmsg_broadcast_s**)data;
-   buzzvm_t vm = (buzzvm_t)params;
-   buzzheap_obj_mark(msg->topic, vm);
-   buzzheap_obj_mark(msg->value, vm);
+void buzzoutmsg_queue_set_sched(buzzvm_t vm,
+                                buzzoutmsg_sched_t sched) {
+   vm->outmsgs->sched = sched ? sched : buzzoutmsg_sched_fair;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_set_weight(buzzvm_t vm,
+                                 int type,
+                                 uint32_t weight) {
+   vm->outmsgs->classes[type].weight = weight > 0 ? weight : 1;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_set_rate(buzzvm_t vm,
+                               int type,
+                               uint32_t rate,
+                               uint32_t burst) {
+   struct buzzoutmsg_class_s* c = vm->outmsgs->classes + type;
+   c->rate = rate;
+   c->burst = burst > rate ? burst : rate;
+   c->tokens = c->burst;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_set_mtu(buzzvm_t vm,
+                              uint32_t mtu) {
+   vm->outmsgs->mtu = mtu;
+}
+
+/****************************************/
+/****************************************/
+
+static struct buzzoutmsg_topic_s* buzzoutmsg_topic(buzzvm_t vm,
+                                                  uint16_t topic) {
+   const struct buzzoutmsg_topic_s* t = buzzdict_get(vm->outmsgs->topics,
+                                                     &topic,
+                                                     struct buzzoutmsg_topic_s);
+   if(!t) {
+      /* Add default settings */
+      struct buzzoutmsg_topic_s d = { .prio = 0, .latest = 0 };
+      buzzdict_set(vm->outmsgs->topics, &topic, &d);
+      t = buzzdict_get(vm->outmsgs->topics, &topic, struct buzzoutmsg_topic_s);
+   }
+   return (struct buzzoutmsg_topic_s*)t;
 }
 
-void buzzoutmsg_vstig_mark(uint32_t pos, void* data, void* params) {
-   struct buzzoutmsg_vstig_s* msg = *(struct buzzoutmsg_vstig_s**)data;
-   buzzvm_t vm = (buzzvm_t)params;
-   buzzheap_vstigobj_mark(&msg->key, &msg->data, vm);
+void buzzoutmsg_queue_set_priority(buzzvm_t vm,
+                                   uint16_t topic,
+                                   int32_t prio) {
+   buzzoutmsg_topic(vm, topic)->prio = prio;
 }
 
-void buzzoutmsg_gc(struct buzzvm_s* vm) {
-   /* Go through all the broadcast topic strings and mark them */
-   buzzdarray_foreach(vm->outmsgs->queues[BUZZMSG_BROADCAST],
-                      buzzoutmsg_broadcast_mark,
-                      vm);
-   /* Go through all the vstig keys and values and mark them */
-   buzzdarray_foreach(vm->outmsgs->queues[BUZZMSG_VSTIG_PUT],
-                      buzzoutmsg_vstig_mark,
-                      vm);
-   buzzdarray_foreach(vm->outmsgs->queues[BUZZMSG_VSTIG_QUERY],
-                      buzzoutmsg_vstig_mark,
-                      vm);
+/****************************************/
+/****************************************/
+
+void buzzoutmsg_queue_set_latest(buzzvm_t vm,
+                                 uint16_t topic,
+                                 int latest) {
+   buzzoutmsg_topic(vm, topic)->latest = (latest != 0);
+   /* Messages queued from now on are independent */
+   if(!latest) buzzdict_remove(vm->outmsgs->bcast, &topic);
 }
 
 /****************************************/
 /****************************************/
+
@@ -11,6 +11,49 @@ struct buzzvm_s;
 extern "C" {
 #endif
 
+   /*
+    * Outgoing message scheduler.
+    * A scheduler picks the message class (a BUZZMSG_* type) whose first
+    * message must be sent next.
+    * @param vm The Buzz VM.
+    * @param avail The space left in the current frame, in bytes.
+    * @return The chosen message class, or -1 if nothing can be sent.
+    */
+   typedef int (*buzzoutmsg_sched_t)(struct buzzvm_s* vm,
+                                     uint32_t avail);
+
+   /*
+    * Scheduling data of a message class.
+    */
+   struct buzzoutmsg_class_s {
+      /* Relative share of the bandwidth (must be > 0) */
+      uint32_t weight;
+      /* Token bucket refill, in bytes per step (0 means unlimited) */
+      uint32_t rate;
+      /* Token bucket depth, in bytes */
+      uint32_t burst;
+      /* Tokens currently available, in bytes */
+      uint32_t tokens;
+      /* Virtual finish time of the last message sent */
+      uint64_t vtime;
+      /* Total bytes sent for this class */
+      uint64_t sent_bytes;
+      /* Total messages sent for this class */
+      uint32_t sent_msgs;
+      /* Total messages dropped because larger than the MTU */
+      uint32_t dropped;
+   };
+
+   /*
+    * Broadcast settings of a topic.
+    */
+   struct buzzoutmsg_topic_s {
+      /* Priority of the topic (higher is sent first) */
+      int32_t prio;
+      /* Whether only the latest queued value is kept */
+      uint8_t latest;
+   };
+
    /*
     * Data of a Buzz message queue.
     */
@@ -19,6 +62,20 @@ extern "C" {
       buzzdarray_t queues[BUZZMSG_TYPE_COUNT];
       /* Vstig message dict for fast duplicate management */
       buzzdict_t vstig;
+      /* Broadcast topic settings (string id -> struct buzzoutmsg_topic_s) */
+      buzzdict_t topics;
+      /* Queued latest-only broadcasts for fast coalescing (string id -> message) */
+      buzzdict_t bcast;
+      /* Empty payload buffers kept for reuse */
+      buzzdarray_t pool;
+      /* Scheduling data for each message type */
+      struct buzzoutmsg_class_s classes[BUZZMSG_TYPE_COUNT];
+      /* Virtual clock of the fair scheduler */
+      uint64_t vclock;
+      /* Largest message that can be sent, in bytes (0 means unlimited) */
+      uint32_t mtu;
+      /* The active scheduler */
+      buzzoutmsg_sched_t sched;
    };
    typedef struct buzzoutmsg_queue_s* buzzoutmsg_queue_t;
 
@@ -34,6 +91,15 @@ extern "C" {
     */
    extern void buzzoutmsg_queue_destroy(buzzoutmsg_queue_t* msgq);
 
+   /*
+    * Clones a message queue.
+    * The queued messages, the topic settings and the scheduler state are
+    * copied; the buffers kept for reuse are not.
+    * @param msgq The message queue.
+    * @return A new message queue.
+    */
+   extern buzzoutmsg_queue_t buzzoutmsg_queue_clone(buzzoutmsg_queue_t msgq);
+
    /*
     * Returns the size of a message queue.
     * @param vm The Buzz VM.
@@ -43,6 +109,8 @@ extern "C" {
 
    /*
     * Appends a new broadcast message.
+    * If the topic is latest-only and a message on it is already queued,
+    * the queued value is replaced in place instead.
     * @param vm The Buzz VM.
     * @param topic The topic on which to send (a string object)
     * @param value The value.
@@ -53,11 +121,34 @@ extern "C" {
 
    /*
     * Appends a new swarm list message.
+    * The list replaces any queued swarm message.
     * @param vm The Buzz VM.
     * @param ids A list of swarm ids in which the robot is a member.
+    * @param version The membership version.
     */
    extern void buzzoutmsg_queue_append_swarm_list(struct buzzvm_s* vm,
-                                                  const buzzdict_t ids);
+                                                  const buzzdict_t ids,
+                                                  uint16_t version);
+
+   /*
+    * Appends a new swarm heartbeat message.
+    * A queued heartbeat is updated. Nothing is queued if a swarm list is.
+    * @param vm The Buzz VM.
+    * @param version The membership version.
+    * @param hash The hash of the swarms in which the robot is a member.
+    */
+   extern void buzzoutmsg_queue_append_swarm_heartbeat(struct buzzvm_s* vm,
+                                                       uint16_t version,
+                                                       uint32_t hash);
+
+   /*
+    * Appends a new swarm list request message.
+    * Duplicate requests are discarded.
+    * @param vm The Buzz VM.
+    * @param robot The robot whose swarm list is requested.
+    */
+   extern void buzzoutmsg_queue_append_swarm_request(struct buzzvm_s* vm,
+                                                     uint16_t robot);
    
    /*
     * Appends a new swarm join/leave message.
@@ -71,26 +162,67 @@ extern "C" {
 
    /*
     * Appends a new virtual stigmergy message.
-    * The ownership of the payload is assumed by the message queue. Make sure
-    * the payload is in the heap.
+    * The message is serialized immediately, so the queue keeps no
+    * reference to the passed key and data.
     * @param vm The Buzz VM.
     * @param type The message type (BUZZMSG_VSTIG_PUT or BUZZMSG_VSTIG_QUERY)
     * @param id The id of the virtual stigmergy.
     * @param key The key.
     * @param data The data of the entry.
+    * @return The size of the queued message, or 0 if a newer one was queued.
+    */
+   extern uint32_t buzzoutmsg_queue_append_vstig(struct buzzvm_s* vm,
+                                                 int type,
+                                                 uint16_t id,
+                                                 const buzzobj_t key,
+                                                 const buzzvstig_elem_t data);
+
+   /*
+    * Appends a new virtual stigmergy digest message.
+    * The digest carries the hashes and the entry counts of the children
+    * of a node in the anti-entropy tree. A queued digest of the same node
+    * is updated.
+    * @param vm The Buzz VM.
+    * @param id The id of the virtual stigmergy.
+    * @param level The level of the node.
+    * @param node The index of the node in its level.
+    * @param hashes The BUZZVSTIG_SYNC_FANOUT hashes of the children.
+    * @param counts The BUZZVSTIG_SYNC_FANOUT entry counts of the children.
+    * @return The size of the queued message, or 0 if a queued one was updated.
     */
-   extern void buzzoutmsg_queue_append_vstig(struct buzzvm_s* vm,
-                                             int type,
-                                             uint16_t id,
-                                             const buzzobj_t key,
-                                             const buzzvstig_elem_t data);
+   extern uint32_t buzzoutmsg_queue_append_vstig_digest(struct buzzvm_s* vm,
+                                                        uint16_t id,
+                                                        uint8_t level,
+                                                        uint16_t node,
+                                                        const uint32_t* hashes,
+                                                        const uint16_t* counts);
+
+   /*
+    * Appends a new virtual stigmergy request message.
+    * The request asks a robot for its entries under a node of the
+    * anti-entropy tree. Duplicate requests are discarded.
+    * @param vm The Buzz VM.
+    * @param id The id of the virtual stigmergy.
+    * @param robot The robot that must answer.
+    * @param level The level of the node.
+    * @param node The index of the node in its level.
+    * @return The size of the queued message, or 0 if it was a duplicate.
+    */
+   extern uint32_t buzzoutmsg_queue_append_vstig_request(struct buzzvm_s* vm,
+                                                         uint16_t id,
+                                                         uint16_t robot,
+                                                         uint8_t level,
+                                                         uint16_t node);
 
    /*
     * Returns the first serialized message in the queue.
+    * The message is the one the active scheduler would send next in an
+    * empty frame. NULL is returned also when all the queued messages are
+    * held back by the rate limits.
     * You are in charge of freeing both the message data and the payload.
     * @param vm The Buzz VM.
     * @return The message data or NULL.
-    * @see buzzoutmsg_queue_first
+    * @see buzzoutmsg_queue_next
     */
    extern buzzmsg_payload_t buzzoutmsg_queue_first(struct buzzvm_s* vm);
 
@@ -102,12 +234,133 @@ extern "C" {
    extern void buzzoutmsg_queue_next(struct buzzvm_s* vm);
 
    /*
-    * Performs garbage collection.
-    * You should never call this function. It is called by
-    * buzzheap_gc() when necessary.
+    * Removes the next message to send and returns it serialized.
+    * The message is chosen by the active scheduler among those whose size
+    * does not exceed the passed available space. Call this function
+    * repeatedly, decreasing the available space, to fill a frame.
+    * You are in charge of freeing the returned payload, preferably with
+    * buzzoutmsg_queue_recycle().
+    * @param vm The Buzz VM.
+    * @param avail The space left in the frame, in bytes.
+    * @return The message data or NULL if no message fits.
+    */
+   extern buzzmsg_payload_t buzzoutmsg_queue_pop(struct buzzvm_s* vm,
+                                                 uint32_t avail);
+
+   /*
+    * Returns the serialized size of the first message of a class.
+    * @param vm The Buzz VM.
+    * @param type The message type.
+    * @return The size in bytes, or 0 if the class queue is empty.
+    */
+   extern uint32_t buzzoutmsg_queue_head_size(struct buzzvm_s* vm,
+                                              int type);
+
+   /*
+    * Refills the token buckets of the message classes.
+    * This function is called once per step by buzzvm_process_outmsgs().
+    * @param vm The Buzz VM.
+    */
+   extern void buzzoutmsg_queue_refill(struct buzzvm_s* vm);
+
+   /*
+    * Sets the scheduler of the message queue.
+    * @param vm The Buzz VM.
+    * @param sched The scheduler.
+    * @see buzzoutmsg_sched_fair
+    * @see buzzoutmsg_sched_fixed
+    */
+   extern void buzzoutmsg_queue_set_sched(struct buzzvm_s* vm,
+                                          buzzoutmsg_sched_t sched);
+
+   /*
+    * Sets the relative bandwidth share of a message class.
+    * @param vm The Buzz VM.
+    * @param type The message type.
+    * @param weight The weight (values of 0 are treated as 1).
+    */
+   extern void buzzoutmsg_queue_set_weight(struct buzzvm_s* vm,
+                                           int type,
+                                           uint32_t weight);
+
+   /*
+    * Sets the rate limit of a message class.
+    * @param vm The Buzz VM.
+    * @param type The message type.
+    * @param rate The maximum bytes per step (0 means unlimited).
+    * @param burst The maximum bytes that can accumulate across steps.
+    */
+   extern void buzzoutmsg_queue_set_rate(struct buzzvm_s* vm,
+                                         int type,
+                                         uint32_t rate,
+                                         uint32_t burst);
+
+   /*
+    * Sets the size of the largest message that can be sent.
+    * Larger messages are discarded instead of clogging their queue.
+    * @param vm The Buzz VM.
+    * @param mtu The maximum message size in bytes (0 means unlimited).
+    */
+   extern void buzzoutmsg_queue_set_mtu(struct buzzvm_s* vm,
+                                        uint32_t mtu);
+
+   /*
+    * Sets the priority of a broadcast topic.
+    * Broadcast messages are sent by decreasing topic priority, and in
+    * order of arrival for equal priorities. The default priority is 0.
+    * The new priority applies to the messages queued from now on.
+    * @param vm The Buzz VM.
+    * @param topic The string id of the topic.
+    * @param prio The priority.
+    */
+   extern void buzzoutmsg_queue_set_priority(struct buzzvm_s* vm,
+                                             uint16_t topic,
+                                             int32_t prio);
+
+   /*
+    * Sets whether only the latest value of a broadcast topic is sent.
+    * When set, a newer value replaces the queued one, which keeps its
+    * position in the queue. By default, every value is sent.
+    * @param vm The Buzz VM.
+    * @param topic The string id of the topic.
+    * @param latest 1 to send only the latest value, 0 to send every value.
+    */
+   extern void buzzoutmsg_queue_set_latest(struct buzzvm_s* vm,
+                                           uint16_t topic,
+                                           int latest);
+
+   /*
+    * Weighted fair scheduler with rate limits.
+    * This is the default scheduler. Each class receives a share of the
+    * bytes sent proportional to its weight. When the message of the most
+    * entitled class does not fit the frame, the largest message that fits
+    * is chosen instead.
+    * @param vm The Buzz VM.
+    * @param avail The space left in the current frame, in bytes.
+    * @return The chosen message class, or -1 if nothing can be sent.
+    */
+   extern int buzzoutmsg_sched_fair(struct buzzvm_s* vm,
+                                    uint32_t avail);
+
+   /*
+    * Fixed priority scheduler with rate limits.
+    * The classes are served in the order of buzzmsg_payload_type_e.
+    * @param vm The Buzz VM.
+    * @param avail The space left in the current frame, in bytes.
+    * @return The chosen message class, or -1 if nothing can be sent.
+    */
+   extern int buzzoutmsg_sched_fixed(struct buzzvm_s* vm,
+                                     uint32_t avail);
+
+   /*
+    * Gives a payload back to the message queue for reuse.
+    * Use this function instead of buzzmsg_payload_destroy() on the
+    * payloads returned by buzzoutmsg_queue_pop().
     * @param vm The Buzz VM.
+    * @param m The payload. It is set to NULL upon return.
     */
-   extern void buzzoutmsg_gc(struct buzzvm_s* vm);
+   extern void buzzoutmsg_queue_recycle(struct buzzvm_s* vm,
+                                        buzzmsg_payload_t* m);
 
 #ifdef __cplusplus
 }
@@ -6,16 +6,16 @@
 /****************************************/
 /****************************************/
 
-static int PARSE_ERROR    =  0;
-static int PARSE_OK       =  1;
+static const int PARSE_ERROR    =  0;
+static const int PARSE_OK       =  1;
 
-static int TYPE_BASIC     = -1;
-static int TYPE_CLOSURE   = -2;
-static int TYPE_TABLE     = -3;
+static const int TYPE_BASIC     = -1;
+static const int TYPE_CLOSURE   = -2;
+static const int TYPE_TABLE     = -3;
 
-static int SCOPE_LOCAL    =  0;
-static int SCOPE_GLOBAL   =  1;
-static int SCOPE_AUTO     =  2;
+static const int SCOPE_LOCAL    =  0;
+static const int SCOPE_GLOBAL   =  1;
+static const int SCOPE_AUTO     =  2;
 
 /****************************************/
 /****************************************/
@@ -0,0 +1,641 @@
+#include "buzzprof.h"
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+/****************************************/
+/****************************************/
+
+#define BUZZPROF_BUCKETS 1024
+
+/*
+ * A growable byte buffer.
+ */
+struct buzzprof_buf_s {
+   uint8_t* data;
+   size_t size;
+   size_t cap;
+};
+
+static void buf_append(struct buzzprof_buf_s* b,
+                       const void* data,
+                       size_t size) {
+   if(b->size + size > b->cap) {
+      while(b->size + size > b->cap) b->cap = b->cap ? b->cap * 2 : 256;
+      b->data = (uint8_t*)realloc(b->data, b->cap);
+   }
+   memcpy(b->data + b->size, data, size);
+   b->size += size;
+}
+
+#define buf_puts(b, s) buf_append(b, s, strlen(s))
+
+/****************************************/
+/****************************************/
+
+/*
+ * Stacks are stored as an array of int32_t: the number of elements that
+ * follow, then a (frame code, offset) pair per frame, innermost first.
+ * The offset of a C function frame is -1.
+ */
+
+static uint32_t buzzprof_stack_hash(const void* key) {
+   const int32_t* s = *(const int32_t**)key;
+   uint32_t h = 2166136261u;
+   int32_t i;
+   for(i = 0; i <= s[0]; ++i) {
+      h ^= (uint32_t)s[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+static int buzzprof_stack_cmp(const void* a, const void* b) {
+   const int32_t* x = *(const int32_t**)a;
+   const int32_t* y = *(const int32_t**)b;
+   if(x[0] != y[0]) return x[0] < y[0] ? -1 : 1;
+   return memcmp(x + 1, y + 1, x[0] * sizeof(int32_t));
+}
+
+static void buzzprof_stack_destroy(const void* key, void* data, void* params) {
+   free(*(int32_t**)key);
+   free((void*)key);
+   free(data);
+}
+
+/*
+ * Adds samples to a stack.
+ */
+static void buzzprof_add(buzzprof_t p,
+                         const int32_t* s,
+                         uint64_t n) {
+   uint64_t* c = (uint64_t*)buzzdict_rawget(p->samples, &s);
+   if(c) *c += n;
+   else {
+      int32_t* k = (int32_t*)malloc((s[0] + 1) * sizeof(int32_t));
+      memcpy(k, s, (s[0] + 1) * sizeof(int32_t));
+      buzzdict_set(p->samples, &k, &n);
+   }
+   p->total += n;
+}
+
+/****************************************/
+/****************************************/
+
+buzzprof_t buzzprof_new(int mode,
+                        uint32_t period) {
+   buzzprof_t p = (buzzprof_t)calloc(1, sizeof(struct buzzprof_s));
+   p->mode = mode;
+   p->period = period > 0 ? period : 1;
+   if(mode == BUZZPROF_TIMER) p->period *= 1000;
+   p->rng = 2463534242u;
+   p->samples = buzzdict_new(BUZZPROF_BUCKETS,
+                             sizeof(int32_t*),
+                             sizeof(uint64_t),
+                             buzzprof_stack_hash,
+                             buzzprof_stack_cmp,
+                             buzzprof_stack_destroy);
+   return p;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzprof_destroy(buzzprof_t* p) {
+   buzzdict_destroy(&(*p)->samples);
+   free((*p)->buf);
+   free(*p);
+   *p = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the number of instructions before the next sample, uniformly
+ * drawn in [1, 2*period-1].
+ */
+static uint32_t buzzprof_interval(buzzprof_t p) {
+   p->rng ^= p->rng << 13;
+   p->rng ^= p->rng >> 17;
+   p->rng ^= p->rng << 5;
+   return 1 + (uint32_t)(p->rng % (2 * p->period - 1));
+}
+
+void buzzprof_attach(buzzvm_t vm,
+                     buzzprof_t p) {
+   vm->prof = p;
+   if(!p) return;
+   p->countdown = (p->mode == BUZZPROF_INSTRUCTIONS) ?
+      buzzprof_interval(p) :
+      BUZZPROF_POLL;
+   buzzprof_resume(p);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzprof_resume(buzzprof_t p) {
+   if(p->mode == BUZZPROF_TIMER)
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &p->last);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns 1 if the given offset holds a call instruction.
+ */
+static int buzzprof_iscall(buzzvm_t vm,
+                           int32_t pc) {
+   return pc >= 0 && pc < vm->bcode_size &&
+      (vm->bcode[pc] == BUZZVM_INSTR_CALLC ||
+       vm->bcode[pc] == BUZZVM_INSTR_CALLS);
+}
+
+/*
+ * Records the current call stack.
+ *
+ * The stack at index i > 0 in vm->stacks belongs to the closure in the
+ * local symbol table at index i-1, and the top of the stack at index i-1
+ * is the return address of the call. The bottom stack is either the main
+ * script or the host: it is part of the sample only if it was left
+ * through a call instruction.
+ */
+static void buzzprof_sample(buzzvm_t vm,
+                            uint64_t n) {
+   buzzprof_t p = vm->prof;
+   int64_t i = buzzdarray_size(vm->stacks) - 1;
+   if(p->bufcap < 2 * i + 3) {
+      p->bufcap = 2 * i + 3;
+      p->buf = (int32_t*)realloc(p->buf, p->bufcap * sizeof(int32_t));
+   }
+   int32_t* s = p->buf;
+   int32_t pc = vm->pc;
+   s[0] = 0;
+   for(; i >= 0; --i) {
+      int32_t fun = BUZZPROF_SCRIPT;
+      if(i > 0) {
+         if(i > buzzdarray_size(vm->lsymts)) break;
+         buzzvm_lsyms_t l = buzzdarray_get(vm->lsymts, i - 1, buzzvm_lsyms_t);
+         if(!l->isnative)     fun = BUZZPROF_CFUN(l->ref);
+         else if(l->ref >= 0) fun = l->ref;
+      }
+      else if(buzzdarray_size(vm->stacks) > 1 && !buzzprof_iscall(vm, pc)) break;
+      s[++s[0]] = fun;
+      s[++s[0]] = (fun < BUZZPROF_SCRIPT) ? -1 : pc;
+      /* Go to the caller */
+      if(i > 0) {
+         buzzdarray_t st = buzzdarray_get(vm->stacks, i - 1, buzzdarray_t);
+         if(buzzdarray_isempty(st)) break;
+         buzzobj_t ret = buzzdarray_last(st, buzzobj_t);
+         if(ret->o.type != BUZZTYPE_INT) break;
+         pc = ret->i.value - 1;
+      }
+   }
+   if(s[0] > 0) buzzprof_add(p, s, n);
+}
+
+void buzzprof_tick(buzzvm_t vm) {
+   buzzprof_t p = vm->prof;
+   if(p->mode == BUZZPROF_INSTRUCTIONS) {
+      p->countdown = buzzprof_interval(p);
+      buzzprof_sample(vm, 1);
+   }
+   else {
+      p->countdown = BUZZPROF_POLL;
+      struct timespec now;
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+      int64_t dt = (int64_t)(now.tv_sec - p->last.tv_sec) * 1000000000 +
+         (now.tv_nsec - p->last.tv_nsec);
+      if(dt > 0) p->budget += dt;
+      p->last = now;
+      if(p->budget >= p->period) {
+         buzzprof_sample(vm, p->budget / p->period);
+         p->budget %= p->period;
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzprof_merge_elem(const void* key, void* data, void* params) {
+   buzzprof_add((buzzprof_t)params, *(const int32_t**)key, *(uint64_t*)data);
+}
+
+void buzzprof_merge(buzzprof_t dst,
+                    buzzprof_t src) {
+   buzzdict_foreach(src->samples, buzzprof_merge_elem, dst);
+}
+
+/****************************************/
+/****************************************/
+
+uint64_t buzzprof_samples(buzzprof_t p) {
+   return p->total;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Function names.
+ * The debug information does not name functions, so the names are
+ * taken from the global symbols that hold closures, and from the
+ * closures stored in global tables, such as "math.sqrt".
+ */
+
+struct buzzprof_names_s {
+   buzzvm_t vm;
+   /* Frame code -> name */
+   buzzdict_t names;
+   /* Name of the table being scanned, NULL when scanning globals */
+   const char* table;
+};
+
+static void buzzprof_names_destroy(const void* key, void* data, void* params) {
+   free((void*)key);
+   free(*(char**)data);
+   free(data);
+}
+
+static void buzzprof_names_set(struct buzzprof_names_s* n,
+                               buzzobj_t c,
+                               const char* name) {
+   int32_t fun = c->c.value.isnative ?
+      c->c.value.ref :
+      BUZZPROF_CFUN(c->c.value.ref);
+   char* x;
+   if(n->table) {
+      x = (char*)malloc(strlen(n->table) + strlen(name) + 2);
+      sprintf(x, "%s.%s", n->table, name);
+   }
+   else x = strdup(name);
+   buzzdict_set(n->names, &fun, &x);
+}
+
+static void buzzprof_names_field(const void* key, void* data, void* params) {
+   buzzobj_t k = *(buzzobj_t*)key;
+   buzzobj_t o = *(buzzobj_t*)data;
+   if(k->o.type == BUZZTYPE_STRING && o->o.type == BUZZTYPE_CLOSURE)
+      buzzprof_names_set((struct buzzprof_names_s*)params, o, k->s.value.str);
+}
+
+static void buzzprof_names_gsym(const void* key, void* data, void* params) {
+   struct buzzprof_names_s* n = (struct buzzprof_names_s*)params;
+   buzzobj_t o = *(buzzobj_t*)data;
+   const char* sym = buzzvm_string_get(n->vm, *(int32_t*)key);
+   if(!sym) return;
+   if(n->table && o->o.type == BUZZTYPE_TABLE) {
+      n->table = sym;
+      buzzdict_foreach(o->t.value, buzzprof_names_field, n);
+   }
+   else if(!n->table && o->o.type == BUZZTYPE_CLOSURE)
+      buzzprof_names_set(n, o, sym);
+}
+
+buzzdict_t buzzprof_names(buzzvm_t vm) {
+   struct buzzprof_names_s n;
+   n.vm = vm;
+   n.names = buzzdict_new(BUZZPROF_BUCKETS,
+                          sizeof(int32_t),
+                          sizeof(char*),
+                          buzzdict_int32keyhash,
+                          buzzdict_int32keycmp,
+                          buzzprof_names_destroy);
+   n.table = "";
+   buzzdict_foreach(vm->gsyms, buzzprof_names_gsym, &n);
+   n.table = NULL;
+   buzzdict_foreach(vm->gsyms, buzzprof_names_gsym, &n);
+   return n.names;
+}
+
+/*
+ * A resolved frame.
+ */
+struct buzzprof_frame_s {
+   const char* name;
+   const char* file;
+   uint64_t line;
+};
+
+static void buzzprof_resolve(buzzdict_t names,
+                             buzzdebug_t dbg,
+                             int32_t fun,
+                             int32_t pc,
+                             struct buzzprof_frame_s* f) {
+   const char** name = buzzdict_get(names, &fun, char*);
+   if(name)                       f->name = *name;
+   else if(fun == BUZZPROF_SCRIPT) f->name = "<script>";
+   else if(fun < BUZZPROF_SCRIPT)  f->name = "<C function>";
+   else                            f->name = "<lambda>";
+   f->file = NULL;
+   f->line = 0;
+   if(dbg && pc >= 0) {
+      const buzzdebug_entry_t* e = buzzdebug_info_get_fromoffset(dbg, &pc);
+      /* Code added by the compiler has no line */
+      if(e && (*e)->fname && (*e)->line > 0) {
+         f->file = (*e)->fname;
+         f->line = (*e)->line;
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzprof_folded_s {
+   buzzdict_t names;
+   buzzdebug_t dbg;
+   /* Folded stacks */
+   buzzdarray_t lines;
+};
+
+struct buzzprof_line_s {
+   char* stack;
+   uint64_t count;
+};
+
+static void buzzprof_folded_elem(const void* key, void* data, void* params) {
+   struct buzzprof_folded_s* fs = (struct buzzprof_folded_s*)params;
+   const int32_t* s = *(const int32_t**)key;
+   struct buzzprof_buf_s b = { NULL, 0, 0 };
+   struct buzzprof_frame_s f;
+   char loc[32];
+   int32_t i;
+   /* Go from the outermost frame to the innermost */
+   for(i = s[0] - 1; i > 0; i -= 2) {
+      buzzprof_resolve(fs->names, fs->dbg, s[i], s[i+1], &f);
+      if(b.size > 0) buf_puts(&b, ";");
+      buf_puts(&b, f.name);
+      if(f.file) {
+         const char* base = strrchr(f.file, '/');
+         buf_puts(&b, " (");
+         buf_puts(&b, base ? base + 1 : f.file);
+         snprintf(loc, sizeof(loc), ":%" PRIu64 ")", f.line);
+         buf_puts(&b, loc);
+      }
+   }
+   buf_append(&b, "", 1);
+   struct buzzprof_line_s l = { (char*)b.data, *(uint64_t*)data };
+   buzzdarray_push(fs->lines, &l);
+}
+
+static int buzzprof_line_cmp(const void* a, const void* b) {
+   return strcmp(((const struct buzzprof_line_s*)a)->stack,
+                 ((const struct buzzprof_line_s*)b)->stack);
+}
+
+int buzzprof_write_folded(buzzprof_t p,
+                          buzzvm_t vm,
+                          buzzdebug_t dbg,
+                          FILE* f) {
+   struct buzzprof_folded_s fs;
+   fs.names = buzzprof_names(vm);
+   fs.dbg = dbg;
+   fs.lines = buzzdarray_new(buzzdict_size(p->samples) + 1,
+                             sizeof(struct buzzprof_line_s),
+                             NULL);
+   buzzdict_foreach(p->samples, buzzprof_folded_elem, &fs);
+   /* Different offsets can map to the same lines: sort and merge */
+   buzzdarray_sort(fs.lines, buzzprof_line_cmp);
+   uint32_t i, j;
+   int err = 0;
+   for(i = 0; i < buzzdarray_size(fs.lines); i = j) {
+      struct buzzprof_line_s l = buzzdarray_get(fs.lines, i, struct buzzprof_line_s);
+      for(j = i + 1;
+          j < buzzdarray_size(fs.lines) &&
+             strcmp(l.stack, buzzdarray_get(fs.lines, j, struct buzzprof_line_s).stack) == 0;
+          ++j)
+         l.count += buzzdarray_get(fs.lines, j, struct buzzprof_line_s).count;
+      if(fprintf(f, "%s %" PRIu64 "\n", l.stack, l.count) < 0) err = -1;
+   }
+   for(i = 0; i < buzzdarray_size(fs.lines); ++i)
+      free(buzzdarray_get(fs.lines, i, struct buzzprof_line_s).stack);
+   buzzdarray_destroy(&fs.lines);
+   buzzdict_destroy(&fs.names);
+   return err;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Protocol buffer encoding, enough for the pprof profile.proto.
+ */
+
+static void pb_varint(struct buzzprof_buf_s* b,
+                      uint64_t x) {
+   uint8_t v[10];
+   size_t n = 0;
+   do {
+      v[n] = x & 0x7F;
+      x >>= 7;
+      if(x) v[n] |= 0x80;
+      ++n;
+   } while(x);
+   buf_append(b, v, n);
+}
+
+static void pb_int(struct buzzprof_buf_s* b,
+                   uint32_t field,
+                   uint64_t x) {
+   pb_varint(b, field << 3);
+   pb_varint(b, x);
+}
+
+static void pb_bytes(struct buzzprof_buf_s* b,
+                     uint32_t field,
+                     const void* data,
+                     size_t size) {
+   pb_varint(b, (field << 3) | 2);
+   pb_varint(b, size);
+   buf_append(b, data, size);
+}
+
+/* Writes a sub-message and empties its buffer */
+static void pb_msg(struct buzzprof_buf_s* b,
+                   uint32_t field,
+                   struct buzzprof_buf_s* m) {
+   pb_bytes(b, field, m->data, m->size);
+   m->size = 0;
+}
+
+/*
+ * profile.proto field numbers.
+ */
+#define PPROF_SAMPLE_TYPE   1
+#define PPROF_SAMPLE        2
+#define PPROF_LOCATION      4
+#define PPROF_FUNCTION      5
+#define PPROF_STRING_TABLE  6
+#define PPROF_PERIOD_TYPE   11
+#define PPROF_PERIOD        12
+
+struct buzzprof_pprof_s {
+   buzzprof_t p;
+   buzzdict_t names;
+   buzzdebug_t dbg;
+   /* String table */
+   buzzdarray_t strings;
+   /* Frame code -> function id */
+   buzzdict_t funs;
+   /* (frame code, offset) -> location id */
+   buzzdict_t locs;
+   /* Encoded samples, locations and functions */
+   struct buzzprof_buf_s samples;
+   struct buzzprof_buf_s locations;
+   struct buzzprof_buf_s functions;
+   /* Scratch buffers for sub-messages */
+   struct buzzprof_buf_s m1;
+   struct buzzprof_buf_s m2;
+};
+
+static uint64_t pprof_string(struct buzzprof_pprof_s* pp,
+                             const char* s) {
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(pp->strings); ++i)
+      if(strcmp(buzzdarray_get(pp->strings, i, const char*), s) == 0)
+         return i;
+   buzzdarray_push(pp->strings, &s);
+   return i;
+}
+
+static uint32_t buzzprof_int64keyhash(const void* key) {
+   uint64_t x = *(const uint64_t*)key;
+   return (uint32_t)(x ^ (x >> 32)) * 2654435761u;
+}
+
+static int buzzprof_int64keycmp(const void* a, const void* b) {
+   int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+   return (x < y) ? -1 : (x > y);
+}
+
+static uint64_t pprof_function(struct buzzprof_pprof_s* pp,
+                               int32_t fun,
+                               const struct buzzprof_frame_s* at) {
+   const uint64_t* id = buzzdict_get(pp->funs, &fun, uint64_t);
+   if(id) return *id;
+   uint64_t nid = buzzdict_size(pp->funs) + 1;
+   buzzdict_set(pp->funs, &fun, &nid);
+   /* Bytecode functions are located at their entry point */
+   struct buzzprof_frame_s f;
+   buzzprof_resolve(pp->names, pp->dbg, fun, fun, &f);
+   if(fun < 0) f = *at;
+   pb_int(&pp->m1, 1, nid);
+   pb_int(&pp->m1, 2, pprof_string(pp, f.name));
+   pb_int(&pp->m1, 4, pprof_string(pp, f.file ? f.file : ""));
+   pb_int(&pp->m1, 5, f.line);
+   pb_msg(&pp->functions, PPROF_FUNCTION, &pp->m1);
+   return nid;
+}
+
+static uint64_t pprof_location(struct buzzprof_pprof_s* pp,
+                               int32_t fun,
+                               int32_t pc) {
+   int64_t key = (int64_t)((uint64_t)(uint32_t)fun << 32) | (uint32_t)pc;
+   const uint64_t* id = buzzdict_get(pp->locs, &key, uint64_t);
+   if(id) return *id;
+   uint64_t nid = buzzdict_size(pp->locs) + 1;
+   buzzdict_set(pp->locs, &key, &nid);
+   struct buzzprof_frame_s f;
+   buzzprof_resolve(pp->names, pp->dbg, fun, pc, &f);
+   uint64_t fid = pprof_function(pp, fun, &f);
+   pb_int(&pp->m2, 1, fid);
+   pb_int(&pp->m2, 2, f.line);
+   pb_int(&pp->m1, 1, nid);
+   if(pc >= 0) pb_int(&pp->m1, 3, pc);
+   pb_msg(&pp->m1, 4, &pp->m2);
+   pb_msg(&pp->locations, PPROF_LOCATION, &pp->m1);
+   return nid;
+}
+
+static void buzzprof_pprof_elem(const void* key, void* data, void* params) {
+   struct buzzprof_pprof_s* pp = (struct buzzprof_pprof_s*)params;
+   const int32_t* s = *(const int32_t**)key;
+   uint64_t n = *(uint64_t*)data;
+   /* Locations go from the innermost frame to the outermost */
+   struct buzzprof_buf_s ids = { NULL, 0, 0 };
+   int32_t i;
+   for(i = 1; i < s[0]; i += 2)
+      pb_varint(&ids, pprof_location(pp, s[i], s[i+1]));
+   struct buzzprof_buf_s vals = { NULL, 0, 0 };
+   pb_varint(&vals, n);
+   pb_varint(&vals, n * pp->p->period);
+   struct buzzprof_buf_s m = { NULL, 0, 0 };
+   pb_bytes(&m, 1, ids.data, ids.size);
+   pb_bytes(&m, 2, vals.data, vals.size);
+   pb_msg(&pp->samples, PPROF_SAMPLE, &m);
+   free(ids.data);
+   free(vals.data);
+   free(m.data);
+}
+
+static void pprof_value_type(struct buzzprof_pprof_s* pp,
+                             struct buzzprof_buf_s* b,
+                             uint32_t field,
+                             const char* type,
+                             const char* unit) {
+   struct buzzprof_buf_s m = { NULL, 0, 0 };
+   pb_int(&m, 1, pprof_string(pp, type));
+   pb_int(&m, 2, pprof_string(pp, unit));
+   pb_msg(b, field, &m);
+   free(m.data);
+}
+
+int buzzprof_write_pprof(buzzprof_t p,
+                         buzzvm_t vm,
+                         buzzdebug_t dbg,
+                         FILE* f) {
+   struct buzzprof_pprof_s pp;
+   memset(&pp, 0, sizeof(pp));
+   pp.p = p;
+   pp.names = buzzprof_names(vm);
+   pp.dbg = dbg;
+   pp.strings = buzzdarray_new(64, sizeof(const char*), NULL);
+   pp.funs = buzzdict_new(BUZZPROF_BUCKETS,
+                          sizeof(int32_t),
+                          sizeof(uint64_t),
+                          buzzdict_int32keyhash,
+                          buzzdict_int32keycmp,
+                          NULL);
+   pp.locs = buzzdict_new(BUZZPROF_BUCKETS,
+                          sizeof(int64_t),
+                          sizeof(uint64_t),
+                          buzzprof_int64keyhash,
+                          buzzprof_int64keycmp,
+                          NULL);
+   /* The first string must be empty */
+   pprof_string(&pp, "");
+   /* Sample values: number of samples, and instructions or time */
+   struct buzzprof_buf_s out = { NULL, 0, 0 };
+   const char* type = (p->mode == BUZZPROF_TIMER) ? "cpu" : "instructions";
+   const char* unit = (p->mode == BUZZPROF_TIMER) ? "nanoseconds" : "count";
+   pprof_value_type(&pp, &out, PPROF_SAMPLE_TYPE, "samples", "count");
+   pprof_value_type(&pp, &out, PPROF_SAMPLE_TYPE, type, unit);
+   buzzdict_foreach(p->samples, buzzprof_pprof_elem, &pp);
+   buf_append(&out, pp.samples.data, pp.samples.size);
+   buf_append(&out, pp.locations.data, pp.locations.size);
+   buf_append(&out, pp.functions.data, pp.functions.size);
+   pprof_value_type(&pp, &out, PPROF_PERIOD_TYPE, type, unit);
+   pb_int(&out, PPROF_PERIOD, p->period);
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(pp.strings); ++i) {
+      const char* s = buzzdarray_get(pp.strings, i, const char*);
+      pb_bytes(&out, PPROF_STRING_TABLE, s, strlen(s));
+   }
+   int err = (fwrite(out.data, 1, out.size, f) == out.size) ? 0 : -1;
+   /* Clean up */
+   free(out.data);
+   free(pp.samples.data);
+   free(pp.locations.data);
+   free(pp.functions.data);
+   free(pp.m1.data);
+   free(pp.m2.data);
+   buzzdict_destroy(&pp.locs);
+   buzzdict_destroy(&pp.funs);
+   buzzdarray_destroy(&pp.strings);
+   buzzdict_destroy(&pp.names);
+   return err;
+}
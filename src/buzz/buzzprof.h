@@ -0,0 +1,177 @@
+#ifndef BUZZPROF_H
+#define BUZZPROF_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <buzz/buzzvm.h>
+#include <buzz/buzzdebug.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Sampling triggers.
+    */
+#define BUZZPROF_INSTRUCTIONS 0
+#define BUZZPROF_TIMER        1
+
+   /*
+    * Instructions between two checks of the CPU time in timer mode.
+    */
+#define BUZZPROF_POLL 64
+
+   /*
+    * Frame codes.
+    * A frame is coded as the bytecode offset of the running closure, as
+    * BUZZPROF_SCRIPT for the main script, or as BUZZPROF_CFUN(i) for the
+    * C function at index i in the VM function list.
+    */
+#define BUZZPROF_SCRIPT -1
+#define BUZZPROF_CFUN(i) (-2 - (int32_t)(i))
+
+   /*
+    * The sampling profiler.
+    *
+    * Once attached to a VM, the profiler is called every few instructions
+    * by buzzvm_step(). It then rebuilds the call stack from the VM stacks
+    * and counts it. With BUZZPROF_INSTRUCTIONS, a sample is taken about
+    * every 'period' instructions; the actual interval is randomized
+    * around the period to avoid locking onto loops. With BUZZPROF_TIMER,
+    * the thread CPU time is checked every BUZZPROF_POLL instructions and
+    * a sample is counted for every 'period' microseconds spent in the VM.
+    */
+   struct buzzprof_s {
+      /* BUZZPROF_INSTRUCTIONS or BUZZPROF_TIMER */
+      int mode;
+      /* Sampling period, in instructions or nanoseconds */
+      uint64_t period;
+      /* Instructions before the next call to buzzprof_tick() */
+      uint32_t countdown;
+      /* Random number generator state */
+      uint32_t rng;
+      /* Time not accounted for yet, in nanoseconds */
+      uint64_t budget;
+      /* Time of the last check */
+      struct timespec last;
+      /* Stack -> sample count */
+      buzzdict_t samples;
+      /* Total number of samples */
+      uint64_t total;
+      /* Buffer for the current stack */
+      int32_t* buf;
+      /* Capacity of the buffer */
+      uint32_t bufcap;
+   };
+   typedef struct buzzprof_s* buzzprof_t;
+
+   /*
+    * Creates a new profiler.
+    * @param mode BUZZPROF_INSTRUCTIONS or BUZZPROF_TIMER.
+    * @param period The sampling period, in instructions or microseconds
+    * of CPU time.
+    * @return A new profiler.
+    */
+   extern buzzprof_t buzzprof_new(int mode,
+                                  uint32_t period);
+
+   /*
+    * Destroys a profiler.
+    * The profiler must not be attached to a VM anymore.
+    * @param p The profiler.
+    */
+   extern void buzzprof_destroy(buzzprof_t* p);
+
+   /*
+    * Attaches a profiler to a VM.
+    * A profiler must be attached to a single VM at a time.
+    * @param vm The VM data.
+    * @param p The profiler, or NULL to stop profiling.
+    */
+   extern void buzzprof_attach(buzzvm_t vm,
+                               buzzprof_t p);
+
+   /*
+    * Called by buzzvm_step() when the countdown of the profiler expires.
+    * @param vm The VM data.
+    */
+   extern void buzzprof_tick(buzzvm_t vm);
+
+   /*
+    * Discards the time spent since the last check.
+    * The VM calls this function when the host enters it, so that the
+    * time spent in the host is not sampled. Hosts that call buzzvm_step()
+    * directly should call it before starting.
+    * @param p The profiler.
+    */
+   extern void buzzprof_resume(buzzprof_t p);
+
+   /*
+    * Adds the samples of a profiler to another.
+    * The profilers must have been attached to VMs running the same
+    * bytecode.
+    * @param dst The profiler that receives the samples.
+    * @param src The profiler whose samples are added.
+    */
+   extern void buzzprof_merge(buzzprof_t dst,
+                              buzzprof_t src);
+
+   /*
+    * Returns the total number of samples.
+    * @param p The profiler.
+    * @return The number of samples.
+    */
+   extern uint64_t buzzprof_samples(buzzprof_t p);
+
+   /*
+    * Names the functions of a VM.
+    * The debug information does not name functions, so the names are
+    * taken from the global symbols that hold closures, and from the
+    * closures stored in global tables, such as "math.sqrt". Global
+    * symbols take precedence over table fields.
+    * @param vm The VM data.
+    * @return A dictionary of frame code (int32_t) -> name (char*), to
+    * destroy with buzzdict_destroy().
+    */
+   extern buzzdict_t buzzprof_names(buzzvm_t vm);
+
+   /*
+    * Writes the samples in the folded stack format.
+    * Each line has the frames from the outermost to the innermost,
+    * separated by semicolons, followed by a space and the sample count.
+    * This is the input of flamegraph.pl and speedscope.
+    * @param p The profiler.
+    * @param vm A VM running the profiled bytecode, used to name functions.
+    * @param dbg The debug information, or NULL.
+    * @param f The file to write into.
+    * @return 0 on success, -1 on error.
+    */
+   extern int buzzprof_write_folded(buzzprof_t p,
+                                    buzzvm_t vm,
+                                    buzzdebug_t dbg,
+                                    FILE* f);
+
+   /*
+    * Writes the samples in the pprof format.
+    * The profile is written as an uncompressed protocol buffer, which
+    * 'go tool pprof' reads as is.
+    * @param p The profiler.
+    * @param vm A VM running the profiled bytecode, used to name functions.
+    * @param dbg The debug information, or NULL.
+    * @param f The file to write into.
+    * @return 0 on success, -1 on error.
+    */
+   extern int buzzprof_write_pprof(buzzprof_t p,
+                                   buzzvm_t vm,
+                                   buzzdebug_t dbg,
+                                   FILE* f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,435 @@
+#include "buzzrec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * File signature
+ */
+#define BUZZREC_MAGIC "BZZREC01"
+
+/*
+ * Default number of rows in a chunk
+ */
+#define BUZZREC_CHUNK 4096
+
+/*
+ * Number of chunk buffers shared by the recorder and the writer thread
+ */
+#define BUZZREC_BUFFERS 4
+
+/*
+ * Maximum size of an encoded value
+ */
+#define BUZZREC_VARINT_MAX 5
+
+/*
+ * A chunk buffer, with the columns one after the other
+ */
+struct buzzrec_buffer_s {
+   buzzrec_value_t* values;
+   uint32_t rows;
+};
+
+struct buzzrec_s {
+   /* The file */
+   FILE* fd;
+   /* The columns */
+   struct buzzrec_column_s* cols;
+   uint32_t ncols;
+   /* Rows per chunk */
+   uint32_t chunk;
+   /* The chunk buffers */
+   struct buzzrec_buffer_s bufs[BUZZREC_BUFFERS];
+   /* The buffer being filled */
+   uint32_t head;
+   /* The next buffer to write */
+   uint32_t tail;
+   /* Buffers waiting to be written or being written */
+   uint32_t pending;
+   /* Encoding buffer of the writer */
+   uint8_t* out;
+   /* The writer thread */
+   pthread_t writer;
+   pthread_mutex_t lock;
+   pthread_cond_t full;
+   pthread_cond_t space;
+   /* 1 when the writer must exit */
+   int quit;
+   /* 1 if a write failed */
+   int failed;
+};
+
+struct buzzrec_reader_s {
+   /* The file */
+   FILE* fd;
+   /* The columns */
+   struct buzzrec_column_s* cols;
+   uint32_t ncols;
+   /* The values of the current chunk */
+   buzzrec_value_t* values;
+   uint32_t rows;
+   uint32_t capacity;
+   /* Encoded data of the current chunk */
+   uint8_t* in;
+   uint32_t insize;
+};
+
+/****************************************/
+/****************************************/
+
+static uint8_t* buzzrec_put_u32(uint8_t* p, uint32_t x) {
+   p[0] = x;
+   p[1] = x >> 8;
+   p[2] = x >> 16;
+   p[3] = x >> 24;
+   return p + 4;
+}
+
+static uint32_t buzzrec_get_u32(const uint8_t* p) {
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint8_t* buzzrec_put_varint(uint8_t* p, uint32_t x) {
+   while(x >= 0x80) {
+      *(p++) = (x & 0x7F) | 0x80;
+      x >>= 7;
+   }
+   *(p++) = x;
+   return p;
+}
+
+/*
+ * Reads a variable-length integer.
+ * Returns the position after it, or NULL if it goes past the end.
+ */
+static const uint8_t* buzzrec_get_varint(const uint8_t* p,
+                                         const uint8_t* end,
+                                         uint32_t* x) {
+   uint32_t shift = 0;
+   *x = 0;
+   while(p < end && shift < 35) {
+      *x |= (uint32_t)(*p & 0x7F) << shift;
+      if(!(*(p++) & 0x80)) return p;
+      shift += 7;
+   }
+   return NULL;
+}
+
+/*
+ * Encodes the values of a column.
+ * Returns the position after the encoded data.
+ */
+static uint8_t* buzzrec_encode(uint8_t* p,
+                               uint8_t type,
+                               const buzzrec_value_t* v,
+                               uint32_t rows) {
+   uint32_t i, prev = 0, cur;
+   for(i = 0; i < rows; ++i) {
+      memcpy(&cur, &v[i], sizeof(uint32_t));
+      if(type == BUZZREC_INT) {
+         int32_t d = (int32_t)(cur - prev);
+         p = buzzrec_put_varint(p, ((uint32_t)d << 1) ^ (uint32_t)(d >> 31));
+      }
+      else {
+         p = buzzrec_put_varint(p, cur ^ prev);
+      }
+      prev = cur;
+   }
+   return p;
+}
+
+/*
+ * Decodes the values of a column.
+ * Returns 0 on success, -1 if the data is corrupted.
+ */
+static int buzzrec_decode(const uint8_t* p,
+                          const uint8_t* end,
+                          uint8_t type,
+                          buzzrec_value_t* v,
+                          uint32_t rows) {
+   uint32_t i, prev = 0, x;
+   for(i = 0; i < rows; ++i) {
+      if(!(p = buzzrec_get_varint(p, end, &x))) return -1;
+      if(type == BUZZREC_INT) prev += (x >> 1) ^ -(x & 1);
+      else prev ^= x;
+      memcpy(&v[i], &prev, sizeof(uint32_t));
+   }
+   return p == end ? 0 : -1;
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzrec_write_chunk(buzzrec_t r,
+                                const struct buzzrec_buffer_s* b) {
+   /* Chunk header: rows, then the size of each column */
+   uint8_t* p = buzzrec_put_u32(r->out, b->rows);
+   uint8_t* sizes = p;
+   p += 4 * r->ncols;
+   uint32_t c;
+   for(c = 0; c < r->ncols; ++c) {
+      uint8_t* start = p;
+      p = buzzrec_encode(p, r->cols[c].type, b->values + c * r->chunk, b->rows);
+      buzzrec_put_u32(sizes + 4 * c, p - start);
+   }
+   if(fwrite(r->out, 1, p - r->out, r->fd) < (size_t)(p - r->out))
+      r->failed = 1;
+}
+
+static void* buzzrec_writer(void* arg) {
+   buzzrec_t r = (buzzrec_t)arg;
+   pthread_mutex_lock(&r->lock);
+   while(1) {
+      while(r->pending == 0 && !r->quit)
+         pthread_cond_wait(&r->full, &r->lock);
+      if(r->pending == 0) break;
+      struct buzzrec_buffer_s* b = r->bufs + r->tail;
+      pthread_mutex_unlock(&r->lock);
+      buzzrec_write_chunk(r, b);
+      pthread_mutex_lock(&r->lock);
+      b->rows = 0;
+      r->tail = (r->tail + 1) % BUZZREC_BUFFERS;
+      --r->pending;
+      pthread_cond_signal(&r->space);
+   }
+   pthread_mutex_unlock(&r->lock);
+   return NULL;
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzrec_free(buzzrec_t r) {
+   uint32_t i;
+   for(i = 0; i < BUZZREC_BUFFERS; ++i)
+      free(r->bufs[i].values);
+   for(i = 0; i < r->ncols; ++i)
+      free((char*)r->cols[i].name);
+   free(r->cols);
+   free(r->out);
+   free(r);
+}
+
+buzzrec_t buzzrec_open(const char* fname,
+                       const struct buzzrec_column_s* cols,
+                       uint32_t ncols,
+                       uint32_t chunk) {
+   uint32_t i;
+   buzzrec_t r = (buzzrec_t)calloc(1, sizeof(struct buzzrec_s));
+   r->ncols = ncols;
+   r->chunk = chunk ? chunk : BUZZREC_CHUNK;
+   /* Copy the columns */
+   r->cols = (struct buzzrec_column_s*)calloc(ncols ? ncols : 1, sizeof(struct buzzrec_column_s));
+   for(i = 0; i < ncols; ++i) {
+      r->cols[i].name = strdup(cols[i].name);
+      r->cols[i].type = cols[i].type;
+   }
+   /* Allocate the buffers once and for all */
+   for(i = 0; i < BUZZREC_BUFFERS; ++i)
+      r->bufs[i].values = (buzzrec_value_t*)malloc((size_t)r->chunk * (ncols ? ncols : 1) * sizeof(buzzrec_value_t));
+   r->out = (uint8_t*)malloc(4 + 4 * (size_t)ncols + (size_t)r->chunk * ncols * BUZZREC_VARINT_MAX);
+   /* Create the file and write the header */
+   r->fd = fopen(fname, "wb");
+   if(!r->fd) {
+      buzzrec_free(r);
+      return NULL;
+   }
+   uint8_t hdr[4];
+   fwrite(BUZZREC_MAGIC, 1, 8, r->fd);
+   buzzrec_put_u32(hdr, ncols);
+   fwrite(hdr, 1, 4, r->fd);
+   for(i = 0; i < ncols; ++i) {
+      uint16_t len = strlen(r->cols[i].name);
+      hdr[0] = r->cols[i].type;
+      hdr[1] = len;
+      hdr[2] = len >> 8;
+      fwrite(hdr, 1, 3, r->fd);
+      fwrite(r->cols[i].name, 1, len, r->fd);
+   }
+   /* Start the writer */
+   pthread_mutex_init(&r->lock, NULL);
+   pthread_cond_init(&r->full, NULL);
+   pthread_cond_init(&r->space, NULL);
+   if(pthread_create(&r->writer, NULL, buzzrec_writer, r) != 0) {
+      pthread_cond_destroy(&r->space);
+      pthread_cond_destroy(&r->full);
+      pthread_mutex_destroy(&r->lock);
+      fclose(r->fd);
+      buzzrec_free(r);
+      return NULL;
+   }
+   return r;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzrec_close(buzzrec_t* r) {
+   buzzrec_flush(*r);
+   pthread_mutex_lock(&(*r)->lock);
+   (*r)->quit = 1;
+   pthread_cond_signal(&(*r)->full);
+   pthread_mutex_unlock(&(*r)->lock);
+   pthread_join((*r)->writer, NULL);
+   pthread_cond_destroy(&(*r)->space);
+   pthread_cond_destroy(&(*r)->full);
+   pthread_mutex_destroy(&(*r)->lock);
+   int failed = (*r)->failed;
+   if(fclose((*r)->fd) != 0) failed = 1;
+   buzzrec_free(*r);
+   *r = NULL;
+   return failed ? -1 : 0;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzrec_push(buzzrec_t r,
+                  const buzzrec_value_t* row) {
+   struct buzzrec_buffer_s* b = r->bufs + r->head;
+   uint32_t c;
+   for(c = 0; c < r->ncols; ++c)
+      b->values[c * r->chunk + b->rows] = row[c];
+   if(++b->rows == r->chunk) buzzrec_flush(r);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzrec_flush(buzzrec_t r) {
+   if(r->bufs[r->head].rows == 0) return;
+   pthread_mutex_lock(&r->lock);
+   ++r->pending;
+   pthread_cond_signal(&r->full);
+   r->head = (r->head + 1) % BUZZREC_BUFFERS;
+   /* Wait for the writer to free the next buffer */
+   while(r->pending == BUZZREC_BUFFERS)
+      pthread_cond_wait(&r->space, &r->lock);
+   pthread_mutex_unlock(&r->lock);
+}
+
+/****************************************/
+/****************************************/
+
+buzzrec_reader_t buzzrec_reader_open(const char* fname) {
+   FILE* fd = fopen(fname, "rb");
+   if(!fd) return NULL;
+   buzzrec_reader_t r = (buzzrec_reader_t)calloc(1, sizeof(struct buzzrec_reader_s));
+   r->fd = fd;
+   /* Check the header */
+   char magic[8];
+   uint8_t hdr[4];
+   if(fread(magic, 1, 8, fd) < 8 ||
+      memcmp(magic, BUZZREC_MAGIC, 8) != 0 ||
+      fread(hdr, 1, 4, fd) < 4) {
+      buzzrec_reader_close(&r);
+      return NULL;
+   }
+   /* Read the columns */
+   uint32_t ncols = buzzrec_get_u32(hdr);
+   r->cols = (struct buzzrec_column_s*)calloc(ncols ? ncols : 1, sizeof(struct buzzrec_column_s));
+   for(; r->ncols < ncols; ++r->ncols) {
+      if(fread(hdr, 1, 3, fd) < 3 || hdr[0] > BUZZREC_FLOAT) {
+         buzzrec_reader_close(&r);
+         return NULL;
+      }
+      uint16_t len = hdr[1] | (hdr[2] << 8);
+      char* name = (char*)malloc(len + 1);
+      r->cols[r->ncols].name = name;
+      r->cols[r->ncols].type = hdr[0];
+      if(fread(name, 1, len, fd) < len) {
+         ++r->ncols;
+         buzzrec_reader_close(&r);
+         return NULL;
+      }
+      name[len] = 0;
+   }
+   return r;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzrec_reader_close(buzzrec_reader_t* r) {
+   uint32_t i;
+   for(i = 0; i < (*r)->ncols; ++i)
+      free((char*)(*r)->cols[i].name);
+   free((*r)->cols);
+   free((*r)->values);
+   free((*r)->in);
+   fclose((*r)->fd);
+   free(*r);
+   *r = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzrec_reader_ncols(buzzrec_reader_t r) {
+   return r->ncols;
+}
+
+/****************************************/
+/****************************************/
+
+const struct buzzrec_column_s* buzzrec_reader_col(buzzrec_reader_t r,
+                                                  uint32_t c) {
+   return r->cols + c;
+}
+
+/****************************************/
+/****************************************/
+
+int64_t buzzrec_reader_next(buzzrec_reader_t r) {
+   uint8_t hdr[4];
+   size_t n = fread(hdr, 1, 4, r->fd);
+   if(n == 0) return 0;
+   if(n < 4) return -1;
+   uint32_t rows = buzzrec_get_u32(hdr);
+   /* Make room for the values */
+   if(rows > r->capacity) {
+      free(r->values);
+      r->values = (buzzrec_value_t*)malloc((size_t)rows * (r->ncols ? r->ncols : 1) * sizeof(buzzrec_value_t));
+      r->capacity = rows;
+   }
+   /* Read the column sizes */
+   uint32_t c, total = 0;
+   uint32_t* sizes = (uint32_t*)malloc((r->ncols ? r->ncols : 1) * sizeof(uint32_t));
+   for(c = 0; c < r->ncols; ++c) {
+      if(fread(hdr, 1, 4, r->fd) < 4 ||
+         (sizes[c] = buzzrec_get_u32(hdr)) > (uint64_t)rows * BUZZREC_VARINT_MAX) {
+         free(sizes);
+         return -1;
+      }
+      total += sizes[c];
+   }
+   /* Read and decode the columns */
+   if(total > r->insize) {
+      free(r->in);
+      r->in = (uint8_t*)malloc(total);
+      r->insize = total;
+   }
+   const uint8_t* p = r->in;
+   int err = fread(r->in, 1, total, r->fd) < total;
+   for(c = 0; c < r->ncols && !err; ++c) {
+      err = buzzrec_decode(p, p + sizes[c], r->cols[c].type, r->values + (size_t)c * rows, rows);
+      p += sizes[c];
+   }
+   free(sizes);
+   if(err) return -1;
+   r->rows = rows;
+   return rows;
+}
+
+/****************************************/
+/****************************************/
+
+const buzzrec_value_t* buzzrec_reader_values(buzzrec_reader_t r,
+                                             uint32_t c) {
+   return r->values + (size_t)c * r->rows;
+}
+
+/****************************************/
+/****************************************/
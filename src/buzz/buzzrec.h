@@ -0,0 +1,143 @@
+#ifndef BUZZREC_H
+#define BUZZREC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Column types.
+    */
+#define BUZZREC_INT   0
+#define BUZZREC_FLOAT 1
+
+   /*
+    * A value of a telemetry record.
+    */
+   union buzzrec_value_u {
+      int32_t i;
+      float   f;
+   };
+   typedef union buzzrec_value_u buzzrec_value_t;
+
+   /*
+    * A column of a telemetry file.
+    */
+   struct buzzrec_column_s {
+      /* The column name */
+      const char* name;
+      /* The column type, BUZZREC_INT or BUZZREC_FLOAT */
+      uint8_t type;
+   };
+
+   /*
+    * A telemetry recorder.
+    *
+    * The recorder stores rows of values in a binary file. The rows are
+    * gathered in chunks of preallocated buffers, where each column is
+    * contiguous. Full chunks are compressed and written by a background
+    * thread, so adding a row only copies the values.
+    *
+    * In a chunk, integer columns are stored as the zigzag-encoded
+    * difference with the previous value, and float columns as the XOR
+    * with the bits of the previous value. Both are then written as
+    * variable-length integers, so values that change little take little
+    * space.
+    */
+   typedef struct buzzrec_s* buzzrec_t;
+
+   /*
+    * A telemetry reader.
+    */
+   typedef struct buzzrec_reader_s* buzzrec_reader_t;
+
+   /*
+    * Creates a telemetry file and starts its writer thread.
+    * @param fname The file name.
+    * @param cols The columns.
+    * @param ncols The number of columns.
+    * @param chunk The number of rows in a chunk, 0 for the default.
+    * @return The recorder, or NULL in case of error (see errno).
+    */
+   extern buzzrec_t buzzrec_open(const char* fname,
+                                 const struct buzzrec_column_s* cols,
+                                 uint32_t ncols,
+                                 uint32_t chunk);
+
+   /*
+    * Writes the remaining rows, stops the writer thread and closes the
+    * file.
+    * @param r The recorder.
+    * @return 0 if all the rows were written, -1 otherwise.
+    */
+   extern int buzzrec_close(buzzrec_t* r);
+
+   /*
+    * Adds a row.
+    * The row is copied. When a chunk is full, it is handed to the writer
+    * thread. If the writer is behind by all the buffers, this call waits.
+    * @param r The recorder.
+    * @param row The values, one per column.
+    */
+   extern void buzzrec_push(buzzrec_t r,
+                            const buzzrec_value_t* row);
+
+   /*
+    * Hands the current chunk to the writer thread, even if it is not full.
+    * @param r The recorder.
+    */
+   extern void buzzrec_flush(buzzrec_t r);
+
+   /*
+    * Opens a telemetry file for reading.
+    * @param fname The file name.
+    * @return The reader, or NULL in case of error.
+    */
+   extern buzzrec_reader_t buzzrec_reader_open(const char* fname);
+
+   /*
+    * Closes a telemetry file.
+    * @param r The reader.
+    */
+   extern void buzzrec_reader_close(buzzrec_reader_t* r);
+
+   /*
+    * Returns the number of columns.
+    * @param r The reader.
+    * @return The number of columns.
+    */
+   extern uint32_t buzzrec_reader_ncols(buzzrec_reader_t r);
+
+   /*
+    * Returns a column.
+    * @param r The reader.
+    * @param c The column index.
+    * @return The column.
+    */
+   extern const struct buzzrec_column_s* buzzrec_reader_col(buzzrec_reader_t r,
+                                                            uint32_t c);
+
+   /*
+    * Reads the next chunk.
+    * @param r The reader.
+    * @return The number of rows in the chunk, 0 at the end of the file,
+    * or -1 if the file is corrupted.
+    */
+   extern int64_t buzzrec_reader_next(buzzrec_reader_t r);
+
+   /*
+    * Returns the values of a column in the current chunk.
+    * @param r The reader.
+    * @param c The column index.
+    * @return The values, as many as the rows in the chunk.
+    */
+   extern const buzzrec_value_t* buzzrec_reader_values(buzzrec_reader_t r,
+                                                       uint32_t c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,112 @@
+#include <buzz/buzzrec.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void usage(const char* path, int status) {
+   fprintf(stderr, "Usage:\n\t%s [options] <file.bzr>\n\n", path);
+   fprintf(stderr, "Prints a telemetry file as CSV.\n\n");
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, "\t--columns DIR               write each column into DIR/<name>.i32 or DIR/<name>.f32\n");
+   fprintf(stderr, "\t                            as raw little-endian values, instead of printing CSV\n\n");
+   exit(status);
+}
+
+/*
+ * Writes a value in little-endian order.
+ */
+static int write_value(FILE* fd, const buzzrec_value_t* v) {
+   uint32_t x;
+   memcpy(&x, v, sizeof(uint32_t));
+   uint8_t b[4] = { x, x >> 8, x >> 16, x >> 24 };
+   return fwrite(b, 1, 4, fd) == 4;
+}
+
+int main(int argc, char** argv) {
+   /* The telemetry file name */
+   char* fname;
+   /* The directory for the column files, NULL for CSV */
+   char* coldir = NULL;
+   /* Parse command line */
+   int i;
+   for(i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; ++i) {
+      if(i + 1 < argc && strcmp(argv[i], "--columns") == 0) {
+         coldir = argv[++i];
+      }
+      else {
+         fprintf(stderr, "error: %s: unrecognized option '%s'\n", argv[0], argv[i]);
+         usage(argv[0], 1);
+      }
+   }
+   if(argc - i != 1) usage(argv[0], 0);
+   fname = argv[i];
+   /* Open the file */
+   buzzrec_reader_t r = buzzrec_reader_open(fname);
+   if(!r) {
+      fprintf(stderr, "%s: can't read telemetry file\n", fname);
+      return 1;
+   }
+   uint32_t c, ncols = buzzrec_reader_ncols(r);
+   FILE** cols = NULL;
+   if(coldir) {
+      /* Create a file per column */
+      cols = (FILE**)calloc(ncols ? ncols : 1, sizeof(FILE*));
+      for(c = 0; c < ncols; ++c) {
+         const struct buzzrec_column_s* col = buzzrec_reader_col(r, c);
+         char* path = (char*)malloc(strlen(coldir) + strlen(col->name) + 6);
+         sprintf(path, "%s/%s.%s", coldir, col->name, col->type == BUZZREC_INT ? "i32" : "f32");
+         cols[c] = fopen(path, "wb");
+         if(!cols[c]) {
+            perror(path);
+            return 1;
+         }
+         free(path);
+      }
+   }
+   else {
+      /* Print the CSV header */
+      for(c = 0; c < ncols; ++c)
+         fprintf(stdout, "%s%s", c ? "," : "", buzzrec_reader_col(r, c)->name);
+      fprintf(stdout, "\n");
+   }
+   /* Go through the chunks */
+   int64_t rows, j;
+   int err = 0;
+   while(!err && (rows = buzzrec_reader_next(r)) > 0) {
+      if(coldir) {
+         for(c = 0; c < ncols && !err; ++c) {
+            const buzzrec_value_t* v = buzzrec_reader_values(r, c);
+            for(j = 0; j < rows && !err; ++j)
+               err = !write_value(cols[c], v + j);
+         }
+      }
+      else {
+         for(j = 0; j < rows; ++j) {
+            for(c = 0; c < ncols; ++c) {
+               const buzzrec_value_t* v = buzzrec_reader_values(r, c) + j;
+               if(c) fputc(',', stdout);
+               if(buzzrec_reader_col(r, c)->type == BUZZREC_INT)
+                  fprintf(stdout, "%d", v->i);
+               else
+                  fprintf(stdout, "%.9g", v->f);
+            }
+            fputc('\n', stdout);
+         }
+      }
+   }
+   if(rows < 0) {
+      fprintf(stderr, "%s: corrupted telemetry file\n", fname);
+      err = 1;
+   }
+   else if(err) {
+      fprintf(stderr, "%s: can't write the column files\n", fname);
+   }
+   /* Clean up */
+   if(coldir) {
+      for(c = 0; c < ncols; ++c)
+         if(fclose(cols[c]) != 0) err = 1;
+      free(cols);
+   }
+   buzzrec_reader_close(&r);
+   return err;
+}
@@ -1,10 +1,36 @@
 #include <buzz/buzzasm.h>
+#include <buzz/buzztransport.h>
+#include <buzz/buzzprof.h>
+#include <buzz/buzzstats.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+/*
+ * Frame size for the transports
+ */
+#define BUZZRUN_MTU 1024
 
 void usage(const char* path, int status) {
-   fprintf(stderr, "Usage:\n\t%s [--trace] <file.bo> <file.bdb>\n\n", path);
+   fprintf(stderr, "Usage:\n\t%s [options] <file.bo> <file.bdb>\n\n", path);
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, "\t--trace                     show the stack at every instruction\n");
+   fprintf(stderr, "\t--transport none|udp[:group[:port]]\n");
+   fprintf(stderr, "\t                            exchange messages with other bzzrun processes\n");
+   fprintf(stderr, "\t--id N                      robot id (default: 1)\n");
+   fprintf(stderr, "\t--steps N                   number of control steps, 0 to run forever (default: 0)\n");
+   fprintf(stderr, "\t--period MS                 control step duration in ms (default: 100)\n");
+   fprintf(stderr, "\t--position X,Y,Z            robot position advertised to the neighbors\n");
+   fprintf(stderr, "\t--profile FILE              write a sampling profile into FILE\n");
+   fprintf(stderr, "\t--profile-mode instructions|timer\n");
+   fprintf(stderr, "\t                            sample every N instructions or every N microseconds\n");
+   fprintf(stderr, "\t                            of CPU time (default: instructions)\n");
+   fprintf(stderr, "\t--profile-period N          sampling period (default: 1000)\n");
+   fprintf(stderr, "\t--profile-format folded|pprof\n");
+   fprintf(stderr, "\t                            folded stacks for flame graphs, or pprof (default: folded)\n");
+   fprintf(stderr, "\t--stats FILE                count the executed instructions, functions and allocations,\n");
+   fprintf(stderr, "\t                            and write the counters into FILE as JSON\n\n");
    exit(status);
 }
 
@@ -46,6 +72,51 @@ int print(buzzvm_t vm) {
    return buzzvm_ret0(vm);
 }
 
+void report_error(buzzvm_t vm, buzzdebug_t dbg_buf, const char* bcfname) {
+   const buzzdebug_entry_t* dbg = buzzdebug_info_get_fromoffset(dbg_buf, &vm->oldpc);
+   if(dbg != NULL) {
+      fprintf(stderr, "%s: execution terminated abnormally at %s:%" PRIu64 ":%" PRIu64 " : %s\n\n",
+              bcfname,
+              (*dbg)->fname,
+              (*dbg)->line,
+              (*dbg)->col,
+              vm->errormsg);
+   }
+   else {
+      fprintf(stderr, "%s: execution terminated abnormally at bytecode offset %d: %s\n\n",
+              bcfname,
+              vm->oldpc,
+              vm->errormsg);
+   }
+}
+
+buzztransport_t make_transport(const char* path, const char* spec) {
+   if(strcmp(spec, "none") == 0) return NULL;
+   if(strncmp(spec, "udp", 3) != 0 || (spec[3] != 0 && spec[3] != ':')) {
+      fprintf(stderr, "error: %s: unknown transport '%s'\n", path, spec);
+      usage(path, 1);
+   }
+   /* Parse udp[:group[:port]] */
+   char group[64] = "";
+   unsigned int port = 0;
+   if(spec[3] == ':') {
+      const char* c = strchr(spec + 4, ':');
+      size_t len = c ? (size_t)(c - spec - 4) : strlen(spec + 4);
+      if(len >= sizeof(group)) len = sizeof(group) - 1;
+      memcpy(group, spec + 4, len);
+      group[len] = 0;
+      if(c) port = strtoul(c + 1, NULL, 10);
+   }
+   buzztransport_t t = buzztransport_udp_new(group[0] ? group : NULL,
+                                             port,
+                                             BUZZRUN_MTU);
+   if(!t) {
+      perror(spec);
+      exit(1);
+   }
+   return t;
+}
+
 int main(int argc, char** argv) {
    /* The bytecode filename */
    char* bcfname;
@@ -53,21 +124,84 @@ int main(int argc, char** argv) {
    char* dbgfname;
    /* Whether or not to show the assembly information */
    int trace = 0;
+   /* The transport, or NULL to just run the script */
+   buzztransport_t transport = NULL;
+   /* The robot id */
+   uint16_t id = 1;
+   /* Number of control steps */
+   unsigned long steps = 0;
+   /* Control step duration in ms */
+   unsigned long period = 100;
+   /* Robot position */
+   float pos[3] = { 0.0f, 0.0f, 0.0f };
+   /* The profile file name, NULL to disable profiling */
+   char* proffname = NULL;
+   /* Profiling parameters */
+   int profmode = BUZZPROF_INSTRUCTIONS;
+   unsigned long profperiod = 1000;
+   int profpprof = 0;
+   /* The execution counter file name, NULL to disable the counters */
+   char* statsfname = NULL;
    /* Parse command line */
-   if(argc < 3 || argc > 4) usage(argv[0], 0);
-   if(argc == 3) {
-      bcfname = argv[1];
-      dbgfname = argv[2];
-   }
-   else {
-      bcfname = argv[2];
-      dbgfname = argv[3];
-      if(strcmp(argv[1], "--trace") != 0) {
-         fprintf(stderr, "error: %s: unrecognized option '%s'\n", argv[0], argv[1]);
+   int i;
+   for(i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; ++i) {
+      if(strcmp(argv[i], "--trace") == 0) {
+         trace = 1;
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--transport") == 0) {
+         if(transport) buzztransport_destroy(&transport);
+         transport = make_transport(argv[0], argv[++i]);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--id") == 0) {
+         id = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--steps") == 0) {
+         steps = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--period") == 0) {
+         period = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--position") == 0) {
+         if(sscanf(argv[++i], "%f,%f,%f", pos, pos + 1, pos + 2) < 2) {
+            fprintf(stderr, "error: %s: invalid position '%s'\n", argv[0], argv[i]);
+            usage(argv[0], 1);
+         }
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--profile") == 0) {
+         proffname = argv[++i];
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--profile-mode") == 0) {
+         ++i;
+         if(strcmp(argv[i], "instructions") == 0) profmode = BUZZPROF_INSTRUCTIONS;
+         else if(strcmp(argv[i], "timer") == 0)   profmode = BUZZPROF_TIMER;
+         else {
+            fprintf(stderr, "error: %s: unknown profiling mode '%s'\n", argv[0], argv[i]);
+            usage(argv[0], 1);
+         }
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--profile-period") == 0) {
+         profperiod = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--profile-format") == 0) {
+         ++i;
+         if(strcmp(argv[i], "folded") == 0)     profpprof = 0;
+         else if(strcmp(argv[i], "pprof") == 0) profpprof = 1;
+         else {
+            fprintf(stderr, "error: %s: unknown profile format '%s'\n", argv[0], argv[i]);
+            usage(argv[0], 1);
+         }
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--stats") == 0) {
+         statsfname = argv[++i];
+      }
+      else {
+         fprintf(stderr, "error: %s: unrecognized option '%s'\n", argv[0], argv[i]);
          usage(argv[0], 1);
       }
-      trace = 1;
    }
+   if(argc - i != 2) usage(argv[0], 0);
+   bcfname = argv[i];
+   dbgfname = argv[i+1];
    /* Read bytecode and fill in data structure */
    FILE* fd = fopen(bcfname, "rb");
    if(!fd) perror(bcfname);
@@ -85,16 +219,59 @@ int main(int argc, char** argv) {
       perror(dbgfname);
    }
    /* Create new VM */
-   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_t vm = buzzvm_new(id);
    /* Set byte code */
    buzzvm_set_bcode(vm, bcode_buf, bcode_size);
    /* Register hook functions */
    buzzvm_pushs(vm, buzzvm_string_register(vm, "log", 1));
    buzzvm_pushcc(vm, buzzvm_function_register(vm, print));
    buzzvm_gstore(vm);
+   buzzvm_stats_register(vm);
+   /* Start profiling */
+   buzzprof_t prof = NULL;
+   if(proffname) {
+      prof = buzzprof_new(profmode, profperiod);
+      buzzprof_attach(vm, prof);
+   }
+   /* Start counting */
+   if(statsfname && !buzzvm_stats_enable(vm, 1)) {
+      fprintf(stderr, "error: %s: Buzz was compiled without BUZZ_STATS\n", argv[0]);
+      statsfname = NULL;
+   }
    /* Run byte code */
    do if(trace) buzzdebug_stack_dump(vm, 1, stdout);
    while(buzzvm_step(vm) == BUZZVM_STATE_READY);
+   /* With a transport, run the control loop */
+   if(transport && vm->state == BUZZVM_STATE_DONE) {
+      buzztransport_set_position(transport, pos[0], pos[1], pos[2]);
+      struct timespec ts;
+      ts.tv_sec = period / 1000;
+      ts.tv_nsec = (period % 1000) * 1000000;
+      if(buzzvm_function_call(vm, "init", 0) == BUZZVM_STATE_READY) {
+         buzzvm_pop(vm);
+         unsigned long s;
+         for(s = 0; steps == 0 || s < steps; ++s) {
+            buzztransport_receive(vm, transport);
+            if(buzzvm_function_call(vm, "step", 0) != BUZZVM_STATE_READY)
+               break;
+            buzzvm_pop(vm);
+            buzztransport_send(vm, transport);
+            nanosleep(&ts, NULL);
+         }
+         /* destroy() is optional */
+         if(vm->state == BUZZVM_STATE_READY) {
+            buzzvm_pushs(vm, buzzvm_string_register(vm, "destroy", 0));
+            buzzvm_gload(vm);
+            int hasdestroy = buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_CLOSURE;
+            buzzvm_pop(vm);
+            if(!hasdestroy ||
+               buzzvm_function_call(vm, "destroy", 0) == BUZZVM_STATE_READY) {
+               if(hasdestroy) buzzvm_pop(vm);
+               vm->state = BUZZVM_STATE_DONE;
+            }
+         }
+      }
+   }
    /* Done running, check final state */
    int retval;
    if(vm->state == BUZZVM_STATE_DONE) {
@@ -107,27 +284,41 @@ int main(int argc, char** argv) {
    else {
       /* Execution terminated with errors */
       if(trace) buzzdebug_stack_dump(vm, 1, stdout);
-      const buzzdebug_entry_t* dbg = buzzdebug_info_get_fromoffset(dbg_buf, &vm->oldpc);
-      if(dbg != NULL) {
-         fprintf(stderr, "%s: execution terminated abnormally at %s:%" PRIu64 ":%" PRIu64 " : %s\n\n",
-                 bcfname,
-                 (*dbg)->fname,
-                 (*dbg)->line,
-                 (*dbg)->col,
-                 vm->errormsg);
+      report_error(vm, dbg_buf, bcfname);
+      retval = 1;
+   }
+   /* Write the profile */
+   if(prof) {
+      buzzprof_attach(vm, NULL);
+      FILE* pf = fopen(proffname, profpprof ? "wb" : "w");
+      int err = pf ? 0 : -1;
+      if(pf) {
+         err = profpprof ?
+            buzzprof_write_pprof(prof, vm, dbg_buf, pf) :
+            buzzprof_write_folded(prof, vm, dbg_buf, pf);
+         if(fclose(pf) != 0) err = -1;
       }
-      else {
-         fprintf(stderr, "%s: execution terminated abnormally at bytecode offset %d: %s\n\n",
-                 bcfname,
-                 vm->oldpc,
-                 vm->errormsg);
+      if(err) {
+         perror(proffname);
+         retval = 1;
+      }
+      buzzprof_destroy(&prof);
+   }
+   /* Write the execution counters */
+   if(statsfname) {
+      FILE* sf = fopen(statsfname, "w");
+      int err = sf ? buzzvm_stats_write_json(vm, sf) : -1;
+      if(sf && fclose(sf) != 0) err = -1;
+      if(err) {
+         perror(statsfname);
+         retval = 1;
       }
-      retval = 1;
    }
    /* Destroy VM */
    free(bcode_buf);
    buzzdebug_destroy(&dbg_buf);
    buzzvm_destroy(&vm);
+   if(transport) buzztransport_destroy(&transport);
    /* All done */
    return retval;
 }
@@ -0,0 +1,735 @@
+#include "buzzsim.h"
+#include "buzzmsg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Number of robots a worker takes at once
+ */
+#define BUZZSIM_CHUNK 64
+
+/*
+ * Maximum number of grid cells along a side of the arena
+ */
+#define BUZZSIM_GRID_MAX 1024
+
+/*
+ * Distance between the wheels of a robot in cm (as the foot-bot)
+ */
+#define BUZZSIM_INTERWHEEL 14.0f
+
+/*
+ * Task executed on every robot by the workers
+ */
+typedef void (*buzzsim_task)(buzzsim_t s, uint32_t i);
+
+/*
+ * A sender heard by a robot, as seen by the receiver
+ */
+struct buzzsim_heard_s {
+   uint32_t robot;
+   float distance;
+   float azimuth;
+};
+
+struct buzzsim_s {
+   /* The configuration */
+   struct buzzsim_config_s conf;
+   /* The robots */
+   struct buzzsim_robot_s* robots;
+   /* The bytecode */
+   const uint8_t* bcode;
+   uint32_t bcode_size;
+   /* Control steps done */
+   uint64_t steps;
+   /* Index of the frames written at this step */
+   int cur;
+   /* Grid of the positions advertised with the frames */
+   uint32_t side;
+   float cell;
+   uint32_t* cellstart;
+   uint32_t* cellrobots;
+   uint32_t* cellof;
+   /* Worker threads, the calling thread is not included */
+   pthread_t* threads;
+   uint32_t nthreads;
+   pthread_mutex_t lock;
+   pthread_cond_t go;
+   pthread_cond_t done;
+   /* Incremented every time a task is started */
+   uint32_t gen;
+   /* Number of workers still running the task */
+   uint32_t busy;
+   /* 1 when the workers must exit */
+   int quit;
+   /* The current task */
+   buzzsim_task task;
+   /* The next robot to take */
+   uint32_t next;
+};
+
+/****************************************/
+/****************************************/
+
+void buzzsim_config_default(struct buzzsim_config_s* c) {
+   c->robots = 100;
+   c->threads = 0;
+   c->arena = 0.0f;
+   c->range = 2.0f;
+   c->loss = 0.0f;
+   c->mtu = 200;
+   c->dt = 0.1f;
+   c->maxspeed = 10.0f;
+   c->maxturn = 3.14159265f;
+   c->seed = 0;
+   c->log = 1;
+   c->bus = 0;
+}
+
+/****************************************/
+/****************************************/
+
+static uint64_t buzzsim_hash(uint64_t x) {
+   /* splitmix64 finalizer */
+   x += 0x9E3779B97F4A7C15ULL;
+   x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+   return x ^ (x >> 31);
+}
+
+/*
+ * Returns a number in [0,1) that depends only on the key.
+ * This keeps the placement and the packet loss independent of the
+ * order in which the workers step the robots.
+ */
+static float buzzsim_uniform(uint32_t seed, uint64_t key) {
+   return (buzzsim_hash(key ^ buzzsim_hash(seed)) >> 40) * (1.0f / 16777216.0f);
+}
+
+/****************************************/
+/****************************************/
+
+static void buzzsim_work(buzzsim_t s) {
+   uint32_t i, end;
+   while((i = __sync_fetch_and_add(&s->next, BUZZSIM_CHUNK)) < s->conf.robots) {
+      end = i + BUZZSIM_CHUNK;
+      if(end > s->conf.robots) end = s->conf.robots;
+      for(; i < end; ++i) s->task(s, i);
+   }
+}
+
+static void* buzzsim_worker(void* arg) {
+   buzzsim_t s = (buzzsim_t)arg;
+   uint32_t gen = 0;
+   pthread_mutex_lock(&s->lock);
+   while(1) {
+      while(s->gen == gen && !s->quit)
+         pthread_cond_wait(&s->go, &s->lock);
+      if(s->quit) break;
+      gen = s->gen;
+      pthread_mutex_unlock(&s->lock);
+      buzzsim_work(s);
+      pthread_mutex_lock(&s->lock);
+      if(--s->busy == 0) pthread_cond_signal(&s->done);
+   }
+   pthread_mutex_unlock(&s->lock);
+   return NULL;
+}
+
+/*
+ * Runs a task on every robot and waits for it to be over.
+ * The calling thread takes part in the work.
+ */
+static void buzzsim_run(buzzsim_t s, buzzsim_task task) {
+   s->task = task;
+   s->next = 0;
+   if(s->nthreads == 0) {
+      buzzsim_work(s);
+      return;
+   }
+   pthread_mutex_lock(&s->lock);
+   s->busy = s->nthreads;
+   ++s->gen;
+   pthread_cond_broadcast(&s->go);
+   pthread_mutex_unlock(&s->lock);
+   buzzsim_work(s);
+   pthread_mutex_lock(&s->lock);
+   while(s->busy > 0)
+      pthread_cond_wait(&s->done, &s->lock);
+   pthread_mutex_unlock(&s->lock);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the robot of a VM.
+ */
+static buzzsim_robot_t buzzsim_get(buzzvm_t vm) {
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "controller", 1));
+   buzzvm_gload(vm);
+   buzzsim_robot_t r = (buzzsim_robot_t)buzzvm_stack_at(vm, 1)->u.value;
+   buzzvm_pop(vm);
+   return r;
+}
+
+/*
+ * Sets the motor command so that the robot goes along a vector
+ * expressed in its own frame.
+ */
+static void buzzsim_heading(buzzsim_t s, buzzsim_robot_t r, float x, float y) {
+   float a = atan2f(y, x);
+   float l = sqrtf(x*x + y*y);
+   if(l > s->conf.maxspeed) l = s->conf.maxspeed;
+   /* Turn towards the vector, and go forward only when facing it */
+   r->w = a / s->conf.dt;
+   r->v = cosf(a) > 0.0f ? l * cosf(a) : 0.0f;
+}
+
+static int buzzsim_gotoc(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   buzzvm_lload(vm, 1);
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert_number(vm, 2);
+   buzzvm_type_assert_number(vm, 1);
+   buzzsim_robot_t r = buzzsim_get(vm);
+   buzzsim_heading(r->sim, r,
+                   buzzvm_stack_number_to_float(vm, 2),
+                   buzzvm_stack_number_to_float(vm, 1));
+   return buzzvm_ret0(vm);
+}
+
+static int buzzsim_gotop(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   buzzvm_lload(vm, 1);
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert_number(vm, 2);
+   buzzvm_type_assert_number(vm, 1);
+   float l = buzzvm_stack_number_to_float(vm, 2);
+   float a = buzzvm_stack_number_to_float(vm, 1);
+   buzzsim_robot_t r = buzzsim_get(vm);
+   buzzsim_heading(r->sim, r, l * cosf(a), l * sinf(a));
+   return buzzvm_ret0(vm);
+}
+
+static int buzzsim_set_wheels(buzzvm_t vm) {
+   buzzvm_lnum_assert(vm, 2);
+   buzzvm_lload(vm, 1);
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert_number(vm, 2);
+   buzzvm_type_assert_number(vm, 1);
+   float left = buzzvm_stack_number_to_float(vm, 2);
+   float right = buzzvm_stack_number_to_float(vm, 1);
+   buzzsim_robot_t r = buzzsim_get(vm);
+   r->v = (left + right) / 2.0f;
+   r->w = (right - left) / BUZZSIM_INTERWHEEL;
+   return buzzvm_ret0(vm);
+}
+
+static int buzzsim_log(buzzvm_t vm) {
+   if(!buzzsim_get(vm)->sim->conf.log) return buzzvm_ret0(vm);
+   /* Keep the line of each robot in one piece */
+   flockfile(stdout);
+   fprintf(stdout, "[ROBOT %u] ", vm->robot);
+   int i;
+   for(i = 1; i < buzzdarray_size(vm->lsyms->syms); ++i) {
+      buzzvm_lload(vm, i);
+      buzzobj_t o = buzzvm_stack_at(vm, 1);
+      buzzvm_pop(vm);
+      switch(o->o.type) {
+         case BUZZTYPE_NIL:
+            fprintf(stdout, "[nil]");
+            break;
+         case BUZZTYPE_INT:
+            fprintf(stdout, "%d", o->i.value);
+            break;
+         case BUZZTYPE_FLOAT:
+            fprintf(stdout, "%f", o->f.value);
+            break;
+         case BUZZTYPE_TABLE:
+            fprintf(stdout, "[table with %d elems]", (buzzdict_size(o->t.value)));
+            break;
+         case BUZZTYPE_CLOSURE:
+            if(o->c.value.isnative)
+               fprintf(stdout, "[n-closure @%d]", o->c.value.ref);
+            else
+               fprintf(stdout, "[c-closure @%d]", o->c.value.ref);
+            break;
+         case BUZZTYPE_STRING:
+            fprintf(stdout, "%s", o->s.value.str);
+            break;
+         case BUZZTYPE_USERDATA:
+            fprintf(stdout, "[userdata @%p]", o->u.value);
+            break;
+         default:
+            break;
+      }
+   }
+   fprintf(stdout, "\n");
+   funlockfile(stdout);
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the table stored in t under the given key, making it if needed.
+ */
+static buzzobj_t buzzsim_subtable(buzzvm_t vm, buzzobj_t t, const char* key) {
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, key, 1));
+   buzzvm_tget(vm);
+   buzzobj_t st = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   if(st->o.type != BUZZTYPE_TABLE) {
+      st = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+      buzzvm_push(vm, t);
+      buzzvm_pushs(vm, buzzvm_string_register(vm, key, 1));
+      buzzvm_push(vm, st);
+      buzzvm_tput(vm);
+   }
+   return st;
+}
+
+static void buzzsim_putf(buzzvm_t vm, buzzobj_t t, const char* key, float v) {
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, key, 1));
+   buzzvm_pushf(vm, v);
+   buzzvm_tput(vm);
+}
+
+static void buzzsim_fill_pose(buzzvm_t vm, buzzobj_t t, void* data) {
+   buzzsim_robot_t r = (buzzsim_robot_t)data;
+   buzzobj_t p = buzzsim_subtable(vm, t, "position");
+   buzzsim_putf(vm, p, "x", r->x);
+   buzzsim_putf(vm, p, "y", r->y);
+   buzzsim_putf(vm, p, "z", 0.0f);
+   buzzobj_t o = buzzsim_subtable(vm, t, "orientation");
+   buzzsim_putf(vm, o, "yaw", r->yaw);
+   buzzsim_putf(vm, o, "pitch", 0.0f);
+   buzzsim_putf(vm, o, "roll", 0.0f);
+}
+
+static void buzzsim_register(buzzsim_robot_t r, buzzvm_t vm) {
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "controller", 1));
+   buzzvm_pushu(vm, r);
+   buzzvm_gstore(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "log", 1));
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, buzzsim_log));
+   buzzvm_gstore(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "goto", 1));
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, buzzsim_gotoc));
+   buzzvm_gstore(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "gotoc", 1));
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, buzzsim_gotoc));
+   buzzvm_gstore(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "gotop", 1));
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, buzzsim_gotop));
+   buzzvm_gstore(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "set_wheels", 1));
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, buzzsim_set_wheels));
+   buzzvm_gstore(vm);
+   /* Sensors */
+   buzzvm_hostsym_register(vm,
+                           buzzvm_string_register(vm, "pose", 1),
+                           buzzheap_newobj(vm, BUZZTYPE_TABLE),
+                           buzzsim_fill_pose,
+                           r);
+   /* There are no obstacles, the readings are always empty */
+   buzzvm_hostsym_register(vm,
+                           buzzvm_string_register(vm, "proximity", 1),
+                           buzzheap_newobj(vm, BUZZTYPE_TABLE),
+                           NULL,
+                           NULL);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Transport backend: a sent frame is kept by the sender for the next
+ * step, and a robot receives the frames of the senders it heard.
+ */
+static int buzzsim_transport_send(buzztransport_t t,
+                                  const uint8_t* frame,
+                                  uint32_t size) {
+   buzzsim_robot_t r = (buzzsim_robot_t)t->data;
+   int f = r->sim->cur;
+   if(r->frame[f]) buzzmsg_payload_destroy(&r->frame[f]);
+   r->frame[f] = buzzmsg_payload_frombuffer(frame, size);
+   return 1;
+}
+
+static int64_t buzzsim_transport_recv(buzztransport_t t,
+                                      uint8_t* buf,
+                                      uint32_t size,
+                                      struct buzztransport_nbr_s* nbr) {
+   buzzsim_robot_t r = (buzzsim_robot_t)t->data;
+   if(r->head >= buzzdarray_size(r->heard)) return 0;
+   struct buzzsim_heard_s h = buzzdarray_get(r->heard, r->head, struct buzzsim_heard_s);
+   ++r->head;
+   buzzmsg_payload_t frame = r->sim->robots[h.robot].frame[!r->sim->cur];
+   nbr->valid = 1;
+   nbr->distance = h.distance;
+   nbr->azimuth = h.azimuth;
+   nbr->elevation = 0.0f;
+   int64_t n = buzzmsg_payload_size(frame) < size ? buzzmsg_payload_size(frame) : size;
+   memcpy(buf, frame->data, n);
+   return n;
+}
+
+static void buzzsim_init_robot(buzzsim_t s, uint32_t i) {
+   buzzsim_robot_t r = s->robots + i;
+   r->transport = buzztransport_new(s->conf.mtu);
+   r->transport->send = buzzsim_transport_send;
+   r->transport->recv = buzzsim_transport_recv;
+   r->transport->data = r;
+   r->heard = buzzdarray_new(16, sizeof(struct buzzsim_heard_s), NULL);
+   r->vm = buzzvm_new(i);
+   buzzvm_set_bcode(r->vm, s->bcode, s->bcode_size);
+   buzzsim_register(r, r->vm);
+   /* Run the global part of the script, then init() */
+   while(buzzvm_step(r->vm) == BUZZVM_STATE_READY);
+   if(r->vm->state != BUZZVM_STATE_DONE) return;
+   buzzvm_hostsyms_update(r->vm, 1);
+   if(buzzvm_function_call(r->vm, "init", 0) == BUZZVM_STATE_READY)
+      buzzvm_pop(r->vm);
+}
+
+static void buzzsim_destroy_robot(buzzsim_t s, uint32_t i) {
+   buzzsim_robot_t r = s->robots + i;
+   if(!r->vm) return;
+   /* destroy() is optional */
+   if(r->vm->state == BUZZVM_STATE_READY) {
+      buzzvm_pushs(r->vm, buzzvm_string_register(r->vm, "destroy", 0));
+      buzzvm_gload(r->vm);
+      int hasdestroy = buzzvm_stack_at(r->vm, 1)->o.type == BUZZTYPE_CLOSURE;
+      buzzvm_pop(r->vm);
+      if(hasdestroy &&
+         buzzvm_function_call(r->vm, "destroy", 0) == BUZZVM_STATE_READY)
+         buzzvm_pop(r->vm);
+   }
+   buzzvm_destroy(&r->vm);
+   buzztransport_destroy(&r->transport);
+   buzzdarray_destroy(&r->heard);
+   int f;
+   for(f = 0; f < 2; ++f) {
+      if(r->frame[f]) buzzmsg_payload_destroy(&r->frame[f]);
+      if(r->msgs[f]) buzzdarray_destroy(&r->msgs[f]);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+static uint32_t buzzsim_cell(buzzsim_t s, float x, float y) {
+   int32_t cx = (int32_t)(x / s->cell);
+   int32_t cy = (int32_t)(y / s->cell);
+   if(cx < 0) cx = 0; else if(cx >= s->side) cx = s->side - 1;
+   if(cy < 0) cy = 0; else if(cy >= s->side) cy = s->side - 1;
+   return cy * s->side + cx;
+}
+
+/*
+ * Sorts the robots by the cell of the position advertised with the
+ * frames of the given index.
+ */
+static void buzzsim_grid(buzzsim_t s, int f) {
+   uint32_t i, cells = s->side * s->side;
+   memset(s->cellstart, 0, (cells + 1) * sizeof(uint32_t));
+   for(i = 0; i < s->conf.robots; ++i) {
+      s->cellof[i] = buzzsim_cell(s, s->robots[i].fx[f], s->robots[i].fy[f]);
+      ++s->cellstart[s->cellof[i]];
+   }
+   /* Make each entry the end of its cell, then fill backwards */
+   for(i = 1; i <= cells; ++i)
+      s->cellstart[i] += s->cellstart[i-1];
+   for(i = s->conf.robots; i > 0; --i)
+      s->cellrobots[--s->cellstart[s->cellof[i-1]]] = i-1;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Lists the robots heard among those that sent a frame in range at the
+ * previous step.
+ */
+static void buzzsim_listen(buzzsim_t s, uint32_t i, int f) {
+   buzzsim_robot_t r = s->robots + i;
+   float range2 = s->conf.range * s->conf.range;
+   r->heard->size = 0;
+   r->head = 0;
+   int32_t cx = s->cellof[i] % s->side;
+   int32_t cy = s->cellof[i] / s->side;
+   int32_t gx, gy;
+   uint32_t k, c;
+   for(gy = cy - 1; gy <= cy + 1; ++gy) {
+      if(gy < 0 || gy >= s->side) continue;
+      for(gx = cx - 1; gx <= cx + 1; ++gx) {
+         if(gx < 0 || gx >= s->side) continue;
+         c = gy * s->side + gx;
+         for(k = s->cellstart[c]; k < s->cellstart[c+1]; ++k) {
+            uint32_t j = s->cellrobots[k];
+            buzzsim_robot_t o = s->robots + j;
+            if(j == i || !o->fsize[f]) continue;
+            float dx = o->fx[f] - r->x;
+            float dy = o->fy[f] - r->y;
+            float d2 = dx*dx + dy*dy;
+            if(d2 > range2) continue;
+            if(s->conf.loss > 0.0f &&
+               buzzsim_uniform(s->conf.seed,
+                               (s->steps << 32) | ((uint64_t)j << 16) | i) < s->conf.loss) {
+               ++r->lost;
+               continue;
+            }
+            ++r->received;
+            float a = atan2f(dy, dx) - r->yaw;
+            struct buzzsim_heard_s h = { j, sqrtf(d2) * 100.0f, atan2f(sinf(a), cosf(a)) };
+            buzzdarray_push(r->heard, &h);
+         }
+      }
+   }
+}
+
+/*
+ * Delivers the frames sent in range at the previous step.
+ */
+static void buzzsim_receive(buzzsim_t s, uint32_t i, int f) {
+   buzzsim_robot_t r = s->robots + i;
+   buzzsim_listen(s, i, f);
+   if(!s->conf.bus) {
+      buzztransport_receive(r->vm, r->transport);
+      return;
+   }
+   /* Hand over the payloads of the senders, without building frames */
+   buzzneighbors_reset(r->vm);
+   uint32_t k, m;
+   for(k = 0; k < buzzdarray_size(r->heard); ++k) {
+      struct buzzsim_heard_s h = buzzdarray_get(r->heard, k, struct buzzsim_heard_s);
+      buzzsim_robot_t o = s->robots + h.robot;
+      buzzneighbors_add(r->vm, o->vm->robot, h.distance, h.azimuth, 0.0f);
+      for(m = 0; m < buzzdarray_size(o->msgs[f]); ++m)
+         buzzinmsg_queue_append_shared(r->vm, o->vm->robot,
+                                       buzzdarray_get(o->msgs[f], m, buzzmsg_payload_t));
+   }
+   buzzvm_process_inmsgs(r->vm);
+}
+
+static void buzzsim_payload_destroy(uint32_t pos, void* data, void* params) {
+   buzzmsg_payload_destroy((buzzmsg_payload_t*)data);
+}
+
+/*
+ * Sends the queued messages in the frame of the given index.
+ * With the local bus, the payloads are kept as they are, and only the
+ * size of the frame they would make is accounted for.
+ */
+static void buzzsim_send(buzzsim_t s, uint32_t i, int f) {
+   buzzsim_robot_t r = s->robots + i;
+   if(!s->conf.bus) {
+      buzztransport_set_position(r->transport, r->x, r->y, 0.0f);
+      buzztransport_send(r->vm, r->transport);
+      r->fsize[f] = buzzmsg_payload_size(r->frame[f]);
+   }
+   else {
+      uint32_t mtu = s->conf.mtu;
+      buzzvm_process_outmsgs(r->vm);
+      /* The payloads sent two steps ago are not read anymore */
+      if(r->msgs[f]) {
+         uint32_t m;
+         for(m = 0; m < buzzdarray_size(r->msgs[f]); ++m)
+            buzzoutmsg_queue_recycle(r->vm, (buzzmsg_payload_t*)r->msgs[f]->data + m);
+         r->msgs[f]->size = 0;
+      }
+      else {
+         r->msgs[f] = buzzdarray_new(10, sizeof(buzzmsg_payload_t), buzzsim_payload_destroy);
+      }
+      /* Pick the messages as buzztransport_send() does */
+      buzzoutmsg_queue_set_mtu(r->vm, mtu - BUZZTRANSPORT_HEADER_SIZE - sizeof(uint16_t));
+      uint32_t size = BUZZTRANSPORT_HEADER_SIZE;
+      buzzmsg_payload_t m;
+      while(size + sizeof(uint16_t) < mtu &&
+            (m = buzzoutmsg_queue_pop(r->vm,
+                                      mtu - size - sizeof(uint16_t))) != NULL) {
+         size += sizeof(uint16_t) + buzzmsg_payload_size(m);
+         buzzdarray_push(r->msgs[f], &m);
+      }
+      r->fsize[f] = size;
+   }
+   ++r->sent;
+   r->bytes += r->fsize[f];
+}
+
+/*
+ * Applies the motor command for a step.
+ */
+static void buzzsim_move(buzzsim_t s, buzzsim_robot_t r) {
+   float v = r->v, w = r->w;
+   if(v > s->conf.maxspeed) v = s->conf.maxspeed;
+   else if(v < -s->conf.maxspeed) v = -s->conf.maxspeed;
+   if(w > s->conf.maxturn) w = s->conf.maxturn;
+   else if(w < -s->conf.maxturn) w = -s->conf.maxturn;
+   r->yaw += w * s->conf.dt;
+   r->yaw = atan2f(sinf(r->yaw), cosf(r->yaw));
+   /* Speeds are in cm/s, positions in m */
+   r->x += v * cosf(r->yaw) * s->conf.dt / 100.0f;
+   r->y += v * sinf(r->yaw) * s->conf.dt / 100.0f;
+   /* The robots stop at the walls */
+   if(r->x < 0.0f) r->x = 0.0f; else if(r->x > s->conf.arena) r->x = s->conf.arena;
+   if(r->y < 0.0f) r->y = 0.0f; else if(r->y > s->conf.arena) r->y = s->conf.arena;
+}
+
+static void buzzsim_step_robot(buzzsim_t s, uint32_t i) {
+   buzzsim_robot_t r = s->robots + i;
+   int f = s->cur;
+   if(r->vm->state == BUZZVM_STATE_READY) {
+      buzzsim_receive(s, i, !f);
+      buzzvm_hostsyms_update(r->vm, 1);
+      if(buzzvm_function_call(r->vm, "step", 0) == BUZZVM_STATE_READY) {
+         buzzvm_pop(r->vm);
+         buzzsim_send(s, i, f);
+         buzzsim_move(s, r);
+         r->fx[f] = r->x;
+         r->fy[f] = r->y;
+         return;
+      }
+   }
+   /* A robot in error sends nothing */
+   r->fsize[f] = 0;
+}
+
+/****************************************/
+/****************************************/
+
+buzzsim_t buzzsim_new(const struct buzzsim_config_s* c,
+                      const uint8_t* bcode,
+                      uint32_t bcode_size) {
+   if(c->robots == 0 || c->robots > BUZZSIM_ROBOTS_MAX ||
+      c->mtu < BUZZTRANSPORT_HEADER_SIZE + sizeof(uint16_t) + 1 || c->dt <= 0.0f)
+      return NULL;
+   buzzsim_t s = (buzzsim_t)calloc(1, sizeof(struct buzzsim_s));
+   s->conf = *c;
+   if(s->conf.arena <= 0.0f) s->conf.arena = sqrtf(c->robots);
+   if(s->conf.threads == 0) {
+      long n = sysconf(_SC_NPROCESSORS_ONLN);
+      s->conf.threads = n > 0 ? n : 1;
+   }
+   s->bcode = bcode;
+   s->bcode_size = bcode_size;
+   /* Place the robots at random */
+   s->robots = (struct buzzsim_robot_s*)calloc(c->robots, sizeof(struct buzzsim_robot_s));
+   uint32_t i;
+   for(i = 0; i < c->robots; ++i) {
+      buzzsim_robot_t r = s->robots + i;
+      r->sim = s;
+      r->x = buzzsim_uniform(c->seed, 3 * (uint64_t)i) * s->conf.arena;
+      r->y = buzzsim_uniform(c->seed, 3 * (uint64_t)i + 1) * s->conf.arena;
+      r->yaw = (buzzsim_uniform(c->seed, 3 * (uint64_t)i + 2) * 2.0f - 1.0f) * 3.14159265f;
+      r->fx[0] = r->fx[1] = r->x;
+      r->fy[0] = r->fy[1] = r->y;
+   }
+   /* Make the grid, with cells no smaller than the range */
+   float side = s->conf.range > 0.0f ? s->conf.arena / s->conf.range : BUZZSIM_GRID_MAX;
+   s->side = side < 1.0f ? 1 : (side > BUZZSIM_GRID_MAX ? BUZZSIM_GRID_MAX : (uint32_t)side);
+   s->cell = s->conf.arena / s->side;
+   s->cellstart = (uint32_t*)malloc((s->side * s->side + 1) * sizeof(uint32_t));
+   s->cellrobots = (uint32_t*)malloc(c->robots * sizeof(uint32_t));
+   s->cellof = (uint32_t*)malloc(c->robots * sizeof(uint32_t));
+   /* Start the workers */
+   pthread_mutex_init(&s->lock, NULL);
+   pthread_cond_init(&s->go, NULL);
+   pthread_cond_init(&s->done, NULL);
+   s->threads = (pthread_t*)malloc(s->conf.threads * sizeof(pthread_t));
+   for(i = 0; i + 1 < s->conf.threads; ++i) {
+      if(pthread_create(s->threads + i, NULL, buzzsim_worker, s) != 0) break;
+      ++s->nthreads;
+   }
+   /* Make the VMs and run init() */
+   buzzsim_run(s, buzzsim_init_robot);
+   /* The first step reads frames with index 1 */
+   buzzsim_grid(s, 1);
+   return s;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzsim_destroy(buzzsim_t* s) {
+   buzzsim_run(*s, buzzsim_destroy_robot);
+   /* Stop the workers */
+   pthread_mutex_lock(&(*s)->lock);
+   (*s)->quit = 1;
+   pthread_cond_broadcast(&(*s)->go);
+   pthread_mutex_unlock(&(*s)->lock);
+   uint32_t i;
+   for(i = 0; i < (*s)->nthreads; ++i)
+      pthread_join((*s)->threads[i], NULL);
+   pthread_cond_destroy(&(*s)->done);
+   pthread_cond_destroy(&(*s)->go);
+   pthread_mutex_destroy(&(*s)->lock);
+   free((*s)->threads);
+   free((*s)->cellof);
+   free((*s)->cellrobots);
+   free((*s)->cellstart);
+   free((*s)->robots);
+   free(*s);
+   *s = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzsim_step(buzzsim_t s) {
+   buzzsim_run(s, buzzsim_step_robot);
+   /* The next step reads the frames sent at this one */
+   buzzsim_grid(s, s->cur);
+   s->cur = !s->cur;
+   ++s->steps;
+   uint32_t i, n = 0;
+   for(i = 0; i < s->conf.robots; ++i)
+      n += s->robots[i].vm->state == BUZZVM_STATE_READY;
+   return n;
+}
+
+/****************************************/
+/****************************************/
+
+uint32_t buzzsim_robots(buzzsim_t s) {
+   return s->conf.robots;
+}
+
+/****************************************/
+/****************************************/
+
+buzzsim_robot_t buzzsim_robot(buzzsim_t s,
+                              uint32_t i) {
+   return s->robots + i;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzsim_stats(buzzsim_t s,
+                   struct buzzsim_stats_s* st) {
+   memset(st, 0, sizeof(struct buzzsim_stats_s));
+   st->threads = s->conf.threads;
+   st->steps = s->steps;
+   uint32_t i;
+   for(i = 0; i < s->conf.robots; ++i) {
+      buzzsim_robot_t r = s->robots + i;
+      st->failed += r->vm->state != BUZZVM_STATE_READY;
+      st->sent += r->sent;
+      st->received += r->received;
+      st->lost += r->lost;
+      st->bytes += r->bytes;
+   }
+}
+
+/****************************************/
+/****************************************/
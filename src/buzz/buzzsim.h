@@ -0,0 +1,182 @@
+#ifndef BUZZSIM_H
+#define BUZZSIM_H
+
+#include <buzz/buzzvm.h>
+#include <buzz/buzztransport.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Maximum number of robots in a simulation.
+    * Robot ids are 16-bit, and the robots get ids 0 to N-1.
+    */
+#define BUZZSIM_ROBOTS_MAX 65536
+
+   /*
+    * Configuration of a headless swarm simulation.
+    * Positions are in meters, speeds and neighbor distances in cm, as
+    * in ARGoS.
+    */
+   struct buzzsim_config_s {
+      /* Number of robots */
+      uint32_t robots;
+      /* Number of worker threads, 0 for one per processor */
+      uint32_t threads;
+      /* Side of the square arena, 0 for one square meter per robot */
+      float arena;
+      /* Communication range */
+      float range;
+      /* Probability that a frame is lost, in [0,1] */
+      float loss;
+      /* Frame size in bytes */
+      uint32_t mtu;
+      /* Duration of a control step in seconds */
+      float dt;
+      /* Maximum linear speed */
+      float maxspeed;
+      /* Maximum angular speed in rad/s */
+      float maxturn;
+      /* Seed for the placement and the packet loss */
+      uint32_t seed;
+      /* 1 to print what the scripts log, 0 to discard it */
+      int log;
+      /*
+       * 1 to let the receivers read the serialized payloads of the sender
+       * in place (local bus), 0 to go through frames. Either way, each
+       * receiver deserializes the payloads into its own objects.
+       * Range, loss and frame size are accounted for in the same way.
+       */
+      int bus;
+   };
+
+   /*
+    * Data of a simulated robot.
+    * The pose and the motor command are only touched by the worker that
+    * steps the robot.
+    */
+   struct buzzsim_robot_s {
+      /* The VM */
+      buzzvm_t vm;
+      /* The simulation */
+      struct buzzsim_s* sim;
+      /* Position */
+      float x, y;
+      /* Heading in radians */
+      float yaw;
+      /* Commanded linear speed */
+      float v;
+      /* Commanded angular speed in rad/s */
+      float w;
+      /* Transport that builds, delivers and parses the frames */
+      buzztransport_t transport;
+      /* Senders heard at this step, and the next one to receive */
+      buzzdarray_t heard;
+      uint32_t head;
+      /* Frames sent at the odd and even steps */
+      buzzmsg_payload_t frame[2];
+      /* Payloads sent at the odd and even steps, with the local bus */
+      buzzdarray_t msgs[2];
+      /* Size of the frames sent at the odd and even steps, 0 when nothing was sent */
+      uint32_t fsize[2];
+      /* Position advertised with each frame */
+      float fx[2], fy[2];
+      /* Frame counters */
+      uint64_t sent;
+      uint64_t received;
+      uint64_t lost;
+      /* Bytes sent */
+      uint64_t bytes;
+   };
+   typedef struct buzzsim_robot_s* buzzsim_robot_t;
+
+   /*
+    * Aggregated counters of a simulation.
+    */
+   struct buzzsim_stats_s {
+      /* Number of threads stepping the robots */
+      uint32_t threads;
+      /* Control steps done */
+      uint64_t steps;
+      /* Robots whose VM is in error */
+      uint32_t failed;
+      /* Frames sent, received and lost */
+      uint64_t sent;
+      uint64_t received;
+      uint64_t lost;
+      /* Bytes sent */
+      uint64_t bytes;
+   };
+
+   /*
+    * A headless swarm simulation.
+    */
+   typedef struct buzzsim_s* buzzsim_t;
+
+   /*
+    * Fills a configuration with the default values.
+    * @param c The configuration.
+    */
+   extern void buzzsim_config_default(struct buzzsim_config_s* c);
+
+   /*
+    * Creates a new simulation.
+    * The robots are placed at random in the arena and their VMs run the
+    * global part of the script and init().
+    * The bytecode is shared by the VMs, so it must stay valid until the
+    * simulation is destroyed.
+    * @param c The configuration.
+    * @param bcode The bytecode.
+    * @param bcode_size The size of the bytecode.
+    * @return The simulation, or NULL in case of error.
+    */
+   extern buzzsim_t buzzsim_new(const struct buzzsim_config_s* c,
+                                const uint8_t* bcode,
+                                uint32_t bcode_size);
+
+   /*
+    * Destroys a simulation.
+    * destroy() is called on the VMs that define it.
+    * @param s The simulation.
+    */
+   extern void buzzsim_destroy(buzzsim_t* s);
+
+   /*
+    * Executes a control step of every robot.
+    * Each robot receives the frames its neighbors sent at the previous
+    * step, calls step(), sends a frame, and moves.
+    * @param s The simulation.
+    * @return The number of robots whose VM is still running.
+    */
+   extern uint32_t buzzsim_step(buzzsim_t s);
+
+   /*
+    * Returns the number of robots.
+    * @param s The simulation.
+    * @return The number of robots.
+    */
+   extern uint32_t buzzsim_robots(buzzsim_t s);
+
+   /*
+    * Returns a robot.
+    * @param s The simulation.
+    * @param i The robot index, from 0 to buzzsim_robots()-1.
+    * @return The robot.
+    */
+   extern buzzsim_robot_t buzzsim_robot(buzzsim_t s,
+                                        uint32_t i);
+
+   /*
+    * Sums the counters of the robots.
+    * @param s The simulation.
+    * @param st Where to store the counters.
+    */
+   extern void buzzsim_stats(buzzsim_t s,
+                             struct buzzsim_stats_s* st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,188 @@
+#include <buzz/buzzsim.h>
+#include <buzz/buzzdebug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Number of failed robots whose error is reported
+ */
+#define BZZSWARM_ERRORS_MAX 10
+
+void usage(const char* path, int status) {
+   fprintf(stderr, "Usage:\n\t%s [options] <file.bo> <file.bdb>\n\n", path);
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, "\t--robots N                  number of robots, at most %u (default: 100)\n", BUZZSIM_ROBOTS_MAX);
+   fprintf(stderr, "\t--threads N                 number of threads, 0 for one per processor (default: 0)\n");
+   fprintf(stderr, "\t--steps N                   number of control steps (default: 100)\n");
+   fprintf(stderr, "\t--arena M                   side of the square arena in m, 0 for 1 m^2 per robot (default: 0)\n");
+   fprintf(stderr, "\t--range M                   communication range in m (default: 2)\n");
+   fprintf(stderr, "\t--loss P                    probability that a frame is lost (default: 0)\n");
+   fprintf(stderr, "\t--mtu B                     frame size in bytes (default: 200)\n");
+   fprintf(stderr, "\t--dt S                      control step duration in s (default: 0.1)\n");
+   fprintf(stderr, "\t--bus frame|local           deliver serialized frames, or let the receivers read the payloads in place (default: frame)\n");
+   fprintf(stderr, "\t--seed N                    seed for the placement and the packet loss (default: 0)\n");
+   fprintf(stderr, "\t--quiet                     discard what the scripts log\n");
+   fprintf(stderr, "\t--csv                       print the results as a CSV line\n\n");
+   exit(status);
+}
+
+void report_error(buzzvm_t vm, buzzdebug_t dbg_buf, const char* bcfname) {
+   const buzzdebug_entry_t* dbg = buzzdebug_info_get_fromoffset(dbg_buf, &vm->oldpc);
+   if(dbg != NULL) {
+      fprintf(stderr, "%s: robot %u: execution terminated abnormally at %s:%" PRIu64 ":%" PRIu64 " : %s\n",
+              bcfname,
+              vm->robot,
+              (*dbg)->fname,
+              (*dbg)->line,
+              (*dbg)->col,
+              vm->errormsg);
+   }
+   else {
+      fprintf(stderr, "%s: robot %u: execution terminated abnormally at bytecode offset %d: %s\n",
+              bcfname,
+              vm->robot,
+              vm->oldpc,
+              vm->errormsg);
+   }
+}
+
+double now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+   /* The bytecode filename */
+   char* bcfname;
+   /* The debugging information file name */
+   char* dbgfname;
+   /* The simulation settings */
+   struct buzzsim_config_s conf;
+   buzzsim_config_default(&conf);
+   /* Number of control steps */
+   unsigned long steps = 100;
+   /* Whether or not to print CSV */
+   int csv = 0;
+   /* Parse command line */
+   int i;
+   for(i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; ++i) {
+      if(i + 1 < argc && strcmp(argv[i], "--robots") == 0) {
+         conf.robots = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--threads") == 0) {
+         conf.threads = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--steps") == 0) {
+         steps = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--arena") == 0) {
+         conf.arena = strtof(argv[++i], NULL);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--range") == 0) {
+         conf.range = strtof(argv[++i], NULL);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--loss") == 0) {
+         conf.loss = strtof(argv[++i], NULL);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--mtu") == 0) {
+         conf.mtu = strtoul(argv[++i], NULL, 10);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--dt") == 0) {
+         conf.dt = strtof(argv[++i], NULL);
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--bus") == 0) {
+         ++i;
+         if(strcmp(argv[i], "frame") == 0) conf.bus = 0;
+         else if(strcmp(argv[i], "local") == 0) conf.bus = 1;
+         else {
+            fprintf(stderr, "error: %s: unknown bus '%s'\n", argv[0], argv[i]);
+            usage(argv[0], 1);
+         }
+      }
+      else if(i + 1 < argc && strcmp(argv[i], "--seed") == 0) {
+         conf.seed = strtoul(argv[++i], NULL, 10);
+      }
+      else if(strcmp(argv[i], "--quiet") == 0) {
+         conf.log = 0;
+      }
+      else if(strcmp(argv[i], "--csv") == 0) {
+         csv = 1;
+      }
+      else {
+         fprintf(stderr, "error: %s: unrecognized option '%s'\n", argv[0], argv[i]);
+         usage(argv[0], 1);
+      }
+   }
+   if(argc - i != 2) usage(argv[0], 0);
+   bcfname = argv[i];
+   dbgfname = argv[i+1];
+   /* Read bytecode and fill in data structure */
+   FILE* fd = fopen(bcfname, "rb");
+   if(!fd) {
+      perror(bcfname);
+      return 1;
+   }
+   fseek(fd, 0, SEEK_END);
+   size_t bcode_size = ftell(fd);
+   rewind(fd);
+   uint8_t* bcode_buf = (uint8_t*)malloc(bcode_size);
+   if(fread(bcode_buf, 1, bcode_size, fd) < bcode_size) {
+      perror(bcfname);
+   }
+   fclose(fd);
+   /* Read debug information */
+   buzzdebug_t dbg_buf = buzzdebug_new();
+   if(!buzzdebug_fromfile(dbg_buf, dbgfname)) {
+      perror(dbgfname);
+   }
+   /* Create the robots and run init() */
+   double t0 = now();
+   buzzsim_t sim = buzzsim_new(&conf, bcode_buf, bcode_size);
+   if(!sim) {
+      fprintf(stderr, "error: %s: invalid settings\n", argv[0]);
+      usage(argv[0], 1);
+   }
+   double t1 = now();
+   /* Run the control steps */
+   unsigned long s;
+   for(s = 0; s < steps && buzzsim_step(sim) > 0; ++s);
+   double t2 = now();
+   /* Report the errors */
+   struct buzzsim_stats_s st;
+   buzzsim_stats(sim, &st);
+   uint32_t r, shown = 0;
+   for(r = 0; r < buzzsim_robots(sim) && shown < BZZSWARM_ERRORS_MAX; ++r) {
+      buzzvm_t vm = buzzsim_robot(sim, r)->vm;
+      if(vm->state != BUZZVM_STATE_READY) {
+         report_error(vm, dbg_buf, bcfname);
+         ++shown;
+      }
+   }
+   if(st.failed > shown)
+      fprintf(stderr, "%s: %u more robots failed\n", bcfname, st.failed - shown);
+   /* Print the results */
+   double rate = st.steps > 0 ? (double)st.steps * conf.robots / (t2 - t1) : 0.0;
+   if(csv) {
+      fprintf(stdout, "robots,threads,steps,init_s,run_s,robot_steps_per_s,failed,frames_sent,frames_received,frames_lost,bytes_sent\n");
+      fprintf(stdout, "%u,%u,%" PRIu64 ",%f,%f,%f,%u,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+              conf.robots, st.threads, st.steps, t1 - t0, t2 - t1, rate, st.failed,
+              st.sent, st.received, st.lost, st.bytes);
+   }
+   else {
+      fprintf(stdout, "%s: %u robots, %u threads, %" PRIu64 " steps\n", bcfname, conf.robots, st.threads, st.steps);
+      fprintf(stdout, "\tinit:     %f s\n", t1 - t0);
+      fprintf(stdout, "\tsteps:    %f s (%f robot steps/s)\n", t2 - t1, rate);
+      fprintf(stdout, "\tframes:   %" PRIu64 " sent, %" PRIu64 " received, %" PRIu64 " lost\n",
+              st.sent, st.received, st.lost);
+      fprintf(stdout, "\tbytes:    %" PRIu64 " sent\n", st.bytes);
+      fprintf(stdout, "\tfailed:   %u robots\n\n", st.failed);
+   }
+   /* Clean up */
+   buzzsim_destroy(&sim);
+   buzzdebug_destroy(&dbg_buf);
+   free(bcode_buf);
+   return st.failed > 0;
+}
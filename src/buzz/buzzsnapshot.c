@@ -0,0 +1,449 @@
+#include "buzzsnapshot.h"
+#include "buzzvstig.h"
+#include "buzzvstiglog.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Size of the state of the random number generator (see buzzmath.c)
+ */
+#define BUZZSNAPSHOT_RNG_SIZE 624
+
+struct buzzvm_snapshot_s {
+   /* The frozen VM */
+   buzzvm_t vm;
+   /* Object of the original VM -> position in the heap */
+   buzzdict_t objs;
+};
+
+/*
+ * Data to clone a VM.
+ * The objects of the clone are stored in the heap in the same order as
+ * in the original VM, so an object is mapped by its position.
+ */
+struct buzzvm_clone_s {
+   /* The original VM */
+   buzzvm_t src;
+   /* The clone */
+   buzzvm_t dst;
+   /* Object of the original VM -> position in the heap */
+   buzzdict_t objs;
+};
+typedef struct buzzvm_clone_s* buzzvm_clone_t;
+
+/*
+ * Data to clone a dictionary
+ */
+struct buzzvm_clone_dict_s {
+   buzzvm_clone_t c;
+   buzzdict_t dst;
+};
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the clone of an object.
+ * Objects that are not in the heap are shared.
+ */
+static buzzobj_t clone_obj(buzzvm_clone_t c, buzzobj_t o) {
+   if(!o) return NULL;
+   const uint32_t* pos = buzzdict_get(c->objs, &o, uint32_t);
+   if(!pos) return o;
+   return buzzdarray_get(c->dst->heap->objs, *pos, buzzobj_t);
+}
+
+/*
+ * Returns a copy of a list of objects, with the objects replaced by
+ * their clones.
+ */
+static buzzdarray_t clone_objlist(buzzvm_clone_t c, buzzdarray_t da) {
+   buzzdarray_t x = buzzdarray_clone(da);
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(x); ++i)
+      ((buzzobj_t*)x->data)[i] = clone_obj(c, ((buzzobj_t*)x->data)[i]);
+   return x;
+}
+
+/*
+ * Returns a copy of an array, or NULL if the array is NULL.
+ */
+static void* clone_array(const void* a, size_t count, size_t size) {
+   if(!a) return NULL;
+   void* x = malloc(count ? count * size : 1);
+   memcpy(x, a, count * size);
+   return x;
+}
+
+/*
+ * Returns an empty dictionary with the same settings as the given one.
+ */
+static buzzdict_t clone_dict_new(buzzdict_t dt) {
+   return buzzdict_new(dt->num_buckets,
+                       dt->key_size,
+                       dt->data_size,
+                       dt->hashf,
+                       dt->keycmpf,
+                       dt->dstryf);
+}
+
+static void clone_dict_plain(const void* key, void* data, void* params) {
+   buzzdict_set(((struct buzzvm_clone_dict_s*)params)->dst, key, data);
+}
+
+static void clone_dict_objval(const void* key, void* data, void* params) {
+   struct buzzvm_clone_dict_s* p = (struct buzzvm_clone_dict_s*)params;
+   buzzobj_t v = clone_obj(p->c, *(buzzobj_t*)data);
+   buzzdict_set(p->dst, key, &v);
+}
+
+static void clone_dict_objkeyval(const void* key, void* data, void* params) {
+   struct buzzvm_clone_dict_s* p = (struct buzzvm_clone_dict_s*)params;
+   buzzobj_t k = clone_obj(p->c, *(buzzobj_t*)key);
+   buzzobj_t v = clone_obj(p->c, *(buzzobj_t*)data);
+   buzzdict_set(p->dst, &k, &v);
+}
+
+/*
+ * Returns a copy of a dictionary.
+ * The entries are inserted again, because the hash of a table key
+ * depends on its address.
+ */
+static buzzdict_t clone_dict(buzzvm_clone_t c,
+                             buzzdict_t dt,
+                             buzzdict_elem_funp fun) {
+   struct buzzvm_clone_dict_s p = { .c = c, .dst = clone_dict_new(dt) };
+   buzzdict_foreach(dt, fun, &p);
+   return p.dst;
+}
+
+/****************************************/
+/****************************************/
+
+static void clone_heap(buzzvm_clone_t c) {
+   buzzheap_t src = c->src->heap;
+   buzzheap_t dst = buzzheap_new();
+   dst->max_objs = src->max_objs;
+   dst->marker = src->marker;
+   c->dst->heap = dst;
+   /* Make the objects first, so the references can be resolved */
+   uint32_t i, n = buzzdarray_size(src->objs);
+   for(i = 0; i < n; ++i) {
+      buzzobj_t o = buzzdarray_get(src->objs, i, buzzobj_t);
+      buzzobj_t x = (buzzobj_t)malloc(sizeof(union buzzobj_u));
+      memcpy(x, o, sizeof(union buzzobj_u));
+      buzzdarray_push(dst->objs, &x);
+      buzzdict_set(c->objs, &o, &i);
+   }
+   /* Copy the contents */
+   for(i = 0; i < n; ++i) {
+      buzzobj_t o = buzzdarray_get(src->objs, i, buzzobj_t);
+      buzzobj_t x = buzzdarray_get(dst->objs, i, buzzobj_t);
+      switch(o->o.type) {
+         case BUZZTYPE_STRING:
+            x->s.value.str = buzzstrman_get(c->dst->strings, o->s.value.sid);
+            break;
+         case BUZZTYPE_TABLE:
+            x->t.value = clone_dict(c, o->t.value, clone_dict_objkeyval);
+            break;
+         case BUZZTYPE_CLOSURE:
+            x->c.value.actrec = clone_objlist(c, o->c.value.actrec);
+            break;
+         case BUZZTYPE_USERDATA:
+            if(o->u.clone) x->u.value = o->u.clone(o->u.value);
+            break;
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+static void clone_stacks(buzzvm_clone_t c) {
+   buzzvm_t src = c->src;
+   buzzvm_t dst = c->dst;
+   uint32_t i;
+   /* Stacks */
+   dst->stacks = buzzdarray_clone(src->stacks);
+   for(i = 0; i < buzzdarray_size(dst->stacks); ++i) {
+      buzzdarray_t s = buzzdarray_get(src->stacks, i, buzzdarray_t);
+      buzzdarray_t x = clone_objlist(c, s);
+      ((buzzdarray_t*)dst->stacks->data)[i] = x;
+      if(s == src->stack) dst->stack = x;
+   }
+   /* Local symbol tables */
+   dst->lsymts = buzzdarray_clone(src->lsymts);
+   dst->lsyms = NULL;
+   for(i = 0; i < buzzdarray_size(dst->lsymts); ++i) {
+      buzzvm_lsyms_t l = buzzdarray_get(src->lsymts, i, buzzvm_lsyms_t);
+      buzzvm_lsyms_t x = buzzvm_lsyms_new(l->isswarm, clone_objlist(c, l->syms));
+      x->ref = l->ref;
+      x->isnative = l->isnative;
+      ((buzzvm_lsyms_t*)dst->lsymts->data)[i] = x;
+      if(l == src->lsyms) dst->lsyms = x;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Data to clone the entries of a virtual stigmergy
+ */
+struct buzzvm_clone_vstig_s {
+   buzzvm_clone_t c;
+   buzzvstig_t dst;
+   /* Original entry -> cloned entry */
+   buzzdict_t elems;
+};
+
+static void clone_vstig_elem(const void* key, void* data, void* params) {
+   struct buzzvm_clone_vstig_s* p = (struct buzzvm_clone_vstig_s*)params;
+   buzzvstig_elem_t e = *(buzzvstig_elem_t*)data;
+   buzzvstig_elem_t x = (buzzvstig_elem_t)malloc(sizeof(struct buzzvstig_elem_s));
+   memcpy(x, e, sizeof(struct buzzvstig_elem_s));
+   x->data = clone_obj(p->c, e->data);
+   /* The eviction data only exists in a bounded virtual stigmergy */
+   if(e->link) {
+      x->link = (buzzvstig_link_t)malloc(sizeof(struct buzzvstig_link_s));
+      memcpy(x->link, e->link, sizeof(struct buzzvstig_link_s));
+      x->link->key = clone_obj(p->c, e->link->key);
+      memset(x->link->prev, 0, sizeof(x->link->prev));
+      memset(x->link->next, 0, sizeof(x->link->next));
+   }
+   buzzobj_t k = clone_obj(p->c, *(buzzobj_t*)key);
+   buzzdict_set(p->dst->data, &k, &x);
+   buzzdict_set(p->elems, &e, &x);
+}
+
+static buzzvstig_elem_t clone_vstig_link(struct buzzvm_clone_vstig_s* p,
+                                         buzzvstig_elem_t e) {
+   if(!e) return NULL;
+   return *buzzdict_get(p->elems, &e, buzzvstig_elem_t);
+}
+
+static void clone_vstig_links(const void* key, void* data, void* params) {
+   struct buzzvm_clone_vstig_s* p = (struct buzzvm_clone_vstig_s*)params;
+   buzzvstig_elem_t e = *(buzzvstig_elem_t*)key;
+   buzzvstig_elem_t x = *(buzzvstig_elem_t*)data;
+   if(!e->link) return;
+   int l;
+   for(l = 0; l < 2; ++l) {
+      x->link->prev[l] = clone_vstig_link(p, e->link->prev[l]);
+      x->link->next[l] = clone_vstig_link(p, e->link->next[l]);
+   }
+}
+
+static void clone_vstig(const void* key, void* data, void* params) {
+   struct buzzvm_clone_dict_s* pd = (struct buzzvm_clone_dict_s*)params;
+   buzzvstig_t vs = *(buzzvstig_t*)data;
+   buzzvstig_t x = buzzvstig_new();
+   /* Entries */
+   struct buzzvm_clone_vstig_s p = {
+      .c = pd->c,
+      .dst = x,
+      .elems = buzzdict_new(buzzdict_size(vs->data) + 1,
+                            sizeof(buzzvstig_elem_t),
+                            sizeof(buzzvstig_elem_t),
+                            buzzdict_ptrkeyhash,
+                            buzzdict_ptrkeycmp,
+                            NULL)
+   };
+   buzzdict_foreach(vs->data, clone_vstig_elem, &p);
+   x->tombstones = vs->tombstones;
+   /* Conflict handling */
+   x->conflict = vs->conflict;
+   x->onconflict = clone_obj(pd->c, vs->onconflict);
+   x->onconflictlost = clone_obj(pd->c, vs->onconflictlost);
+   /* Limits, and the use and age lists */
+   x->limits = vs->limits;
+   x->limits.priority = clone_obj(pd->c, vs->limits.priority);
+   if(vs->limits.capacity > 0 || vs->limits.ttl > 0) {
+      int l;
+      for(l = 0; l < 2; ++l) {
+         x->limits.head[l] = clone_vstig_link(&p, vs->limits.head[l]);
+         x->limits.tail[l] = clone_vstig_link(&p, vs->limits.tail[l]);
+      }
+      buzzdict_foreach(p.elems, clone_vstig_links, &p);
+   }
+   /* Priority heap, in the same order */
+   if(vs->limits.heap) {
+      x->limits.heap = buzzdarray_new(buzzdarray_size(vs->limits.heap) + 1,
+                                      sizeof(buzzvstig_elem_t),
+                                      NULL);
+      uint32_t i;
+      for(i = 0; i < buzzdarray_size(vs->limits.heap); ++i) {
+         buzzvstig_elem_t e = clone_vstig_link(&p, buzzdarray_get(vs->limits.heap, i, buzzvstig_elem_t));
+         buzzdarray_push(x->limits.heap, &e);
+      }
+   }
+   buzzdict_destroy(&p.elems);
+   /* Anti-entropy state, hashed again for the keys that moved */
+   if(vs->sync.hashes) {
+      buzzvstig_sync_set(x, vs->sync.period, vs->sync.bandwidth);
+      x->sync.countdown = vs->sync.countdown;
+      x->sync.budget = vs->sync.budget;
+   }
+   /* Aggregates */
+   if(vs->aggs) {
+      x->aggs = buzzdarray_clone(vs->aggs);
+      uint32_t i;
+      for(i = 0; i < buzzdarray_size(x->aggs); ++i) {
+         buzzvstig_agg_t a = buzzdarray_get(vs->aggs, i, buzzvstig_agg_t);
+         buzzvstig_agg_t ax = (buzzvstig_agg_t)malloc(sizeof(struct buzzvstig_agg_s));
+         memcpy(ax, a, sizeof(struct buzzvstig_agg_s));
+         ax->filter = clone_obj(pd->c, a->filter);
+         ax->hist = (uint32_t*)clone_array(a->hist, a->bins, sizeof(uint32_t));
+         ((buzzvstig_agg_t*)x->aggs->data)[i] = ax;
+      }
+   }
+   /* The persistent log stays open in the original; the copy only
+    * remembers it, and buzzvm_fork() opens it again */
+   x->log = vs->log ? buzzvstiglog_clone(vs->log) : NULL;
+   buzzdict_set(pd->dst, key, &x);
+}
+
+/****************************************/
+/****************************************/
+
+static buzzneighbors_store_t clone_neighbors(buzzvm_clone_t c,
+                                             buzzneighbors_store_t s) {
+   buzzneighbors_store_t x = (buzzneighbors_store_t)malloc(sizeof(struct buzzneighbors_store_s));
+   memcpy(x, s, sizeof(struct buzzneighbors_store_s));
+   x->id        = (uint16_t*)clone_array(s->id,        s->capacity, sizeof(uint16_t));
+   x->distance  = (float*)clone_array(s->distance,     s->capacity, sizeof(float));
+   x->azimuth   = (float*)clone_array(s->azimuth,      s->capacity, sizeof(float));
+   x->elevation = (float*)clone_array(s->elevation,    s->capacity, sizeof(float));
+   x->age       = (uint32_t*)clone_array(s->age,       s->capacity, sizeof(uint32_t));
+   x->order     = (uint32_t*)clone_array(s->order,     s->capacity, sizeof(uint32_t));
+   x->data      = (buzzobj_t*)clone_array(s->data,     s->capacity, sizeof(buzzobj_t));
+   x->mname     = (buzzobj_t*)clone_array(s->mname,    s->nmethods, sizeof(buzzobj_t));
+   x->mfun      = (uint32_t*)clone_array(s->mfun,      s->nmethods, sizeof(uint32_t));
+   uint32_t i;
+   for(i = 0; i < s->size; ++i)
+      x->data[i] = clone_obj(c, s->data[i]);
+   for(i = 0; i < s->nmethods; ++i)
+      x->mname[i] = clone_obj(c, s->mname[i]);
+   return x;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Clones a VM.
+ * The object map of the clone is stored in objs, if not NULL.
+ */
+static buzzvm_t buzzvm_clone(buzzvm_t vm,
+                             buzzdict_t* objs) {
+   struct buzzvm_clone_s c;
+   c.src = vm;
+   /* Copy the plain fields, then replace the structures */
+   c.dst = (buzzvm_t)malloc(sizeof(struct buzzvm_s));
+   memcpy(c.dst, vm, sizeof(struct buzzvm_s));
+   c.objs = buzzdict_new(buzzdarray_size(vm->heap->objs) + 1,
+                         sizeof(buzzobj_t),
+                         sizeof(uint32_t),
+                         buzzdict_ptrkeyhash,
+                         buzzdict_ptrkeycmp,
+                         NULL);
+   buzzvm_t x = c.dst;
+   /* Strings and objects */
+   x->strings = buzzstrman_clone(vm->strings);
+   clone_heap(&c);
+   /* Stacks and symbols */
+   clone_stacks(&c);
+   x->gsyms = clone_dict(&c, vm->gsyms, clone_dict_objval);
+   x->flist = buzzdarray_clone(vm->flist);
+   /* Swarms */
+   x->swarms = clone_dict(&c, vm->swarms, clone_dict_plain);
+   x->swarmstack = buzzdarray_clone(vm->swarmstack);
+   x->swarmmembers = buzzswarm_members_clone(vm->swarmmembers);
+   /* Messages */
+   x->inmsgs = buzzinmsg_queue_clone(vm->inmsgs);
+   x->outmsgs = buzzoutmsg_queue_clone(vm->outmsgs);
+   /* Virtual stigmergies, listeners and neighbors */
+   x->vstigs = clone_dict(&c, vm->vstigs, clone_vstig);
+   x->listeners = clone_dict(&c, vm->listeners, clone_dict_objval);
+   x->neighbors = clone_neighbors(&c, vm->neighbors);
+   /* Host symbols and pinned objects */
+   x->hostsyms = buzzdarray_clone(vm->hostsyms);
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(x->hostsyms); ++i) {
+      buzzvm_hostsym_t h = (buzzvm_hostsym_t)x->hostsyms->data + i;
+      h->o = clone_obj(&c, h->o);
+   }
+   x->pins = clone_objlist(&c, vm->pins);
+   /* Error and random number generator */
+   if(vm->errormsg) x->errormsg = strdup(vm->errormsg);
+   x->rngstate = (int32_t*)clone_array(vm->rngstate,
+                                       BUZZSNAPSHOT_RNG_SIZE,
+                                       sizeof(int32_t));
+   /* Profilers and counters are not shared */
+   x->prof = NULL;
+   x->stats = NULL;
+   if(objs) *objs = c.objs;
+   else buzzdict_destroy(&c.objs);
+   return x;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_snapshot_t buzzvm_snapshot(buzzvm_t vm) {
+   buzzvm_snapshot_t s = (buzzvm_snapshot_t)malloc(sizeof(struct buzzvm_snapshot_s));
+   s->vm = buzzvm_clone(vm, &s->objs);
+   return s;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvm_snapshot_destroy(buzzvm_snapshot_t* s) {
+   buzzvm_destroy(&(*s)->vm);
+   buzzdict_destroy(&(*s)->objs);
+   free(*s);
+   *s = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Opens the log of a virtual stigmergy of a fork, and replays it over the
+ * entries of the snapshot.
+ */
+static void fork_vstiglog(const void* key, void* data, void* params) {
+   buzzvm_t vm = (buzzvm_t)params;
+   buzzvstig_t vs = *(buzzvstig_t*)data;
+   if(!vs->log) return;
+   /* The replayed records must not be appended to the log again */
+   buzzvstiglog_t closed = vs->log;
+   vs->log = NULL;
+   vs->log = buzzvstiglog_reopen(vm, vs, closed);
+   if(!vs->log)
+      fprintf(stderr, "[WARNING] [ROBOT %u] Can't open virtual stigmergy log %s: %s\n", vm->robot, closed->fname, strerror(errno));
+   buzzvstiglog_close(&closed);
+}
+
+buzzvm_t buzzvm_fork(buzzvm_snapshot_t s) {
+   buzzvm_t vm = buzzvm_clone(s->vm, NULL);
+   buzzdict_foreach(vm->vstigs, fork_vstiglog, vm);
+   return vm;
+}
+
+/****************************************/
+/****************************************/
+
+buzzobj_t buzzvm_snapshot_obj(buzzvm_snapshot_t s,
+                              buzzvm_t vm,
+                              buzzobj_t o) {
+   const uint32_t* pos = buzzdict_get(s->objs, &o, uint32_t);
+   if(!pos || *pos >= buzzdarray_size(vm->heap->objs)) return NULL;
+   return buzzdarray_get(vm->heap->objs, *pos, buzzobj_t);
+}
+
+/****************************************/
+/****************************************/
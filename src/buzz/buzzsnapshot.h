@@ -0,0 +1,77 @@
+#ifndef BUZZSNAPSHOT_H
+#define BUZZSNAPSHOT_H
+
+#include <buzz/buzzvm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * A frozen copy of the state of a VM.
+    *
+    * A snapshot holds the heap, the stacks, the global symbols, the
+    * strings, the swarms, the virtual stigmergies, the neighbors and the
+    * message queues of a VM. Forking a snapshot makes a new VM that
+    * resumes from that state, without running the script again.
+    *
+    * The bytecode, the C closures, the data passed with the host symbols
+    * and the user data without a clone function are shared with the
+    * original VM, so they must stay valid for as long as the snapshot
+    * and its forks.
+    *
+    * A fork opens the persistent logs of the virtual stigmergies again,
+    * and replays them over the entries of the snapshot, so the changes
+    * made since the snapshot are kept. A log can be open in one VM only:
+    * fork after destroying the VM that holds it, or the fork runs without
+    * persistence.
+    */
+   typedef struct buzzvm_snapshot_s* buzzvm_snapshot_t;
+
+   /*
+    * Takes a snapshot of a VM.
+    * The VM is only read, so it must not be stepped by another thread in
+    * the meantime.
+    * @param vm The VM data.
+    * @return The snapshot.
+    */
+   extern buzzvm_snapshot_t buzzvm_snapshot(buzzvm_t vm);
+
+   /*
+    * Destroys a snapshot.
+    * The forks are not affected.
+    * @param s The snapshot.
+    */
+   extern void buzzvm_snapshot_destroy(buzzvm_snapshot_t* s);
+
+   /*
+    * Creates a new VM from a snapshot.
+    * The new VM is independent from the snapshot and from the other forks.
+    * The snapshot is only read, so several threads can fork it at once.
+    * The persistent logs of the virtual stigmergies are opened and
+    * replayed, which may call the priority closures of the fork.
+    * @param s The snapshot.
+    * @return A new VM.
+    */
+   extern buzzvm_t buzzvm_fork(buzzvm_snapshot_t s);
+
+   /*
+    * Returns the object of a fork that corresponds to an object of the
+    * VM the snapshot was taken from.
+    * The host uses it to find the objects it kept a handle to, such as
+    * host symbols or pinned objects. The fork must not have run any
+    * code yet, since garbage collection moves the objects around.
+    * @param s The snapshot.
+    * @param vm A fork of the snapshot.
+    * @param o An object of the original VM at the time of the snapshot.
+    * @return The corresponding object, or NULL if it is unknown.
+    */
+   extern buzzobj_t buzzvm_snapshot_obj(buzzvm_snapshot_t s,
+                                        buzzvm_t vm,
+                                        buzzobj_t o);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,390 @@
+#include "buzzstats.h"
+#include "buzzprof.h"
+#include <buzz/config.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+/****************************************/
+/****************************************/
+
+#define BUZZVM_STATS_BUCKETS 64
+
+/*
+ * A running Buzz function.
+ */
+struct buzzvm_stats_frame_s {
+   /* Size of vm->lsymts when the function was called */
+   uint32_t depth;
+   /* Entry point of the function */
+   int32_t ref;
+   /* Cycle count at the call */
+   uint64_t t0;
+};
+
+/****************************************/
+/****************************************/
+
+int buzzvm_stats_enable(buzzvm_t vm,
+                        int on) {
+#ifdef BUZZ_STATS
+   if(on && !vm->stats) {
+      vm->stats = (struct buzzvm_stats_s*)calloc(1, sizeof(struct buzzvm_stats_s));
+      vm->stats->cfuns = buzzdarray_new(16, sizeof(struct buzzvm_stats_counter_s), NULL);
+      vm->stats->funs = buzzdict_new(BUZZVM_STATS_BUCKETS,
+                                     sizeof(int32_t),
+                                     sizeof(struct buzzvm_stats_counter_s),
+                                     buzzdict_int32keyhash,
+                                     buzzdict_int32keycmp,
+                                     NULL);
+      vm->stats->frames = buzzdarray_new(16, sizeof(struct buzzvm_stats_frame_s), NULL);
+   }
+#else
+   if(on) return 0;
+#endif
+   if(!on && vm->stats) {
+      buzzdarray_destroy(&vm->stats->cfuns);
+      buzzdict_destroy(&vm->stats->funs);
+      buzzdarray_destroy(&vm->stats->frames);
+      free(vm->stats);
+      vm->stats = NULL;
+   }
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvm_stats_reset(buzzvm_t vm) {
+   if(!vm->stats) return;
+   buzzvm_stats_enable(vm, 0);
+   buzzvm_stats_enable(vm, 1);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvm_stats_get(buzzvm_t vm,
+                     struct buzzvm_stats_s* stats) {
+   if(!vm->stats) return 0;
+   *stats = *vm->stats;
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvm_stats_instr(buzzvm_t vm,
+                        uint8_t instr,
+                        uint64_t t0) {
+   if(instr >= BUZZVM_INSTR_COUNT) return;
+   ++vm->stats->instr[instr].count;
+   vm->stats->instr[instr].cycles += buzzvm_stats_clock() - t0;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvm_stats_cfun(buzzvm_t vm,
+                       uint32_t ref,
+                       uint64_t t0) {
+   uint64_t t1 = buzzvm_stats_clock();
+   /* The C function may have disabled the counters */
+   if(!vm->stats) return;
+   buzzdarray_t c = vm->stats->cfuns;
+   static const struct buzzvm_stats_counter_s ZERO = { 0, 0 };
+   while(buzzdarray_size(c) <= ref) buzzdarray_push(c, &ZERO);
+   struct buzzvm_stats_counter_s* x =
+      (struct buzzvm_stats_counter_s*)c->data + ref;
+   ++x->count;
+   x->cycles += t1 - t0;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvm_stats_call(buzzvm_t vm) {
+   if(!vm->lsyms->isnative) return;
+   buzzdarray_t f = vm->stats->frames;
+   struct buzzvm_stats_frame_s fr;
+   fr.depth = buzzdarray_size(vm->lsymts);
+   fr.ref = vm->lsyms->ref;
+   /* Drop the functions that never returned, e.g. after an error */
+   while(!buzzdarray_isempty(f) &&
+         buzzdarray_last(f, struct buzzvm_stats_frame_s).depth >= fr.depth)
+      buzzdarray_pop(f);
+   /* Count the call */
+   struct buzzvm_stats_counter_s* x =
+      (struct buzzvm_stats_counter_s*)
+      buzzdict_rawget(vm->stats->funs, &fr.ref);
+   if(x) ++x->count;
+   else {
+      struct buzzvm_stats_counter_s c = { 1, 0 };
+      buzzdict_set(vm->stats->funs, &fr.ref, &c);
+   }
+   fr.t0 = buzzvm_stats_clock();
+   buzzdarray_push(f, &fr);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvm_stats_ret(buzzvm_t vm) {
+   if(!vm->lsyms->isnative) return;
+   uint64_t t1 = buzzvm_stats_clock();
+   buzzdarray_t f = vm->stats->frames;
+   uint32_t depth = buzzdarray_size(vm->lsymts);
+   while(!buzzdarray_isempty(f) &&
+         buzzdarray_last(f, struct buzzvm_stats_frame_s).depth > depth)
+      buzzdarray_pop(f);
+   if(buzzdarray_isempty(f)) return;
+   const struct buzzvm_stats_frame_s* fr =
+      &buzzdarray_last(f, struct buzzvm_stats_frame_s);
+   /* Functions called before the counters were enabled have no frame */
+   if(fr->depth != depth) return;
+   struct buzzvm_stats_counter_s* x =
+      (struct buzzvm_stats_counter_s*)
+      buzzdict_rawget(vm->stats->funs, &fr->ref);
+   if(x) x->cycles += t1 - fr->t0;
+   buzzdarray_pop(f);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Helpers to sort the Buzz functions by entry point.
+ */
+
+struct buzzvm_stats_fun_s {
+   int32_t ref;
+   struct buzzvm_stats_counter_s c;
+};
+
+static void buzzvm_stats_funs_collect(const void* key, void* data, void* params) {
+   struct buzzvm_stats_fun_s x;
+   x.ref = *(int32_t*)key;
+   x.c = *(struct buzzvm_stats_counter_s*)data;
+   buzzdarray_push((buzzdarray_t)params, &x);
+}
+
+static int buzzvm_stats_funs_cmp(const void* a, const void* b) {
+   int32_t x = ((const struct buzzvm_stats_fun_s*)a)->ref;
+   int32_t y = ((const struct buzzvm_stats_fun_s*)b)->ref;
+   return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static buzzdarray_t buzzvm_stats_funs_sorted(buzzvm_t vm) {
+   buzzdarray_t a = buzzdarray_new(buzzdict_size(vm->stats->funs) + 1,
+                                   sizeof(struct buzzvm_stats_fun_s),
+                                   NULL);
+   buzzdict_foreach(vm->stats->funs, buzzvm_stats_funs_collect, a);
+   buzzdarray_sort(a, buzzvm_stats_funs_cmp);
+   return a;
+}
+
+static const char* buzzvm_stats_name(buzzdict_t names, int32_t code) {
+   const char** n = buzzdict_get(names, &code, char*);
+   return n ? *n : NULL;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Writes a JSON string.
+ */
+static void json_string(FILE* f, const char* s) {
+   fputc('"', f);
+   for(; *s; ++s) {
+      if(*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+      else if((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+      else fputc(*s, f);
+   }
+   fputc('"', f);
+}
+
+static void json_counter(FILE* f, const struct buzzvm_stats_counter_s* c) {
+   fprintf(f, "\"count\": %" PRIu64 ", \"cycles\": %" PRIu64, c->count, c->cycles);
+}
+
+int buzzvm_stats_write_json(buzzvm_t vm,
+                            FILE* f) {
+   if(!vm->stats) return -1;
+   struct buzzvm_stats_s* s = vm->stats;
+   buzzdict_t names = buzzprof_names(vm);
+   uint32_t i;
+   int sep;
+   fprintf(f, "{\n  \"clock\": \"%s\",\n", BUZZVM_STATS_CLOCK);
+   /* Opcodes */
+   fprintf(f, "  \"instructions\": {");
+   for(i = 0, sep = 0; i < BUZZVM_INSTR_COUNT; ++i) {
+      if(!s->instr[i].count) continue;
+      fprintf(f, "%s\n    \"%s\": { ", sep++ ? "," : "", buzzvm_instr_desc[i]);
+      json_counter(f, s->instr + i);
+      fprintf(f, " }");
+   }
+   fprintf(f, "\n  },\n");
+   /* C closures */
+   fprintf(f, "  \"cfunctions\": [");
+   for(i = 0, sep = 0; i < buzzdarray_size(s->cfuns); ++i) {
+      const struct buzzvm_stats_counter_s* c =
+         &buzzdarray_get(s->cfuns, i, struct buzzvm_stats_counter_s);
+      if(!c->count) continue;
+      fprintf(f, "%s\n    { \"index\": %" PRIu32 ", \"name\": ", sep++ ? "," : "", i);
+      const char* n = buzzvm_stats_name(names, BUZZPROF_CFUN(i));
+      if(n) json_string(f, n);
+      else fprintf(f, "null");
+      fprintf(f, ", ");
+      json_counter(f, c);
+      fprintf(f, " }");
+   }
+   fprintf(f, "\n  ],\n");
+   /* Buzz functions */
+   fprintf(f, "  \"functions\": [");
+   buzzdarray_t funs = buzzvm_stats_funs_sorted(vm);
+   for(i = 0; i < buzzdarray_size(funs); ++i) {
+      const struct buzzvm_stats_fun_s* x =
+         &buzzdarray_get(funs, i, struct buzzvm_stats_fun_s);
+      fprintf(f, "%s\n    { \"offset\": %" PRId32 ", \"name\": ", i ? "," : "", x->ref);
+      const char* n = buzzvm_stats_name(names, x->ref);
+      if(n) json_string(f, n);
+      else fprintf(f, "null");
+      fprintf(f, ", ");
+      json_counter(f, &x->c);
+      fprintf(f, " }");
+   }
+   buzzdarray_destroy(&funs);
+   fprintf(f, "\n  ],\n");
+   /* Allocations */
+   fprintf(f, "  \"allocations\": {");
+   for(i = 0, sep = 0; i < BUZZVM_STATS_TYPES; ++i) {
+      if(!s->allocs[i]) continue;
+      fprintf(f, "%s\n    \"%s\": %" PRIu64, sep++ ? "," : "", buzztype_desc[i], s->allocs[i]);
+   }
+   fprintf(f, "\n  }\n}\n");
+   buzzdict_destroy(&names);
+   return ferror(f) ? -1 : 0;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Pushes a counter value. Values beyond the range of integers are pushed
+ * as floats.
+ */
+static void buzzvm_stats_pushnum(buzzvm_t vm, uint64_t v) {
+   if(v <= INT32_MAX) buzzvm_pushi(vm, (int32_t)v);
+   else buzzvm_pushf(vm, (float)v);
+}
+
+/*
+ * Pushes a table key: the name if known, the number otherwise.
+ */
+static void buzzvm_stats_pushkey(buzzvm_t vm, const char* name, int32_t n) {
+   if(name) buzzvm_pushs(vm, buzzvm_string_register(vm, name, 0));
+   else buzzvm_pushi(vm, n);
+}
+
+/*
+ * Sets key = { count = ..., cycles = ... } in the table on top of the stack.
+ */
+static void buzzvm_stats_putcounter(buzzvm_t vm,
+                                    const char* name,
+                                    int32_t n,
+                                    const struct buzzvm_stats_counter_s* c) {
+   buzzvm_dup(vm);
+   buzzvm_stats_pushkey(vm, name, n);
+   buzzvm_pusht(vm);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "count", 1));
+   buzzvm_stats_pushnum(vm, c->count);
+   buzzvm_tput(vm);
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "cycles", 1));
+   buzzvm_stats_pushnum(vm, c->cycles);
+   buzzvm_tput(vm);
+   buzzvm_tput(vm);
+}
+
+int buzzvm_stats_table(buzzvm_t vm) {
+   if(!vm->stats) {
+      buzzvm_pushnil(vm);
+      return buzzvm_ret1(vm);
+   }
+   struct buzzvm_stats_s* s = vm->stats;
+   buzzdict_t names = buzzprof_names(vm);
+   uint32_t i;
+   buzzvm_pusht(vm);
+   /* Opcodes */
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "instructions", 1));
+   buzzvm_pusht(vm);
+   for(i = 0; i < BUZZVM_INSTR_COUNT; ++i)
+      if(s->instr[i].count)
+         buzzvm_stats_putcounter(vm, buzzvm_instr_desc[i], i, s->instr + i);
+   buzzvm_tput(vm);
+   /* C closures */
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "cfunctions", 1));
+   buzzvm_pusht(vm);
+   for(i = 0; i < buzzdarray_size(s->cfuns); ++i) {
+      const struct buzzvm_stats_counter_s* c =
+         &buzzdarray_get(s->cfuns, i, struct buzzvm_stats_counter_s);
+      if(c->count)
+         buzzvm_stats_putcounter(vm, buzzvm_stats_name(names, BUZZPROF_CFUN(i)), i, c);
+   }
+   buzzvm_tput(vm);
+   /* Buzz functions */
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "functions", 1));
+   buzzvm_pusht(vm);
+   buzzdarray_t funs = buzzvm_stats_funs_sorted(vm);
+   for(i = 0; i < buzzdarray_size(funs); ++i) {
+      const struct buzzvm_stats_fun_s* x =
+         &buzzdarray_get(funs, i, struct buzzvm_stats_fun_s);
+      buzzvm_stats_putcounter(vm, buzzvm_stats_name(names, x->ref), x->ref, &x->c);
+   }
+   buzzdarray_destroy(&funs);
+   buzzvm_tput(vm);
+   /* Allocations */
+   buzzvm_dup(vm);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "allocations", 1));
+   buzzvm_pusht(vm);
+   for(i = 0; i < BUZZVM_STATS_TYPES; ++i) {
+      if(!s->allocs[i]) continue;
+      buzzvm_dup(vm);
+      buzzvm_pushs(vm, buzzvm_string_register(vm, buzztype_desc[i], 1));
+      buzzvm_stats_pushnum(vm, s->allocs[i]);
+      buzzvm_tput(vm);
+   }
+   buzzvm_tput(vm);
+   buzzdict_destroy(&names);
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+buzzvm_state buzzvm_stats_register(buzzvm_t vm) {
+   /* Get the debug table, or make it */
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "debug", 1));
+   buzzvm_gload(vm);
+   if(buzzvm_stack_at(vm, 1)->o.type != BUZZTYPE_TABLE) {
+      buzzvm_pop(vm);
+      buzzvm_pushs(vm, buzzvm_string_register(vm, "debug", 1));
+      buzzvm_pusht(vm);
+      buzzvm_gstore(vm);
+      buzzvm_pushs(vm, buzzvm_string_register(vm, "debug", 1));
+      buzzvm_gload(vm);
+   }
+   /* Add debug.stats() */
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "stats", 1));
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, buzzvm_stats_table));
+   buzzvm_tput(vm);
+   return vm->state;
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,156 @@
+#ifndef BUZZSTATS_H
+#define BUZZSTATS_H
+
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Number of object types counted in the allocations.
+    */
+#define BUZZVM_STATS_TYPES 7
+
+   /*
+    * An execution counter.
+    */
+   struct buzzvm_stats_counter_s {
+      /* Number of executions */
+      uint64_t count;
+      /* Cumulative cycles */
+      uint64_t cycles;
+   };
+
+   /*
+    * The VM execution counters.
+    *
+    * The counters are compiled in when Buzz is configured with BUZZ_STATS
+    * (the default), and they are updated only for the VMs where they were
+    * enabled with buzzvm_stats_enable(). Otherwise, the VM only checks
+    * vm->stats once per instruction.
+    *
+    * Cycles are read from the time stamp counter where available, and in
+    * nanoseconds otherwise. The cycles of a call to a C closure include
+    * the whole C function; the cycles of a Buzz function run from the
+    * call to the return and include the functions it calls.
+    */
+   struct buzzvm_stats_s {
+      /* Counters per opcode */
+      struct buzzvm_stats_counter_s instr[BUZZVM_INSTR_COUNT];
+      /* Counters per C closure, indexed as vm->flist */
+      buzzdarray_t cfuns;
+      /* Counters per Buzz function, by entry point */
+      buzzdict_t funs;
+      /* Allocations per object type */
+      uint64_t allocs[BUZZVM_STATS_TYPES];
+      /* Running Buzz functions (internal) */
+      buzzdarray_t frames;
+   };
+
+   /*
+    * The source of the cycle counts, as written in the JSON dump.
+    */
+#if defined(__x86_64__) || defined(__i386__)
+#define BUZZVM_STATS_CLOCK "tsc"
+#elif defined(__aarch64__)
+#define BUZZVM_STATS_CLOCK "cntvct"
+#else
+#define BUZZVM_STATS_CLOCK "ns"
+#endif
+
+   /*
+    * Returns the current cycle count.
+    */
+   static inline uint64_t buzzvm_stats_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+      return __rdtsc();
+#elif defined(__aarch64__)
+      uint64_t t;
+      __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+      return t;
+#else
+      struct timespec t;
+      clock_gettime(CLOCK_MONOTONIC, &t);
+      return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+#endif
+   }
+
+   /*
+    * Enables or disables the execution counters of a VM.
+    * Disabling the counters discards them.
+    * @param vm The VM data.
+    * @param on 1 to enable the counters, 0 to disable them.
+    * @return 1 on success, 0 if the counters were not compiled in.
+    */
+   extern int buzzvm_stats_enable(buzzvm_t vm,
+                                  int on);
+
+   /*
+    * Sets all the counters of a VM to zero.
+    * @param vm The VM data.
+    */
+   extern void buzzvm_stats_reset(buzzvm_t vm);
+
+   /*
+    * Copies the counters of a VM.
+    * The containers in the copy belong to the VM, and they are valid until
+    * the counters are disabled.
+    * @param vm The VM data.
+    * @param stats The counters.
+    * @return 1 if the counters are enabled, 0 otherwise.
+    */
+   extern int buzzvm_stats_get(buzzvm_t vm,
+                               struct buzzvm_stats_s* stats);
+
+   /*
+    * Writes the counters as JSON.
+    * Only the opcodes and functions that were executed are written.
+    * @param vm The VM data.
+    * @param f The file to write into.
+    * @return 0 on success, -1 on error or if the counters are disabled.
+    */
+   extern int buzzvm_stats_write_json(buzzvm_t vm,
+                                      FILE* f);
+
+   /*
+    * C closure that pushes the counters as a table, or nil if they are
+    * disabled. Hosts register it as debug.stats().
+    * @param vm The VM data.
+    * @return The VM state.
+    */
+   extern int buzzvm_stats_table(buzzvm_t vm);
+
+   /*
+    * Adds stats() to the global 'debug' table, creating the table if
+    * needed.
+    * @param vm The VM data.
+    * @return The VM state.
+    */
+   extern buzzvm_state buzzvm_stats_register(buzzvm_t vm);
+
+   /*
+    * Hooks called by the VM when the counters are enabled.
+    */
+   extern void buzzvm_stats_instr(buzzvm_t vm,
+                                  uint8_t instr,
+                                  uint64_t t0);
+
+   extern void buzzvm_stats_cfun(buzzvm_t vm,
+                                 uint32_t ref,
+                                 uint64_t t0);
+
+   extern void buzzvm_stats_call(buzzvm_t vm);
+
+   extern void buzzvm_stats_ret(buzzvm_t vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -188,6 +188,27 @@ void buzzstrman_destroy(buzzstrman_t* sm) {
 /****************************************/
 /****************************************/
 
+static void buzzstrman_clone_str(const void* key,
+                                 void* data,
+                                 void* param) {
+   buzzstrman_t sm = (buzzstrman_t)param;
+   buzzid2strdata_t sd = *(buzzid2strdata_t*)data;
+   char* str = strdup(sd->str);
+   buzzid2strdata_t sd2 = buzzid2strdata_new(str, sd->protect);
+   buzzdict_set(sm->str2id, &str, key);
+   buzzdict_set(sm->id2str, key, &sd2);
+}
+
+buzzstrman_t buzzstrman_clone(buzzstrman_t sm) {
+   buzzstrman_t x = buzzstrman_new();
+   buzzdict_foreach(sm->id2str, buzzstrman_clone_str, x);
+   x->maxsid = sm->maxsid;
+   return x;
+}
+
+/****************************************/
+/****************************************/
+
 uint16_t buzzstrman_register(buzzstrman_t sm,
                              const char* str,
                              int protect) {
@@ -225,6 +246,15 @@ uint16_t buzzstrman_register(buzzstrman_t sm,
 /****************************************/
 /****************************************/
 
+int32_t buzzstrman_find(buzzstrman_t sm,
+                        const char* str) {
+   const uint16_t* id = buzzdict_get(sm->str2id, &str, uint16_t);
+   return id ? *id : -1;
+}
+
+/****************************************/
+/****************************************/
+
 const char* buzzstrman_get(buzzstrman_t sm,
                            uint16_t sid) {
    const buzzid2strdata_t* x = buzzdict_get(sm->id2str, &sid, buzzid2strdata_t);
@@ -27,6 +27,15 @@ extern "C" {
     */
    extern void buzzstrman_destroy(buzzstrman_t* sm);
 
+   /**
+    * Clones a string manager.
+    * The strings keep their ids and protected flags.
+    * The source is only read, so it can be cloned by several threads at once.
+    * @param sm The string manager.
+    * @return A new string manager.
+    */
+   extern buzzstrman_t buzzstrman_clone(buzzstrman_t sm);
+
    /**
     * Registers a string into the string manager.
     * The string is cloned internally.
@@ -43,6 +52,17 @@ extern "C" {
                                        const char* str,
                                        int protect);
 
+   /*
+    * Looks for the id of a string without registering it.
+    * The string manager is only read, so several threads can look
+    * strings up at once.
+    * @param sm The string manager.
+    * @param str The string.
+    * @return The id associated to the given string, or -1 if not found.
+    */
+   extern int32_t buzzstrman_find(buzzstrman_t sm,
+                                  const char* str);
+
    /*
     * Get the string corresponding to the given string id.
     * @param sm The string manager.
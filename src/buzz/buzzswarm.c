@@ -2,6 +2,7 @@
 #include "buzzvm.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /****************************************/
 /****************************************/
@@ -22,47 +23,209 @@
 /****************************************/
 
 /*
- * An element in the data structure that stores robot
- * membership data.
+ * Makes sure an array of count elements of the given size has room for
+ * at least n elements. New elements are zeroed.
  */
-struct buzzswarm_elem_s {
-   buzzdarray_t swarms;
-   uint16_t age;
-};
-typedef struct buzzswarm_elem_s* buzzswarm_elem_t;
+static void* members_grow(void* a, uint32_t* count, uint32_t n, size_t size) {
+   if(n <= *count) return a;
+   uint32_t c = *count ? *count : 8;
+   while(c < n) c *= 2;
+   a = realloc(a, c * size);
+   memset((uint8_t*)a + *count * size, 0, (c - *count) * size);
+   *count = c;
+   return a;
+}
+
+/*
+ * Returns the bitset of the robot at the given position.
+ */
+#define members_bits(m, pos) ((m)->bits + (size_t)(pos) * (m)->words)
 
-buzzswarm_elem_t buzzswarm_elem_new() {
-   buzzswarm_elem_t e = (buzzswarm_elem_t)malloc(sizeof(struct buzzswarm_elem_s));
-   e->swarms = buzzdarray_new(1, sizeof(uint16_t), NULL);
-   e->age = 0;
-   return e;
+/*
+ * Returns the position of a robot, or -1 if the robot is unknown.
+ */
+static int64_t members_find(buzzswarm_members_t m, uint16_t robot) {
+   if(robot >= m->nslots || !m->slots[robot]) return -1;
+   return m->slots[robot] - 1;
 }
 
-void buzzswarm_elem_destroy(const void* key, void* data, void* params) {
-   buzzswarm_elem_t e = *(buzzswarm_elem_t*)data;
-   buzzdarray_destroy(&(e->swarms));
-   free(e);
-   free((void*)key);
-   free(data);
+/*
+ * Returns the column of a swarm, or -1 if the swarm has no known members.
+ */
+static int32_t members_column(buzzswarm_members_t m, uint16_t swarm) {
+   if(swarm >= m->ncols || !m->cols[swarm]) return -1;
+   return m->cols[swarm] - 1;
+}
+
+/*
+ * Returns the position of a robot, adding it if necessary.
+ */
+static uint32_t members_add(buzzswarm_members_t m, uint16_t robot) {
+   int64_t pos = members_find(m, robot);
+   if(pos >= 0) return pos;
+   if(m->size == m->capacity) {
+      m->capacity = m->capacity ? m->capacity * 2 : 8;
+      m->robots = (uint16_t*)realloc(m->robots, m->capacity * sizeof(uint16_t));
+      m->ages = (uint16_t*)realloc(m->ages, m->capacity * sizeof(uint16_t));
+      m->bits = (uint64_t*)realloc(m->bits, (size_t)m->capacity * m->words * sizeof(uint64_t));
+      m->versions = (uint16_t*)realloc(m->versions, m->capacity * sizeof(uint16_t));
+      m->hashes = (uint32_t*)realloc(m->hashes, m->capacity * sizeof(uint32_t));
+   }
+   m->slots = (uint32_t*)members_grow(m->slots, &m->nslots, robot + 1, sizeof(uint32_t));
+   m->robots[m->size] = robot;
+   m->ages[m->size] = 0;
+   m->versions[m->size] = 0;
+   m->hashes[m->size] = 0;
+   memset(members_bits(m, m->size), 0, m->words * sizeof(uint64_t));
+   m->slots[robot] = ++m->size;
+   return m->size - 1;
+}
+
+/*
+ * Returns the column of a swarm, assigning a free one if necessary.
+ */
+static uint16_t members_column_add(buzzswarm_members_t m, uint16_t swarm) {
+   int32_t c = members_column(m, swarm);
+   if(c >= 0) return c;
+   /* Reuse a column whose swarm has no more known members */
+   for(c = 0; c < m->used && m->counts[c]; ++c);
+   if(c == m->used) {
+      /* Make room for a new column */
+      if(m->used == m->words * 64) {
+         /* Widen all the bitsets by one word */
+         uint16_t w = m->words + 1;
+         uint64_t* bits = (uint64_t*)calloc((size_t)(m->capacity ? m->capacity : 1) * w,
+                                            sizeof(uint64_t));
+         uint32_t i;
+         for(i = 0; i < m->size; ++i)
+            memcpy(bits + (size_t)i * w, members_bits(m, i), m->words * sizeof(uint64_t));
+         free(m->bits);
+         m->bits = bits;
+         m->words = w;
+      }
+      ++m->used;
+      m->sids = (uint16_t*)realloc(m->sids, m->used * sizeof(uint16_t));
+      m->counts = (uint32_t*)realloc(m->counts, m->used * sizeof(uint32_t));
+      m->counts[c] = 0;
+   }
+   m->cols = (uint16_t*)members_grow(m->cols, &m->ncols, swarm + 1, sizeof(uint16_t));
+   m->cols[swarm] = c + 1;
+   m->sids[c] = swarm;
+   return c;
+}
+
+/*
+ * Sets or clears a bit in the bitset of a robot, keeping the counts
+ * and the hash up to date. A column whose count drops to zero is released.
+ */
+static void members_set(buzzswarm_members_t m, uint32_t pos, uint16_t c, int in) {
+   uint64_t* w = members_bits(m, pos) + c / 64;
+   uint64_t b = (uint64_t)1 << (c % 64);
+   if(in && !(*w & b)) {
+      *w |= b;
+      ++m->counts[c];
+      m->hashes[pos] += buzzswarm_hash(m->sids[c]);
+   }
+   else if(!in && (*w & b)) {
+      *w &= ~b;
+      m->hashes[pos] -= buzzswarm_hash(m->sids[c]);
+      if(--m->counts[c] == 0) m->cols[m->sids[c]] = 0;
+   }
+}
+
+/*
+ * Clears the bitset of a robot.
+ */
+static void members_clear(buzzswarm_members_t m, uint32_t pos) {
+   uint16_t c;
+   for(c = 0; c < m->used; ++c)
+      members_set(m, pos, c, 0);
+}
+
+/*
+ * Returns 1 if the bitset of a robot is empty, 0 otherwise.
+ */
+static int members_isempty(buzzswarm_members_t m, uint32_t pos) {
+   uint64_t* w = members_bits(m, pos);
+   uint16_t i;
+   for(i = 0; i < m->words; ++i)
+      if(w[i]) return 0;
+   return 1;
+}
+
+/*
+ * Forgets the robot at the given position.
+ * The last robot takes its place.
+ */
+static void members_remove(buzzswarm_members_t m, uint32_t pos) {
+   members_clear(m, pos);
+   m->slots[m->robots[pos]] = 0;
+   --m->size;
+   if(pos < m->size) {
+      m->robots[pos] = m->robots[m->size];
+      m->ages[pos] = m->ages[m->size];
+      m->versions[pos] = m->versions[m->size];
+      m->hashes[pos] = m->hashes[m->size];
+      memcpy(members_bits(m, pos), members_bits(m, m->size), m->words * sizeof(uint64_t));
+      m->slots[m->robots[pos]] = pos + 1;
+   }
 }
 
 /****************************************/
 /****************************************/
 
 buzzswarm_members_t buzzswarm_members_new() {
-   return buzzdict_new(10,
-                       sizeof(uint16_t),
-                       sizeof(buzzswarm_elem_t),
-                       buzzdict_uint16keyhash,
-                       buzzdict_uint16keycmp,
-                       buzzswarm_elem_destroy);
+   buzzswarm_members_t m = (buzzswarm_members_t)calloc(1, sizeof(struct buzzswarm_members_s));
+   m->words = 1;
+   return m;
 }
 
 /****************************************/
 /****************************************/
 
 void buzzswarm_members_destroy(buzzswarm_members_t* m) {
-   buzzdict_destroy(m);
+   free((*m)->cols);
+   free((*m)->sids);
+   free((*m)->counts);
+   free((*m)->slots);
+   free((*m)->robots);
+   free((*m)->ages);
+   free((*m)->bits);
+   free((*m)->versions);
+   free((*m)->hashes);
+   free(*m);
+   *m = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns a copy of an array of count elements of the given size.
+ */
+static void* members_dup(const void* a, size_t count, size_t size) {
+   if(!a) return NULL;
+   void* x = malloc(count * size);
+   memcpy(x, a, count * size);
+   return x;
+}
+
+buzzswarm_members_t buzzswarm_members_clone(buzzswarm_members_t m) {
+   buzzswarm_members_t x = (buzzswarm_members_t)malloc(sizeof(struct buzzswarm_members_s));
+   *x = *m;
+   x->cols     = (uint16_t*)members_dup(m->cols, m->ncols, sizeof(uint16_t));
+   x->sids     = (uint16_t*)members_dup(m->sids, m->used, sizeof(uint16_t));
+   x->counts   = (uint32_t*)members_dup(m->counts, m->used, sizeof(uint32_t));
+   x->slots    = (uint32_t*)members_dup(m->slots, m->nslots, sizeof(uint32_t));
+   x->robots   = (uint16_t*)members_dup(m->robots, m->capacity, sizeof(uint16_t));
+   x->ages     = (uint16_t*)members_dup(m->ages, m->capacity, sizeof(uint16_t));
+   x->versions = (uint16_t*)members_dup(m->versions, m->capacity, sizeof(uint16_t));
+   x->hashes   = (uint32_t*)members_dup(m->hashes, m->capacity, sizeof(uint32_t));
+   /* The bitsets are widened with room for at least one robot */
+   x->bits     = (uint64_t*)members_dup(m->bits,
+                                        (size_t)(m->capacity ? m->capacity : 1) * m->words,
+                                        sizeof(uint64_t));
+   return x;
 }
 
 /****************************************/
@@ -71,26 +234,9 @@ void buzzswarm_members_destroy(buzzswarm_members_t* m) {
 void buzzswarm_members_join(buzzswarm_members_t m,
                             uint16_t robot,
                             uint16_t swarm) {
-   /* Is an entry for the passed robot already present? */
-   const buzzswarm_elem_t* e = buzzdict_get(m, &robot, buzzswarm_elem_t);
-   if(e) {
-      /* Yes, update it */
-      (*e)->age = 0;
-      /* Search for the passed id; if found, nothing to do */
-      uint32_t i;
-      for(i = 0; i < buzzdarray_size((*e)->swarms); ++i) {
-         if(buzzdarray_get((*e)->swarms, i, uint16_t) == swarm) return;
-      }
-      /* If we get here, it's because we got new information - add it */
-      buzzdarray_push((*e)->swarms, &swarm);
-   }
-   else {
-      /* No, create it */
-      buzzswarm_elem_t ne = buzzswarm_elem_new();
-      buzzdarray_push(ne->swarms, &swarm);
-      /* Add it to the structure */
-      buzzdict_set(m, &robot, &ne);
-   }
+   uint32_t pos = members_add(m, robot);
+   m->ages[pos] = 0;
+   members_set(m, pos, members_column_add(m, swarm), 1);
 }
 
 /****************************************/
@@ -99,48 +245,51 @@ void buzzswarm_members_join(buzzswarm_members_t m,
 void buzzswarm_members_leave(buzzswarm_members_t m,
                              uint16_t robot,
                              uint16_t swarm) {
-   /* Is an entry for the passed robot present? */
-   const buzzswarm_elem_t* e = buzzdict_get(m, &robot, buzzswarm_elem_t);
-   if(e) {
-      /* Yes, update it */
-      (*e)->age = 0;
-      /* Search for the passed id */
-      uint32_t i;
-      for(i = 0; i < buzzdarray_size((*e)->swarms); ++i) {
-         if(buzzdarray_get((*e)->swarms, i, uint16_t) == swarm) break;
-      }
-      /* If the element was found, remove it */
-      if(i < buzzdarray_size((*e)->swarms))
-         buzzdarray_remove((*e)->swarms, i);
-      /* If no swarm id is known for this robot, remove the entry altogether */
-      if(buzzdarray_isempty((*e)->swarms))
-         buzzdict_remove(m, &robot);
-   }
    /* Nothing to do if you get a 'leave' message for someone you don't know */
+   int64_t pos = members_find(m, robot);
+   if(pos < 0) return;
+   m->ages[pos] = 0;
+   int32_t c = members_column(m, swarm);
+   if(c >= 0) members_set(m, pos, c, 0);
+   /* If no swarm id is known for this robot, remove the entry altogether */
+   if(members_isempty(m, pos))
+      members_remove(m, pos);
 }
 
 /****************************************/
 /****************************************/
 
-void buzzswarm_members_refresh(buzzswarm_members_t m,
-                               uint16_t robot,
-                               buzzdarray_t swarms) {
-   /* Is an entry for the passed robot already present? */
-   const buzzswarm_elem_t* e = buzzdict_get(m, &robot, buzzswarm_elem_t);
-   if(e) {
-      /* Yes, update it */
-      (*e)->age = 0;
-      buzzdarray_destroy(&((*e)->swarms));
-      (*e)->swarms = swarms;
-   }
-   else {
-      /* No, create it */
-      buzzswarm_elem_t ne = buzzswarm_elem_new();
-      buzzdarray_destroy(&(ne->swarms));
-      ne->swarms = swarms;
-      /* Add it to the structure */
-      buzzdict_set(m, &robot, &ne);
-   }
+int buzzswarm_members_refresh(buzzswarm_members_t m,
+                              uint16_t robot,
+                              uint16_t version,
+                              const uint16_t* swarms,
+                              uint16_t n) {
+   int isnew = members_find(m, robot) < 0;
+   uint32_t pos = members_add(m, robot);
+   m->ages[pos] = 0;
+   m->versions[pos] = version;
+   members_clear(m, pos);
+   uint16_t i;
+   for(i = 0; i < n; ++i)
+      members_set(m, pos, members_column_add(m, swarms[i]), 1);
+   if(members_isempty(m, pos))
+      members_remove(m, pos);
+   return isnew;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzswarm_members_heartbeat(buzzswarm_members_t m,
+                                uint16_t robot,
+                                uint16_t version,
+                                uint32_t hash) {
+   int64_t pos = members_find(m, robot);
+   /* An unknown robot is up to date if it is in no swarm */
+   if(pos < 0) return hash == 0;
+   if(m->versions[pos] != version || m->hashes[pos] != hash) return 0;
+   m->ages[pos] = 0;
+   return 1;
 }
 
 /****************************************/
@@ -149,101 +298,134 @@ void buzzswarm_members_refresh(buzzswarm_members_t m,
 int buzzswarm_members_isrobotin(buzzswarm_members_t m,
                                 uint16_t robot,
                                 uint16_t swarm) {
-   /* Is an entry for the passed robot present?
-    * If not, return false */
-   const buzzswarm_elem_t* e = buzzdict_get(m, &robot, buzzswarm_elem_t);
-   if(!e) return 0;
-   /* If we get here, an entry is present
-    * Does it contain the passed swarm id? */
-   uint32_t i;
-   for(i = 0; i < buzzdarray_size((*e)->swarms); ++i) {
-      if(buzzdarray_get((*e)->swarms, i, uint16_t) == swarm) return 1;
-   }
-   /* If we get here, it's because we couldn't find the id */
-   return 0;
+   int64_t pos = members_find(m, robot);
+   int32_t c = members_column(m, swarm);
+   if(pos < 0 || c < 0) return 0;
+   return (members_bits(m, pos)[c / 64] >> (c % 64)) & 1;
 }
 
 /****************************************/
 /****************************************/
 
-struct buzzswarm_members_print_s {
-   FILE* stream;
-   uint16_t robot;
-};
-typedef struct buzzswarm_members_print_s* buzzswarm_members_print_t;
-
-void print_swarm_elem(const void* key, void* data, void* params) {
-   buzzswarm_elem_t e = *(buzzswarm_elem_t*)data;
-   buzzswarm_members_print_t p = (buzzswarm_members_print_t)params;
-   fprintf(stdout, "   %u:%u:", p->robot, *(uint16_t*)key);
-   if(!buzzdarray_isempty(e->swarms)) {
-      fprintf(p->stream,
-              "%u",
-              buzzdarray_get(e->swarms, 0, uint16_t));
-      for(uint32_t i = 1; i < buzzdarray_size(e->swarms); ++i) {
-         fprintf(p->stream,
-                 " %u",
-                 buzzdarray_get(e->swarms, i, uint16_t));
-      }
-   }
-   fprintf(stdout, "\n");
+uint32_t buzzswarm_members_count(buzzswarm_members_t m,
+                                 uint16_t swarm) {
+   int32_t c = members_column(m, swarm);
+   return c < 0 ? 0 : m->counts[c];
 }
 
+/****************************************/
+/****************************************/
+
 void buzzswarm_members_print(FILE* stream,
                              buzzswarm_members_t m,
                              uint16_t robot) {
    fprintf(stream,
            "ROBOT %u: swarm member table size: %u\n",
            robot,
-           buzzdict_size(m));
-   struct buzzswarm_members_print_s x = {
-      .stream = stream,
-      .robot = robot
-   };
-   buzzdict_foreach(m, print_swarm_elem, &x);
+           m->size);
+   uint32_t i;
+   uint16_t c;
+   for(i = 0; i < m->size; ++i) {
+      fprintf(stream, "   %u:%u:", robot, m->robots[i]);
+      const char* sep = "";
+      for(c = 0; c < m->used; ++c) {
+         if((members_bits(m, i)[c / 64] >> (c % 64)) & 1) {
+            fprintf(stream, "%s%u", sep, m->sids[c]);
+            sep = " ";
+         }
+      }
+      fprintf(stream, "\n");
+   }
 }
 
 /****************************************/
 /****************************************/
 
 /* Maximum age (in steps) for swarm membership to be remembered */
-static int MEMBERSHIP_AGE_MAX = 50;
-
-/* Information on element to delete */
-struct buzzswarm_members_todelete_s {
-   uint16_t key;
-   struct buzzswarm_members_todelete_s* next;
-};
-typedef struct buzzswarm_members_todelete_s* buzzswarm_members_todelete_t;
-
-/* Function that checks whether an element must be deleted */
-void check_swarm_elem(const void* key, void* data, void* params) {
-   buzzswarm_elem_t elem = *(buzzswarm_elem_t*)data;
-   buzzswarm_members_todelete_t* todel = (buzzswarm_members_todelete_t*)params;
-   /* Increase the element's age */
-   ++elem->age;
-   /* Mark the element to delete if it exceeds the maximum age */
-   if(elem->age > MEMBERSHIP_AGE_MAX) {
-      buzzswarm_members_todelete_t x =
-         (buzzswarm_members_todelete_t)malloc(
-            sizeof(struct buzzswarm_members_todelete_s));
-      x->key = *(uint16_t*)key;
-      x->next = *todel;
-      *todel = x;
+static const int MEMBERSHIP_AGE_MAX = 50;
+
+void buzzswarm_members_update(buzzswarm_members_t m) {
+   /* Age all the robots in one sweep, going backwards so that the robot
+    * moved into the place of a removed one has already been visited */
+   uint32_t i = m->size;
+   while(i > 0) {
+      --i;
+      if(++m->ages[i] > MEMBERSHIP_AGE_MAX)
+         members_remove(m, i);
    }
 }
 
-void buzzswarm_members_update(buzzswarm_members_t m) {
-   /* Go through elements and make a list of the elements to erase */
-   buzzswarm_members_todelete_t todel = NULL;
-   buzzdict_foreach(m, check_swarm_elem, &todel);
-   /* Erase elements */
-   buzzswarm_members_todelete_t next;
-   while(todel) {
-      next = todel->next;
-      buzzdict_remove(m, &todel->key);
-      free(todel);
-      todel = next;
+/****************************************/
+/****************************************/
+
+uint32_t buzzswarm_hash(uint16_t swarm) {
+   /* Finalizer of MurmurHash3, never 0 for a 16-bit id */
+   uint32_t h = swarm + 0x9e3779b9u;
+   h ^= h >> 16;
+   h *= 0x85ebca6bu;
+   h ^= h >> 13;
+   h *= 0xc2b2ae35u;
+   h ^= h >> 16;
+   return h;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzswarm_gossip_set(buzzvm_t vm,
+                          uint16_t minperiod,
+                          uint16_t maxperiod) {
+   struct buzzswarm_gossip_s* g = &vm->swarmgossip;
+   g->minperiod = minperiod > 0 ? minperiod : 1;
+   g->maxperiod = maxperiod > g->minperiod ? maxperiod : g->minperiod;
+   if(g->period < g->minperiod) g->period = g->minperiod;
+   if(g->period > g->maxperiod) g->period = g->maxperiod;
+   if(g->countdown > g->period) g->countdown = g->period;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzswarm_gossip_hurry(buzzvm_t vm) {
+   struct buzzswarm_gossip_s* g = &vm->swarmgossip;
+   g->period = g->minperiod;
+   if(g->countdown > g->period) g->countdown = g->period;
+}
+
+/****************************************/
+/****************************************/
+
+static void gossip_hash(const void* key, void* data, void* params) {
+   if(*(uint8_t*)data)
+      *(uint32_t*)params += buzzswarm_hash(*(uint16_t*)key);
+}
+
+void buzzswarm_gossip_step(buzzvm_t vm) {
+   /* Nothing to say if no swarm was ever created */
+   if(buzzdict_isempty(vm->swarms)) return;
+   struct buzzswarm_gossip_s* g = &vm->swarmgossip;
+   uint32_t h = 0;
+   buzzdict_foreach(vm->swarms, gossip_hash, &h);
+   if(h != g->hash) {
+      /* The membership changed: heartbeats are frequent again */
+      ++g->version;
+      g->hash = h;
+      g->period = g->minperiod;
+      g->requested = 1;
+   }
+   if(g->requested) {
+      /* The list replaces the queued join/leave messages */
+      g->requested = 0;
+      g->countdown = g->period;
+      buzzoutmsg_queue_append_swarm_list(vm, vm->swarms, g->version);
+      return;
+   }
+   if(g->countdown > 0) --g->countdown;
+   if(g->countdown == 0) {
+      buzzoutmsg_queue_append_swarm_heartbeat(vm, g->version, g->hash);
+      /* Back off while nothing changes */
+      g->period = (g->period < g->maxperiod / 2) ? (g->period * 2) : g->maxperiod;
+      g->countdown = g->period;
    }
 }
 
@@ -14,9 +14,73 @@ extern "C" {
    struct buzzvm_s;
 
    /*
-    * Data type for the robot membership data structure.
+    * The robot membership data structure.
+    * Swarm ids are remapped to a dense range of columns, and every known
+    * robot has a bitset with one bit per column. Robot and swarm ids
+    * index flat lookup arrays, so membership checks take constant time.
     */
-   typedef buzzdict_t buzzswarm_members_t;
+   struct buzzswarm_members_s {
+      /* Swarm id -> column + 1 (0 if the swarm has no known members) */
+      uint16_t* cols;
+      /* Size of cols */
+      uint32_t ncols;
+      /* Column -> swarm id */
+      uint16_t* sids;
+      /* Column -> number of known member robots (0 if free) */
+      uint32_t* counts;
+      /* Number of columns ever used */
+      uint16_t used;
+      /* Number of 64-bit words in a robot bitset */
+      uint16_t words;
+      /* Robot id -> position in the robot arrays + 1 (0 if unknown) */
+      uint32_t* slots;
+      /* Size of slots */
+      uint32_t nslots;
+      /* The known robots: ids, ages and bitsets (words per robot) */
+      uint16_t* robots;
+      uint16_t* ages;
+      uint64_t* bits;
+      /* The membership version last listed by each robot, and the
+       * hash of its known swarms */
+      uint16_t* versions;
+      uint32_t* hashes;
+      /* Number of known robots */
+      uint32_t size;
+      /* Capacity of the robot arrays */
+      uint32_t capacity;
+   };
+   typedef struct buzzswarm_members_s* buzzswarm_members_t;
+
+   /*
+    * Default bounds of the swarm heartbeat period, in steps.
+    * Receivers forget a robot after 50 steps of silence, so the longest
+    * period should leave room for a lost heartbeat.
+    */
+#define BUZZSWARM_GOSSIP_MINPERIOD 5
+#define BUZZSWARM_GOSSIP_MAXPERIOD 20
+
+   /*
+    * The state of the swarm membership gossip of a robot.
+    * A robot sends its full swarm list only when its membership changes
+    * or when a neighbor asks for it. Otherwise, it sends a heartbeat with
+    * the version and the hash of its membership. The heartbeat period
+    * starts at minperiod after a change and doubles up to maxperiod.
+    */
+   struct buzzswarm_gossip_s {
+      /* Version of the membership, incremented at every change */
+      uint16_t version;
+      /* Hash of the swarms the robot is a member of */
+      uint32_t hash;
+      /* Steps to the next heartbeat */
+      uint16_t countdown;
+      /* Current heartbeat period */
+      uint16_t period;
+      /* Bounds of the heartbeat period */
+      uint16_t minperiod;
+      uint16_t maxperiod;
+      /* Whether a neighbor asked for the swarm list */
+      uint8_t requested;
+   };
 
    /*
     * Creates a new swarm membership structure.
@@ -30,6 +94,13 @@ extern "C" {
     */
    extern void buzzswarm_members_destroy(buzzswarm_members_t* m);
 
+   /*
+    * Clones a swarm membership structure.
+    * @param m The swarm membership structure.
+    * @return A new swarm membership structure.
+    */
+   extern buzzswarm_members_t buzzswarm_members_clone(buzzswarm_members_t m);
+
    /*
     * Adds info on the fact that a robot joined a swarm.
     * @param m The swarm membership structure.
@@ -52,15 +123,33 @@ extern "C" {
 
    /*
     * Refreshes the membership information for a robot.
-    * The ownership of the passed swarm id list is assumed by
-    * this structure. Do not free it.
+    * The robot is considered a member of exactly the passed swarms.
     * @param m The swarm membership structure.
     * @param robot The robot id.
-    * @param swarm The swarms id list.
+    * @param version The membership version of the robot.
+    * @param swarms The swarm ids.
+    * @param n The number of swarm ids.
+    * @return 1 if the robot was unknown, 0 otherwise.
     */
-   extern void buzzswarm_members_refresh(buzzswarm_members_t m,
+   extern int buzzswarm_members_refresh(buzzswarm_members_t m,
                                          uint16_t robot,
-                                         buzzdarray_t swarms);
+                                         uint16_t version,
+                                         const uint16_t* swarms,
+                                         uint16_t n);
+
+   /*
+    * Checks the heartbeat of a robot against the known membership.
+    * If they match, the membership of the robot is kept alive.
+    * @param m The swarm membership structure.
+    * @param robot The robot id.
+    * @param version The membership version of the robot.
+    * @param hash The hash of the swarms of the robot.
+    * @return 1 if the known membership is up to date, 0 if the full list is needed.
+    */
+   extern int buzzswarm_members_heartbeat(buzzswarm_members_t m,
+                                          uint16_t robot,
+                                          uint16_t version,
+                                          uint32_t hash);
 
    /*
     * Returns 1 if a robot is a member of the given swarm, 0 otherwise.
@@ -73,8 +162,18 @@ extern "C" {
                                           uint16_t robot,
                                           uint16_t swarm);
 
+   /*
+    * Returns the number of known robots that are members of the given swarm.
+    * @param m The swarm membership structure.
+    * @param swarm The swarm id.
+    * @return The number of known members.
+    */
+   extern uint32_t buzzswarm_members_count(buzzswarm_members_t m,
+                                           uint16_t swarm);
+
    /*
     * Updates the information in the swarm membership structure.
+    * Robots that have not been heard of for a while are forgotten.
     * @param m The swarm membership structure.
     */
    extern void buzzswarm_members_update(buzzswarm_members_t m);
@@ -89,6 +188,41 @@ extern "C" {
                                        buzzswarm_members_t m,
                                        uint16_t robot);
 
+   /*
+    * Returns the hash of a swarm id.
+    * The hash of a set of swarms is the sum of the hashes of its ids, so
+    * it does not depend on their order and 0 stands for the empty set.
+    * @param swarm The swarm id.
+    * @return The hash of the swarm id.
+    */
+   extern uint32_t buzzswarm_hash(uint16_t swarm);
+
+   /*
+    * Sets the bounds of the swarm heartbeat period.
+    * @param vm The Buzz VM state.
+    * @param minperiod The period after a membership change, in steps (at least 1).
+    * @param maxperiod The longest period, in steps (at least minperiod).
+    */
+   extern void buzzswarm_gossip_set(struct buzzvm_s* vm,
+                                    uint16_t minperiod,
+                                    uint16_t maxperiod);
+
+   /*
+    * Makes the next swarm heartbeat come after the shortest period.
+    * This is done when a new neighbor shows up, so that it learns the
+    * local membership quickly.
+    * @param vm The Buzz VM state.
+    */
+   extern void buzzswarm_gossip_hurry(struct buzzvm_s* vm);
+
+   /*
+    * Performs the periodic tasks of the swarm membership gossip.
+    * Queues the swarm list if the membership changed or was requested,
+    * and a heartbeat when the period expires.
+    * @param vm The Buzz VM state.
+    */
+   extern void buzzswarm_gossip_step(struct buzzvm_s* vm);
+
    /*
     * Registers the swarm data into the virtual machine.
     * @param vm The Buzz VM state.
@@ -0,0 +1,345 @@
+#include "buzztransport.h"
+#include "buzzvm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * Default multicast group and port
+ */
+#define BUZZTRANSPORT_UDP_GROUP "239.255.42.99"
+#define BUZZTRANSPORT_UDP_PORT  24580
+
+/****************************************/
+/****************************************/
+
+buzztransport_t buzztransport_new(uint32_t mtu) {
+   buzztransport_t t = (buzztransport_t)calloc(1, sizeof(struct buzztransport_s));
+   t->mtu = mtu;
+   return t;
+}
+
+/****************************************/
+/****************************************/
+
+void buzztransport_destroy(buzztransport_t* t) {
+   if(!*t) return;
+   if((*t)->destroy) (*t)->destroy(*t);
+   free(*t);
+   *t = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+void buzztransport_set_position(buzztransport_t t,
+                                float x,
+                                float y,
+                                float z) {
+   t->position[0] = x;
+   t->position[1] = y;
+   t->position[2] = z;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * UDP multicast backend
+ */
+struct buzztransport_udp_s {
+   int fd;
+   struct sockaddr_in group;
+};
+
+static int buzztransport_udp_send(buzztransport_t t,
+                                  const uint8_t* frame,
+                                  uint32_t size) {
+   struct buzztransport_udp_s* u = (struct buzztransport_udp_s*)t->data;
+   return sendto(u->fd, frame, size, 0,
+                 (struct sockaddr*)&u->group, sizeof(u->group)) == size;
+}
+
+static int64_t buzztransport_udp_recv(buzztransport_t t,
+                                      uint8_t* buf,
+                                      uint32_t size,
+                                      struct buzztransport_nbr_s* nbr) {
+   struct buzztransport_udp_s* u = (struct buzztransport_udp_s*)t->data;
+   ssize_t n = recv(u->fd, buf, size, MSG_DONTWAIT);
+   if(n >= 0) return n;
+   if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+   return -1;
+}
+
+static void buzztransport_udp_destroy(buzztransport_t t) {
+   struct buzztransport_udp_s* u = (struct buzztransport_udp_s*)t->data;
+   close(u->fd);
+   free(u);
+}
+
+buzztransport_t buzztransport_udp_new(const char* group,
+                                      uint16_t port,
+                                      uint32_t mtu) {
+   if(!group) group = BUZZTRANSPORT_UDP_GROUP;
+   if(!port) port = BUZZTRANSPORT_UDP_PORT;
+   /* Create the socket */
+   int fd = socket(AF_INET, SOCK_DGRAM, 0);
+   if(fd < 0) return NULL;
+   /* Let several processes on the host use the same port */
+   int on = 1;
+   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+   setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+   /* Bind to the port */
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_ANY);
+   addr.sin_port = htons(port);
+   if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      close(fd);
+      return NULL;
+   }
+   /* Join the group */
+   struct ip_mreq mreq;
+   if(inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1) {
+      close(fd);
+      return NULL;
+   }
+   mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+   if(setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+      close(fd);
+      return NULL;
+   }
+   /* Keep the frames on the host, and deliver them to local sockets */
+   unsigned char ttl = 0, loop = 1;
+   setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+   setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+   /* Make the transport */
+   struct buzztransport_udp_s* u = (struct buzztransport_udp_s*)malloc(sizeof(struct buzztransport_udp_s));
+   u->fd = fd;
+   memset(&u->group, 0, sizeof(u->group));
+   u->group.sin_family = AF_INET;
+   u->group.sin_addr = mreq.imr_multiaddr;
+   u->group.sin_port = htons(port);
+   buzztransport_t t = buzztransport_new(mtu);
+   t->send = buzztransport_udp_send;
+   t->recv = buzztransport_udp_recv;
+   t->destroy = buzztransport_udp_destroy;
+   t->data = u;
+   return t;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Loopback backend
+ */
+struct buzztransport_bus_s {
+   /* The attached transports */
+   buzzdarray_t endpoints;
+};
+
+struct buzztransport_loopback_s {
+   /* The bus */
+   buzztransport_bus_t bus;
+   /* Received frames, oldest first */
+   buzzdarray_t inbox;
+   /* Position of the next frame to receive in the inbox */
+   uint32_t head;
+};
+
+static void buzztransport_frame_destroy(uint32_t pos, void* data, void* params) {
+   /* The received frames are already gone */
+   if(*(buzzdarray_t*)data) buzzdarray_destroy((buzzdarray_t*)data);
+}
+
+buzztransport_bus_t buzztransport_bus_new() {
+   buzztransport_bus_t bus = (buzztransport_bus_t)malloc(sizeof(struct buzztransport_bus_s));
+   bus->endpoints = buzzdarray_new(10, sizeof(buzztransport_t), NULL);
+   return bus;
+}
+
+void buzztransport_bus_destroy(buzztransport_bus_t* bus) {
+   buzzdarray_destroy(&(*bus)->endpoints);
+   free(*bus);
+   *bus = NULL;
+}
+
+static int buzztransport_loopback_send(buzztransport_t t,
+                                       const uint8_t* frame,
+                                       uint32_t size) {
+   struct buzztransport_loopback_s* l = (struct buzztransport_loopback_s*)t->data;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(l->bus->endpoints); ++i) {
+      buzztransport_t e = buzzdarray_get(l->bus->endpoints, i, buzztransport_t);
+      if(e == t) continue;
+      buzzdarray_t f = buzzmsg_payload_frombuffer(frame, size);
+      buzzdarray_push(((struct buzztransport_loopback_s*)e->data)->inbox, &f);
+   }
+   return 1;
+}
+
+static int64_t buzztransport_loopback_recv(buzztransport_t t,
+                                           uint8_t* buf,
+                                           uint32_t size,
+                                           struct buzztransport_nbr_s* nbr) {
+   struct buzztransport_loopback_s* l = (struct buzztransport_loopback_s*)t->data;
+   if(l->head >= buzzdarray_size(l->inbox)) return 0;
+   /* Take the oldest frame, leaving an empty slot */
+   buzzdarray_t f = buzzdarray_get(l->inbox, l->head, buzzdarray_t);
+   int64_t n = buzzdarray_size(f) < size ? buzzdarray_size(f) : size;
+   memcpy(buf, f->data, n);
+   buzzdarray_destroy(&f);
+   buzzdarray_set(l->inbox, l->head, &f);
+   ++l->head;
+   /* Once every frame is received, reuse the inbox from the start */
+   if(l->head == buzzdarray_size(l->inbox)) {
+      l->inbox->size = 0;
+      l->head = 0;
+   }
+   return n;
+}
+
+static void buzztransport_loopback_destroy(buzztransport_t t) {
+   struct buzztransport_loopback_s* l = (struct buzztransport_loopback_s*)t->data;
+   /* Detach from the bus */
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(l->bus->endpoints); ++i) {
+      if(buzzdarray_get(l->bus->endpoints, i, buzztransport_t) == t) {
+         buzzdarray_remove(l->bus->endpoints, i);
+         break;
+      }
+   }
+   buzzdarray_destroy(&l->inbox);
+   free(l);
+}
+
+buzztransport_t buzztransport_loopback_new(buzztransport_bus_t bus,
+                                           uint32_t mtu) {
+   struct buzztransport_loopback_s* l = (struct buzztransport_loopback_s*)malloc(sizeof(struct buzztransport_loopback_s));
+   l->bus = bus;
+   l->inbox = buzzdarray_new(10, sizeof(buzzdarray_t), buzztransport_frame_destroy);
+   l->head = 0;
+   buzztransport_t t = buzztransport_new(mtu);
+   t->send = buzztransport_loopback_send;
+   t->recv = buzztransport_loopback_recv;
+   t->destroy = buzztransport_loopback_destroy;
+   t->data = l;
+   buzzdarray_push(bus->endpoints, &t);
+   return t;
+}
+
+/****************************************/
+/****************************************/
+
+static void buzztransport_parse(buzzvm_t vm,
+                                buzztransport_t t,
+                                buzzmsg_payload_t frame,
+                                const struct buzztransport_nbr_s* nbr) {
+   /* Parse the header */
+   uint16_t rid;
+   float pos[3];
+   int64_t p = buzzmsg_deserialize_u16(&rid, frame, 0);
+   if(p >= 0) p = buzzmsg_deserialize_float(pos + 0, frame, p);
+   if(p >= 0) p = buzzmsg_deserialize_float(pos + 1, frame, p);
+   if(p >= 0) p = buzzmsg_deserialize_float(pos + 2, frame, p);
+   if(p < 0) {
+      fprintf(stderr, "[WARNING] [ROBOT %u] Malformed frame received\n", vm->robot);
+      return;
+   }
+   /* Ignore the frames sent by this robot */
+   if(rid == vm->robot) return;
+   /* Update neighbor information */
+   if(nbr->valid) {
+      buzzneighbors_add(vm, rid, nbr->distance, nbr->azimuth, nbr->elevation);
+   }
+   else {
+      float dx = pos[0] - t->position[0];
+      float dy = pos[1] - t->position[1];
+      float dz = pos[2] - t->position[2];
+      float dxy = sqrtf(dx*dx + dy*dy);
+      buzzneighbors_add(vm, rid,
+                        sqrtf(dx*dx + dy*dy + dz*dz),
+                        atan2f(dy, dx),
+                        atan2f(dz, dxy));
+   }
+   /* Go through the messages until there's nothing else to read */
+   uint16_t sz;
+   while((p = buzzmsg_deserialize_u16(&sz, frame, p)) >= 0 && sz > 0) {
+      if(p + sz > buzzmsg_payload_size(frame)) {
+         fprintf(stderr, "[WARNING] [ROBOT %u] Truncated message received from robot %u\n", vm->robot, rid);
+         return;
+      }
+      buzzinmsg_queue_append(vm, rid,
+                             buzzmsg_payload_frombuffer((uint8_t*)frame->data + p, sz));
+      p += sz;
+   }
+}
+
+int buzztransport_receive(buzzvm_t vm,
+                          buzztransport_t t) {
+   /* Reset neighbor information */
+   buzzneighbors_reset(vm);
+   /* Go through the available frames */
+   uint8_t* buf = (uint8_t*)malloc(t->mtu);
+   int count = 0;
+   int64_t n;
+   struct buzztransport_nbr_s nbr;
+   memset(&nbr, 0, sizeof(nbr));
+   while((n = t->recv(t, buf, t->mtu, &nbr)) > 0) {
+      buzzmsg_payload_t frame = buzzmsg_payload_frombuffer(buf, n);
+      buzztransport_parse(vm, t, frame, &nbr);
+      buzzmsg_payload_destroy(&frame);
+      memset(&nbr, 0, sizeof(nbr));
+      ++count;
+   }
+   free(buf);
+   /* Process messages */
+   buzzvm_process_inmsgs(vm);
+   return count;
+}
+
+/****************************************/
+/****************************************/
+
+int buzztransport_send(buzzvm_t vm,
+                       buzztransport_t t) {
+   /* Process outgoing messages */
+   buzzvm_process_outmsgs(vm);
+   /* Make the header */
+   buzzmsg_payload_t frame = buzzmsg_payload_new(t->mtu);
+   buzzmsg_serialize_u16(frame, vm->robot);
+   buzzmsg_serialize_float(frame, t->position[0]);
+   buzzmsg_serialize_float(frame, t->position[1]);
+   buzzmsg_serialize_float(frame, t->position[2]);
+   /* Messages that can never fit a frame are discarded */
+   buzzoutmsg_queue_set_mtu(vm, t->mtu - BUZZTRANSPORT_HEADER_SIZE - sizeof(uint16_t));
+   /* Fill the frame with the messages picked by the scheduler */
+   buzzmsg_payload_t m;
+   while(buzzmsg_payload_size(frame) + sizeof(uint16_t) < t->mtu &&
+         (m = buzzoutmsg_queue_pop(vm,
+                                   t->mtu - buzzmsg_payload_size(frame) - sizeof(uint16_t))) != NULL) {
+      buzzmsg_serialize_u16(frame, buzzmsg_payload_size(m));
+      uint32_t i;
+      for(i = 0; i < buzzmsg_payload_size(m); ++i)
+         buzzmsg_serialize_u8(frame, buzzmsg_payload_get(m, i));
+      buzzoutmsg_queue_recycle(vm, &m);
+   }
+   /* Send the frame */
+   int ok = t->send(t, (uint8_t*)frame->data, buzzmsg_payload_size(frame));
+   buzzmsg_payload_destroy(&frame);
+   return ok;
+}
+
+/****************************************/
+/****************************************/
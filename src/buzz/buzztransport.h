@@ -0,0 +1,168 @@
+#ifndef BUZZTRANSPORT_H
+#define BUZZTRANSPORT_H
+
+#include <buzz/buzzdarray.h>
+#include <buzz/buzzmsg.h>
+
+struct buzzvm_s;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * Neighbor information attached to a received frame.
+    * A backend that can measure where the sender is (e.g., a range and
+    * bearing device) sets valid to 1 and fills the rest. Otherwise, the
+    * information is computed from the position advertised by the sender.
+    */
+   struct buzztransport_nbr_s {
+      int valid;
+      float distance;
+      float azimuth;
+      float elevation;
+   };
+
+   /*
+    * A transport moves frames between robots.
+    * A frame is the sender id, the sender position, and a sequence of
+    * (size, payload) messages, as in the ARGoS range and bearing data.
+    */
+   struct buzztransport_s {
+      /*
+       * Sends a frame to the neighbors.
+       * @param t The transport.
+       * @param frame The frame data.
+       * @param size The frame size.
+       * @return 1 on success, 0 on error.
+       */
+      int (*send)(struct buzztransport_s* t,
+                  const uint8_t* frame,
+                  uint32_t size);
+      /*
+       * Receives a frame without blocking.
+       * @param t The transport.
+       * @param buf The buffer where the frame is copied.
+       * @param size The buffer size.
+       * @param nbr Where to store the neighbor information, if known.
+       * @return The frame size, 0 if no frame is available, -1 on error.
+       */
+      int64_t (*recv)(struct buzztransport_s* t,
+                      uint8_t* buf,
+                      uint32_t size,
+                      struct buzztransport_nbr_s* nbr);
+      /*
+       * Frees the backend data.
+       * @param t The transport.
+       */
+      void (*destroy)(struct buzztransport_s* t);
+      /* The largest frame size */
+      uint32_t mtu;
+      /* The position of the local robot */
+      float position[3];
+      /* Backend data */
+      void* data;
+   };
+   typedef struct buzztransport_s* buzztransport_t;
+
+   /*
+    * Size of the frame header: robot id and position, each coordinate
+    * serialized as a mantissa and an exponent
+    */
+#define BUZZTRANSPORT_HEADER_SIZE (sizeof(uint16_t) + 3 * 2 * sizeof(int32_t))
+
+   /*
+    * An in-process bus for loopback transports.
+    */
+   typedef struct buzztransport_bus_s* buzztransport_bus_t;
+
+   /*
+    * Creates a transport without a backend.
+    * A custom backend sets send, recv, destroy and data.
+    * @param mtu The largest frame size.
+    * @return The transport.
+    */
+   extern buzztransport_t buzztransport_new(uint32_t mtu);
+
+   /*
+    * Creates a UDP multicast transport.
+    * The frames do not leave the host (the multicast TTL is 0).
+    * @param group The multicast group address, or NULL for the default.
+    * @param port The UDP port, or 0 for the default.
+    * @param mtu The largest frame size.
+    * @return The transport, or NULL in case of error.
+    */
+   extern buzztransport_t buzztransport_udp_new(const char* group,
+                                                uint16_t port,
+                                                uint32_t mtu);
+
+   /*
+    * Creates a new loopback bus.
+    * @return The bus.
+    */
+   extern buzztransport_bus_t buzztransport_bus_new();
+
+   /*
+    * Destroys a loopback bus.
+    * The transports attached to the bus must be destroyed first.
+    * @param bus The bus.
+    */
+   extern void buzztransport_bus_destroy(buzztransport_bus_t* bus);
+
+   /*
+    * Creates a transport attached to an in-process loopback bus.
+    * The frames sent on the transport are received by every other
+    * transport attached to the same bus.
+    * @param bus The bus.
+    * @param mtu The largest frame size.
+    * @return The transport.
+    */
+   extern buzztransport_t buzztransport_loopback_new(buzztransport_bus_t bus,
+                                                     uint32_t mtu);
+
+   /*
+    * Destroys a transport.
+    * @param t The transport.
+    */
+   extern void buzztransport_destroy(buzztransport_t* t);
+
+   /*
+    * Sets the position of the local robot.
+    * The position is advertised in every frame.
+    * @param t The transport.
+    * @param x The x coordinate.
+    * @param y The y coordinate.
+    * @param z The z coordinate.
+    */
+   extern void buzztransport_set_position(buzztransport_t t,
+                                          float x,
+                                          float y,
+                                          float z);
+
+   /*
+    * Receives all the available frames.
+    * The neighbor information is reset and refilled, the messages are
+    * appended to the input queue, and buzzvm_process_inmsgs() is called.
+    * @param vm The Buzz VM.
+    * @param t The transport.
+    * @return The number of frames received.
+    */
+   extern int buzztransport_receive(struct buzzvm_s* vm,
+                                    buzztransport_t t);
+
+   /*
+    * Sends a frame with the queued messages.
+    * buzzvm_process_outmsgs() is called, and the frame is filled with the
+    * messages chosen by the outgoing message scheduler.
+    * @param vm The Buzz VM.
+    * @param t The transport.
+    * @return 1 on success, 0 on error.
+    */
+   extern int buzztransport_send(struct buzzvm_s* vm,
+                                 buzztransport_t t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -608,13 +608,18 @@ int64_t buzzobj_deserialize(buzzobj_t* data,
          return buzzmsg_deserialize_float(&((*data)->f.value), buf, p);
       }
       case BUZZTYPE_STRING: {
-         char* str;
-         p = buzzmsg_deserialize_string(&str, buf, p);
-         if(p < 0) return -1;
+         /* Short strings are interned from the stack, without malloc() */
+         uint16_t len;
+         p = buzzmsg_deserialize_u16(&len, buf, p);
+         if(p < 0 || p + len > buzzdarray_size(buf)) return -1;
+         char sbuf[64];
+         char* str = len < sizeof(sbuf) ? sbuf : (char*)malloc(len + 1);
+         memcpy(str, (uint8_t*)buf->data + p, len);
+         str[len] = 0;
          (*data)->s.value.sid = buzzstrman_register(vm->strings, str, 0);
          (*data)->s.value.str = buzzstrman_get(vm->strings, (*data)->s.value.sid);
-         free(str);
-         return p;
+         if(str != sbuf) free(str);
+         return p + len;
       }
       case BUZZTYPE_TABLE: {
          uint8_t size;
@@ -4,6 +4,9 @@
 #include "buzzmath.h"
 #include "buzzio.h"
 #include "buzzstring.h"
+#include "buzzprof.h"
+#include "buzzstats.h"
+#include <buzz/config.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -18,7 +21,6 @@ const char *buzzvm_error_desc[] = { "none", "unknown instruction", "stack error"
 
 const char *buzzvm_instr_desc[] = {"nop", "done", "pushnil", "dup", "pop", "ret0", "ret1", "add", "sub", "mul", "div", "mod", "pow", "unm", "land", "lor", "lnot", "band", "bor", "bnot", "lshift", "rshift", "eq", "neq", "gt", "gte", "lt", "lte", "gload", "gstore", "pusht", "tput", "tget", "callc", "calls", "pushf", "pushi", "pushs", "pushcn", "pushcc", "pushl", "lload", "lstore", "lremove", "jump", "jumpz", "jumpnz"};
 
-static uint16_t SWARM_BROADCAST_PERIOD = 10;
 
 /****************************************/
 /****************************************/
@@ -210,6 +212,8 @@ buzzvm_lsyms_t buzzvm_lsyms_new(uint8_t isswarm,
    buzzvm_lsyms_t s = (buzzvm_lsyms_t)malloc(sizeof(struct buzzvm_lsyms_s));
    s->isswarm = isswarm;
    s->syms = syms;
+   s->ref = -1;
+   s->isnative = 0;
    return s;
 }
 
@@ -245,7 +249,7 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
       /* Extract the message data */
       uint16_t rid;
       buzzmsg_payload_t msg;
-      buzzinmsg_queue_extract(vm, &rid, &msg);
+      int shared = buzzinmsg_queue_extract(vm, &rid, &msg) == BUZZINMSG_SHARED;
       /* Dispatch the message wrt its type in msg->payload[0] */
       switch(buzzmsg_payload_get(msg, 0)) {
          case BUZZMSG_BROADCAST: {
@@ -288,7 +292,7 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             /* Deserialize key and value from msg */
             buzzobj_t k;          // key
             buzzvstig_elem_t v =  // value
-               (buzzvstig_elem_t)malloc(sizeof(struct buzzvstig_elem_s));
+               (buzzvstig_elem_t)calloc(1, sizeof(struct buzzvstig_elem_s));
             if(buzzvstig_elem_deserialize(&k, &v, msg, pos, vm) < 0) {
                fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_PUT message received\n", vm->robot);
                free(v);
@@ -301,38 +305,16 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
                ((*l)->timestamp < v->timestamp)) { /* Local element is older */
                /* Local element must be updated */
                /* Store element */
-               buzzvstig_store(*vs, &k, &v);
-               buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
+               buzzvstig_store(vm, *vs, &k, &v);
+               /* Relay it, unless anti-entropy takes care of propagation */
+               if(!(*vs)->sync.hashes)
+                  buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
             }
             else if(((*l)->timestamp == v->timestamp) && /* Same timestamp */
                     ((*l)->robot != v->robot)) {         /* Different robot */
                /* Conflict! */
-               /* Call conflict manager */
-               buzzvstig_elem_t c =
-                  buzzvstig_onconflict_call(vm, *vs, k, *l, v);
-               if(!c) {
+               if(!buzzvstig_onconflict_resolve(vm, *vs, id, k, v))
                   fprintf(stderr, "[WARNING] [ROBOT %u] Error resolving PUT conflict\n", vm->robot);
-                  break;
-               }
-               /* Get rid of useless vstig element */
-               free(v);
-               /* Did this robot lose the conflict? */
-               if((c->robot != vm->robot) &&
-                  ((*l)->robot == vm->robot)) {
-                  /* Yes */
-                  /* Save current local entry */
-                  buzzvstig_elem_t ol = buzzvstig_elem_clone(vm, *l);
-                  /* Store winning value */
-                  buzzvstig_store(*vs, &k, &c);
-                  /* Call conflict lost manager */
-                  buzzvstig_onconflictlost_call(vm, *vs, k, ol);
-               }
-               else {
-                  /* This robot did not lose the conflict */
-                  /* Just propagate the PUT message */
-                  buzzvstig_store(*vs, &k, &c);
-               }
-               buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, c);
             }
             else {
                /* Remote element is older, ignore it */
@@ -352,7 +334,7 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             /* Deserialize key and value from msg */
             buzzobj_t k;         // key
             buzzvstig_elem_t v = // value
-               (buzzvstig_elem_t)malloc(sizeof(struct buzzvstig_elem_s));
+               (buzzvstig_elem_t)calloc(1, sizeof(struct buzzvstig_elem_s));
             if(buzzvstig_elem_deserialize(&k, &v, msg, pos, vm) < 0) {
                fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_QUERY message received (2)\n", vm->robot);
                free(v);
@@ -377,18 +359,22 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
                   free(v);
                }
                else {
-                  /* Store element and propagate PUT message */
-                  buzzvstig_store(*vs, &k, &v);
-                  buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
+                  /* Store element and propagate PUT message, unless
+                   * anti-entropy takes care of propagation */
+                  buzzvstig_store(vm, *vs, &k, &v);
+                  if(!(*vs)->sync.hashes)
+                     buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
                }
                break;
             }
             /* Element found */
             if((*l)->timestamp < v->timestamp) {
                /* Local element is older */
-               /* Store element */
-               buzzvstig_store(*vs, &k, &v);
-               buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
+               /* Store element and relay it, unless anti-entropy takes
+                * care of propagation */
+               buzzvstig_store(vm, *vs, &k, &v);
+               if(!(*vs)->sync.hashes)
+                  buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, v);
             }
             else if((*l)->timestamp > v->timestamp) {
                /* Local element is newer */
@@ -399,29 +385,7 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             else if(((*l)->timestamp == v->timestamp) && /* Same timestamp */
                     ((*l)->robot != v->robot)) {         /* Different robot */
                /* Conflict! */
-               /* Call conflict manager */
-               buzzvstig_elem_t c =
-                  buzzvstig_onconflict_call(vm, *vs, k, *l, v);
-               free(v);
-               /* Make sure conflict manager returned with an element to process */
-               if(!c) break;
-               /* Did this robot lose the conflict? */
-               if((c->robot != vm->robot) &&
-                  ((*l)->robot == vm->robot)) {
-                  /* Yes */
-                  /* Save current local entry */
-                  buzzvstig_elem_t ol = buzzvstig_elem_clone(vm, *l);
-                  /* Store winning value */
-                  buzzvstig_store(*vs, &k, &c);
-                  /* Call conflict lost manager */
-                  buzzvstig_onconflictlost_call(vm, *vs, k, ol);
-               }
-               else {
-                  /* This robot did not lose the conflict */
-                  /* Just propagate the PUT message */
-                  buzzvstig_store(*vs, &k, &c);
-               }
-               buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, c);
+               buzzvstig_onconflict_resolve(vm, *vs, id, k, v);
             }
             else {
                /* Remote element is same as local, ignore it */
@@ -430,27 +394,72 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             }
             break;
          }
-         case BUZZMSG_SWARM_LIST: {
-            /* Deserialize number of swarm ids */
-            uint16_t nsids;
-            int64_t pos = buzzmsg_deserialize_u16(&nsids, msg, 1);
+         case BUZZMSG_VSTIG_DIGEST: {
+            /* Deserialize the vstig id and the node */
+            uint16_t id, node;
+            uint8_t level;
+            uint32_t hashes[BUZZVSTIG_SYNC_FANOUT];
+            uint16_t counts[BUZZVSTIG_SYNC_FANOUT];
+            int64_t pos = buzzmsg_deserialize_u16(&id, msg, 1);
+            if(pos > 0) pos = buzzmsg_deserialize_u8(&level, msg, pos);
+            if(pos > 0) pos = buzzmsg_deserialize_u16(&node, msg, pos);
+            int i;
+            for(i = 0; i < BUZZVSTIG_SYNC_FANOUT && pos > 0; ++i) {
+               pos = buzzmsg_deserialize_u32(hashes + i, msg, pos);
+               if(pos > 0) pos = buzzmsg_deserialize_u16(counts + i, msg, pos);
+            }
+            if(pos < 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_DIGEST message received\n", vm->robot);
+               break;
+            }
+            /* Look for virtual stigmergy */
+            const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+            if(!vs) break;
+            /* Compare with the local entries */
+            buzzvstig_sync_ondigest(vm, id, *vs, rid, level, node, hashes, counts);
+            break;
+         }
+         case BUZZMSG_VSTIG_REQUEST: {
+            /* Deserialize the vstig id, the recipient and the node */
+            uint16_t id, robot, node;
+            uint8_t level;
+            int64_t pos = buzzmsg_deserialize_u16(&id, msg, 1);
+            if(pos > 0) pos = buzzmsg_deserialize_u16(&robot, msg, pos);
+            if(pos > 0) pos = buzzmsg_deserialize_u8(&level, msg, pos);
+            if(pos > 0) pos = buzzmsg_deserialize_u16(&node, msg, pos);
             if(pos < 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_VSTIG_REQUEST message received\n", vm->robot);
+               break;
+            }
+            /* Is the request for this robot? */
+            if(robot != vm->robot) break;
+            /* Look for virtual stigmergy */
+            const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+            if(!vs) break;
+            /* Answer the request */
+            buzzvstig_sync_onrequest(vm, id, *vs, level, node);
+            break;
+         }
+         case BUZZMSG_SWARM_LIST: {
+            /* Deserialize membership version and number of swarm ids */
+            uint16_t version, nsids;
+            int64_t pos = buzzmsg_deserialize_u16(&version, msg, 1);
+            if(pos > 0) pos = buzzmsg_deserialize_u16(&nsids, msg, pos);
+            if(pos < 0 ||
+               pos + nsids * sizeof(uint16_t) > buzzdarray_size(msg)) {
                fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_SWARM_LIST message received\n", vm->robot);
                break;
             }
-            if(nsids < 1) break;
-            /* Deserialize swarm ids */
-            buzzdarray_t sids = buzzdarray_new(nsids, sizeof(uint16_t), NULL);
+            /* Deserialize swarm ids; short lists need no allocation */
+            uint16_t sbuf[64];
+            uint16_t* sids = nsids <= 64 ? sbuf : (uint16_t*)malloc(nsids * sizeof(uint16_t));
             uint16_t i;
-            for(i = 0; i < nsids; ++i) {
-               pos = buzzmsg_deserialize_u16(buzzdarray_makeslot(sids, i), msg, pos);
-               if(pos < 0) {
-                  fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_SWARM_LIST message received\n", vm->robot);
-                  break;
-               }
-            }
-            /* Update the information */
-            buzzswarm_members_refresh(vm->swarmmembers, rid, sids);
+            for(i = 0; i < nsids; ++i)
+               pos = buzzmsg_deserialize_u16(sids + i, msg, pos);
+            /* Update the information; a new neighbor gets a heartbeat soon */
+            if(buzzswarm_members_refresh(vm->swarmmembers, rid, version, sids, nsids))
+               buzzswarm_gossip_hurry(vm);
+            if(sids != sbuf) free(sids);
             break;
          }
          case BUZZMSG_SWARM_JOIN: {
@@ -477,9 +486,36 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
             buzzswarm_members_leave(vm->swarmmembers, rid, sid);
             break;
          }
+         case BUZZMSG_SWARM_HEARTBEAT: {
+            /* Deserialize membership version and hash */
+            uint16_t version;
+            uint32_t hash;
+            int64_t pos = buzzmsg_deserialize_u16(&version, msg, 1);
+            if(pos > 0) pos = buzzmsg_deserialize_u32(&hash, msg, pos);
+            if(pos < 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_SWARM_HEARTBEAT message received\n", vm->robot);
+               break;
+            }
+            /* Ask for the full list if the known one is stale */
+            if(!buzzswarm_members_heartbeat(vm->swarmmembers, rid, version, hash))
+               buzzoutmsg_queue_append_swarm_request(vm, rid);
+            break;
+         }
+         case BUZZMSG_SWARM_REQUEST: {
+            /* Deserialize the robot whose list is requested */
+            uint16_t robot;
+            int64_t pos = buzzmsg_deserialize_u16(&robot, msg, 1);
+            if(pos < 0) {
+               fprintf(stderr, "[WARNING] [ROBOT %u] Malformed BUZZMSG_SWARM_REQUEST message received\n", vm->robot);
+               break;
+            }
+            /* The list is sent at the end of the step */
+            if(robot == vm->robot) vm->swarmgossip.requested = 1;
+            break;
+         }
       }
-      /* Get rid of the message */
-      buzzmsg_payload_destroy(&msg);
+      /* Get rid of the message, unless other VMs read it too */
+      if(!shared) buzzmsg_payload_destroy(&msg);
    }
    /* Update swarm membership */
    buzzswarm_members_update(vm->swarmmembers);
@@ -488,16 +524,19 @@ void buzzvm_process_inmsgs(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
+void buzzvm_vstig_step(const void* key, void* data, void* params) {
+   buzzvstig_step((buzzvm_t)params,
+                  *(uint16_t*)key,
+                  *(buzzvstig_t*)data);
+}
+
 void buzzvm_process_outmsgs(buzzvm_t vm) {
-   /* Must broadcast swarm list message? */
-   if(vm->swarmbroadcast > 0)
-      --vm->swarmbroadcast;
-   if(vm->swarmbroadcast == 0 &&
-      !buzzdict_isempty(vm->swarms)) {
-      vm->swarmbroadcast = SWARM_BROADCAST_PERIOD;
-      buzzoutmsg_queue_append_swarm_list(vm,
-                                         vm->swarms);
-   }
+   /* Refill the rate limits of the message classes */
+   buzzoutmsg_queue_refill(vm);
+   /* Virtual stigmergy expiry and anti-entropy */
+   buzzdict_foreach(vm->vstigs, buzzvm_vstig_step, vm);
+   /* Swarm membership lists and heartbeats */
+   buzzswarm_gossip_step(vm);
 }
 
 /****************************************/
@@ -552,7 +591,9 @@ buzzvm_t buzzvm_new(uint16_t robot) {
                                    NULL);
    /* Create swarm member structure */
    vm->swarmmembers = buzzswarm_members_new();
-   vm->swarmbroadcast = SWARM_BROADCAST_PERIOD;
+   buzzswarm_gossip_set(vm,
+                        BUZZSWARM_GOSSIP_MINPERIOD,
+                        BUZZSWARM_GOSSIP_MAXPERIOD);
    /* Create message queues */
    vm->inmsgs = buzzinmsg_queue_new();
    vm->outmsgs = buzzoutmsg_queue_new();
@@ -570,6 +611,11 @@ buzzvm_t buzzvm_new(uint16_t robot) {
                                 buzzdict_uint16keyhash,
                                 buzzdict_uint16keycmp,
                                 NULL);
+   /* Create neighbor store */
+   vm->neighbors = buzzneighbors_store_new();
+   /* Create host symbol and pinned object lists */
+   vm->hostsyms = buzzdarray_new(5, sizeof(struct buzzvm_hostsym_s), NULL);
+   vm->pins = buzzdarray_new(10, sizeof(buzzobj_t), NULL);
    /* Take care of the robot id */
    vm->robot = robot;
    /* Initialize empty random number generator (buzzvm_math takes care of creating it) */
@@ -608,6 +654,13 @@ void buzzvm_destroy(buzzvm_t* vm) {
    buzzdict_destroy(&(*vm)->vstigs);
    /* Get rid of neighbor value listeners */
    buzzdict_destroy(&(*vm)->listeners);
+   /* Get rid of the neighbor store */
+   buzzneighbors_store_destroy(&(*vm)->neighbors);
+   /* Get rid of host symbols and pinned objects */
+   buzzdarray_destroy(&(*vm)->hostsyms);
+   buzzdarray_destroy(&(*vm)->pins);
+   /* Get rid of the execution counters */
+   buzzvm_stats_enable(*vm, 0);
    free(*vm);
    *vm = 0;
 }
@@ -717,10 +770,16 @@ buzzvm_state buzzvm_step(buzzvm_t vm) {
    /* buzzvm_dump(vm); */
    /* Can't execute if not ready */
    if(vm->state != BUZZVM_STATE_READY) return vm->state;
+   /* Run the profiler */
+   if(vm->prof && --vm->prof->countdown == 0) buzzprof_tick(vm);
    /* Execute GC */
    buzzheap_gc(vm);
    /* Fetch instruction and (potential) argument */
    uint8_t instr = vm->bcode[vm->pc];
+#ifdef BUZZ_STATS
+   /* Start the execution counter */
+   uint64_t t0 = vm->stats ? buzzvm_stats_clock() : 0;
+#endif
    /* Execute instruction */
    switch(instr) {
       case BUZZVM_INSTR_NOP: {
@@ -989,6 +1048,10 @@ buzzvm_state buzzvm_step(buzzvm_t vm) {
          buzzvm_seterror(vm, BUZZVM_ERROR_INSTR, NULL);
          break;
    }
+#ifdef BUZZ_STATS
+   /* Update the execution counters */
+   if(t0 && vm->stats) buzzvm_stats_instr(vm, instr, t0);
+#endif
    return vm->state;
 }
 
@@ -996,6 +1059,7 @@ buzzvm_state buzzvm_step(buzzvm_t vm) {
 /****************************************/
 
 buzzvm_state buzzvm_execute_script(buzzvm_t vm) {
+   if(vm->prof) buzzprof_resume(vm->prof);
    while(buzzvm_step(vm) == BUZZVM_STATE_READY);
    return vm->state;
 }
@@ -1014,6 +1078,8 @@ buzzvm_state buzzvm_closure_call(buzzvm_t vm,
    buzzvm_pushi(vm, argc);
    /* Save the current stack depth */
    uint32_t stacks = buzzdarray_size(vm->stacks);
+   /* Time spent in the host is not profiled */
+   if(vm->prof && stacks == 1) buzzprof_resume(vm->prof);
    /* Call the closure and keep stepping until
     * the stack count is back to the saved value */
    buzzvm_callc(vm);
@@ -1110,7 +1176,12 @@ buzzvm_state buzzvm_call(buzzvm_t vm, int isswrm) {
    vm->lsyms =
       buzzvm_lsyms_new(isswrm,
                        buzzdarray_clone(c->c.value.actrec));
+   vm->lsyms->ref = c->c.value.ref;
+   vm->lsyms->isnative = c->c.value.isnative;
    buzzdarray_push(vm->lsymts, &(vm->lsyms));
+#ifdef BUZZ_STATS
+   if(vm->stats) buzzvm_stats_call(vm);
+#endif
    /* Add function arguments to the local symbols */
    int32_t i;
    for(i = argn; i > 0; --i)
@@ -1133,9 +1204,21 @@ buzzvm_state buzzvm_call(buzzvm_t vm, int isswrm) {
       vm->oldpc = vm->pc;
       vm->pc = c->c.value.ref;
    }
-   else buzzdarray_get(vm->flist,
-                       c->c.value.ref,
-                       buzzvm_funp)(vm);
+   else {
+#ifdef BUZZ_STATS
+      /* The closure may be collected during the call */
+      int32_t ref = c->c.value.ref;
+      uint64_t t0 = vm->stats ? buzzvm_stats_clock() : 0;
+      buzzdarray_get(vm->flist,
+                     ref,
+                     buzzvm_funp)(vm);
+      if(t0) buzzvm_stats_cfun(vm, ref, t0);
+#else
+      buzzdarray_get(vm->flist,
+                     c->c.value.ref,
+                     buzzvm_funp)(vm);
+#endif
+   }
    return vm->state;
 }
 
@@ -1334,11 +1417,32 @@ buzzvm_state buzzvm_tget(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
+static void buzzvm_hostsym_load(buzzvm_t vm,
+                                uint16_t sid) {
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(vm->hostsyms); ++i) {
+      buzzvm_hostsym_t h = (buzzvm_hostsym_t)vm->hostsyms->data + i;
+      if(h->sid == sid) {
+         if(h->stale) {
+            /* Clear the flag first, the fill function may load symbols too */
+            h->stale = 0;
+            --vm->hoststale;
+            h->fill(vm, h->o, h->data);
+         }
+         return;
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
 buzzvm_state buzzvm_gload(buzzvm_t vm) {
    buzzvm_stack_assert(vm, 1);
    buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
    buzzobj_t str = buzzvm_stack_at(vm, 1);
    buzzvm_pop(vm);
+   if(vm->hoststale) buzzvm_hostsym_load(vm, str->s.value.sid);
    const buzzobj_t* o = buzzdict_get(vm->gsyms, &(str->s.value.sid), buzzobj_t);
    if(!o) { buzzvm_pushnil(vm); }
    else { buzzvm_push(vm, (*o)); }
@@ -1348,6 +1452,46 @@ buzzvm_state buzzvm_gload(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
+void buzzvm_hostsym_register(buzzvm_t vm,
+                             uint16_t sid,
+                             buzzobj_t o,
+                             buzzvm_hostsym_fill fill,
+                             void* data) {
+   struct buzzvm_hostsym_s h = { o, fill, data, sid, 0 };
+   int32_t k = sid;
+   buzzdarray_push(vm->hostsyms, &h);
+   buzzdict_set(vm->gsyms, &k, &o);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvm_hostsyms_update(buzzvm_t vm,
+                            int lazy) {
+   uint32_t i;
+   int32_t k;
+   vm->hoststale = 0;
+   for(i = 0; i < buzzdarray_size(vm->hostsyms); ++i) {
+      buzzvm_hostsym_t h = (buzzvm_hostsym_t)vm->hostsyms->data + i;
+      k = h->sid;
+      buzzdict_set(vm->gsyms, &k, &h->o);
+      h->stale = lazy && h->fill;
+      vm->hoststale += h->stale;
+      if(!lazy && h->fill) h->fill(vm, h->o, h->data);
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvm_pin(buzzvm_t vm,
+                buzzobj_t o) {
+   buzzdarray_push(vm->pins, &o);
+}
+
+/****************************************/
+/****************************************/
+
 buzzvm_state buzzvm_gstore(buzzvm_t vm) {
    buzzvm_stack_assert((vm), 2);
    buzzvm_type_assert((vm), 2, BUZZTYPE_STRING);
@@ -1366,6 +1510,9 @@ buzzvm_state buzzvm_ret0(buzzvm_t vm) {
    /* Pop swarm stack */
    if(vm->lsyms->isswarm)
       buzzdarray_pop(vm->swarmstack);
+#ifdef BUZZ_STATS
+   if(vm->stats) buzzvm_stats_ret(vm);
+#endif
    /* Pop local symbol table */
    buzzdarray_pop(vm->lsymts);
    /* Set local symbol table pointer */
@@ -1396,6 +1543,9 @@ buzzvm_state buzzvm_ret1(buzzvm_t vm) {
    /* Pop swarm stack */
    if(vm->lsyms->isswarm)
       buzzdarray_pop(vm->swarmstack);
+#ifdef BUZZ_STATS
+   if(vm->stats) buzzvm_stats_ret(vm);
+#endif
    /* Pop local symbol table */
    buzzdarray_pop(vm->lsymts);
    /* Set local symbol table pointer */
@@ -127,6 +127,10 @@ extern "C" {
       buzzdarray_t syms;
       /* 1 if this is a swarm closure, 0 if not */
       uint8_t isswarm;
+      /* The closure being executed, as in buzzclosure_s; -1 if unknown */
+      int32_t ref;
+      /* 1 if the closure is in bytecode, 0 if it is a C function */
+      uint8_t isnative;
    };
    typedef struct buzzvm_lsyms_s* buzzvm_lsyms_t;
 
@@ -139,6 +143,33 @@ extern "C" {
    extern buzzvm_lsyms_t buzzvm_lsyms_new(uint8_t isswarm,
                                           buzzdarray_t syms);
 
+   /*
+    * Function pointer to fill a host symbol.
+    * @param vm The VM data.
+    * @param o The object bound to the symbol.
+    * @param data The data passed at registration.
+    */
+   typedef void (*buzzvm_hostsym_fill)(struct buzzvm_s* vm,
+                                       buzzobj_t o,
+                                       void* data);
+
+   /*
+    * Data for a global symbol owned by the host
+    */
+   struct buzzvm_hostsym_s {
+      /* The object bound to the symbol */
+      buzzobj_t o;
+      /* The fill function */
+      buzzvm_hostsym_fill fill;
+      /* The data passed to the fill function */
+      void* data;
+      /* The symbol string id */
+      uint16_t sid;
+      /* 1 if the object must be filled on the next load, 0 if not */
+      uint8_t stale;
+   };
+   typedef struct buzzvm_hostsym_s* buzzvm_hostsym_t;
+
    /*
     * VM data
     */
@@ -173,8 +204,8 @@ extern "C" {
       buzzdarray_t swarmstack;
       /* Swarm members */
       buzzswarm_members_t swarmmembers;
-      /* Counter for swarm membership broadcasting */
-      uint16_t swarmbroadcast;
+      /* Swarm membership gossip */
+      struct buzzswarm_gossip_s swarmgossip;
       /* Input message FIFO */
       buzzinmsg_queue_t inmsgs;
       /* Output message FIFO */
@@ -183,6 +214,14 @@ extern "C" {
       buzzdict_t vstigs;
       /* Neighbor value listeners */
       buzzdict_t listeners;
+      /* Neighbors of the current step */
+      buzzneighbors_store_t neighbors;
+      /* Global symbols owned by the host */
+      buzzdarray_t hostsyms;
+      /* Number of host symbols waiting to be filled */
+      uint32_t hoststale;
+      /* Objects kept alive for the host */
+      buzzdarray_t pins;
       /* Current VM state */
       buzzvm_state state;
       /* Current VM error */
@@ -195,6 +234,10 @@ extern "C" {
       int32_t* rngstate;
       /* Random number generator index */
       uint32_t rngidx;
+      /* Sampling profiler, NULL if disabled */
+      struct buzzprof_s* prof;
+      /* Execution counters, NULL if disabled */
+      struct buzzvm_stats_s* stats;
    };
    typedef struct buzzvm_s* buzzvm_t;
 
@@ -462,6 +505,43 @@ extern "C" {
     */
    extern buzzvm_state buzzvm_gload(buzzvm_t vm);
 
+   /*
+    * Binds a host-owned object to a global symbol.
+    * The object is never garbage-collected, and it is bound again to the
+    * symbol at every call to buzzvm_hostsyms_update(), so that the script
+    * can't lose it by assigning the symbol.
+    * @param vm The VM data.
+    * @param sid The string id of the symbol.
+    * @param o The object.
+    * @param fill The function that fills the object.
+    * @param data The data passed to the fill function.
+    */
+   extern void buzzvm_hostsym_register(buzzvm_t vm,
+                                       uint16_t sid,
+                                       buzzobj_t o,
+                                       buzzvm_hostsym_fill fill,
+                                       void* data);
+
+   /*
+    * Binds the host symbols again and fills their objects.
+    * When lazy is 0, all the objects are filled right away. Otherwise, each
+    * object is filled the first time the script loads its symbol, and not
+    * at all if the script never does.
+    * @param vm The VM data.
+    * @param lazy 1 to defer filling to the first load, 0 to fill now.
+    */
+   extern void buzzvm_hostsyms_update(buzzvm_t vm,
+                                      int lazy);
+
+   /*
+    * Keeps an object alive until the VM is destroyed.
+    * Use this for objects the host holds across garbage collections.
+    * @param vm The VM data.
+    * @param o The object.
+    */
+   extern void buzzvm_pin(buzzvm_t vm,
+                          buzzobj_t o);
+
    /*
     * Stores the object located at the stack top into a global variable, pops operand.
     * Internally checks whether the operation is valid.
@@ -916,6 +996,14 @@ extern "C" {
  */
 #define buzzvm_string_register(vm, str, protect) buzzstrman_register((vm)->strings, str, protect)
 
+/*
+ * Looks for the id of a string in the virtual machine, without registering it.
+ * @param vm The VM data.
+ * @param str The string.
+ * @return The id of the string, or -1 if not found.
+ */
+#define buzzvm_string_find(vm, str) buzzstrman_find((vm)->strings, str)
+
 /*
  * Registers a string in the virtual machine.
  * @param vm The VM data.
@@ -1,8 +1,12 @@
 #include "buzzvstig.h"
+#include "buzzvstiglog.h"
 #include "buzzmsg.h"
 #include "buzzvm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
 
 /****************************************/
 /****************************************/
@@ -59,7 +63,7 @@ int buzzvstig_key_cmp(const void* a, const void* b) {
 buzzvstig_elem_t buzzvstig_elem_new(buzzobj_t data,
                                     uint16_t timestamp,
                                     uint16_t robot) {
-   buzzvstig_elem_t e = (buzzvstig_elem_t)malloc(sizeof(struct buzzvstig_elem_s));
+   buzzvstig_elem_t e = (buzzvstig_elem_t)calloc(1, sizeof(struct buzzvstig_elem_s));
    e->data = data;
    e->timestamp = timestamp;
    e->robot = robot;
@@ -70,7 +74,7 @@ buzzvstig_elem_t buzzvstig_elem_new(buzzobj_t data,
 /****************************************/
 
 buzzvstig_elem_t buzzvstig_elem_clone(buzzvm_t vm, const buzzvstig_elem_t e) {
-   buzzvstig_elem_t x = (buzzvstig_elem_t)malloc(sizeof(struct buzzvstig_elem_s));
+   buzzvstig_elem_t x = (buzzvstig_elem_t)calloc(1, sizeof(struct buzzvstig_elem_s));
    x->data      = buzzheap_clone(vm, e->data);
    x->timestamp = e->timestamp;
    x->robot     = e->robot;
@@ -82,6 +86,7 @@ buzzvstig_elem_t buzzvstig_elem_clone(buzzvm_t vm, const buzzvstig_elem_t e) {
 
 void buzzvstig_elem_destroy(const void* key, void* data, void* params) {
    free((void*)key);
+   free((*(buzzvstig_elem_t*)data)->link);
    free(*(buzzvstig_elem_t*)data);
    free(data);
 }
@@ -98,8 +103,14 @@ buzzvstig_t buzzvstig_new() {
       buzzvstig_key_hash,
       buzzvstig_key_cmp,
       buzzvstig_elem_destroy);
+   x->tombstones = 0;
+   x->conflict = BUZZVSTIG_CONFLICT_ROBOT;
    x->onconflict = NULL;
    x->onconflictlost = NULL;
+   memset(&x->sync, 0, sizeof(struct buzzvstig_sync_s));
+   memset(&x->limits, 0, sizeof(struct buzzvstig_limits_s));
+   x->aggs = NULL;
+   x->log = NULL;
    return x;
 }
 
@@ -107,6 +118,10 @@ buzzvstig_t buzzvstig_new() {
 /****************************************/
 
 void buzzvstig_destroy(buzzvstig_t* vs) {
+   buzzvstig_sync_set(*vs, 0, 0);
+   if((*vs)->limits.heap) buzzdarray_destroy(&((*vs)->limits.heap));
+   if((*vs)->aggs) buzzdarray_destroy(&((*vs)->aggs));
+   if((*vs)->log) buzzvstiglog_close(&((*vs)->log));
    buzzdict_destroy(&((*vs)->data));
    free(*vs);
 }
@@ -114,6 +129,534 @@ void buzzvstig_destroy(buzzvstig_t* vs) {
 /****************************************/
 /****************************************/
 
+static uint32_t buzzvstig_sync_mix(uint32_t h) {
+   h ^= h >> 16;
+   h *= 0x85ebca6b;
+   h ^= h >> 13;
+   h *= 0xc2b2ae35;
+   h ^= h >> 16;
+   return h;
+}
+
+static uint32_t buzzvstig_sync_keyhash(const buzzobj_t key) {
+   return buzzvstig_sync_mix(buzzobj_hash(key) ^ ((uint32_t)key->o.type << 24));
+}
+
+/*
+ * Adds (dir = 1) or removes (dir = -1) an entry from the leaf hashes.
+ */
+static void buzzvstig_sync_account(buzzvstig_t vs,
+                                   const buzzobj_t key,
+                                   const buzzvstig_elem_t e,
+                                   int dir) {
+   if(!vs->sync.hashes) return;
+   uint32_t kh = buzzvstig_sync_keyhash(key);
+   uint32_t leaf = kh % BUZZVSTIG_SYNC_LEAVES;
+   vs->sync.hashes[leaf] ^= buzzvstig_sync_mix(
+      kh ^ buzzvstig_sync_mix(((uint32_t)e->timestamp << 16) | e->robot));
+   vs->sync.counts[leaf] += dir;
+}
+
+/*
+ * Adds (add = 1) or removes (add = 0) the key of an entry from the keys
+ * of its leaf. A key is added when it is first stored or when it replaces
+ * an equal key in the data, so that the leaves hold the very objects
+ * kept by the data.
+ */
+static void buzzvstig_sync_index(buzzvstig_t vs,
+                                 const buzzobj_t key,
+                                 int add) {
+   if(!vs->sync.hashes) return;
+   uint32_t leaf = buzzvstig_sync_keyhash(key) % BUZZVSTIG_SYNC_LEAVES;
+   buzzdarray_t ks = vs->sync.keys[leaf];
+   if(!ks) {
+      if(!add) return;
+      ks = vs->sync.keys[leaf] = buzzdarray_new(2, sizeof(buzzobj_t), NULL);
+   }
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(ks); ++i) {
+      if(buzzvstig_key_cmp(&key, &buzzdarray_get(ks, i, buzzobj_t)) == 0) {
+         if(add) {
+            buzzdarray_set(ks, i, &key);
+         }
+         else {
+            /* Fill the hole with the last key */
+            if(i + 1 < buzzdarray_size(ks))
+               buzzdarray_set(ks, i, &buzzdarray_last(ks, buzzobj_t));
+            buzzdarray_pop(ks);
+         }
+         return;
+      }
+   }
+   if(add) buzzdarray_push(ks, &key);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_agg_destroy(uint32_t pos, void* data, void* params) {
+   buzzvstig_agg_t a = *(buzzvstig_agg_t*)data;
+   free(a->hist);
+   free(a);
+}
+
+/*
+ * Calls the filter of an aggregate on a value.
+ */
+static int buzzvstig_agg_test(buzzvm_t vm,
+                              buzzvstig_agg_t a,
+                              const buzzobj_t key,
+                              const buzzobj_t value) {
+   if(value->o.type == BUZZTYPE_NIL) return 0;
+   if(!a->filter) return 1;
+   if(vm->state != BUZZVM_STATE_READY) return 0;
+   /* Save current stack size */
+   uint32_t ss = buzzvm_stack_top(vm);
+   /* Push closure and params (key, value) */
+   buzzvm_push(vm, a->filter);
+   buzzvm_push(vm, key);
+   buzzvm_push(vm, value);
+   /* Call closure */
+   if(buzzvm_closure_call(vm, 2) != BUZZVM_STATE_READY ||
+      buzzvm_stack_top(vm) <= ss) return 0;
+   /* Same truth values as the if statement */
+   buzzobj_t r = buzzvm_stack_at(vm, 1);
+   int t = !(r->o.type == BUZZTYPE_NIL ||
+             (r->o.type == BUZZTYPE_INT && r->i.value == 0));
+   buzzvm_pop(vm);
+   return t;
+}
+
+/*
+ * Returns the bits of the aggregates a value counts in.
+ */
+static uint32_t buzzvstig_agg_mask(buzzvm_t vm,
+                                   buzzvstig_t vs,
+                                   const buzzobj_t key,
+                                   const buzzobj_t value) {
+   if(!vs->aggs) return 0;
+   uint32_t m = 0;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(vs->aggs); ++i)
+      if(buzzvstig_agg_test(vm, buzzdarray_get(vs->aggs, i, buzzvstig_agg_t), key, value))
+         m |= 1u << i;
+   return m;
+}
+
+/*
+ * Adds (dir = 1) or removes (dir = -1) a value from an aggregate.
+ */
+static void buzzvstig_agg_apply(buzzvstig_agg_t a,
+                                const buzzobj_t value,
+                                int dir) {
+   a->count += dir;
+   if(!buzzobj_isnumber(value)) return;
+   double x = buzzobj_isint(value) ? value->i.value : value->f.value;
+   a->numbers += dir;
+   a->sum += dir * x;
+   if(a->numbers == 0) {
+      /* Get rid of rounding errors */
+      a->sum = 0.0;
+      a->stale = 0;
+   }
+   else if(dir > 0 && a->numbers == 1) {
+      a->min = x;
+      a->max = x;
+      a->stale = 0;
+   }
+   else if(dir > 0) {
+      if(x < a->min) a->min = x;
+      if(x > a->max) a->max = x;
+   }
+   else if(x <= a->min || x >= a->max) {
+      /* An extreme value is gone */
+      a->stale = 1;
+   }
+   if(a->hist) {
+      uint32_t b = 0;
+      if(x >= a->high) b = a->bins - 1;
+      else if(x > a->low) b = (uint32_t)((x - a->low) / (a->high - a->low) * a->bins);
+      if(b >= a->bins) b = a->bins - 1;
+      a->hist[b] += dir;
+   }
+}
+
+/*
+ * Adds (dir = 1) or removes (dir = -1) an entry from its aggregates.
+ */
+static void buzzvstig_agg_account(buzzvstig_t vs,
+                                  const buzzvstig_elem_t e,
+                                  int dir) {
+   if(!vs->aggs || !e->aggs) return;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(vs->aggs); ++i)
+      if(e->aggs & (1u << i))
+         buzzvstig_agg_apply(buzzdarray_get(vs->aggs, i, buzzvstig_agg_t), e->data, dir);
+}
+
+/****************************************/
+/****************************************/
+
+static int buzzvstig_isbounded(buzzvstig_t vs) {
+   return vs->limits.capacity > 0 || vs->limits.ttl > 0;
+}
+
+static void buzzvstig_list_unlink(buzzvstig_t vs,
+                                  buzzvstig_elem_t e,
+                                  int l) {
+   buzzvstig_link_t x = e->link;
+   if(x->prev[l]) x->prev[l]->link->next[l] = x->next[l];
+   else vs->limits.head[l] = x->next[l];
+   if(x->next[l]) x->next[l]->link->prev[l] = x->prev[l];
+   else vs->limits.tail[l] = x->prev[l];
+   x->prev[l] = NULL;
+   x->next[l] = NULL;
+}
+
+static void buzzvstig_list_append(buzzvstig_t vs,
+                                  buzzvstig_elem_t e,
+                                  int l) {
+   e->link->prev[l] = vs->limits.tail[l];
+   e->link->next[l] = NULL;
+   if(vs->limits.tail[l]) vs->limits.tail[l]->link->next[l] = e;
+   else vs->limits.head[l] = e;
+   vs->limits.tail[l] = e;
+}
+
+/*
+ * Returns 1 if entry a must be evicted before entry b: the lowest
+ * priority goes first and, on a tie, the least recently written entry.
+ */
+static int buzzvstig_heap_before(buzzvstig_elem_t a,
+                                 buzzvstig_elem_t b) {
+   if(a->link->priority != b->link->priority)
+      return a->link->priority < b->link->priority;
+   return (int32_t)(a->link->serial - b->link->serial) < 0;
+}
+
+static void buzzvstig_heap_place(buzzdarray_t h,
+                                 buzzvstig_elem_t e,
+                                 uint32_t i) {
+   buzzdarray_set(h, i, &e);
+   e->link->heap = i;
+}
+
+/*
+ * Moves the entry at position i up or down until the heap is in order.
+ */
+static void buzzvstig_heap_fix(buzzdarray_t h,
+                               uint32_t i) {
+   buzzvstig_elem_t e = buzzdarray_get(h, i, buzzvstig_elem_t);
+   uint32_t n = buzzdarray_size(h);
+   while(i > 0) {
+      buzzvstig_elem_t p = buzzdarray_get(h, (i - 1) / 2, buzzvstig_elem_t);
+      if(!buzzvstig_heap_before(e, p)) break;
+      buzzvstig_heap_place(h, p, i);
+      i = (i - 1) / 2;
+   }
+   while(2 * i + 1 < n) {
+      uint32_t c = 2 * i + 1;
+      if(c + 1 < n &&
+         buzzvstig_heap_before(buzzdarray_get(h, c + 1, buzzvstig_elem_t),
+                               buzzdarray_get(h, c, buzzvstig_elem_t)))
+         ++c;
+      buzzvstig_elem_t x = buzzdarray_get(h, c, buzzvstig_elem_t);
+      if(!buzzvstig_heap_before(x, e)) break;
+      buzzvstig_heap_place(h, x, i);
+      i = c;
+   }
+   buzzvstig_heap_place(h, e, i);
+}
+
+static void buzzvstig_heap_insert(buzzdarray_t h,
+                                  buzzvstig_elem_t e) {
+   e->link->heap = buzzdarray_size(h);
+   buzzdarray_push(h, &e);
+   buzzvstig_heap_fix(h, e->link->heap);
+}
+
+static void buzzvstig_heap_remove(buzzdarray_t h,
+                                  buzzvstig_elem_t e) {
+   buzzvstig_elem_t last = buzzdarray_get(h, buzzdarray_size(h) - 1, buzzvstig_elem_t);
+   buzzdarray_pop(h);
+   if(last == e) return;
+   buzzvstig_heap_place(h, last, e->link->heap);
+   buzzvstig_heap_fix(h, e->link->heap);
+}
+
+/*
+ * Takes an entry out of the lists and the heap, and frees its eviction
+ * data. The deletion markers (nil entries) are never in them.
+ */
+static void buzzvstig_unlink(buzzvstig_t vs,
+                             buzzvstig_elem_t e) {
+   if(!e->link) return;
+   buzzvstig_list_unlink(vs, e, BUZZVSTIG_LIST_USE);
+   buzzvstig_list_unlink(vs, e, BUZZVSTIG_LIST_AGE);
+   if(vs->limits.heap) buzzvstig_heap_remove(vs->limits.heap, e);
+   free(e->link);
+   e->link = NULL;
+}
+
+/*
+ * Calls the priority closure on an entry.
+ */
+static float buzzvstig_priority(buzzvm_t vm,
+                                buzzvstig_t vs,
+                                const buzzobj_t key,
+                                const buzzvstig_elem_t e) {
+   if(vs->limits.policy != BUZZVSTIG_EVICT_PRIORITY ||
+      !vs->limits.priority ||
+      vm->state != BUZZVM_STATE_READY) return 0.0f;
+   /* Save current stack size */
+   uint32_t ss = buzzvm_stack_top(vm);
+   /* Push closure and params (key, value) */
+   buzzvm_push(vm, vs->limits.priority);
+   buzzvm_push(vm, key);
+   buzzvm_push(vm, e->data);
+   /* Call closure */
+   if(buzzvm_closure_call(vm, 2) != BUZZVM_STATE_READY ||
+      buzzvm_stack_top(vm) <= ss) return 0.0f;
+   /* Get the priority */
+   buzzobj_t r = buzzvm_stack_at(vm, 1);
+   float p = 0.0f;
+   if(r->o.type == BUZZTYPE_INT)        p = r->i.value;
+   else if(r->o.type == BUZZTYPE_FLOAT) p = r->f.value;
+   else fprintf(stderr, "[WARNING] [ROBOT %u] virtual stigmergy priority(): Return value type is %s, expected int or float\n", vm->robot, buzztype_desc[r->o.type]);
+   buzzvm_pop(vm);
+   return p;
+}
+
+/*
+ * Returns the entry to evict according to the policy.
+ */
+static buzzvstig_elem_t buzzvstig_victim(buzzvstig_t vs) {
+   if(vs->limits.policy == BUZZVSTIG_EVICT_LRU)
+      return vs->limits.head[BUZZVSTIG_LIST_USE];
+   if(vs->limits.policy == BUZZVSTIG_EVICT_OLDEST)
+      return vs->limits.head[BUZZVSTIG_LIST_AGE];
+   /* Lowest priority; on a tie, the least recently written entry */
+   return buzzdarray_get(vs->limits.heap, 0, buzzvstig_elem_t);
+}
+
+/*
+ * Removes an entry to respect the limits.
+ * With synchronization enabled, the value is dropped but the entry is
+ * kept as a nil marker with the same timestamp and robot, otherwise the
+ * neighbors would bring it back. The digests don't depend on the value,
+ * so they still match those of the neighbors, and the newer writes
+ * replace the marker as usual.
+ */
+static void buzzvstig_drop(buzzvm_t vm,
+                           buzzvstig_t vs,
+                           buzzvstig_elem_t e) {
+   buzzobj_t k = e->link->key;
+   if(!vs->sync.hashes) {
+      buzzvstig_remove(vs, &k);
+      return;
+   }
+   buzzvstig_unlink(vs, e);
+   buzzvstig_agg_account(vs, e, -1);
+   e->data = buzzheap_newobj(vm, BUZZTYPE_NIL);
+   e->aggs = 0;
+   ++vs->tombstones;
+   if(vs->log) buzzvstiglog_append(vs->log, k, e);
+}
+
+/*
+ * Evicts entries until the virtual stigmergy holds at most max entries,
+ * deletion markers excluded.
+ */
+static void buzzvstig_shrink(buzzvm_t vm,
+                             buzzvstig_t vs,
+                             uint32_t max) {
+   while(buzzdict_size(vs->data) - vs->tombstones > max) {
+      buzzvstig_drop(vm, vs, buzzvstig_victim(vs));
+      ++vs->limits.evicted;
+   }
+}
+
+/*
+ * Allocates the eviction data of a new entry and puts the entry at the
+ * end of the lists.
+ */
+static void buzzvstig_link(buzzvstig_t vs,
+                           const buzzobj_t key,
+                           buzzvstig_elem_t e,
+                           float priority) {
+   e->link = (buzzvstig_link_t)calloc(1, sizeof(struct buzzvstig_link_s));
+   e->link->key = key;
+   e->link->priority = priority;
+   e->link->updated = vs->limits.clock;
+   e->link->serial = vs->limits.serial++;
+   buzzvstig_list_append(vs, e, BUZZVSTIG_LIST_USE);
+   buzzvstig_list_append(vs, e, BUZZVSTIG_LIST_AGE);
+   if(vs->limits.heap) buzzvstig_heap_insert(vs->limits.heap, e);
+}
+
+/*
+ * Moves an entry written in place to the end of the lists, and to its
+ * new place in the heap.
+ */
+static void buzzvstig_written(buzzvstig_t vs,
+                              buzzvstig_elem_t e) {
+   e->link->updated = vs->limits.clock;
+   e->link->serial = vs->limits.serial++;
+   buzzvstig_list_unlink(vs, e, BUZZVSTIG_LIST_USE);
+   buzzvstig_list_append(vs, e, BUZZVSTIG_LIST_USE);
+   buzzvstig_list_unlink(vs, e, BUZZVSTIG_LIST_AGE);
+   buzzvstig_list_append(vs, e, BUZZVSTIG_LIST_AGE);
+   if(vs->limits.heap) buzzvstig_heap_fix(vs->limits.heap, e->link->heap);
+}
+
+/*
+ * Moves a read entry to the end of the use list.
+ */
+static void buzzvstig_read(buzzvstig_t vs,
+                           buzzvstig_elem_t e) {
+   if(!e->link) return;
+   buzzvstig_list_unlink(vs, e, BUZZVSTIG_LIST_USE);
+   buzzvstig_list_append(vs, e, BUZZVSTIG_LIST_USE);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_store(buzzvm_t vm,
+                     buzzvstig_t vs,
+                     const buzzobj_t* key,
+                     const buzzvstig_elem_t* el) {
+   /* The closures could modify the virtual stigmergy, call them first */
+   float priority = buzzvstig_priority(vm, vs, *key, *el);
+   (*el)->aggs = buzzvstig_agg_mask(vm, vs, *key, (*el)->data);
+   const buzzvstig_elem_t* o = buzzvstig_fetch(vs, key);
+   if(vs->sync.hashes) {
+      if(o) buzzvstig_sync_account(vs, *key, *o, -1);
+      buzzvstig_sync_account(vs, *key, *el, 1);
+      buzzvstig_sync_index(vs, *key, 1);
+   }
+   if(o) buzzvstig_agg_account(vs, *o, -1);
+   buzzvstig_agg_account(vs, *el, 1);
+   if(o && (*o)->data->o.type == BUZZTYPE_NIL) --vs->tombstones;
+   if((*el)->data->o.type == BUZZTYPE_NIL) ++vs->tombstones;
+   if(buzzvstig_isbounded(vs) && (*el)->data->o.type != BUZZTYPE_NIL) {
+      if(o && (*o)->data->o.type != BUZZTYPE_NIL) {
+         /* The old entry is about to be destroyed */
+         buzzvstig_unlink(vs, *o);
+      }
+      else if(vs->limits.capacity > 0) {
+         /* Make room for the new entry */
+         buzzvstig_shrink(vm, vs, vs->limits.capacity - 1);
+      }
+      buzzvstig_link(vs, *key, *el, priority);
+   }
+   else if(o) {
+      /* The old entry is about to be destroyed */
+      buzzvstig_unlink(vs, *o);
+   }
+   buzzdict_set(vs->data, key, el);
+   if(vs->log) buzzvstiglog_append(vs->log, *key, *el);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_remove(buzzvstig_t vs,
+                      const buzzobj_t* key) {
+   const buzzvstig_elem_t* o = buzzvstig_fetch(vs, key);
+   if(o) {
+      if(vs->log) buzzvstiglog_remove(vs->log, *key);
+      buzzvstig_sync_account(vs, *key, *o, -1);
+      buzzvstig_sync_index(vs, *key, 0);
+      buzzvstig_agg_account(vs, *o, -1);
+      buzzvstig_unlink(vs, *o);
+      if((*o)->data->o.type == BUZZTYPE_NIL) --vs->tombstones;
+   }
+   buzzdict_remove(vs->data, key);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_limits_link(const void* key, void* data, void* params) {
+   buzzvstig_elem_t e = *(buzzvstig_elem_t*)data;
+   if(e->data->o.type == BUZZTYPE_NIL) return;
+   buzzvstig_link((buzzvstig_t)params, *(buzzobj_t*)key, e, 0.0f);
+}
+
+void buzzvstig_limits_unlink(const void* key, void* data, void* params) {
+   buzzvstig_elem_t e = *(buzzvstig_elem_t*)data;
+   free(e->link);
+   e->link = NULL;
+}
+
+void buzzvstig_limits_heap(const void* key, void* data, void* params) {
+   buzzvstig_t vs = (buzzvstig_t)params;
+   buzzvstig_elem_t e = *(buzzvstig_elem_t*)data;
+   if(e->data->o.type == BUZZTYPE_NIL) return;
+   buzzvstig_heap_insert(vs->limits.heap, e);
+}
+
+void buzzvstig_limits_set(buzzvm_t vm,
+                          buzzvstig_t vs,
+                          uint32_t capacity,
+                          buzzvstig_evict_e policy,
+                          uint32_t ttl) {
+   int wasbounded = buzzvstig_isbounded(vs);
+   vs->limits.capacity = capacity;
+   vs->limits.policy = policy;
+   vs->limits.ttl = ttl;
+   if(!buzzvstig_isbounded(vs) || policy != BUZZVSTIG_EVICT_PRIORITY) {
+      /* The heap is not maintained any longer */
+      if(vs->limits.heap) buzzdarray_destroy(&vs->limits.heap);
+   }
+   if(!buzzvstig_isbounded(vs)) {
+      /* The lists are not maintained any longer */
+      if(wasbounded)
+         buzzdict_foreach(vs->data, buzzvstig_limits_unlink, vs);
+      memset(vs->limits.head, 0, sizeof(vs->limits.head));
+      memset(vs->limits.tail, 0, sizeof(vs->limits.tail));
+      return;
+   }
+   if(policy == BUZZVSTIG_EVICT_PRIORITY && !vs->limits.heap) {
+      vs->limits.heap = buzzdarray_new(buzzdict_size(vs->data) + 1,
+                                       sizeof(buzzvstig_elem_t),
+                                       NULL);
+      /* Put the current entries in the heap */
+      if(wasbounded)
+         buzzdict_foreach(vs->data, buzzvstig_limits_heap, vs);
+   }
+   if(!wasbounded) {
+      /* Put the current entries in the lists */
+      buzzdict_foreach(vs->data, buzzvstig_limits_link, vs);
+   }
+   if(capacity > 0)
+      buzzvstig_shrink(vm, vs, capacity);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_step(buzzvm_t vm,
+                    uint16_t id,
+                    buzzvstig_t vs) {
+   ++vs->limits.clock;
+   /* Remove the entries whose lifetime is over */
+   if(vs->limits.ttl > 0) {
+      buzzvstig_elem_t e;
+      while((e = vs->limits.head[BUZZVSTIG_LIST_AGE]) &&
+            vs->limits.clock - e->link->updated >= vs->limits.ttl) {
+         buzzvstig_drop(vm, vs, e);
+         ++vs->limits.expired;
+      }
+   }
+   buzzvstig_sync_step(vm, id, vs);
+   if(vs->log) buzzvstiglog_step(vs->log, vs);
+}
+
+/****************************************/
+/****************************************/
+
 void buzzvstig_elem_serialize(buzzmsg_payload_t buf,
                               const buzzobj_t key,
                               const buzzvstig_elem_t data) {
@@ -152,13 +695,117 @@ int64_t buzzvstig_elem_deserialize(buzzobj_t* key,
 /****************************************/
 /****************************************/
 
+/*
+ * Returns a field of a table of options, or NULL if the field is not set.
+ */
+static buzzobj_t buzzvstig_option(buzzvm_t vm,
+                                  buzzobj_t opts,
+                                  const char* name) {
+   buzzvm_push(vm, opts);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, name, 1));
+   buzzvm_tget(vm);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   return o->o.type != BUZZTYPE_NIL ? o : NULL;
+}
+
 int buzzvstig_create(buzzvm_t vm) {
-   buzzvm_lnum_assert(vm, 1);
+   /* Get the id and, optionally, a table of options */
+   if(buzzvm_lnum(vm) != 1 && buzzvm_lnum(vm) != 2) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "stigmergy.create(): expected 1 or 2 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
    /* Get vstig id */
    buzzvm_lload(vm, 1);
    buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
    uint16_t id = buzzvm_stack_at(vm, 1)->i.value;
    buzzvm_pop(vm);
+   /* Get the memory limits */
+   uint32_t capacity = 0;
+   uint32_t ttl = 0;
+   buzzvstig_evict_e policy = BUZZVSTIG_EVICT_LRU;
+   buzzobj_t priority = NULL;
+   /* Get the persistence options */
+   const char* persist = NULL;
+   buzzvstiglog_fsync_e fsync = BUZZVSTIGLOG_FSYNC_STEP;
+   if(buzzvm_lnum(vm) == 2) {
+      buzzvm_lload(vm, 2);
+      buzzvm_type_assert(vm, 1, BUZZTYPE_TABLE);
+      buzzobj_t opts = buzzvm_stack_at(vm, 1);
+      buzzvm_pop(vm);
+      buzzobj_t o = buzzvstig_option(vm, opts, "capacity");
+      if(o) {
+         if(o->o.type != BUZZTYPE_INT || o->i.value < 0) {
+            buzzvm_seterror(vm,
+                            BUZZVM_ERROR_TYPE,
+                            "stigmergy.create(): expected a non-negative integer for capacity");
+            return vm->state;
+         }
+         capacity = o->i.value;
+      }
+      o = buzzvstig_option(vm, opts, "ttl");
+      if(o) {
+         if(o->o.type != BUZZTYPE_INT || o->i.value < 0) {
+            buzzvm_seterror(vm,
+                            BUZZVM_ERROR_TYPE,
+                            "stigmergy.create(): expected a non-negative integer for ttl");
+            return vm->state;
+         }
+         ttl = o->i.value;
+      }
+      priority = buzzvstig_option(vm, opts, "priority");
+      if(priority) {
+         if(priority->o.type != BUZZTYPE_CLOSURE) {
+            buzzvm_seterror(vm,
+                            BUZZVM_ERROR_TYPE,
+                            "stigmergy.create(): expected a closure for priority, got %s",
+                            buzztype_desc[priority->o.type]);
+            return vm->state;
+         }
+         /* A priority closure implies the priority policy */
+         policy = BUZZVSTIG_EVICT_PRIORITY;
+      }
+      o = buzzvstig_option(vm, opts, "policy");
+      if(o) {
+         const char* p = o->o.type == BUZZTYPE_STRING ? o->s.value.str : "";
+         if(strcmp(p, "lru") == 0)           policy = BUZZVSTIG_EVICT_LRU;
+         else if(strcmp(p, "oldest") == 0)   policy = BUZZVSTIG_EVICT_OLDEST;
+         else if(strcmp(p, "priority") == 0) policy = BUZZVSTIG_EVICT_PRIORITY;
+         else {
+            buzzvm_seterror(vm,
+                            BUZZVM_ERROR_TYPE,
+                            "stigmergy.create(): expected \"lru\", \"oldest\", or \"priority\" for policy");
+            return vm->state;
+         }
+      }
+      o = buzzvstig_option(vm, opts, "persist");
+      if(o) {
+         if(o->o.type != BUZZTYPE_STRING) {
+            buzzvm_seterror(vm,
+                            BUZZVM_ERROR_TYPE,
+                            "stigmergy.create(): expected a directory name for persist, got %s",
+                            buzztype_desc[o->o.type]);
+            return vm->state;
+         }
+         persist = o->s.value.str;
+      }
+      o = buzzvstig_option(vm, opts, "fsync");
+      if(o) {
+         const char* f = o->o.type == BUZZTYPE_STRING ? o->s.value.str : "";
+         if(strcmp(f, "never") == 0)       fsync = BUZZVSTIGLOG_FSYNC_NEVER;
+         else if(strcmp(f, "step") == 0)   fsync = BUZZVSTIGLOG_FSYNC_STEP;
+         else if(strcmp(f, "always") == 0) fsync = BUZZVSTIGLOG_FSYNC_ALWAYS;
+         else {
+            buzzvm_seterror(vm,
+                            BUZZVM_ERROR_TYPE,
+                            "stigmergy.create(): expected \"never\", \"step\", or \"always\" for fsync");
+            return vm->state;
+         }
+      }
+   }
    /* Look for virtual stigmergy */
    const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
    if(vs) {
@@ -167,7 +814,20 @@ int buzzvstig_create(buzzvm_t vm) {
    }
    /* Create a new virtual stigmergy */
    buzzvstig_t nvs = buzzvstig_new();
+   buzzvstig_limits_set(vm, nvs, capacity, policy, ttl);
+   nvs->limits.priority = priority;
    buzzdict_set(vm->vstigs, &id, &nvs);
+   if(persist) {
+      /* Load the entries from the log; the virtual stigmergy works
+       * without persistence if the log can't be opened */
+      char* fname;
+      if(asprintf(&fname, "%s/vstig_%u_%u.log", persist, vm->robot, id) >= 0) {
+         nvs->log = buzzvstiglog_open(vm, nvs, fname, fsync);
+         if(!nvs->log)
+            fprintf(stderr, "[WARNING] [ROBOT %u] Can't open virtual stigmergy log %s: %s\n", vm->robot, fname, strerror(errno));
+         free(fname);
+      }
+   }
    /* Create a table */
    buzzvm_pusht(vm);
    /* Add data and methods */
@@ -187,6 +847,9 @@ int buzzvstig_create(buzzvm_t vm) {
    function_register(get);
    function_register(onconflict);
    function_register(onconflictlost);
+   function_register(sync);
+   function_register(evictions);
+   function_register(aggregate);
    /* Return the table */
    return buzzvm_ret1(vm);
 }
@@ -209,13 +872,24 @@ int buzzvstig_put(buzzvm_t vm) {
    if(vs) {
       /* Look for the element */
       const buzzvstig_elem_t* x = buzzvstig_fetch(*vs, &k);
-      if(x) {
+      if(x && (*x)->data->o.type != BUZZTYPE_NIL) {
          /* Element found */
          if(v->o.type != BUZZTYPE_NIL) {
             /* New value is not nil, update the existing element */
+            uint32_t aggs = buzzvstig_agg_mask(vm, *vs, k, v);
+            buzzvstig_sync_account(*vs, k, *x, -1);
+            buzzvstig_agg_account(*vs, *x, -1);
             (*x)->data = v;
             ++((*x)->timestamp);
             (*x)->robot = vm->robot;
+            (*x)->aggs = aggs;
+            buzzvstig_sync_account(*vs, k, *x, 1);
+            buzzvstig_agg_account(*vs, *x, 1);
+            if(buzzvstig_isbounded(*vs)) {
+               (*x)->link->priority = buzzvstig_priority(vm, *vs, k, *x);
+               buzzvstig_written(*vs, *x);
+            }
+            if((*vs)->log) buzzvstiglog_append((*vs)->log, k, *x);
             /* Append a PUT message to the out message queue */
             buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, *x);
          }
@@ -223,19 +897,27 @@ int buzzvstig_put(buzzvm_t vm) {
             /* New value is nil, must delete the existing element */
             /* Make a new element with nil as value to update neighbors */
             buzzvstig_elem_t y = buzzvstig_elem_new(
-               buzzobj_new(BUZZTYPE_NIL), // nil value
+               v,                         // nil value
                (*x)->timestamp + 1,       // new timestamp
                vm->robot);                // robot id
             /* Append a PUT message to the out message queue with nil in it */
             buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, y);
-            /* Delete the existing element */
-            buzzvstig_remove(*vs, &k);
+            if((*vs)->sync.hashes) {
+               /* Keep the nil element, or the synchronization with
+                * neighbors that missed the deletion would restore it */
+               buzzvstig_store(vm, *vs, &k, &y);
+            }
+            else {
+               /* Delete the existing element */
+               buzzvstig_remove(*vs, &k);
+               free(y);
+            }
          }
       }
       else if(v->o.type != BUZZTYPE_NIL) {
-         /* Element not found and new value is not nil, store it */
-         buzzvstig_elem_t y = buzzvstig_elem_new(v, 1, vm->robot);
-         buzzvstig_store(*vs, &k, &y);
+         /* Element not found or deleted and new value is not nil, store it */
+         buzzvstig_elem_t y = buzzvstig_elem_new(v, x ? (*x)->timestamp + 1 : 1, vm->robot);
+         buzzvstig_store(vm, *vs, &k, &y);
          /* Append a PUT message to the out message queue */
          buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, y);
       }
@@ -256,6 +938,8 @@ void buzzvstig_foreach_entry(const void* key, void* data, void* params) {
    /* Cast params */
    struct buzzvstig_foreach_params* p = (struct buzzvstig_foreach_params*)params;
    if(p->vm->state != BUZZVM_STATE_READY) return;
+   /* Skip the deleted entries */
+   if((*(buzzvstig_elem_t*)data)->data->o.type == BUZZTYPE_NIL) return;
    /* Push closure and params (key, value, robot) */
    buzzvm_push(p->vm, p->fun);
    buzzvm_push(p->vm, *(buzzobj_t*)key);
@@ -298,6 +982,8 @@ void buzzvstig_reduce_entry(const void* key, void* data, void* params) {
    /* Cast params */
    struct buzzvstig_reduce_params* p = (struct buzzvstig_reduce_params*)params;
    if(p->vm->state != BUZZVM_STATE_READY) return;
+   /* Skip the deleted entries */
+   if((*(buzzvstig_elem_t*)data)->data->o.type == BUZZTYPE_NIL) return;
    /* Save and pop accumulator from the stack */
    buzzobj_t accum = buzzvm_stack_at(p->vm, 1);
    buzzvm_pop(p->vm);
@@ -358,6 +1044,8 @@ void buzzvstig_map_entry(const void* key, void* data, void* params) {
    /* Cast params */
    struct buzzvstig_map_params* p = (struct buzzvstig_map_params*)params;
    if(p->vm->state != BUZZVM_STATE_READY) return;
+   /* Skip the deleted entries */
+   if((*(buzzvstig_elem_t*)data)->data->o.type == BUZZTYPE_NIL) return;
    /* Save current stack size */
    uint32_t ss = buzzvm_stack_top(p->vm);
    /* Push closure and params (key, value, robot) */
@@ -428,8 +1116,8 @@ int buzzvstig_size(buzzvm_t vm) {
    /* Look for virtual stigmergy */
    const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
    if(vs) {
-      /* Virtual stigmergy found, return its size */
-      buzzvm_pushi(vm, buzzdict_size((*vs)->data));
+      /* Virtual stigmergy found, return its size without the deleted entries */
+      buzzvm_pushi(vm, buzzdict_size((*vs)->data) - (*vs)->tombstones);
    }
    else {
       /* Virtual stigmergy not found, return 0 */
@@ -457,6 +1145,7 @@ int buzzvstig_get(buzzvm_t vm) {
       const buzzvstig_elem_t* e = buzzvstig_fetch(*vs, &k);
       if(e) {
          /* Key found */
+         buzzvstig_read(*vs, *e);
          buzzvm_push(vm, (*e)->data);
          /* Append the message to the out message queue */
          buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_QUERY, id, k, *e);
@@ -485,6 +1174,10 @@ int buzzvstig_get(buzzvm_t vm) {
 /****************************************/
 /****************************************/
 
+static const char* buzzvstig_conflict_names[] = {
+   "robot", "robot_strict", "max", "min"
+};
+
 int buzzvstig_onconflict(struct buzzvm_s* vm) {
    buzzvm_lnum_assert(vm, 1);
    /* Get vstig id */
@@ -493,12 +1186,30 @@ int buzzvstig_onconflict(struct buzzvm_s* vm) {
    const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
    if(vs) {
       /* Virtual stigmergy found */
-      /* Get closure */
+      /* Get closure or policy name */
       buzzvm_lload(vm, 1);
-      buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
-      /* Clone the closure */
-      if((*vs)->onconflict) free((*vs)->onconflict);
-      (*vs)->onconflict = buzzheap_clone(vm, buzzvm_stack_at(vm, 1));
+      buzzobj_t o = buzzvm_stack_at(vm, 1);
+      if(o->o.type == BUZZTYPE_STRING) {
+         /* Native policy */
+         int p;
+         for(p = 0; p < BUZZVSTIG_CONFLICT_CLOSURE; ++p)
+            if(strcmp(o->s.value.str, buzzvstig_conflict_names[p]) == 0) break;
+         if(p == BUZZVSTIG_CONFLICT_CLOSURE) {
+            buzzvm_seterror(vm,
+                            BUZZVM_ERROR_TYPE,
+                            "onconflict(): unknown policy \"%s\", expected \"robot\", \"robot_strict\", \"max\", or \"min\"",
+                            o->s.value.str);
+            return vm->state;
+         }
+         (*vs)->conflict = (buzzvstig_conflict_e)p;
+         (*vs)->onconflict = NULL;
+      }
+      else {
+         buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
+         /* Clone the closure; the heap reclaims the previous one */
+         (*vs)->conflict = BUZZVSTIG_CONFLICT_CLOSURE;
+         (*vs)->onconflict = buzzheap_clone(vm, o);
+      }
    }
    else {
       /* No virtual stigmergy found, just push false */
@@ -524,8 +1235,7 @@ int buzzvstig_onconflictlost(struct buzzvm_s* vm) {
       /* Get closure */
       buzzvm_lload(vm, 1);
       buzzvm_type_assert(vm, 1, BUZZTYPE_CLOSURE);
-      /* Clone the closure */
-      if((*vs)->onconflictlost) free((*vs)->onconflictlost);
+      /* Clone the closure; the heap reclaims the previous one */
       (*vs)->onconflictlost = buzzheap_clone(vm, buzzvm_stack_at(vm, 1));
    }
    else {
@@ -541,6 +1251,600 @@ int buzzvstig_onconflictlost(struct buzzvm_s* vm) {
 /****************************************/
 /****************************************/
 
+int buzzvstig_sync(struct buzzvm_s* vm) {
+   buzzvm_lnum_assert(vm, 2);
+   /* Get vstig id */
+   id_get();
+   /* Get period and bandwidth */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   buzzvm_lload(vm, 2);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_INT);
+   int32_t period = buzzvm_stack_at(vm, 2)->i.value;
+   int32_t bandwidth = buzzvm_stack_at(vm, 1)->i.value;
+   if(period < 0 || bandwidth < 0) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_TYPE,
+                      "sync(): expected non-negative period and bandwidth, got %d and %d",
+                      period, bandwidth);
+      return vm->state;
+   }
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) {
+      buzzvstig_sync_set(*vs, period, bandwidth);
+   }
+   else {
+      /* If this happens, its a bug */
+      fprintf(stderr, "[BUG] [ROBOT %u] Can't find virtual stigmergy %u\n", vm->robot, id);
+   }
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstig_evictions(struct buzzvm_s* vm) {
+   buzzvm_lnum_assert(vm, 0);
+   /* Get vstig id */
+   id_get();
+   /* Make a table with the counters */
+   buzzvm_pusht(vm);
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(vs) {
+      struct buzzvstig_limits_s* l = &(*vs)->limits;
+      add_field(evicted, l, pushi);
+      add_field(expired, l, pushi);
+   }
+   else {
+      /* If this happens, its a bug */
+      fprintf(stderr, "[BUG] [ROBOT %u] Can't find virtual stigmergy %u\n", vm->robot, id);
+   }
+   return buzzvm_ret1(vm);
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzvstig_agg_params {
+   buzzvm_t vm;
+   buzzvstig_agg_t a;
+   uint32_t bit;
+};
+
+void buzzvstig_agg_fill(const void* key, void* data, void* params) {
+   struct buzzvstig_agg_params* p = (struct buzzvstig_agg_params*)params;
+   buzzvstig_elem_t e = *(buzzvstig_elem_t*)data;
+   if(buzzvstig_agg_test(p->vm, p->a, *(buzzobj_t*)key, e->data)) {
+      e->aggs |= p->bit;
+      buzzvstig_agg_apply(p->a, e->data, 1);
+   }
+   else {
+      e->aggs &= ~p->bit;
+   }
+}
+
+buzzvstig_agg_t buzzvstig_agg_new(buzzvm_t vm,
+                                  buzzvstig_t vs,
+                                  uint16_t name,
+                                  buzzvstig_agg_e kind,
+                                  buzzobj_t filter,
+                                  float low,
+                                  float high,
+                                  uint32_t bins) {
+   if(!vs->aggs)
+      vs->aggs = buzzdarray_new(1, sizeof(buzzvstig_agg_t), buzzvstig_agg_destroy);
+   /* Look for an aggregate with the same name */
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(vs->aggs); ++i)
+      if(buzzdarray_get(vs->aggs, i, buzzvstig_agg_t)->name == name) break;
+   if(i == BUZZVSTIG_AGG_MAX_NUM) return NULL;
+   /* Make the aggregate */
+   buzzvstig_agg_t a = (buzzvstig_agg_t)calloc(1, sizeof(struct buzzvstig_agg_s));
+   a->name = name;
+   a->kind = kind;
+   a->filter = filter;
+   a->low = low;
+   a->high = high;
+   a->bins = bins;
+   if(bins > 0) a->hist = (uint32_t*)calloc(bins, sizeof(uint32_t));
+   if(i < buzzdarray_size(vs->aggs)) {
+      /* Replace the existing aggregate */
+      buzzvstig_agg_t old = buzzdarray_get(vs->aggs, i, buzzvstig_agg_t);
+      free(old->hist);
+      free(old);
+   }
+   buzzdarray_set(vs->aggs, i, &a);
+   /* Aggregate the current entries */
+   struct buzzvstig_agg_params p = { .vm = vm, .a = a, .bit = 1u << i };
+   buzzdict_foreach(vs->data, buzzvstig_agg_fill, &p);
+   return a;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_agg_rescan(const void* key, void* data, void* params) {
+   struct buzzvstig_agg_params* p = (struct buzzvstig_agg_params*)params;
+   buzzvstig_elem_t e = *(buzzvstig_elem_t*)data;
+   if(!(e->aggs & p->bit) || !buzzobj_isnumber(e->data)) return;
+   float x = buzzobj_isint(e->data) ? e->data->i.value : e->data->f.value;
+   if(p->a->stale) {
+      p->a->min = x;
+      p->a->max = x;
+      p->a->stale = 0;
+   }
+   if(x < p->a->min) p->a->min = x;
+   if(x > p->a->max) p->a->max = x;
+}
+
+buzzvstig_agg_t buzzvstig_agg_get(buzzvstig_t vs,
+                                  uint16_t name) {
+   if(!vs->aggs) return NULL;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(vs->aggs); ++i) {
+      buzzvstig_agg_t a = buzzdarray_get(vs->aggs, i, buzzvstig_agg_t);
+      if(a->name != name) continue;
+      if(a->stale) {
+         /* Recompute the smallest and largest values */
+         struct buzzvstig_agg_params p = { .vm = NULL, .a = a, .bit = 1u << i };
+         buzzdict_foreach(vs->data, buzzvstig_agg_rescan, &p);
+      }
+      return a;
+   }
+   return NULL;
+}
+
+/****************************************/
+/****************************************/
+
+static const char* buzzvstig_agg_names[] = {
+   "count", "sum", "min", "max", "mean", "histogram"
+};
+
+/*
+ * Pushes the value of an aggregate.
+ */
+static void buzzvstig_agg_push(buzzvm_t vm,
+                               buzzvstig_agg_t a) {
+   switch(a->kind) {
+      case BUZZVSTIG_AGG_COUNT:
+         buzzvm_pushi(vm, a->count);
+         break;
+      case BUZZVSTIG_AGG_SUM:
+         buzzvm_pushf(vm, a->sum);
+         break;
+      case BUZZVSTIG_AGG_MIN:
+         if(a->numbers > 0) buzzvm_pushf(vm, a->min);
+         else buzzvm_pushnil(vm);
+         break;
+      case BUZZVSTIG_AGG_MAX:
+         if(a->numbers > 0) buzzvm_pushf(vm, a->max);
+         else buzzvm_pushnil(vm);
+         break;
+      case BUZZVSTIG_AGG_MEAN:
+         if(a->numbers > 0) buzzvm_pushf(vm, a->sum / a->numbers);
+         else buzzvm_pushnil(vm);
+         break;
+      case BUZZVSTIG_AGG_HISTOGRAM: {
+         /* Table of bin -> number of values */
+         buzzvm_pusht(vm);
+         uint32_t i;
+         for(i = 0; i < a->bins; ++i) {
+            buzzvm_dup(vm);
+            buzzvm_pushi(vm, i);
+            buzzvm_pushi(vm, a->hist[i]);
+            buzzvm_tput(vm);
+         }
+         break;
+      }
+   }
+}
+
+int buzzvstig_aggregate(struct buzzvm_s* vm) {
+   if(buzzvm_lnum(vm) != 1 && buzzvm_lnum(vm) != 2) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_LNUM,
+                      "aggregate(): expected 1 or 2 parameters, got %" PRId64,
+                      buzzvm_lnum(vm));
+      return vm->state;
+   }
+   /* Get vstig id */
+   id_get();
+   /* Get the name */
+   buzzvm_lload(vm, 1);
+   buzzvm_type_assert(vm, 1, BUZZTYPE_STRING);
+   buzzobj_t name = buzzvm_stack_at(vm, 1);
+   /* Look for virtual stigmergy */
+   const buzzvstig_t* vs = buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   if(!vs) {
+      /* If this happens, its a bug */
+      fprintf(stderr, "[BUG] [ROBOT %u] Can't find virtual stigmergy %u\n", vm->robot, id);
+      return buzzvm_ret0(vm);
+   }
+   if(buzzvm_lnum(vm) == 1) {
+      /* Read the aggregate */
+      buzzvstig_agg_t a = buzzvstig_agg_get(*vs, name->s.value.sid);
+      if(a) buzzvstig_agg_push(vm, a);
+      else buzzvm_pushnil(vm);
+      return buzzvm_ret1(vm);
+   }
+   /* Register the aggregate, described by a kind or a table */
+   buzzvm_lload(vm, 2);
+   buzzobj_t spec = buzzvm_stack_at(vm, 1);
+   buzzobj_t kind = spec;
+   buzzobj_t filter = NULL;
+   float low = 0.0f, high = 0.0f;
+   uint32_t bins = 0;
+   if(spec->o.type == BUZZTYPE_TABLE) {
+      kind = buzzvstig_option(vm, spec, "kind");
+      filter = buzzvstig_option(vm, spec, "filter");
+      if(filter && filter->o.type != BUZZTYPE_CLOSURE) {
+         buzzvm_seterror(vm,
+                         BUZZVM_ERROR_TYPE,
+                         "aggregate(): expected a closure for filter, got %s",
+                         buzztype_desc[filter->o.type]);
+         return vm->state;
+      }
+   }
+   int k = BUZZVSTIG_AGG_HISTOGRAM + 1;
+   if(kind && kind->o.type == BUZZTYPE_STRING)
+      for(k = 0; k <= BUZZVSTIG_AGG_HISTOGRAM; ++k)
+         if(strcmp(kind->s.value.str, buzzvstig_agg_names[k]) == 0) break;
+   if(k > BUZZVSTIG_AGG_HISTOGRAM) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_TYPE,
+                      "aggregate(): expected \"count\", \"sum\", \"min\", \"max\", \"mean\", or \"histogram\" for the kind");
+      return vm->state;
+   }
+   if(k == BUZZVSTIG_AGG_HISTOGRAM) {
+      /* The histogram needs a range and a number of bins */
+      buzzobj_t l = spec->o.type == BUZZTYPE_TABLE ? buzzvstig_option(vm, spec, "low") : NULL;
+      buzzobj_t h = spec->o.type == BUZZTYPE_TABLE ? buzzvstig_option(vm, spec, "high") : NULL;
+      buzzobj_t b = spec->o.type == BUZZTYPE_TABLE ? buzzvstig_option(vm, spec, "bins") : NULL;
+      if(!l || !buzzobj_isnumber(l) ||
+         !h || !buzzobj_isnumber(h) ||
+         !b || !buzzobj_isint(b) || b->i.value <= 0 ||
+         (buzzobj_isint(l) ? l->i.value : l->f.value) >=
+         (buzzobj_isint(h) ? h->i.value : h->f.value)) {
+         buzzvm_seterror(vm,
+                         BUZZVM_ERROR_TYPE,
+                         "aggregate(): a histogram needs numbers low < high and a positive integer bins");
+         return vm->state;
+      }
+      low = buzzobj_isint(l) ? l->i.value : l->f.value;
+      high = buzzobj_isint(h) ? h->i.value : h->f.value;
+      bins = b->i.value;
+   }
+   if(!buzzvstig_agg_new(vm, *vs, name->s.value.sid, (buzzvstig_agg_e)k, filter, low, high, bins)) {
+      buzzvm_seterror(vm,
+                      BUZZVM_ERROR_STACK,
+                      "aggregate(): at most %d aggregates per virtual stigmergy",
+                      BUZZVSTIG_AGG_MAX_NUM);
+      return vm->state;
+   }
+   return buzzvm_ret0(vm);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_sync_rehash(const void* key, void* data, void* params) {
+   buzzvstig_sync_account((buzzvstig_t)params,
+                          *(buzzobj_t*)key,
+                          *(buzzvstig_elem_t*)data,
+                          1);
+   buzzvstig_sync_index((buzzvstig_t)params, *(buzzobj_t*)key, 1);
+}
+
+void buzzvstig_sync_set(buzzvstig_t vs,
+                        uint32_t period,
+                        uint32_t bandwidth) {
+   if(period == 0) {
+      /* Disable synchronization */
+      if(vs->sync.keys) {
+         uint32_t i;
+         for(i = 0; i < BUZZVSTIG_SYNC_LEAVES; ++i)
+            if(vs->sync.keys[i]) buzzdarray_destroy(vs->sync.keys + i);
+      }
+      free(vs->sync.keys);
+      free(vs->sync.hashes);
+      free(vs->sync.counts);
+      memset(&vs->sync, 0, sizeof(struct buzzvstig_sync_s));
+      return;
+   }
+   if(!vs->sync.hashes) {
+      /* Hash the current entries */
+      vs->sync.hashes = (uint32_t*)calloc(BUZZVSTIG_SYNC_LEAVES, sizeof(uint32_t));
+      vs->sync.counts = (uint16_t*)calloc(BUZZVSTIG_SYNC_LEAVES, sizeof(uint16_t));
+      vs->sync.keys = (buzzdarray_t*)calloc(BUZZVSTIG_SYNC_LEAVES, sizeof(buzzdarray_t));
+      buzzdict_foreach(vs->data, buzzvstig_sync_rehash, vs);
+   }
+   vs->sync.period = period;
+   vs->sync.countdown = 1;
+   vs->sync.bandwidth = bandwidth;
+   vs->sync.budget = bandwidth;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Returns the number of leaves under a node of the given level.
+ */
+static uint32_t buzzvstig_sync_span(uint8_t level) {
+   uint32_t s = 1;
+   for(; level < BUZZVSTIG_SYNC_DEPTH; ++level) s *= BUZZVSTIG_SYNC_FANOUT;
+   return s;
+}
+
+/*
+ * Returns 1 if the node exists in the tree.
+ */
+static int buzzvstig_sync_isnode(uint8_t level,
+                                 uint16_t node) {
+   return level <= BUZZVSTIG_SYNC_DEPTH &&
+      node < BUZZVSTIG_SYNC_LEAVES / buzzvstig_sync_span(level);
+}
+
+/*
+ * Computes the hashes and the entry counts of the children of a node.
+ * Returns the number of entries under the node.
+ */
+static uint32_t buzzvstig_sync_children(buzzvstig_t vs,
+                                        uint8_t level,
+                                        uint16_t node,
+                                        uint32_t* hashes,
+                                        uint32_t* counts) {
+   uint32_t span = buzzvstig_sync_span(level + 1);
+   uint32_t leaf = (uint32_t)node * BUZZVSTIG_SYNC_FANOUT * span;
+   uint32_t total = 0;
+   uint32_t i, j;
+   for(i = 0; i < BUZZVSTIG_SYNC_FANOUT; ++i) {
+      hashes[i] = 0;
+      counts[i] = 0;
+      for(j = 0; j < span; ++j, ++leaf) {
+         hashes[i] ^= vs->sync.hashes[leaf];
+         counts[i] += vs->sync.counts[leaf];
+      }
+      total += counts[i];
+   }
+   return total;
+}
+
+/*
+ * Returns 1 if some traffic is left in the current period.
+ */
+static int buzzvstig_sync_canspend(buzzvstig_t vs) {
+   return vs->sync.bandwidth == 0 || vs->sync.budget > 0;
+}
+
+static void buzzvstig_sync_spend(buzzvstig_t vs,
+                                 uint32_t sz) {
+   if(vs->sync.bandwidth == 0) return;
+   vs->sync.budget = vs->sync.budget > sz ? vs->sync.budget - sz : 0;
+}
+
+/*
+ * Queues the digest of a node.
+ */
+static void buzzvstig_sync_digest(buzzvm_t vm,
+                                  uint16_t id,
+                                  buzzvstig_t vs,
+                                  uint8_t level,
+                                  uint16_t node) {
+   if(!buzzvstig_sync_canspend(vs)) return;
+   uint32_t hashes[BUZZVSTIG_SYNC_FANOUT];
+   uint32_t counts[BUZZVSTIG_SYNC_FANOUT];
+   buzzvstig_sync_children(vs, level, node, hashes, counts);
+   uint16_t c16[BUZZVSTIG_SYNC_FANOUT];
+   int i;
+   for(i = 0; i < BUZZVSTIG_SYNC_FANOUT; ++i)
+      c16[i] = counts[i] < UINT16_MAX ? counts[i] : UINT16_MAX;
+   buzzvstig_sync_spend(
+      vs,
+      buzzoutmsg_queue_append_vstig_digest(vm, id, level, node, hashes, c16));
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_sync_step(buzzvm_t vm,
+                         uint16_t id,
+                         buzzvstig_t vs) {
+   if(!vs->sync.hashes) return;
+   if(--vs->sync.countdown > 0) return;
+   /* New period */
+   vs->sync.countdown = vs->sync.period;
+   vs->sync.budget = vs->sync.bandwidth;
+   /* An empty virtual stigmergy has nothing to offer */
+   if(buzzdict_isempty(vs->data)) return;
+   buzzvstig_sync_digest(vm, id, vs, 0, 0);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Queues the entries under a node.
+ * Only the keys of the leaves under the node are visited.
+ */
+static void buzzvstig_sync_push(buzzvm_t vm,
+                                uint16_t id,
+                                buzzvstig_t vs,
+                                uint8_t level,
+                                uint16_t node) {
+   uint32_t span = buzzvstig_sync_span(level);
+   uint32_t leaf, i;
+   for(leaf = (uint32_t)node * span; leaf < (uint32_t)(node + 1) * span; ++leaf) {
+      buzzdarray_t ks = vs->sync.keys[leaf];
+      if(!ks) continue;
+      for(i = 0; i < buzzdarray_size(ks); ++i) {
+         if(!buzzvstig_sync_canspend(vs)) return;
+         buzzobj_t k = buzzdarray_get(ks, i, buzzobj_t);
+         buzzvstig_sync_spend(
+            vs,
+            buzzoutmsg_queue_append_vstig(vm,
+                                          BUZZMSG_VSTIG_PUT,
+                                          id,
+                                          k,
+                                          *buzzvstig_fetch(vs, &k)));
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_sync_ondigest(buzzvm_t vm,
+                             uint16_t id,
+                             buzzvstig_t vs,
+                             uint16_t robot,
+                             uint8_t level,
+                             uint16_t node,
+                             const uint32_t* hashes,
+                             const uint16_t* counts) {
+   if(!vs->sync.hashes ||
+      level >= BUZZVSTIG_SYNC_DEPTH ||
+      !buzzvstig_sync_isnode(level, node)) return;
+   uint32_t lhashes[BUZZVSTIG_SYNC_FANOUT];
+   uint32_t lcounts[BUZZVSTIG_SYNC_FANOUT];
+   buzzvstig_sync_children(vs, level, node, lhashes, lcounts);
+   uint32_t i;
+   for(i = 0; i < BUZZVSTIG_SYNC_FANOUT && buzzvstig_sync_canspend(vs); ++i) {
+      if(lhashes[i] == hashes[i]) continue;
+      uint16_t child = node * BUZZVSTIG_SYNC_FANOUT + i;
+      if(level + 1 == BUZZVSTIG_SYNC_DEPTH ||
+         lcounts[i] <= BUZZVSTIG_SYNC_DIRECT ||
+         counts[i] <= BUZZVSTIG_SYNC_DIRECT) {
+         /* One side holds few entries: exchange them. The side holding
+          * more entries sends them, the other one requests them; on a
+          * tie, both do, as either could hold the newer versions. */
+         if(lcounts[i] > 0 && lcounts[i] >= counts[i])
+            buzzvstig_sync_push(vm, id, vs, level + 1, child);
+         if(counts[i] > 0 && counts[i] >= lcounts[i])
+            buzzvstig_sync_spend(
+               vs,
+               buzzoutmsg_queue_append_vstig_request(vm, id, robot, level + 1, child));
+      }
+      else {
+         /* Let the sender compare the grandchildren */
+         buzzvstig_sync_digest(vm, id, vs, level + 1, child);
+      }
+   }
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstig_sync_onrequest(buzzvm_t vm,
+                              uint16_t id,
+                              buzzvstig_t vs,
+                              uint8_t level,
+                              uint16_t node) {
+   if(!vs->sync.hashes ||
+      !buzzvstig_sync_isnode(level, node)) return;
+   buzzvstig_sync_push(vm, id, vs, level, node);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Compares two numeric values.
+ * Returns -1, 0 or 1, or 2 if one of them is not a number.
+ */
+static int buzzvstig_numcmp(const buzzobj_t a,
+                            const buzzobj_t b) {
+   if(!buzzobj_isnumber(a) || !buzzobj_isnumber(b)) return 2;
+   if(buzzobj_isint(a) && buzzobj_isint(b))
+      return (a->i.value > b->i.value) - (a->i.value < b->i.value);
+   float x = buzzobj_isint(a) ? a->i.value : a->f.value;
+   float y = buzzobj_isint(b) ? b->i.value : b->f.value;
+   return (x > y) - (x < y);
+}
+
+/*
+ * Applies a native conflict policy.
+ * Returns lv or rv, whichever wins.
+ */
+static buzzvstig_elem_t buzzvstig_onconflict_native(buzzvm_t vm,
+                                                    buzzvstig_t vs,
+                                                    buzzvstig_elem_t lv,
+                                                    buzzvstig_elem_t rv) {
+   buzzvstig_elem_t hi = lv->robot > rv->robot ? lv : rv;
+   buzzvstig_elem_t lo = lv->robot > rv->robot ? rv : lv;
+   int c = buzzvstig_numcmp(lv->data, rv->data);
+   switch(vs->conflict) {
+      case BUZZVSTIG_CONFLICT_MAX:
+         if(c == 1) return lv;
+         if(c == -1) return rv;
+         break;
+      case BUZZVSTIG_CONFLICT_MIN:
+         if(c == -1) return lv;
+         if(c == 1) return rv;
+         break;
+      case BUZZVSTIG_CONFLICT_ROBOT_STRICT:
+         return hi;
+      default:
+         break;
+   }
+   /* Robot policy: the highest robot id wins, unless its value is nil */
+   if(hi->data->o.type == BUZZTYPE_NIL &&
+      lo->data->o.type != BUZZTYPE_NIL)
+      return lo;
+   return hi;
+}
+
+int buzzvstig_onconflict_resolve(buzzvm_t vm,
+                                 buzzvstig_t vs,
+                                 uint16_t id,
+                                 buzzobj_t k,
+                                 buzzvstig_elem_t rv) {
+   buzzvstig_elem_t lv = *buzzvstig_fetch(vs, &k);
+   buzzvstig_elem_t c;
+   if(vs->conflict == BUZZVSTIG_CONFLICT_CLOSURE) {
+      /* Custom policy */
+      c = buzzvstig_onconflict_call(vm, vs, k, lv, rv);
+      free(rv);
+      if(!c) return 0;
+   }
+   else {
+      /* Native policy */
+      c = buzzvstig_onconflict_native(vm, vs, lv, rv);
+      if(c == lv) {
+         /* The local entry wins, just propagate it, unless
+          * anti-entropy takes care of propagation */
+         free(rv);
+         if(!vs->sync.hashes)
+            buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, lv);
+         return 1;
+      }
+   }
+   /* Store the winning value and propagate it, unless anti-entropy
+    * takes care of propagation */
+   if(!vs->sync.hashes)
+      buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, id, k, c);
+   /* Did this robot lose the conflict? */
+   if(vs->onconflictlost &&
+      (c->robot != vm->robot) &&
+      (lv->robot == vm->robot)) {
+      /* Yes, save the current local entry for the conflict lost manager */
+      buzzvstig_elem_t ol = buzzvstig_elem_clone(vm, lv);
+      buzzvstig_store(vm, vs, &k, &c);
+      buzzvstig_onconflictlost_call(vm, vs, k, ol);
+      free(ol);
+   }
+   else {
+      buzzvstig_store(vm, vs, &k, &c);
+   }
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
 buzzvstig_elem_t buzzvstig_onconflict_call(buzzvm_t vm,
                                            buzzvstig_t vs,
                                            buzzobj_t k,
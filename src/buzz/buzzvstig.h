@@ -3,11 +3,36 @@
 
 #include <buzz/buzztype.h>
 #include <buzz/buzzdict.h>
+#include <buzz/buzzdarray.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+   struct buzzvstig_elem_s;
+
+   /*
+    * The eviction data of an entry.
+    * It is only allocated while the entry is stored in a bounded virtual
+    * stigmergy.
+    */
+   struct buzzvstig_link_s {
+      /* The key of the entry */
+      buzzobj_t key;
+      /* The step of the last write */
+      uint32_t updated;
+      /* The priority, for BUZZVSTIG_EVICT_PRIORITY */
+      float priority;
+      /* The write order, to break priority ties */
+      uint32_t serial;
+      /* The position in the priority heap */
+      uint32_t heap;
+      /* The previous and next entries in the use and age lists */
+      struct buzzvstig_elem_s* prev[2];
+      struct buzzvstig_elem_s* next[2];
+   };
+   typedef struct buzzvstig_link_s* buzzvstig_link_t;
+
    /*
     * An entry in virtual stigmergy.
     */
@@ -18,16 +43,178 @@ extern "C" {
       uint16_t timestamp;
       /* The robot id */
       uint16_t robot;
+      /* Bit i is set if the entry counts in aggregate i */
+      uint32_t aggs;
+      /* The eviction data (NULL unless the virtual stigmergy is bounded) */
+      buzzvstig_link_t link;
    };
    typedef struct buzzvstig_elem_s* buzzvstig_elem_t;
 
+   /*
+    * Eviction policies of a bounded virtual stigmergy.
+    */
+   typedef enum {
+      BUZZVSTIG_EVICT_LRU = 0, // Least recently read or written entry
+      BUZZVSTIG_EVICT_OLDEST,  // Least recently written entry
+      BUZZVSTIG_EVICT_PRIORITY // Entry with the lowest priority
+   } buzzvstig_evict_e;
+
+   /*
+    * The lists of a bounded virtual stigmergy.
+    * The use list is sorted by last read or write, the age list by last
+    * write. The least recent entry is at the head.
+    */
+#define BUZZVSTIG_LIST_USE 0
+#define BUZZVSTIG_LIST_AGE 1
+
+   /*
+    * Memory limits of a virtual stigmergy.
+    */
+   struct buzzvstig_limits_s {
+      /* Maximum number of entries (0 means unlimited) */
+      uint32_t capacity;
+      /* Entry chosen for eviction when the capacity is reached */
+      buzzvstig_evict_e policy;
+      /* Steps an entry lives after its last write (0 means forever) */
+      uint32_t ttl;
+      /* Closure computing the priority of an entry (NULL means 0) */
+      buzzobj_t priority;
+      /* Steps since the creation of the virtual stigmergy */
+      uint32_t clock;
+      /* Number of entries evicted to respect the capacity */
+      uint32_t evicted;
+      /* Number of entries removed because their lifetime was over */
+      uint32_t expired;
+      /* Heads and tails of the use and age lists */
+      buzzvstig_elem_t head[2];
+      buzzvstig_elem_t tail[2];
+      /* Number of writes, to order the entries */
+      uint32_t serial;
+      /* Min-heap of the entries by priority (NULL unless the policy is BUZZVSTIG_EVICT_PRIORITY) */
+      buzzdarray_t heap;
+   };
+
+   /*
+    * Anti-entropy synchronization.
+    * The entries are spread over BUZZVSTIG_SYNC_LEAVES buckets, which are
+    * the leaves of a tree with BUZZVSTIG_SYNC_FANOUT children per node and
+    * BUZZVSTIG_SYNC_DEPTH levels below the root. The hash of a node is the
+    * XOR of the hashes of the entries it covers. Periodically, each robot
+    * broadcasts a digest (hash and entry count of each child) of the root.
+    * A neighbor that disagrees on a child answers with its own digest of
+    * that child, and so on down the tree, until one of the two robots
+    * holds few entries under the node: then, the entries are exchanged.
+    */
+#define BUZZVSTIG_SYNC_FANOUT 16
+#define BUZZVSTIG_SYNC_DEPTH  3
+#define BUZZVSTIG_SYNC_LEAVES 4096
+
+   /*
+    * When one of two robots holds at most this number of entries under a
+    * differing node, the entries are exchanged instead of the digests of
+    * the children.
+    */
+#define BUZZVSTIG_SYNC_DIRECT 8
+
+   /*
+    * Anti-entropy state of a virtual stigmergy.
+    */
+   struct buzzvstig_sync_s {
+      /* Hash of each leaf (NULL when synchronization is disabled) */
+      uint32_t* hashes;
+      /* Number of entries in each leaf */
+      uint16_t* counts;
+      /* Keys of the entries in each leaf (NULL for a leaf never used) */
+      buzzdarray_t* keys;
+      /* Steps between two digests */
+      uint32_t period;
+      /* Steps left before the next digest */
+      uint32_t countdown;
+      /* Synchronization traffic allowed per period, in bytes (0 means unlimited) */
+      uint32_t bandwidth;
+      /* Synchronization traffic left in the current period, in bytes */
+      uint32_t budget;
+   };
+
+   /*
+    * Kinds of aggregates over a virtual stigmergy.
+    * Count covers all the non-nil values; the other kinds only cover
+    * the values that are numbers.
+    */
+   typedef enum {
+      BUZZVSTIG_AGG_COUNT = 0, // Number of entries
+      BUZZVSTIG_AGG_SUM,       // Sum of the values
+      BUZZVSTIG_AGG_MIN,       // Smallest value
+      BUZZVSTIG_AGG_MAX,       // Largest value
+      BUZZVSTIG_AGG_MEAN,      // Average of the values
+      BUZZVSTIG_AGG_HISTOGRAM  // Number of values in each bin
+   } buzzvstig_agg_e;
+
+   /*
+    * The maximum number of aggregates in a virtual stigmergy.
+    */
+#define BUZZVSTIG_AGG_MAX_NUM 32
+
+   /*
+    * An aggregate over a virtual stigmergy.
+    * It is updated on every write, so reading it takes constant time.
+    */
+   struct buzzvstig_agg_s {
+      /* The name (a string id) */
+      uint16_t name;
+      /* The kind of aggregate */
+      buzzvstig_agg_e kind;
+      /* Closure choosing the entries to aggregate (NULL means all) */
+      buzzobj_t filter;
+      /* Number of entries aggregated */
+      uint32_t count;
+      /* Number of entries whose value is a number */
+      uint32_t numbers;
+      /* Sum of the values */
+      double sum;
+      /* Smallest and largest values */
+      float min;
+      float max;
+      /* 1 if min or max were removed and must be recomputed */
+      int stale;
+      /* Histogram range and bins */
+      float low;
+      float high;
+      uint32_t bins;
+      uint32_t* hist;
+   };
+   typedef struct buzzvstig_agg_s* buzzvstig_agg_t;
+
+   /*
+    * Write conflict policies.
+    * A conflict occurs when two robots wrote the same key with the same
+    * timestamp. The native policies are resolved in C; the values of
+    * max and min must be numbers, otherwise the robot policy is used.
+    */
+   typedef enum {
+      BUZZVSTIG_CONFLICT_ROBOT = 0,    // Highest robot id wins, non-nil beats nil (default)
+      BUZZVSTIG_CONFLICT_ROBOT_STRICT, // Highest robot id wins, even with nil
+      BUZZVSTIG_CONFLICT_MAX,          // Largest value wins
+      BUZZVSTIG_CONFLICT_MIN,          // Smallest value wins
+      BUZZVSTIG_CONFLICT_CLOSURE       // The onconflict closure decides
+   } buzzvstig_conflict_e;
+
    /*
     * The virtual stigmergy data.
     */
    struct buzzvstig_s {
       buzzdict_t data;
+      /* Number of entries whose value is nil (deletions kept for synchronization) */
+      uint32_t tombstones;
+      buzzvstig_conflict_e conflict;
       buzzobj_t onconflict;
       buzzobj_t onconflictlost;
+      struct buzzvstig_sync_s sync;
+      struct buzzvstig_limits_s limits;
+      /* The aggregates (NULL if none) */
+      buzzdarray_t aggs;
+      /* The persistent log (NULL if none) */
+      struct buzzvstiglog_s* log;
    };
    typedef struct buzzvstig_s* buzzvstig_t;
 
@@ -169,6 +356,194 @@ extern "C" {
     */
    extern int buzzvstig_onconflictlost(struct buzzvm_s* vm);
 
+   /*
+    * Buzz C closure to set up anti-entropy synchronization.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_sync(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to get the eviction counters.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_evictions(struct buzzvm_s* vm);
+
+   /*
+    * Buzz C closure to register or read an aggregate.
+    * @param vm The Buzz VM state.
+    * @return The updated VM state.
+    */
+   extern int buzzvstig_aggregate(struct buzzvm_s* vm);
+
+   /*
+    * Puts data into a virtual stigmergy structure.
+    * If the key is new and the virtual stigmergy is full, an entry is
+    * evicted according to the eviction policy.
+    * @param vm The Buzz VM state.
+    * @param vs The virtual stigmergy structure.
+    * @param key The key.
+    * @param el The element.
+    */
+   extern void buzzvstig_store(struct buzzvm_s* vm,
+                               buzzvstig_t vs,
+                               const buzzobj_t* key,
+                               const buzzvstig_elem_t* el);
+
+   /*
+    * Deletes data from a virtual stigmergy structure.
+    * @param vs The virtual stigmergy structure.
+    * @param key The key.
+    */
+   extern void buzzvstig_remove(buzzvstig_t vs,
+                                const buzzobj_t* key);
+
+   /*
+    * Sets the memory limits of a virtual stigmergy.
+    * If the virtual stigmergy holds more than capacity entries, the
+    * excess entries are evicted. With synchronization enabled, evicted
+    * and expired entries are kept as nil markers of the same version, so
+    * that neighbors don't bring them back; the markers don't count
+    * towards the capacity.
+    * @param vm The Buzz VM state.
+    * @param vs The virtual stigmergy structure.
+    * @param capacity The maximum number of entries (0 means unlimited).
+    * @param policy The eviction policy.
+    * @param ttl The steps an entry lives after its last write (0 means forever).
+    */
+   extern void buzzvstig_limits_set(struct buzzvm_s* vm,
+                                    buzzvstig_t vs,
+                                    uint32_t capacity,
+                                    buzzvstig_evict_e policy,
+                                    uint32_t ttl);
+
+   /*
+    * Performs the periodic tasks of a virtual stigmergy.
+    * The entries whose lifetime is over are removed, and the
+    * synchronization tasks are performed.
+    * This function is called once per step by buzzvm_process_outmsgs().
+    * @param vm The Buzz VM state.
+    * @param id The id of the virtual stigmergy.
+    * @param vs The virtual stigmergy structure.
+    */
+   extern void buzzvstig_step(struct buzzvm_s* vm,
+                              uint16_t id,
+                              buzzvstig_t vs);
+
+   /*
+    * Registers an aggregate.
+    * An existing aggregate with the same name is replaced. The current
+    * entries are aggregated right away.
+    * @param vm The Buzz VM state.
+    * @param vs The virtual stigmergy structure.
+    * @param name The name of the aggregate (a string id).
+    * @param kind The kind of aggregate.
+    * @param filter A closure (key, value) choosing the entries to aggregate, or NULL.
+    * @param low The lower bound of the histogram.
+    * @param high The upper bound of the histogram.
+    * @param bins The number of histogram bins (0 unless kind is BUZZVSTIG_AGG_HISTOGRAM).
+    * @return The aggregate, or NULL if there are too many aggregates.
+    */
+   extern buzzvstig_agg_t buzzvstig_agg_new(struct buzzvm_s* vm,
+                                            buzzvstig_t vs,
+                                            uint16_t name,
+                                            buzzvstig_agg_e kind,
+                                            buzzobj_t filter,
+                                            float low,
+                                            float high,
+                                            uint32_t bins);
+
+   /*
+    * Looks for an aggregate.
+    * If the smallest or largest value was removed, it is recomputed.
+    * @param vs The virtual stigmergy structure.
+    * @param name The name of the aggregate (a string id).
+    * @return The aggregate, or NULL if not found.
+    */
+   extern buzzvstig_agg_t buzzvstig_agg_get(buzzvstig_t vs,
+                                            uint16_t name);
+
+   /*
+    * Enables or disables anti-entropy synchronization.
+    * While synchronization is enabled, remote updates are not relayed
+    * to the neighbors: the periodic digests propagate them instead.
+    * @param vs The virtual stigmergy structure.
+    * @param period The steps between two digests (0 disables synchronization).
+    * @param bandwidth The bytes of synchronization traffic allowed per period (0 means unlimited).
+    */
+   extern void buzzvstig_sync_set(buzzvstig_t vs,
+                                  uint32_t period,
+                                  uint32_t bandwidth);
+
+   /*
+    * Performs the periodic synchronization tasks.
+    * This function is called once per step by buzzvstig_step().
+    * @param vm The Buzz VM state.
+    * @param id The id of the virtual stigmergy.
+    * @param vs The virtual stigmergy structure.
+    */
+   extern void buzzvstig_sync_step(struct buzzvm_s* vm,
+                                   uint16_t id,
+                                   buzzvstig_t vs);
+
+   /*
+    * Handles a digest received from a neighbor.
+    * For each child that differs from the local one, either the digest of
+    * the child is queued, or the entries under it are exchanged.
+    * @param vm The Buzz VM state.
+    * @param id The id of the virtual stigmergy.
+    * @param vs The virtual stigmergy structure.
+    * @param robot The robot that sent the digest.
+    * @param level The level of the node.
+    * @param node The index of the node in its level.
+    * @param hashes The hashes of the children.
+    * @param counts The number of entries under each child.
+    */
+   extern void buzzvstig_sync_ondigest(struct buzzvm_s* vm,
+                                       uint16_t id,
+                                       buzzvstig_t vs,
+                                       uint16_t robot,
+                                       uint8_t level,
+                                       uint16_t node,
+                                       const uint32_t* hashes,
+                                       const uint16_t* counts);
+
+   /*
+    * Handles a request addressed to this robot.
+    * The entries under the requested node are queued.
+    * @param vm The Buzz VM state.
+    * @param id The id of the virtual stigmergy.
+    * @param vs The virtual stigmergy structure.
+    * @param level The level of the node.
+    * @param node The index of the node in its level.
+    */
+   extern void buzzvstig_sync_onrequest(struct buzzvm_s* vm,
+                                        uint16_t id,
+                                        buzzvstig_t vs,
+                                        uint8_t level,
+                                        uint16_t node);
+
+   /*
+    * Resolves a write conflict.
+    * The local entry for the key and the remote entry have the same
+    * timestamp, but were written by different robots. The winning entry
+    * is stored and, unless synchronization is enabled, a PUT message for
+    * it is queued. If this robot lost,
+    * the onconflictlost closure is called.
+    * @param vm The Buzz VM state.
+    * @param vs The virtual stigmergy structure.
+    * @param id The id of the virtual stigmergy.
+    * @param k The key.
+    * @param rv The remote entry. It is stored or freed.
+    * @return 1 on success, 0 if the conflict manager failed.
+    */
+   extern int buzzvstig_onconflict_resolve(struct buzzvm_s* vm,
+                                           buzzvstig_t vs,
+                                           uint16_t id,
+                                           buzzobj_t k,
+                                           buzzvstig_elem_t rv);
+
    /*
     * Calls the write conflict manager.
     * @param vm The Buzz VM state.
@@ -201,21 +576,6 @@ extern "C" {
  */
 #define buzzvstig_fetch(vs, key) buzzdict_get((vs)->data, (key), buzzvstig_elem_t)
 
-/*
- * Puts data into a virtual stigmergy structure.
- * @param vs The virtual stigmergy structure.
- * @param key The key.
- * @param el The element.
- */
-#define buzzvstig_store(vs, key, el) buzzdict_set((vs)->data, (key), (el));
-
-/*
- * Deletes data from a virtual stigmergy structure.
- * @param vs The virtual stigmergy structure.
- * @param key The key.
- */
-#define buzzvstig_remove(vs, key) buzzdict_remove((vs)->data, (key));
-
 /*
  * Applies the given function to each element in the virtual stigmergy structure.
  * @param vs The virtual stigmergy structure.
@@ -0,0 +1,429 @@
+#include "buzzvstiglog.h"
+#include "buzzvm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The file header.
+ */
+#define BUZZVSTIGLOG_MAGIC     "BZZVSLG2"
+#define BUZZVSTIGLOG_HEADER    8
+
+/*
+ * The header of the first format, whose records have no type and where a
+ * nil value means a removal. Such logs are converted when opened.
+ */
+#define BUZZVSTIGLOG_MAGIC1    "BZZVSLG1"
+
+/*
+ * The record types.
+ */
+#define BUZZVSTIGLOG_PUT       0 // A key and its entry, possibly nil
+#define BUZZVSTIGLOG_REMOVE    1 // A key that was removed
+
+/*
+ * The size of the record header (payload size and checksum).
+ */
+#define BUZZVSTIGLOG_RECORD    8
+
+/*
+ * The smallest mapping. The mapping doubles when full.
+ */
+#define BUZZVSTIGLOG_MINCAP    65536
+
+/*
+ * The log is compacted when it holds more than twice as many records as
+ * entries, plus this number.
+ */
+#define BUZZVSTIGLOG_SLACK     256
+
+/****************************************/
+/****************************************/
+
+static uint32_t buzzvstiglog_checksum(const uint8_t* data,
+                                      uint32_t size) {
+   /* FNV-1a */
+   uint32_t h = 2166136261u;
+   uint32_t i;
+   for(i = 0; i < size; ++i) {
+      h ^= data[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+static void buzzvstiglog_put_u32(uint8_t* p,
+                                 uint32_t x) {
+   p[0] = x;
+   p[1] = x >> 8;
+   p[2] = x >> 16;
+   p[3] = x >> 24;
+}
+
+static uint32_t buzzvstiglog_get_u32(const uint8_t* p) {
+   return
+      (uint32_t)p[0]         |
+      ((uint32_t)p[1] << 8)  |
+      ((uint32_t)p[2] << 16) |
+      ((uint32_t)p[3] << 24);
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Maps the file with the given capacity, growing the file if necessary.
+ */
+static int buzzvstiglog_map(buzzvstiglog_t log,
+                            uint64_t cap) {
+   if(log->map) munmap(log->map, log->capacity);
+   log->map = NULL;
+   if(ftruncate(log->fd, cap) < 0) return 0;
+   void* m = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+   if(m == MAP_FAILED) return 0;
+   log->map = (uint8_t*)m;
+   log->capacity = cap;
+   return 1;
+}
+
+/*
+ * Returns the capacity of a mapping holding the given size.
+ */
+static uint64_t buzzvstiglog_capacity(uint64_t size) {
+   uint64_t cap = BUZZVSTIGLOG_MINCAP;
+   while(cap < size) cap *= 2;
+   return cap;
+}
+
+/*
+ * Writes the records appended since the last call to disk.
+ */
+static void buzzvstiglog_flush(buzzvstiglog_t log) {
+   if(!log->map || log->synced >= log->size) return;
+   uint64_t page = sysconf(_SC_PAGESIZE);
+   uint64_t from = log->synced - log->synced % page;
+   msync(log->map + from, log->size - from, MS_SYNC);
+   log->synced = log->size;
+}
+
+/*
+ * Appends the serialized record in log->buf.
+ */
+static int buzzvstiglog_write(buzzvstiglog_t log) {
+   if(!log->map) return 0;
+   uint32_t sz = buzzmsg_payload_size(log->buf);
+   const uint8_t* data = (const uint8_t*)log->buf->data;
+   /* Make room for the record */
+   if(log->size + BUZZVSTIGLOG_RECORD + sz > log->capacity &&
+      !buzzvstiglog_map(log, buzzvstiglog_capacity(log->size + BUZZVSTIGLOG_RECORD + sz))) {
+      fprintf(stderr, "[WARNING] Can't grow virtual stigmergy log %s: %s\n", log->fname, strerror(errno));
+      return 0;
+   }
+   uint8_t* r = log->map + log->size;
+   memcpy(r + BUZZVSTIGLOG_RECORD, data, sz);
+   buzzvstiglog_put_u32(r + 4, buzzvstiglog_checksum(data, sz));
+   buzzvstiglog_put_u32(r, sz);
+   log->size += BUZZVSTIGLOG_RECORD + sz;
+   ++log->records;
+   if(log->fsync == BUZZVSTIGLOG_FSYNC_ALWAYS)
+      buzzvstiglog_flush(log);
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+/*
+ * Loads the records into the virtual stigmergy.
+ * The size of the log is set to the end of the last valid record.
+ * With v1 set, the records are in the first format.
+ */
+static void buzzvstiglog_load(buzzvm_t vm,
+                              buzzvstiglog_t log,
+                              buzzvstig_t vs,
+                              int v1) {
+   /* Find the end of the valid records */
+   uint64_t end = BUZZVSTIGLOG_HEADER;
+   while(end + BUZZVSTIGLOG_RECORD <= log->capacity) {
+      uint32_t sz = buzzvstiglog_get_u32(log->map + end);
+      if(sz == 0 ||
+         end + BUZZVSTIGLOG_RECORD + sz > log->capacity ||
+         buzzvstiglog_get_u32(log->map + end + 4) !=
+         buzzvstiglog_checksum(log->map + end + BUZZVSTIGLOG_RECORD, sz))
+         break;
+      end += BUZZVSTIGLOG_RECORD + sz;
+   }
+   log->size = BUZZVSTIGLOG_HEADER;
+   log->records = 0;
+   if(end == BUZZVSTIGLOG_HEADER) return;
+   /* Deserialize the records from a single copy of the log */
+   buzzmsg_payload_t buf =
+      buzzmsg_payload_frombuffer(log->map + BUZZVSTIGLOG_HEADER,
+                                 end - BUZZVSTIGLOG_HEADER);
+   uint64_t pos = 0;
+   while(BUZZVSTIGLOG_HEADER + pos < end) {
+      uint32_t sz = buzzvstiglog_get_u32(log->map + BUZZVSTIGLOG_HEADER + pos);
+      int64_t p = pos + BUZZVSTIGLOG_RECORD;
+      uint8_t type = BUZZVSTIGLOG_PUT;
+      if(!v1) p = buzzmsg_deserialize_u8(&type, buf, p);
+      buzzobj_t k;
+      buzzvstig_elem_t e = NULL;
+      if(type == BUZZVSTIGLOG_PUT) {
+         e = buzzvstig_elem_new(NULL, 0, 0);
+         if(p >= 0) p = buzzvstig_elem_deserialize(&k, &e, buf, p, vm);
+      }
+      else if(type == BUZZVSTIGLOG_REMOVE) {
+         if(p >= 0) p = buzzobj_deserialize(&k, buf, p, vm);
+      }
+      else p = -1;
+      if(p != pos + BUZZVSTIGLOG_RECORD + sz) {
+         /* Valid checksum, but not a record: the log ends here */
+         fprintf(stderr, "[WARNING] [ROBOT %u] Malformed record in virtual stigmergy log %s\n", vm->robot, log->fname);
+         free(e);
+         break;
+      }
+      if(!e || (v1 && e->data->o.type == BUZZTYPE_NIL)) {
+         /* Removal */
+         buzzvstig_remove(vs, &k);
+         free(e);
+      }
+      else {
+         /* New entry; a nil value is a deletion that keeps its version */
+         buzzvstig_store(vm, vs, &k, &e);
+      }
+      pos += BUZZVSTIGLOG_RECORD + sz;
+      ++log->records;
+   }
+   buzzmsg_payload_destroy(&buf);
+   log->size = BUZZVSTIGLOG_HEADER + pos;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvstiglog_t buzzvstiglog_open(buzzvm_t vm,
+                                 buzzvstig_t vs,
+                                 const char* fname,
+                                 buzzvstiglog_fsync_e fsync) {
+   int fd = open(fname, O_RDWR | O_CREAT, 0644);
+   if(fd < 0) return NULL;
+   /* Only one VM may write to a log */
+   if(flock(fd, LOCK_EX | LOCK_NB) < 0) {
+      close(fd);
+      return NULL;
+   }
+   struct stat st;
+   if(fstat(fd, &st) < 0) {
+      close(fd);
+      return NULL;
+   }
+   int v1 = 0;
+   if(st.st_size > 0) {
+      /* Make sure this is a log before touching it */
+      char magic[BUZZVSTIGLOG_HEADER];
+      if(pread(fd, magic, BUZZVSTIGLOG_HEADER, 0) != BUZZVSTIGLOG_HEADER) {
+         close(fd);
+         errno = EINVAL;
+         return NULL;
+      }
+      v1 = memcmp(magic, BUZZVSTIGLOG_MAGIC1, BUZZVSTIGLOG_HEADER) == 0;
+      if(!v1 && memcmp(magic, BUZZVSTIGLOG_MAGIC, BUZZVSTIGLOG_HEADER) != 0) {
+         close(fd);
+         errno = EINVAL;
+         return NULL;
+      }
+   }
+   buzzvstiglog_t log = (buzzvstiglog_t)calloc(1, sizeof(struct buzzvstiglog_s));
+   log->fname = strdup(fname);
+   log->fd = fd;
+   log->fsync = fsync;
+   log->buf = buzzmsg_payload_new(64);
+   if(!buzzvstiglog_map(log, buzzvstiglog_capacity(st.st_size))) {
+      buzzvstiglog_close(&log);
+      return NULL;
+   }
+   if(st.st_size == 0) {
+      /* New log */
+      memcpy(log->map, BUZZVSTIGLOG_MAGIC, BUZZVSTIGLOG_HEADER);
+      log->size = BUZZVSTIGLOG_HEADER;
+   }
+   else {
+      buzzvstiglog_load(vm, log, vs, v1);
+      /* Clear what follows the valid records, so that stale data is not
+       * mistaken for records later on */
+      memset(log->map + log->size, 0, log->capacity - log->size);
+   }
+   log->synced = log->size;
+   if(v1) {
+      /* Rewrite the log in the current format; new records can't be
+       * appended to the old one */
+      if(!buzzvstiglog_compact(log, vs)) {
+         buzzvstiglog_close(&log);
+         errno = EINVAL;
+         return NULL;
+      }
+   }
+   else if(log->records > 2 * buzzdict_size(vs->data) + BUZZVSTIGLOG_SLACK)
+      buzzvstiglog_compact(log, vs);
+   return log;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvstiglog_t buzzvstiglog_clone(buzzvstiglog_t log) {
+   buzzvstiglog_t x = (buzzvstiglog_t)calloc(1, sizeof(struct buzzvstiglog_s));
+   x->fname = strdup(log->fname);
+   x->fd = -1;
+   x->fsync = log->fsync;
+   x->buf = buzzmsg_payload_new(64);
+   return x;
+}
+
+/****************************************/
+/****************************************/
+
+buzzvstiglog_t buzzvstiglog_reopen(buzzvm_t vm,
+                                   buzzvstig_t vs,
+                                   buzzvstiglog_t log) {
+   return buzzvstiglog_open(vm, vs, log->fname, log->fsync);
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstiglog_close(buzzvstiglog_t* log) {
+   if((*log)->map) {
+      if((*log)->fsync != BUZZVSTIGLOG_FSYNC_NEVER)
+         buzzvstiglog_flush(*log);
+      munmap((*log)->map, (*log)->capacity);
+      /* Drop the unused part of the mapping */
+      if(ftruncate((*log)->fd, (*log)->size) < 0)
+         fprintf(stderr, "[WARNING] Can't truncate virtual stigmergy log %s: %s\n", (*log)->fname, strerror(errno));
+   }
+   if((*log)->fd >= 0) close((*log)->fd);
+   buzzmsg_payload_destroy(&(*log)->buf);
+   free((*log)->fname);
+   free(*log);
+   *log = NULL;
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstiglog_append(buzzvstiglog_t log,
+                        const buzzobj_t key,
+                        const buzzvstig_elem_t e) {
+   buzzdarray_clear(log->buf, 64);
+   buzzmsg_serialize_u8(log->buf, BUZZVSTIGLOG_PUT);
+   buzzvstig_elem_serialize(log->buf, key, e);
+   return buzzvstiglog_write(log);
+}
+
+/****************************************/
+/****************************************/
+
+int buzzvstiglog_remove(buzzvstiglog_t log,
+                        const buzzobj_t key) {
+   buzzdarray_clear(log->buf, 64);
+   buzzmsg_serialize_u8(log->buf, BUZZVSTIGLOG_REMOVE);
+   buzzobj_serialize(log->buf, key);
+   return buzzvstiglog_write(log);
+}
+
+/****************************************/
+/****************************************/
+
+struct buzzvstiglog_compact_params {
+   buzzvstiglog_t log;
+   FILE* f;
+   int ok;
+};
+
+static void buzzvstiglog_compact_entry(const void* key, void* data, void* params) {
+   struct buzzvstiglog_compact_params* p = (struct buzzvstiglog_compact_params*)params;
+   if(!p->ok) return;
+   buzzdarray_clear(p->log->buf, 64);
+   buzzmsg_serialize_u8(p->log->buf, BUZZVSTIGLOG_PUT);
+   buzzvstig_elem_serialize(p->log->buf, *(buzzobj_t*)key, *(buzzvstig_elem_t*)data);
+   uint32_t sz = buzzmsg_payload_size(p->log->buf);
+   const uint8_t* d = (const uint8_t*)p->log->buf->data;
+   uint8_t hdr[BUZZVSTIGLOG_RECORD];
+   buzzvstiglog_put_u32(hdr, sz);
+   buzzvstiglog_put_u32(hdr + 4, buzzvstiglog_checksum(d, sz));
+   p->ok =
+      fwrite(hdr, BUZZVSTIGLOG_RECORD, 1, p->f) == 1 &&
+      fwrite(d, sz, 1, p->f) == 1;
+}
+
+int buzzvstiglog_compact(buzzvstiglog_t log,
+                         buzzvstig_t vs) {
+   /* Write the current entries to a temporary file */
+   char* tmp;
+   if(asprintf(&tmp, "%s.tmp", log->fname) < 0) return 0;
+   struct buzzvstiglog_compact_params p = {
+      .log = log,
+      .f = fopen(tmp, "wb"),
+      .ok = 1
+   };
+   if(!p.f) {
+      fprintf(stderr, "[WARNING] Can't compact virtual stigmergy log %s: %s\n", tmp, strerror(errno));
+      free(tmp);
+      return 0;
+   }
+   p.ok = fwrite(BUZZVSTIGLOG_MAGIC, BUZZVSTIGLOG_HEADER, 1, p.f) == 1;
+   buzzdict_foreach(vs->data, buzzvstiglog_compact_entry, &p);
+   p.ok = p.ok && fflush(p.f) == 0;
+   if(p.ok && log->fsync != BUZZVSTIGLOG_FSYNC_NEVER)
+      p.ok = fsync(fileno(p.f)) == 0;
+   uint64_t size = p.ok ? (uint64_t)ftell(p.f) : 0;
+   fclose(p.f);
+   /* Replace the log */
+   int fd = -1;
+   if(p.ok &&
+      rename(tmp, log->fname) == 0 &&
+      (fd = open(log->fname, O_RDWR)) >= 0) {
+      /* The new file replaces the old one, lock included */
+      flock(fd, LOCK_EX | LOCK_NB);
+      munmap(log->map, log->capacity);
+      log->map = NULL;
+      close(log->fd);
+      log->fd = fd;
+      if(!buzzvstiglog_map(log, buzzvstiglog_capacity(size))) {
+         fprintf(stderr, "[WARNING] Can't map virtual stigmergy log %s: %s\n", log->fname, strerror(errno));
+         free(tmp);
+         return 0;
+      }
+      log->size = size;
+      log->synced = size;
+      log->records = buzzdict_size(vs->data);
+      free(tmp);
+      return 1;
+   }
+   fprintf(stderr, "[WARNING] Can't compact virtual stigmergy log %s: %s\n", log->fname, strerror(errno));
+   unlink(tmp);
+   free(tmp);
+   return 0;
+}
+
+/****************************************/
+/****************************************/
+
+void buzzvstiglog_step(buzzvstiglog_t log,
+                       buzzvstig_t vs) {
+   if(!log->map) return;
+   if(log->records > 2 * buzzdict_size(vs->data) + BUZZVSTIGLOG_SLACK)
+      buzzvstiglog_compact(log, vs);
+   if(log->fsync == BUZZVSTIGLOG_FSYNC_STEP)
+      buzzvstiglog_flush(log);
+}
+
+/****************************************/
+/****************************************/
@@ -0,0 +1,152 @@
+#ifndef BUZZVSTIGLOG_H
+#define BUZZVSTIGLOG_H
+
+#include <buzz/buzzvstig.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /*
+    * When the changes to a virtual stigmergy log reach the disk.
+    */
+   typedef enum {
+      BUZZVSTIGLOG_FSYNC_NEVER = 0, // When the operating system decides
+      BUZZVSTIGLOG_FSYNC_STEP,      // At the end of every step with changes
+      BUZZVSTIGLOG_FSYNC_ALWAYS     // After every change
+   } buzzvstiglog_fsync_e;
+
+   /*
+    * An append-only, memory-mapped log of the changes to a virtual
+    * stigmergy.
+    * The file starts with an 8-byte header, followed by records made of
+    * the payload size (u32), a checksum of the payload (u32), and the
+    * payload. The payload starts with the record type (u8). A put is
+    * followed by an entry serialized with buzzvstig_elem_serialize(); a
+    * nil value is a deletion that keeps its timestamp, as sent to the
+    * neighbors. A removal is followed by the serialized key. A record that
+    * is cut or corrupted marks the end of the log.
+    */
+   struct buzzvstiglog_s {
+      /* The file name */
+      char* fname;
+      /* The file descriptor */
+      int fd;
+      /* The mapped file */
+      uint8_t* map;
+      /* The size of the mapping */
+      uint64_t capacity;
+      /* The size of the valid records */
+      uint64_t size;
+      /* The number of records */
+      uint32_t records;
+      /* The fsync policy */
+      buzzvstiglog_fsync_e fsync;
+      /* The size of the records known to be on disk */
+      uint64_t synced;
+      /* Buffer to serialize the records */
+      buzzmsg_payload_t buf;
+   };
+   typedef struct buzzvstiglog_s* buzzvstiglog_t;
+
+   /*
+    * Forward declaration of the Buzz VM.
+    */
+   struct buzzvm_s;
+
+   /*
+    * Opens the log of a virtual stigmergy, creating it if necessary.
+    * The recorded entries are loaded into the virtual stigmergy, over the
+    * entries it already holds. Nothing is sent to the neighbors.
+    * If the log contains much more records than entries, it is compacted.
+    * A log is locked while it is open, so it can't be opened twice, even
+    * by two VMs of the same process.
+    * @param vm The Buzz VM state.
+    * @param vs The virtual stigmergy structure.
+    * @param fname The file name.
+    * @param fsync The fsync policy.
+    * @return The log, or NULL in case of error.
+    */
+   extern buzzvstiglog_t buzzvstiglog_open(struct buzzvm_s* vm,
+                                           buzzvstig_t vs,
+                                           const char* fname,
+                                           buzzvstiglog_fsync_e fsync);
+
+   /*
+    * Makes a closed copy of a log.
+    * A closed log only knows its file name and fsync policy. It records
+    * nothing until it is reopened. Snapshots keep their logs this way.
+    * @param log The log.
+    * @return The closed copy.
+    */
+   extern buzzvstiglog_t buzzvstiglog_clone(buzzvstiglog_t log);
+
+   /*
+    * Opens a log again, with the file name and fsync policy of the given
+    * log.
+    * The recorded entries are loaded into the virtual stigmergy, over the
+    * entries it already holds. The given log is not modified.
+    * @param vm The Buzz VM state.
+    * @param vs The virtual stigmergy structure.
+    * @param log The log, usually a closed one.
+    * @return The new log, or NULL in case of error.
+    */
+   extern buzzvstiglog_t buzzvstiglog_reopen(struct buzzvm_s* vm,
+                                             buzzvstig_t vs,
+                                             buzzvstiglog_t log);
+
+   /*
+    * Closes a log.
+    * Pending changes are written to disk, unless the policy is
+    * BUZZVSTIGLOG_FSYNC_NEVER.
+    * @param log The log.
+    */
+   extern void buzzvstiglog_close(buzzvstiglog_t* log);
+
+   /*
+    * Appends the new value of an entry.
+    * @param log The log.
+    * @param key The key.
+    * @param e The entry.
+    * @return 1 on success, 0 in case of error.
+    */
+   extern int buzzvstiglog_append(buzzvstiglog_t log,
+                                  const buzzobj_t key,
+                                  const buzzvstig_elem_t e);
+
+   /*
+    * Appends the removal of an entry.
+    * @param log The log.
+    * @param key The key.
+    * @return 1 on success, 0 in case of error.
+    */
+   extern int buzzvstiglog_remove(buzzvstiglog_t log,
+                                  const buzzobj_t key);
+
+   /*
+    * Rewrites the log with only the current entries.
+    * The new log is written to a temporary file, which then replaces the
+    * log.
+    * @param log The log.
+    * @param vs The virtual stigmergy structure.
+    * @return 1 on success, 0 in case of error.
+    */
+   extern int buzzvstiglog_compact(buzzvstiglog_t log,
+                                   buzzvstig_t vs);
+
+   /*
+    * Performs the periodic tasks of a log.
+    * The log is compacted if it holds too many obsolete records, and the
+    * changes are written to disk according to the fsync policy.
+    * This function is called once per step by buzzvstig_step().
+    * @param log The log.
+    * @param vs The virtual stigmergy structure.
+    */
+   extern void buzzvstiglog_step(buzzvstiglog_t log,
+                                 buzzvstig_t vs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
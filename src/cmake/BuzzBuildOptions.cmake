@@ -1 +1,2 @@
 option(BUZZ_SYMLINK_CMAKE_SCRIPTS "Whether to create a symlink to the Buzz CMake scripts in ${CMAKE_ROOT}/Modules" ON)
+option(BUZZ_STATS "Whether to compile the VM execution counters (see buzzstats.h)" ON)
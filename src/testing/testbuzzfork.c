@@ -0,0 +1,195 @@
+#include <buzz/buzzsnapshot.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+static uint8_t* bcode;
+static uint32_t bcode_size;
+
+/****************************************/
+/****************************************/
+
+static buzzvm_t robot_new(uint16_t id) {
+   buzzvm_t vm = buzzvm_new(id);
+   buzzvm_set_bcode(vm, bcode, bcode_size);
+   buzzvm_execute_script(vm);
+   buzzvm_function_call(vm, "init", 0);
+   buzzvm_pop(vm);
+   return vm;
+}
+
+/*
+ * Executes a control step. Robot 2 is always a neighbor.
+ */
+static void robot_step(buzzvm_t vm) {
+   buzzneighbors_reset(vm);
+   buzzneighbors_add(vm, 2, 100.0f, 0.0f, 0.0f);
+   buzzvm_process_inmsgs(vm);
+   buzzvm_function_call(vm, "step", 0);
+   buzzvm_pop(vm);
+   buzzvm_process_outmsgs(vm);
+}
+
+/*
+ * Hands a copy of the messages of a robot to the given robots.
+ */
+static void deliver(buzzvm_t from, buzzvm_t to1, buzzvm_t to2) {
+   buzzmsg_payload_t m;
+   while((m = buzzoutmsg_queue_pop(from, 1000)) != NULL) {
+      if(to1) buzzinmsg_queue_append(to1, from->robot, buzzdarray_clone(m));
+      if(to2) buzzinmsg_queue_append(to2, from->robot, buzzdarray_clone(m));
+      buzzoutmsg_queue_recycle(from, &m);
+   }
+}
+
+static buzzobj_t global(buzzvm_t vm, const char* name) {
+   buzzvm_pushs(vm, buzzvm_string_register(vm, name, 1));
+   buzzvm_gload(vm);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   return o;
+}
+
+static int same(buzzvm_t a, buzzvm_t b, const char* name) {
+   return buzzobj_eq(global(a, name), global(b, name));
+}
+
+/* Number of entries, deletion markers excluded */
+static uint32_t vstig_size(buzzvm_t vm, uint16_t id) {
+   buzzvstig_t vs = *buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+   return buzzdict_size(vs->data) - vs->tombstones;
+}
+
+/****************************************/
+/****************************************/
+
+int main(int argc, char* argv[]) {
+   if(argc < 2) {
+      fprintf(stderr, "Usage: %s <script.bo>\n", argv[0]);
+      return 1;
+   }
+   /* Read bytecode */
+   FILE* f = fopen(argv[1], "rb");
+   if(!f) { perror(argv[1]); return 1; }
+   fseek(f, 0, SEEK_END);
+   bcode_size = ftell(f);
+   rewind(f);
+   bcode = (uint8_t*)malloc(bcode_size);
+   if(fread(bcode, 1, bcode_size, f) < bcode_size) { perror(argv[1]); return 1; }
+   fclose(f);
+   printf("=== buzzfork ===\n\n");
+   uint32_t i;
+   int ok;
+
+   buzzvm_t a = robot_new(1);
+   buzzvm_t b = robot_new(2);
+
+   /* Objects the host keeps a handle to are found in the forks */
+   buzzobj_t pin = buzzheap_newobj(a, BUZZTYPE_TABLE);
+   buzzvm_pin(a, pin);
+   buzzobj_t sym = buzzheap_newobj(a, BUZZTYPE_TABLE);
+   buzzvm_hostsym_register(a, buzzvm_string_register(a, "sensor", 1), sym, NULL, NULL);
+   buzzvm_snapshot_t s0 = buzzvm_snapshot(a);
+   buzzvm_t f0 = buzzvm_fork(s0);
+   TEST("pinned object",          buzzvm_snapshot_obj(s0, f0, pin) ==
+                                  buzzdarray_last(f0->pins, buzzobj_t));
+   TEST("host symbol",            buzzvm_snapshot_obj(s0, f0, sym) ==
+                                  buzzdarray_last(f0->hostsyms, struct buzzvm_hostsym_s).o &&
+                                  global(f0, "sensor") == buzzvm_snapshot_obj(s0, f0, sym));
+   TEST("unknown object",         buzzvm_snapshot_obj(s0, f0, (buzzobj_t)&ok) == NULL);
+   buzzvm_destroy(&f0);
+
+   /* Run a few steps with pending messages at the end */
+   for(i = 0; i < 3; ++i) {
+      robot_step(b);
+      deliver(b, a, NULL);
+      robot_step(a);
+      deliver(a, NULL, NULL);
+   }
+   robot_step(b);
+   deliver(b, a, NULL);
+   buzzvm_snapshot_t s = buzzvm_snapshot(a);
+   buzzvm_t fa = buzzvm_fork(s);
+   TEST("globals",                global(fa, "count")->i.value == 9 &&
+                                  same(a, fa, "count") && same(a, fa, "last"));
+   TEST("incoming messages",      buzzinmsg_queue_size(fa->inmsgs) > 0 &&
+                                  buzzinmsg_queue_size(fa->inmsgs) == buzzinmsg_queue_size(a->inmsgs));
+   TEST("virtual stigmergy",      vstig_size(fa, 1) >= 2 && vstig_size(fa, 1) == vstig_size(a, 1));
+
+   /* The fork and the original go on in the same way */
+   for(ok = 1, i = 0; i < 5 && ok; ++i) {
+      robot_step(a);
+      robot_step(fa);
+      ok = same(a, fa, "count") && same(a, fa, "last") &&
+           same(a, fa, "heard") && same(a, fa, "total") &&
+           vstig_size(fa, 2) <= 4 && vstig_size(fa, 2) == vstig_size(a, 2) &&
+           buzzoutmsg_queue_size(a) == buzzoutmsg_queue_size(fa);
+      deliver(a, NULL, NULL);
+      deliver(fa, NULL, NULL);
+      robot_step(b);
+      deliver(b, a, fa);
+   }
+   TEST("same steps",             ok && global(fa, "count")->i.value == 24 &&
+                                  global(fa, "heard")->i.value > 0);
+
+   /* Outgoing messages are copied */
+   robot_step(a);
+   buzzvm_snapshot_t s2 = buzzvm_snapshot(a);
+   buzzvm_t fb = buzzvm_fork(s2);
+   buzzmsg_payload_t ma, mb;
+   ok = buzzoutmsg_queue_size(fb) > 0 && buzzoutmsg_queue_size(fb) == buzzoutmsg_queue_size(a);
+   while(ok && (ma = buzzoutmsg_queue_pop(a, 1000)) != NULL) {
+      mb = buzzoutmsg_queue_pop(fb, 1000);
+      ok = mb && buzzmsg_payload_size(ma) == buzzmsg_payload_size(mb) &&
+           memcmp(ma->data, mb->data, buzzmsg_payload_size(ma)) == 0;
+      buzzoutmsg_queue_recycle(a, &ma);
+      if(mb) buzzoutmsg_queue_recycle(fb, &mb);
+   }
+   TEST("outgoing messages",      ok && buzzoutmsg_queue_pop(fb, 1000) == NULL);
+   buzzvm_snapshot_destroy(&s2);
+   buzzvm_destroy(&fb);
+
+   /* The forks are independent from each other */
+   buzzvm_t fc = buzzvm_fork(s);
+   TEST("forks are independent",  global(fc, "count")->i.value == 9 &&
+                                  global(fa, "count")->i.value == 24);
+
+   /* The forks of the initial snapshot start over */
+   buzzvm_destroy(&a);
+   f0 = buzzvm_fork(s0);
+   TEST("reset",                  global(f0, "count")->i.value == 0 &&
+                                  global(f0, "heard")->i.value == 0 &&
+                                  vstig_size(f0, 1) == 2);
+
+   /* The forks outlive the original, and collect garbage */
+   for(i = 0; i < 200; ++i) {
+      robot_step(f0);
+      deliver(f0, NULL, NULL);
+   }
+   TEST("long run",               f0->state == BUZZVM_STATE_READY &&
+                                  global(f0, "count")->i.value == 600 &&
+                                  buzzdict_size(global(f0, "draws")->t.value) == 200);
+   buzzvm_pushi(f0, 4);
+   buzzvm_function_call(f0, "add3", 1);
+   TEST("closures",               f0->state == BUZZVM_STATE_READY &&
+                                  buzzvm_stack_at(f0, 1)->i.value == 7);
+   buzzvm_pop(f0);
+
+   buzzvm_destroy(&f0);
+   buzzvm_destroy(&fa);
+   buzzvm_destroy(&fc);
+   buzzvm_destroy(&b);
+   buzzvm_snapshot_destroy(&s);
+   buzzvm_snapshot_destroy(&s0);
+   free(bcode);
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   return n_fail > 0;
+}
@@ -0,0 +1,85 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+/* An empty program, so that the VM is set up */
+static const uint8_t BCODE[] = { 0, 0, BUZZVM_INSTR_NOP, BUZZVM_INSTR_DONE };
+
+/****************************************/
+/****************************************/
+
+static int n_fills = 0;
+
+static void fill(buzzvm_t vm, buzzobj_t o, void* data) {
+   ++n_fills;
+   buzzvm_push(vm, o);
+   buzzvm_pushs(vm, *(uint16_t*)data);
+   buzzvm_pushi(vm, n_fills);
+   buzzvm_tput(vm);
+}
+
+static buzzobj_t load(buzzvm_t vm, uint16_t sid) {
+   buzzvm_pushs(vm, sid);
+   buzzvm_gload(vm);
+   buzzobj_t o = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   return o;
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzhostsym ===\n\n");
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, BCODE, sizeof(BCODE));
+   uint16_t sym = buzzvm_string_register(vm, "sensor", 1);
+   uint16_t key = buzzvm_string_register(vm, "value", 1);
+   buzzobj_t t = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   buzzvm_hostsym_register(vm, sym, t, fill, &key);
+   TEST("bound at registration",  load(vm, sym) == t && n_fills == 0);
+
+   /* Eager updates fill right away */
+   buzzvm_hostsyms_update(vm, 0);
+   TEST("eager fill",             n_fills == 1 && vm->hoststale == 0);
+
+   /* Lazy updates fill on the first load only */
+   buzzvm_hostsyms_update(vm, 1);
+   TEST("lazy fill deferred",     n_fills == 1 && vm->hoststale == 1);
+   load(vm, sym);
+   load(vm, sym);
+   TEST("lazy fill on load",      n_fills == 2 && vm->hoststale == 0);
+   buzzvm_hostsyms_update(vm, 1);
+   buzzvm_hostsyms_update(vm, 1);
+   TEST("unloaded steps skipped", n_fills == 2 && vm->hoststale == 1);
+
+   /* The script can't lose the object */
+   buzzvm_pushs(vm, sym);
+   buzzvm_pushnil(vm);
+   buzzvm_gstore(vm);
+   vm->heap->max_objs = 0;
+   buzzheap_gc(vm);
+   buzzvm_hostsyms_update(vm, 0);
+   TEST("rebound after store",    load(vm, sym) == t && n_fills == 3);
+
+   /* Pinned objects survive collection */
+   buzzobj_t p = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   buzzvm_pin(vm, p);
+   vm->heap->max_objs = 0;
+   buzzheap_gc(vm);
+   uint32_t i, found = 0;
+   for(i = 0; i < buzzdarray_size(vm->heap->objs); ++i)
+      found |= buzzdarray_get(vm->heap->objs, i, buzzobj_t) == p;
+   TEST("pinned object kept",     found);
+
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   buzzvm_destroy(&vm);
+   return n_fail > 0;
+}
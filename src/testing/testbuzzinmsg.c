@@ -0,0 +1,96 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+/****************************************/
+/****************************************/
+
+static void append(buzzvm_t vm, uint16_t rid) {
+   buzzmsg_payload_t p = buzzmsg_payload_new(1);
+   buzzmsg_serialize_u8(p, rid);
+   buzzinmsg_queue_append(vm, rid, p);
+}
+
+static int extract(buzzvm_t vm) {
+   uint16_t rid;
+   buzzmsg_payload_t p;
+   if(!buzzinmsg_queue_extract(vm, &rid, &p)) return -1;
+   buzzmsg_payload_destroy(&p);
+   return rid;
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   buzzvm_t vm = buzzvm_new(0);
+   printf("=== buzzinmsg ===\n\n");
+   int i;
+
+   /* --- Arrival order --- */
+   append(vm, 3); append(vm, 1); append(vm, 2);
+   TEST("size after append", buzzinmsg_queue_size(vm->inmsgs) == 3);
+   TEST("arrival order 1",   extract(vm) == 3);
+   TEST("arrival order 2",   extract(vm) == 1);
+   TEST("arrival order 3",   extract(vm) == 2);
+   TEST("empty after drain", buzzinmsg_queue_isempty(vm->inmsgs));
+   TEST("extract on empty",  extract(vm) == -1);
+
+   /* --- The slots grow up to the capacity --- */
+   TEST("initial slots",     vm->inmsgs->capacity == BUZZINMSG_QUEUE_SLOTS);
+   for(i = 0; i < 100; ++i) append(vm, i);
+   TEST("grow no drop",      buzzinmsg_queue_size(vm->inmsgs) == 100 &&
+                             vm->inmsgs->dropped == 0);
+   TEST("grow slots",        vm->inmsgs->capacity == 128);
+   TEST("grow keeps order",  extract(vm) == 0 && extract(vm) == 1);
+   while(extract(vm) >= 0);
+
+   /* --- Drop oldest --- */
+   buzzinmsg_queue_set_capacity(vm->inmsgs, 4);
+   for(i = 0; i < 6; ++i) append(vm, i);
+   TEST("drop oldest size",    buzzinmsg_queue_size(vm->inmsgs) == 4);
+   TEST("drop oldest count",   vm->inmsgs->dropped == 2);
+   TEST("drop oldest head",    extract(vm) == 2);
+
+   /* --- Drop newest --- */
+   buzzinmsg_queue_set_policy(vm->inmsgs, BUZZINMSG_DROP_NEWEST);
+   append(vm, 6); append(vm, 7);
+   TEST("drop newest size",    buzzinmsg_queue_size(vm->inmsgs) == 4);
+   TEST("drop newest head",    extract(vm) == 3);
+
+   /* --- Resize keeps order --- */
+   buzzinmsg_queue_set_capacity(vm->inmsgs, 16);
+   TEST("resize capacity",     vm->inmsgs->capacity == 16);
+   TEST("resize keeps order",  extract(vm) == 4);
+
+   /* --- Shared payloads are never freed by the queue --- */
+   buzzinmsg_queue_set_capacity(vm->inmsgs, 2);
+   buzzinmsg_queue_set_policy(vm->inmsgs, BUZZINMSG_DROP_OLDEST);
+   while(extract(vm) >= 0);
+   buzzmsg_payload_t sp = buzzmsg_payload_new(1);
+   buzzmsg_serialize_u8(sp, 9);
+   for(i = 0; i < 4; ++i) buzzinmsg_queue_append_shared(vm, 9, sp);
+   uint16_t rid;
+   buzzmsg_payload_t p;
+   TEST("shared extract",      buzzinmsg_queue_extract(vm, &rid, &p) == BUZZINMSG_SHARED &&
+                               p == sp && rid == 9);
+   append(vm, 10);
+   TEST("owned extract",       buzzinmsg_queue_extract(vm, &rid, &p) == BUZZINMSG_SHARED &&
+                               buzzinmsg_queue_extract(vm, &rid, &p) == BUZZINMSG_OWNED &&
+                               rid == 10);
+   buzzmsg_payload_destroy(&p);
+   buzzinmsg_queue_append_shared(vm, 9, sp);
+   TEST("shared payload kept", buzzmsg_payload_size(sp) == 1);
+
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   buzzvm_destroy(&vm);
+   buzzmsg_payload_destroy(&sp);
+   return n_fail > 0;
+}
@@ -0,0 +1,269 @@
+#include <buzz/buzzvm.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+/* An endless empty loop, so that the neighbor structure is set up and
+ * its methods can be called */
+static const uint8_t BCODE[] = { 0, 0, BUZZVM_INSTR_NOP, BUZZVM_INSTR_JUMP, 2, 0, 0, 0,
+                                 BUZZVM_INSTR_DONE };
+
+/****************************************/
+/****************************************/
+
+static float field(buzzvm_t vm, buzzobj_t t, const char* name) {
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, name, 1));
+   buzzvm_tget(vm);
+   float f = buzzvm_stack_at(vm, 1)->f.value;
+   buzzvm_pop(vm);
+   return f;
+}
+
+static int near(float a, float b) {
+   return fabsf(a - b) < 1e-4f;
+}
+
+static buzzobj_t num(buzzvm_t vm, float f) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_FLOAT);
+   o->f.value = f;
+   return o;
+}
+
+static buzzobj_t inum(buzzvm_t vm, int32_t i) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
+   o->i.value = i;
+   return o;
+}
+
+static buzzobj_t neighbors(buzzvm_t vm) {
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "neighbors", 1));
+   buzzvm_gload(vm);
+   buzzobj_t n = buzzvm_stack_at(vm, 1);
+   buzzvm_pop(vm);
+   return n;
+}
+
+/*
+ * Calls a method of a neighbor structure. The result is left on the
+ * stack, so that the garbage collector keeps it.
+ */
+static buzzobj_t call(buzzvm_t vm, buzzobj_t n, const char* method, int argc, ...) {
+   buzzvm_push(vm, n);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, method, 1));
+   buzzvm_tget(vm);
+   va_list ap;
+   va_start(ap, argc);
+   int i;
+   for(i = 0; i < argc; ++i) buzzvm_push(vm, va_arg(ap, buzzobj_t));
+   va_end(ap);
+   buzzvm_closure_call(vm, argc);
+   return buzzvm_stack_at(vm, 1);
+}
+
+static int32_t count(buzzvm_t vm, buzzobj_t n) {
+   return call(vm, n, "count", 0)->i.value;
+}
+
+static int visited[16];
+static int nvisited;
+
+static int visit(buzzvm_t vm) {
+   buzzvm_lload(vm, 1);
+   if(nvisited < 16) visited[nvisited++] = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   return buzzvm_ret0(vm);
+}
+
+/*
+ * Returns 1 if foreach() goes through the given robots of a neighbor
+ * structure, in the given order.
+ */
+static int robots(buzzvm_t vm, buzzobj_t n, int argc, ...) {
+   nvisited = 0;
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, visit));
+   call(vm, n, "foreach", 1, buzzvm_stack_at(vm, 1));
+   if(nvisited != argc) return 0;
+   va_list ap;
+   va_start(ap, argc);
+   int i, ok = 1;
+   for(i = 0; i < argc; ++i) ok = ok && visited[i] == va_arg(ap, int);
+   va_end(ap);
+   return ok;
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzneighbors ===\n\n");
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, BCODE, sizeof(BCODE));
+   buzzneighbors_store_t s = vm->neighbors;
+   uint32_t objs = buzzdarray_size(vm->heap->objs);
+   int i;
+
+   /* Ingestion makes no Buzz objects */
+   buzzneighbors_reset(vm);
+   for(i = 0; i < 40; ++i)
+      buzzneighbors_add(vm, 100 + i, i, 0.5f, 0.0f);
+   TEST("neighbors stored",       s->size == 40 && s->capacity >= 40);
+   TEST("no objects made",        buzzdarray_size(vm->heap->objs) == objs);
+   TEST("find",                   buzzneighbors_store_find(s, 139) == 39 &&
+                                  buzzneighbors_store_find(s, 99) == -1);
+
+   /* A second reading of a robot replaces the first */
+   buzzneighbors_add(vm, 105, 50.0f, 1.0f, 0.0f);
+   TEST("duplicate replaced",     s->size == 40 && s->distance[5] == 50.0f);
+
+   /* Data tables are made once, on request */
+   buzzobj_t d = buzzneighbors_data(vm, 5);
+   TEST("data table",             field(vm, d, "distance") == 50.0f &&
+                                  field(vm, d, "azimuth") == 1.0f);
+   TEST("data table cached",      buzzneighbors_data(vm, 5) == d);
+   buzzneighbors_add(vm, 105, 60.0f, 1.0f, 0.0f);
+   TEST("data table refreshed",   buzzneighbors_data(vm, 5) != d &&
+                                  field(vm, buzzneighbors_data(vm, 5), "distance") == 60.0f);
+
+   /* Aging */
+   buzzneighbors_age(vm, 1);
+   for(i = 0; i < 20; ++i)
+      buzzneighbors_add(vm, 100 + 2 * i, i, 0.0f, 0.0f);
+   buzzneighbors_age(vm, 1);
+   TEST("old neighbors forgotten", s->size == 20 &&
+                                   buzzneighbors_store_find(s, 101) == -1 &&
+                                   buzzneighbors_store_find(s, 138) >= 0);
+
+   /* The distance order is rebuilt after each change */
+   buzzneighbors_reset(vm);
+   buzzneighbors_add(vm, 1, 3.0f, 0.0f, 0.0f);
+   buzzneighbors_add(vm, 2, 1.0f, 0.0f, 0.0f);
+   buzzneighbors_add(vm, 3, 2.0f, 0.0f, 0.0f);
+   const uint32_t* o = buzzneighbors_store_order(s);
+   TEST("sorted by distance",     s->id[o[0]] == 2 && s->id[o[1]] == 3 && s->id[o[2]] == 1);
+   buzzneighbors_add(vm, 1, 0.5f, 0.0f, 0.0f);
+   o = buzzneighbors_store_order(s);
+   TEST("order refreshed",        s->id[o[0]] == 1 && s->id[o[2]] == 3);
+
+   /* --- Kernels --- */
+   buzzneighbors_reset(vm);
+   buzzneighbors_add(vm, 1, 1.0f, 0.0f, 0.0f);
+   buzzneighbors_add(vm, 2, 2.0f, (float)M_PI / 2.0f, 0.0f);
+   buzzneighbors_add(vm, 3, 3.0f, (float)M_PI, 0.0f);
+   buzzneighbors_add(vm, 4, 0.0f, 0.0f, 0.0f);
+   buzzobj_t n = neighbors(vm);
+   buzzobj_t v = call(vm, n, "vecsum", 0);
+   TEST("vecsum",                 near(field(vm, v, "x"), -2.0f) && near(field(vm, v, "y"), 2.0f));
+   v = call(vm, n, "vecsum", 1, num(vm, 0.0f));
+   TEST("vecsum of unit vectors", near(field(vm, v, "x"), 1.0f) && near(field(vm, v, "y"), 1.0f));
+   v = call(vm, n, "vecsum", 1, num(vm, -1.0f));
+   TEST("vecsum at distance 0",   near(field(vm, v, "x"), 2.0f / 3.0f) && near(field(vm, v, "y"), 0.5f));
+   v = call(vm, n, "centroid", 0);
+   TEST("centroid",               near(field(vm, v, "x"), -0.5f) && near(field(vm, v, "y"), 0.5f) &&
+                                  near(field(vm, v, "z"), 0.0f));
+   TEST("count_within",           call(vm, n, "count_within", 1, num(vm, 2.0f))->i.value == 3 &&
+                                  call(vm, n, "count_within", 1, inum(vm, 0))->i.value == 1);
+   buzzobj_t k = call(vm, n, "nearest", 1, inum(vm, 2));
+   v = call(vm, k, "centroid", 0);
+   TEST("nearest",                count(vm, k) == 2 && near(field(vm, v, "x"), 0.5f));
+   TEST("nearest beyond size",    count(vm, call(vm, n, "nearest", 1, inum(vm, 10))) == 4 &&
+                                  count(vm, call(vm, n, "nearest", 1, inum(vm, 0))) == 0);
+   /* Lennard-Jones: no force at the target distance, repulsion closer,
+    * attraction farther, and the neighbors at distance 0 are ignored */
+   buzzneighbors_reset(vm);
+   buzzneighbors_add(vm, 1, 2.0f, 0.0f, 0.0f);
+   buzzneighbors_add(vm, 4, 0.0f, 0.0f, 0.0f);
+   v = call(vm, neighbors(vm), "lennard_jones", 2, num(vm, 2.0f), num(vm, 1.0f));
+   TEST("lennard_jones at target", near(field(vm, v, "x"), 0.0f) && near(field(vm, v, "y"), 0.0f));
+   v = call(vm, neighbors(vm), "lennard_jones", 2, num(vm, 3.0f), num(vm, 1.0f));
+   TEST("lennard_jones closer",   field(vm, v, "x") < 0.0f && near(field(vm, v, "y"), 0.0f));
+   v = call(vm, neighbors(vm), "lennard_jones", 2, num(vm, 1.0f), num(vm, 1.0f));
+   TEST("lennard_jones farther",  field(vm, v, "x") > 0.0f && isfinite(field(vm, v, "x")));
+   /* Elevation */
+   buzzneighbors_reset(vm);
+   buzzneighbors_add(vm, 1, 2.0f, 0.0f, (float)M_PI / 2.0f);
+   v = call(vm, neighbors(vm), "centroid", 0);
+   TEST("centroid elevation",     near(field(vm, v, "x"), 0.0f) && near(field(vm, v, "z"), 2.0f));
+   /* No neighbors */
+   buzzneighbors_reset(vm);
+   n = neighbors(vm);
+   v = call(vm, n, "vecsum", 0);
+   TEST("empty vecsum",           field(vm, v, "x") == 0.0f && field(vm, v, "y") == 0.0f);
+   v = call(vm, n, "centroid", 0);
+   TEST("empty centroid",         field(vm, v, "x") == 0.0f && field(vm, v, "y") == 0.0f &&
+                                  field(vm, v, "z") == 0.0f);
+   v = call(vm, n, "lennard_jones", 2, num(vm, 1.0f), num(vm, 1.0f));
+   TEST("empty lennard_jones",    field(vm, v, "x") == 0.0f && field(vm, v, "y") == 0.0f);
+   TEST("empty count_within",     call(vm, n, "count_within", 1, num(vm, 10.0f))->i.value == 0);
+   TEST("empty nearest",          count(vm, call(vm, n, "nearest", 1, inum(vm, 3))) == 0);
+   TEST("no errors",              vm->state == BUZZVM_STATE_READY);
+
+   /* --- Selections --- */
+   buzzneighbors_reset(vm);
+   buzzneighbors_add(vm, 1, 1.0f, 0.0f, 0.0f);
+   buzzneighbors_add(vm, 2, 2.0f, (float)M_PI / 2.0f, 0.0f);
+   buzzneighbors_add(vm, 3, 3.0f, (float)M_PI - 0.1f, 0.0f);
+   buzzneighbors_add(vm, 4, 4.0f, -(float)M_PI + 0.1f, 0.0f);
+   buzzneighbors_add(vm, 5, 2.5f, -(float)M_PI / 2.0f, 0.0f);
+   n = neighbors(vm);
+   TEST("within",                 robots(vm, call(vm, n, "within", 1, num(vm, 2.5f)), 3, 1, 2, 5));
+   TEST("within nothing",         robots(vm, call(vm, n, "within", 1, num(vm, 0.5f)), 0));
+   TEST("sector",                 robots(vm, call(vm, n, "sector", 2,
+                                                  num(vm, -(float)M_PI / 4.0f),
+                                                  num(vm, 3.0f * (float)M_PI / 4.0f)), 2, 1, 2));
+   /* A sector from 3pi/4 to -3pi/4 goes through pi */
+   TEST("sector across pi",       robots(vm, call(vm, n, "sector", 2,
+                                                  num(vm, 3.0f * (float)M_PI / 4.0f),
+                                                  num(vm, -3.0f * (float)M_PI / 4.0f)), 2, 3, 4));
+   TEST("sector angles wrapped",  robots(vm, call(vm, n, "sector", 2,
+                                                  num(vm, 11.0f * (float)M_PI / 4.0f),
+                                                  num(vm, -11.0f * (float)M_PI / 4.0f)), 2, 3, 4));
+   TEST("sector full circle",     robots(vm, call(vm, n, "sector", 2,
+                                                  num(vm, -(float)M_PI),
+                                                  num(vm, (float)M_PI)), 5, 1, 2, 3, 4, 5));
+   TEST("sector beyond 2pi",      count(vm, call(vm, n, "sector", 2,
+                                                 num(vm, 0.0f),
+                                                 num(vm, 7.0f))) == 5);
+   TEST("sector up to pi",        robots(vm, call(vm, n, "sector", 2,
+                                                  num(vm, (float)M_PI / 2.0f),
+                                                  num(vm, (float)M_PI)), 2, 2, 3));
+   TEST("sector from pi",         robots(vm, call(vm, n, "sector", 2,
+                                                  num(vm, (float)M_PI),
+                                                  num(vm, -2.0f)), 1, 4));
+   k = call(vm, n, "sector", 2,
+            num(vm, 3.0f * (float)M_PI / 4.0f),
+            num(vm, -3.0f * (float)M_PI / 4.0f));
+   TEST("sector then within",     robots(vm, call(vm, k, "within", 1, num(vm, 3.5f)), 1, 3));
+   buzzobj_t sorted = call(vm, n, "sorted_by_distance", 0);
+   TEST("sorted_by_distance",     robots(vm, sorted, 5, 1, 2, 5, 3, 4));
+   TEST("sorted view sorted",     robots(vm, call(vm, k, "sorted_by_distance", 0), 2, 3, 4));
+   /* The views find their robots again when the neighbors change: robot 3
+    * leaves and the others come back in another order */
+   buzzneighbors_reset(vm);
+   buzzneighbors_add(vm, 4, 4.0f, -(float)M_PI + 0.1f, 0.0f);
+   buzzneighbors_add(vm, 2, 2.0f, (float)M_PI / 2.0f, 0.0f);
+   buzzneighbors_add(vm, 5, 2.5f, -(float)M_PI / 2.0f, 0.0f);
+   buzzneighbors_add(vm, 1, 1.0f, 0.0f, 0.0f);
+   TEST("view after change",      robots(vm, sorted, 4, 1, 2, 5, 4) && count(vm, sorted) == 4);
+   v = call(vm, sorted, "centroid", 0);
+   TEST("view kernel after change", near(field(vm, v, "x"), (1.0f - 4.0f * cosf(0.1f)) / 4.0f));
+   TEST("sector after change",    robots(vm, k, 1, 4));
+   TEST("selections no errors",   vm->state == BUZZVM_STATE_READY);
+
+   /* Reset keeps the arrays */
+   uint32_t cap = s->capacity;
+   buzzneighbors_reset(vm);
+   TEST("reset",                  s->size == 0 && s->capacity == cap);
+
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   buzzvm_destroy(&vm);
+   return n_fail > 0;
+}
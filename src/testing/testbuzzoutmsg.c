@@ -0,0 +1,336 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+#define VSID 1
+
+/****************************************/
+/****************************************/
+
+static buzzobj_t num(buzzvm_t vm, int32_t i) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
+   o->i.value = i;
+   return o;
+}
+
+static buzzobj_t str(buzzvm_t vm, const char* s) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_STRING);
+   o->s.value.sid = buzzvm_string_register(vm, s, 1);
+   o->s.value.str = buzzvm_string_get(vm, o->s.value.sid);
+   return o;
+}
+
+static uint16_t sid(buzzvm_t vm, const char* s) {
+   return buzzvm_string_register(vm, s, 1);
+}
+
+static void bcast(buzzvm_t vm, const char* topic, buzzobj_t value) {
+   buzzoutmsg_queue_append_broadcast(vm, str(vm, topic), value);
+}
+
+static void vput(buzzvm_t vm, int32_t k, int32_t v) {
+   buzzvstig_elem_t e = buzzvstig_elem_new(num(vm, v), 1, vm->robot);
+   buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, VSID, num(vm, k), e);
+   free(e);
+}
+
+/*
+ * Returns the topic of a broadcast payload.
+ */
+static const char* topic_of(buzzvm_t vm, buzzmsg_payload_t pl) {
+   buzzobj_t o;
+   if(buzzobj_deserialize(&o, pl, 1, vm) < 0) return "";
+   return o->s.value.str;
+}
+
+/*
+ * Returns the value of a broadcast payload.
+ */
+static buzzobj_t value_obj(buzzvm_t vm, buzzmsg_payload_t pl) {
+   buzzobj_t o;
+   int64_t pos = buzzobj_deserialize(&o, pl, 1, vm);
+   if(pos < 0 || buzzobj_deserialize(&o, pl, pos, vm) < 0) return NULL;
+   return o;
+}
+
+static int32_t value_of(buzzvm_t vm, buzzmsg_payload_t pl) {
+   buzzobj_t o = value_obj(vm, pl);
+   return (o && o->o.type == BUZZTYPE_INT) ? o->i.value : -1;
+}
+
+/*
+ * Returns a table {i: 10*i} for i in [0,n).
+ */
+static buzzobj_t table(buzzvm_t vm, int32_t n) {
+   buzzobj_t t = buzzheap_newobj(vm, BUZZTYPE_TABLE);
+   int32_t i;
+   for(i = 0; i < n; ++i) {
+      buzzobj_t k = num(vm, i);
+      buzzobj_t v = num(vm, 10 * i);
+      buzzdict_set(t->t.value, &k, &v);
+   }
+   return t;
+}
+
+/*
+ * Returns whether an object is the table {i: 10*i} for i in [0,n).
+ */
+static int table_ok(buzzvm_t vm, buzzobj_t t, int32_t n) {
+   if(!t || t->o.type != BUZZTYPE_TABLE || buzzdict_size(t->t.value) != n) return 0;
+   int32_t i;
+   for(i = 0; i < n; ++i) {
+      buzzobj_t k = num(vm, i);
+      const buzzobj_t* v = buzzdict_get(t->t.value, &k, buzzobj_t);
+      if(!v || (*v)->o.type != BUZZTYPE_INT || (*v)->i.value != 10 * i) return 0;
+   }
+   return 1;
+}
+
+/*
+ * Pops the next message that fits the given space and returns its type.
+ */
+static int pop_type(buzzvm_t vm, uint32_t avail) {
+   buzzmsg_payload_t m = buzzoutmsg_queue_pop(vm, avail);
+   if(!m) return -1;
+   int type = buzzmsg_payload_get(m, 0);
+   buzzoutmsg_queue_recycle(vm, &m);
+   return type;
+}
+
+/****************************************/
+/****************************************/
+
+static void test_weights() {
+   buzzvm_t vm = buzzvm_new(1);
+   int i;
+   buzzoutmsg_queue_set_weight(vm, BUZZMSG_BROADCAST, 3);
+   buzzoutmsg_queue_set_weight(vm, BUZZMSG_VSTIG_PUT, 1);
+   for(i = 0; i < 100; ++i) {
+      bcast(vm, "w", num(vm, i));
+      vput(vm, i, i);
+   }
+   for(i = 0; i < 60; ++i) pop_type(vm, UINT32_MAX);
+   const struct buzzoutmsg_class_s* c = vm->outmsgs->classes;
+   double ratio = (double)c[BUZZMSG_BROADCAST].sent_bytes /
+                  (double)c[BUZZMSG_VSTIG_PUT].sent_bytes;
+   TEST("both classes served",  c[BUZZMSG_BROADCAST].sent_msgs > 0 &&
+                                c[BUZZMSG_VSTIG_PUT].sent_msgs > 0);
+   TEST("bytes follow weights", ratio > 2.5 && ratio < 3.5);
+   TEST("messages counted",     c[BUZZMSG_BROADCAST].sent_msgs +
+                                c[BUZZMSG_VSTIG_PUT].sent_msgs == 60);
+   buzzvm_destroy(&vm);
+}
+
+/****************************************/
+/****************************************/
+
+static void test_rate() {
+   buzzvm_t vm = buzzvm_new(1);
+   int i;
+   for(i = 0; i < 10; ++i) bcast(vm, "r", num(vm, i));
+   uint32_t sz = buzzoutmsg_queue_head_size(vm, BUZZMSG_BROADCAST);
+   buzzoutmsg_queue_set_rate(vm, BUZZMSG_BROADCAST, 2 * sz, 3 * sz);
+   const struct buzzoutmsg_class_s* c = vm->outmsgs->classes + BUZZMSG_BROADCAST;
+   TEST("bucket starts full",   c->tokens == 3 * sz);
+   int n = 0;
+   while(pop_type(vm, UINT32_MAX) >= 0) ++n;
+   TEST("burst is sent",        n == 3);
+   TEST("bucket empty",         c->tokens == 0);
+   buzzoutmsg_queue_refill(vm);
+   n = 0;
+   while(pop_type(vm, UINT32_MAX) >= 0) ++n;
+   TEST("refill sends rate",    n == 2);
+   for(i = 0; i < 5; ++i) buzzoutmsg_queue_refill(vm);
+   TEST("tokens capped",        c->tokens == 3 * sz);
+   n = 0;
+   while(pop_type(vm, UINT32_MAX) >= 0) ++n;
+   TEST("capped burst is sent", n == 3);
+   /* A message larger than the bucket goes out when the bucket is full */
+   buzzoutmsg_queue_set_rate(vm, BUZZMSG_BROADCAST, 1, 1);
+   n = 0;
+   while(pop_type(vm, UINT32_MAX) >= 0) ++n;
+   TEST("large message sent",   n == 1);
+   buzzvm_destroy(&vm);
+}
+
+/****************************************/
+/****************************************/
+
+static void test_bestfit() {
+   buzzvm_t vm = buzzvm_new(1);
+   bcast(vm, "b", str(vm, "a rather long value that makes this message big"));
+   vput(vm, 1, 1);
+   buzzoutmsg_queue_append_swarm_joinleave(vm, BUZZMSG_SWARM_JOIN, 1);
+   uint32_t bsz = buzzoutmsg_queue_head_size(vm, BUZZMSG_BROADCAST);
+   uint32_t vsz = buzzoutmsg_queue_head_size(vm, BUZZMSG_VSTIG_PUT);
+   uint32_t jsz = buzzoutmsg_queue_head_size(vm, BUZZMSG_SWARM_JOIN);
+   TEST("sizes differ",        bsz > vsz && vsz > jsz);
+   TEST("largest fitting",     pop_type(vm, bsz - 1) == BUZZMSG_VSTIG_PUT);
+   TEST("then next fitting",   pop_type(vm, bsz - 1) == BUZZMSG_SWARM_JOIN);
+   TEST("nothing fits",        pop_type(vm, bsz - 1) < 0);
+   TEST("entitled when fits",  pop_type(vm, bsz) == BUZZMSG_BROADCAST);
+   TEST("queue empty",         buzzoutmsg_queue_size(vm) == 0);
+   buzzvm_destroy(&vm);
+}
+
+/****************************************/
+/****************************************/
+
+static void test_oversize() {
+   buzzvm_t vm = buzzvm_new(1);
+   bcast(vm, "o", str(vm, "a rather long value that makes this message big"));
+   bcast(vm, "o", num(vm, 1));
+   vput(vm, 1, 1);
+   uint32_t bsz = buzzoutmsg_queue_head_size(vm, BUZZMSG_BROADCAST);
+   buzzoutmsg_queue_set_mtu(vm, bsz - 1);
+   const struct buzzoutmsg_class_s* c = vm->outmsgs->classes;
+   TEST("small sent",          pop_type(vm, UINT32_MAX) == BUZZMSG_BROADCAST);
+   TEST("large dropped",       c[BUZZMSG_BROADCAST].dropped == 1 &&
+                               c[BUZZMSG_BROADCAST].sent_msgs == 1);
+   TEST("others unaffected",   pop_type(vm, UINT32_MAX) == BUZZMSG_VSTIG_PUT &&
+                               c[BUZZMSG_VSTIG_PUT].dropped == 0);
+   TEST("queue empty",         buzzoutmsg_queue_size(vm) == 0);
+   buzzvm_destroy(&vm);
+}
+
+/****************************************/
+/****************************************/
+
+static void test_priority() {
+   buzzvm_t vm = buzzvm_new(1);
+   buzzoutmsg_queue_set_priority(vm, sid(vm, "low"), -1);
+   buzzoutmsg_queue_set_priority(vm, sid(vm, "high"), 5);
+   bcast(vm, "low", num(vm, 1));
+   bcast(vm, "a", num(vm, 2));
+   bcast(vm, "high", num(vm, 3));
+   bcast(vm, "b", num(vm, 4));
+   const char* order[] = { "high", "a", "b", "low" };
+   int i, ok = 1;
+   for(i = 0; i < 4; ++i) {
+      buzzmsg_payload_t m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+      ok = ok && m && strcmp(topic_of(vm, m), order[i]) == 0;
+      buzzoutmsg_queue_recycle(vm, &m);
+   }
+   TEST("decreasing priority", ok);
+   TEST("queue empty",         buzzoutmsg_queue_size(vm) == 0);
+   buzzvm_destroy(&vm);
+}
+
+/****************************************/
+/****************************************/
+
+static void test_latest() {
+   buzzvm_t vm = buzzvm_new(1);
+   buzzmsg_payload_t m;
+   buzzoutmsg_queue_set_latest(vm, sid(vm, "pos"), 1);
+   bcast(vm, "a", num(vm, 1));
+   bcast(vm, "pos", num(vm, 10));
+   bcast(vm, "b", num(vm, 2));
+   bcast(vm, "pos", num(vm, 11));
+   bcast(vm, "pos", num(vm, 12));
+   bcast(vm, "a", num(vm, 3));
+   TEST("latest coalesced",    buzzoutmsg_queue_size(vm) == 4);
+   m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+   TEST("others before",       strcmp(topic_of(vm, m), "a") == 0 && value_of(vm, m) == 1);
+   buzzoutmsg_queue_recycle(vm, &m);
+   m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+   TEST("position kept",       strcmp(topic_of(vm, m), "pos") == 0);
+   TEST("value replaced",      value_of(vm, m) == 12);
+   buzzoutmsg_queue_recycle(vm, &m);
+   m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+   TEST("others after",        strcmp(topic_of(vm, m), "b") == 0 && value_of(vm, m) == 2);
+   buzzoutmsg_queue_recycle(vm, &m);
+   m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+   TEST("every value kept",    strcmp(topic_of(vm, m), "a") == 0 && value_of(vm, m) == 3);
+   buzzoutmsg_queue_recycle(vm, &m);
+   /* Once sent, a new value is queued anew */
+   bcast(vm, "pos", num(vm, 13));
+   bcast(vm, "a", num(vm, 4));
+   bcast(vm, "pos", num(vm, 14));
+   TEST("queued after send",   buzzoutmsg_queue_size(vm) == 2);
+   m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+   TEST("new message",         strcmp(topic_of(vm, m), "pos") == 0 && value_of(vm, m) == 14);
+   buzzoutmsg_queue_recycle(vm, &m);
+   m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+   buzzoutmsg_queue_recycle(vm, &m);
+   /* Turning coalescing off sends every value again */
+   bcast(vm, "pos", num(vm, 15));
+   buzzoutmsg_queue_set_latest(vm, sid(vm, "pos"), 0);
+   bcast(vm, "pos", num(vm, 16));
+   TEST("coalescing off",      buzzoutmsg_queue_size(vm) == 2);
+   m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+   TEST("old value kept",      value_of(vm, m) == 15);
+   buzzoutmsg_queue_recycle(vm, &m);
+   buzzvm_destroy(&vm);
+}
+
+/****************************************/
+/****************************************/
+
+static void test_pool() {
+   buzzvm_t vm = buzzvm_new(1);
+   buzzdarray_t pool = vm->outmsgs->pool;
+   bcast(vm, "p", num(vm, 1));
+   buzzmsg_payload_t m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+   buzzmsg_payload_t p = m;
+   uint32_t sz = buzzdarray_size(pool);
+   buzzoutmsg_queue_recycle(vm, &m);
+   TEST("payload recycled",    m == NULL && buzzdarray_size(pool) == sz + 1);
+   bcast(vm, "p", num(vm, 2));
+   TEST("payload reused",      buzzdarray_size(pool) == sz);
+   m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+   TEST("same buffer",         m == p && value_of(vm, m) == 2);
+   buzzoutmsg_queue_recycle(vm, &m);
+   /* Queued messages hold no reference to heap objects */
+   uint32_t nobjs = buzzdarray_size(vm->heap->objs);
+   bcast(vm, "gc", table(vm, 5));
+   buzzvstig_elem_t e = buzzvstig_elem_new(table(vm, 3), 1, vm->robot);
+   buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, VSID, num(vm, 1), e);
+   free(e);
+   TEST("objects created",     buzzdarray_size(vm->heap->objs) > nobjs);
+   vm->heap->max_objs = 0;
+   buzzheap_gc(vm);
+   TEST("objects collected",   buzzdarray_size(vm->heap->objs) <= nobjs);
+   int bc = 0, vs = 0, i;
+   for(i = 0; i < 2; ++i) {
+      m = buzzoutmsg_queue_pop(vm, UINT32_MAX);
+      if(m && buzzmsg_payload_get(m, 0) == BUZZMSG_BROADCAST) {
+         bc = table_ok(vm, value_obj(vm, m), 5);
+      }
+      else if(m && buzzmsg_payload_get(m, 0) == BUZZMSG_VSTIG_PUT) {
+         buzzobj_t k = NULL, v = NULL;
+         int64_t pos = buzzobj_deserialize(&k, m, 3, vm);
+         if(pos >= 0) buzzobj_deserialize(&v, m, pos, vm);
+         vs = k && k->i.value == 1 && table_ok(vm, v, 3);
+      }
+      buzzoutmsg_queue_recycle(vm, &m);
+   }
+   TEST("broadcast intact",    bc);
+   TEST("vstig put intact",    vs);
+   buzzvm_destroy(&vm);
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzoutmsg ===\n\n");
+   test_weights();
+   test_rate();
+   test_bestfit();
+   test_oversize();
+   test_priority();
+   test_latest();
+   test_pool();
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   return n_fail > 0;
+}
@@ -0,0 +1,169 @@
+#include <buzz/buzzprof.h>
+#include <buzz/buzzsnapshot.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+static uint8_t* bcode;
+static uint32_t bcode_size;
+static buzzdebug_t dbg;
+
+/****************************************/
+/****************************************/
+
+static buzzvm_t vm_new() {
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, bcode, bcode_size);
+   return vm;
+}
+
+static void call(buzzvm_t vm, const char* fname, int32_t arg) {
+   if(arg >= 0) buzzvm_pushi(vm, arg);
+   buzzvm_function_call(vm, fname, arg >= 0 ? 1 : 0);
+   buzzvm_pop(vm);
+}
+
+/*
+ * Returns the profile in the given format, as a malloc()'d buffer.
+ */
+static char* profile(buzzprof_t p, buzzvm_t vm, int pprof, size_t* size) {
+   FILE* f = tmpfile();
+   if(pprof) buzzprof_write_pprof(p, vm, dbg, f);
+   else      buzzprof_write_folded(p, vm, dbg, f);
+   *size = ftell(f);
+   rewind(f);
+   char* buf = (char*)calloc(*size + 1, 1);
+   if(fread(buf, 1, *size, f) < *size) *size = 0;
+   fclose(f);
+   return buf;
+}
+
+/*
+ * Removes the locations from a folded profile, leaving the names.
+ */
+static void strip(char* folded) {
+   char* w = folded;
+   const char* r;
+   for(r = folded; *r; ++r) {
+      if(r[0] == ' ' && r[1] == '(') r = strchr(r, ')');
+      else *w++ = *r;
+   }
+   *w = 0;
+}
+
+/*
+ * Returns 1 if every line of a folded profile starts with one of the
+ * given frames.
+ */
+static int roots(const char* folded, const char* r1, const char* r2) {
+   const char* l;
+   for(l = folded; *l; l = strchr(l, '\n') + 1) {
+      if(strncmp(l, r1, strlen(r1)) != 0 &&
+         strncmp(l, r2, strlen(r2)) != 0) return 0;
+   }
+   return 1;
+}
+
+/****************************************/
+/****************************************/
+
+int main(int argc, char* argv[]) {
+   if(argc < 3) {
+      fprintf(stderr, "Usage: %s <script.bo> <script.bdb>\n", argv[0]);
+      return 1;
+   }
+   /* Read bytecode and debug information */
+   FILE* f = fopen(argv[1], "rb");
+   if(!f) { perror(argv[1]); return 1; }
+   fseek(f, 0, SEEK_END);
+   bcode_size = ftell(f);
+   rewind(f);
+   bcode = (uint8_t*)malloc(bcode_size);
+   if(fread(bcode, 1, bcode_size, f) < bcode_size) { perror(argv[1]); return 1; }
+   fclose(f);
+   dbg = buzzdebug_new();
+   if(!buzzdebug_fromfile(dbg, argv[2])) { perror(argv[2]); return 1; }
+   printf("=== buzzprof ===\n\n");
+   size_t size;
+   char* out;
+
+   /* Sample the main script and a call chain */
+   buzzvm_t vm = vm_new();
+   buzzprof_t p = buzzprof_new(BUZZPROF_INSTRUCTIONS, 10);
+   buzzprof_attach(vm, p);
+   buzzvm_execute_script(vm);
+   uint64_t script = buzzprof_samples(p);
+   call(vm, "outer", -1);
+   TEST("samples",                script > 100 && buzzprof_samples(p) > script + 200 &&
+                                  vm->state == BUZZVM_STATE_READY);
+   out = profile(p, vm, 0, &size);
+   TEST("locations",              strstr(out, "outer (testbuzzprof.bzz:") != NULL &&
+                                  strstr(out, ";leaf (testbuzzprof.bzz:8) ") != NULL);
+   strip(out);
+   TEST("script",                 strstr(out, "<script>;leaf ") != NULL);
+   TEST("call chain",             strstr(out, "\nouter;mid;leaf ") != NULL);
+   TEST("host frames",            roots(out, "<script>;", "outer"));
+   free(out);
+
+   /* C functions and lambdas */
+   buzzprof_t q = buzzprof_new(BUZZPROF_INSTRUCTIONS, 10);
+   buzzprof_attach(vm, q);
+   call(vm, "viac", -1);
+   call(vm, "rec", 20);
+   out = profile(q, vm, 0, &size);
+   strip(out);
+   TEST("C function",             strstr(out, "viac;foreach;<lambda>;leaf ") != NULL);
+   TEST("recursion",              strstr(out, "\nrec;rec;rec;rec;rec;rec;rec;rec;rec;rec;"
+                                              "rec;rec;rec;rec;rec;rec;rec;rec;rec;rec;rec;leaf ") != NULL);
+   TEST("no foreign roots",       roots(out, "viac", "rec"));
+   free(out);
+
+   /* Merging adds the samples */
+   uint64_t np = buzzprof_samples(p), nq = buzzprof_samples(q);
+   buzzprof_merge(p, q);
+   TEST("merge",                  buzzprof_samples(p) == np + nq);
+
+   /* pprof output */
+   out = profile(p, vm, 1, &size);
+   TEST("pprof",                  size > 0 && (uint8_t)out[0] == 0x0a &&
+                                  memmem(out, size, "instructions", 12) &&
+                                  memmem(out, size, "foreach", 7) &&
+                                  memmem(out, size, "testbuzzprof.bzz", 16));
+   free(out);
+
+   /* Detaching stops sampling, and forks are not profiled */
+   buzzprof_attach(vm, NULL);
+   call(vm, "outer", -1);
+   buzzvm_snapshot_t s = buzzvm_snapshot(vm);
+   buzzvm_t fk = buzzvm_fork(s);
+   TEST("detach",                 buzzprof_samples(q) == nq && fk->prof == NULL);
+   buzzvm_destroy(&fk);
+   buzzvm_snapshot_destroy(&s);
+
+   /* Timer mode */
+   buzzprof_t t = buzzprof_new(BUZZPROF_TIMER, 1);
+   buzzprof_attach(vm, t);
+   int i;
+   for(i = 0; i < 20; ++i) call(vm, "outer", -1);
+   out = profile(t, vm, 0, &size);
+   TEST("timer",                  buzzprof_samples(t) > 0 && strstr(out, "leaf (") != NULL);
+   free(out);
+   buzzprof_attach(vm, NULL);
+
+   buzzprof_destroy(&p);
+   buzzprof_destroy(&q);
+   buzzprof_destroy(&t);
+   buzzvm_destroy(&vm);
+   buzzdebug_destroy(&dbg);
+   free(bcode);
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   return n_fail > 0;
+}
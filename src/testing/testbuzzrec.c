@@ -0,0 +1,125 @@
+#include <buzz/buzzrec.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+static const struct buzzrec_column_s COLS[] = {
+   { "step",  BUZZREC_INT },
+   { "robot", BUZZREC_INT },
+   { "x",     BUZZREC_FLOAT }
+};
+
+/****************************************/
+/****************************************/
+
+static long fsize(const char* fname) {
+   struct stat st;
+   return stat(fname, &st) == 0 ? st.st_size : -1;
+}
+
+/*
+ * Row i of the test data.
+ */
+static void row(uint32_t i, buzzrec_value_t* v) {
+   v[0].i = i / 100;
+   v[1].i = i % 100;
+   v[2].f = (i % 100) * 0.5f + (i / 100) * 0.01f;
+}
+
+/*
+ * Writes n rows, flushing after the given row.
+ */
+static int write_rows(const char* fname, uint32_t n, uint32_t chunk, uint32_t flushat) {
+   buzzrec_t r = buzzrec_open(fname, COLS, 3, chunk);
+   if(!r) return -1;
+   buzzrec_value_t v[3];
+   uint32_t i;
+   for(i = 0; i < n; ++i) {
+      row(i, v);
+      buzzrec_push(r, v);
+      if(i == flushat) buzzrec_flush(r);
+   }
+   return buzzrec_close(&r);
+}
+
+/*
+ * Reads a file back and compares it with the test data.
+ * Returns the number of rows, or -1 on mismatch.
+ */
+static int64_t read_rows(const char* fname, int64_t* chunks) {
+   buzzrec_reader_t r = buzzrec_reader_open(fname);
+   if(!r) return -1;
+   if(buzzrec_reader_ncols(r) != 3 ||
+      strcmp(buzzrec_reader_col(r, 2)->name, "x") != 0 ||
+      buzzrec_reader_col(r, 2)->type != BUZZREC_FLOAT) {
+      buzzrec_reader_close(&r);
+      return -1;
+   }
+   int64_t total = 0, rows, j;
+   buzzrec_value_t v[3];
+   *chunks = 0;
+   while((rows = buzzrec_reader_next(r)) > 0) {
+      ++*chunks;
+      for(j = 0; j < rows; ++j) {
+         row(total + j, v);
+         if(buzzrec_reader_values(r, 0)[j].i != v[0].i ||
+            buzzrec_reader_values(r, 1)[j].i != v[1].i ||
+            buzzrec_reader_values(r, 2)[j].f != v[2].f) {
+            buzzrec_reader_close(&r);
+            return -1;
+         }
+      }
+      total += rows;
+   }
+   buzzrec_reader_close(&r);
+   return rows < 0 ? -1 : total;
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzrec ===\n\n");
+   char fname[] = "/tmp/testbuzzrec_XXXXXX";
+   int fd = mkstemp(fname);
+   close(fd);
+   int64_t chunks;
+
+   /* Rows come back as they went in */
+   TEST("write",                  write_rows(fname, 10000, 256, 10000) == 0);
+   TEST("read",                   read_rows(fname, &chunks) == 10000 && chunks == 40);
+   TEST("compression",            fsize(fname) > 0 && fsize(fname) < 10000 * 3 * 4 / 2);
+
+   /* Flushing closes a chunk early */
+   write_rows(fname, 1000, 256, 99);
+   TEST("flush",                  read_rows(fname, &chunks) == 1000 && chunks == 5);
+
+   /* Files without rows */
+   write_rows(fname, 0, 0, 0);
+   TEST("empty",                  read_rows(fname, &chunks) == 0 && chunks == 0);
+
+   /* Broken files are detected */
+   write_rows(fname, 1000, 256, 1000);
+   TEST("truncated",              truncate(fname, fsize(fname) - 10) == 0 &&
+                                  read_rows(fname, &chunks) == -1);
+   FILE* f = fopen(fname, "wb");
+   fputs("not a telemetry file", f);
+   fclose(f);
+   TEST("bad header",             buzzrec_reader_open(fname) == NULL);
+   TEST("missing file",           buzzrec_open("/nonexistent/dir/file.bzr", COLS, 3, 0) == NULL &&
+                                  buzzrec_reader_open("/nonexistent/dir/file.bzr") == NULL);
+
+   unlink(fname);
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   return n_fail > 0;
+}
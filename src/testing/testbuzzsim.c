@@ -0,0 +1,141 @@
+#include <buzz/buzzsim.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+/****************************************/
+/****************************************/
+
+static int32_t global(buzzsim_t s, uint32_t r, const char* name) {
+   buzzvm_t vm = buzzsim_robot(s, r)->vm;
+   buzzvm_pushs(vm, buzzvm_string_register(vm, name, 1));
+   buzzvm_gload(vm);
+   int32_t v = buzzvm_stack_at(vm, 1)->i.value;
+   buzzvm_pop(vm);
+   return v;
+}
+
+/****************************************/
+/****************************************/
+
+static buzzsim_t run(const struct buzzsim_config_s* c,
+                     const uint8_t* bcode,
+                     uint32_t bcode_size,
+                     uint32_t steps,
+                     struct buzzsim_stats_s* st) {
+   buzzsim_t s = buzzsim_new(c, bcode, bcode_size);
+   uint32_t i;
+   for(i = 0; i < steps; ++i) buzzsim_step(s);
+   buzzsim_stats(s, st);
+   return s;
+}
+
+/****************************************/
+/****************************************/
+
+int main(int argc, char* argv[]) {
+   if(argc < 2) {
+      fprintf(stderr, "Usage: %s <script.bo>\n", argv[0]);
+      return 1;
+   }
+   /* Read bytecode */
+   FILE* f = fopen(argv[1], "rb");
+   if(!f) { perror(argv[1]); return 1; }
+   fseek(f, 0, SEEK_END);
+   uint32_t bcode_size = ftell(f);
+   rewind(f);
+   uint8_t* bcode = (uint8_t*)malloc(bcode_size);
+   if(fread(bcode, 1, bcode_size, f) < bcode_size) { perror(argv[1]); return 1; }
+   fclose(f);
+   printf("=== buzzsim ===\n\n");
+   struct buzzsim_config_s c;
+   struct buzzsim_stats_s st, st2;
+   buzzsim_t s;
+   uint32_t i;
+   int ok;
+
+   /* Settings are checked */
+   buzzsim_config_default(&c);
+   c.robots = BUZZSIM_ROBOTS_MAX + 1;
+   TEST("too many robots",       buzzsim_new(&c, bcode, bcode_size) == NULL);
+
+   /* Everybody in range */
+   buzzsim_config_default(&c);
+   c.robots = 20;
+   c.arena = 1.0f;
+   c.threads = 1;
+   c.log = 0;
+   s = run(&c, bcode, bcode_size, 3, &st);
+   for(ok = 1, i = 0; i < 20 && ok; ++i)
+      ok = global(s, i, "nbrs") == 19 && global(s, i, "hops") == (i > 0);
+   TEST("all neighbors",         ok);
+   TEST("frames counted",        st.steps == 3 && st.sent == 60 &&
+                                 st.received == 2 * 20 * 19 && st.lost == 0 &&
+                                 st.failed == 0);
+   TEST("robots move",           buzzsim_robot(s, 0)->v > 0.0f);
+   buzzsim_destroy(&s);
+
+   /* Nobody in range */
+   c.range = 0.0f;
+   s = run(&c, bcode, bcode_size, 3, &st);
+   TEST("no neighbors",          st.received == 0 && global(s, 5, "nbrs") == 0);
+   buzzsim_destroy(&s);
+
+   /* Everything lost */
+   c.range = 2.0f;
+   c.loss = 1.0f;
+   s = run(&c, bcode, bcode_size, 3, &st);
+   TEST("all lost",              st.received == 0 && st.lost == 2 * 20 * 19);
+   buzzsim_destroy(&s);
+
+   /* A line of robots makes a gradient */
+   buzzsim_config_default(&c);
+   c.robots = 1000;
+   c.arena = 100.0f;
+   c.range = 5.0f;
+   c.loss = 0.3f;
+   c.threads = 1;
+   c.log = 0;
+   s = run(&c, bcode, bcode_size, 20, &st);
+   for(ok = 1, i = 0; i < 1000 && ok; ++i)
+      ok = global(s, i, "steps") == 20 && buzzsim_robot(s, i)->vm->robot == i;
+   TEST("all robots stepped",    ok && st.failed == 0);
+   TEST("some frames lost",      st.lost > 0 && st.received > st.lost);
+   for(ok = 0, i = 1; i < 1000; ++i)
+      ok += global(s, i, "hops") > 1 && global(s, i, "hops") < 1000;
+   TEST("gradient spreads",      ok > 0);
+   /* The outcome does not depend on the number of threads */
+   c.threads = 4;
+   buzzsim_t s2 = run(&c, bcode, bcode_size, 20, &st2);
+   for(ok = 1, i = 0; i < 1000 && ok; ++i)
+      ok = global(s, i, "hops") == global(s2, i, "hops") &&
+         buzzsim_robot(s, i)->x == buzzsim_robot(s2, i)->x;
+   TEST("threads deterministic", ok && st2.threads == 4 &&
+                                 st.received == st2.received &&
+                                 st.lost == st2.lost &&
+                                 st.bytes == st2.bytes);
+   buzzsim_destroy(&s2);
+   /* The local bus gives the same outcome as the frames */
+   c.bus = 1;
+   s2 = run(&c, bcode, bcode_size, 20, &st2);
+   for(ok = 1, i = 0; i < 1000 && ok; ++i)
+      ok = global(s, i, "hops") == global(s2, i, "hops") &&
+         buzzsim_robot(s, i)->x == buzzsim_robot(s2, i)->x;
+   TEST("local bus",             ok && !buzzsim_robot(s2, 0)->frame[0] &&
+                                 st.received == st2.received &&
+                                 st.lost == st2.lost &&
+                                 st.bytes == st2.bytes);
+   buzzsim_destroy(&s2);
+   buzzsim_destroy(&s);
+
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   free(bcode);
+   return n_fail > 0;
+}
@@ -0,0 +1,166 @@
+#include <buzz/buzzstats.h>
+#include <buzz/buzzsnapshot.h>
+#include <buzz/config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+static uint8_t* bcode;
+static uint32_t bcode_size;
+
+/****************************************/
+/****************************************/
+
+/*
+ * Calls a function and returns its result as an integer, or -1 if it is
+ * not an integer.
+ */
+static int32_t call(buzzvm_t vm, const char* fname, int32_t arg) {
+   if(arg >= 0) buzzvm_pushi(vm, arg);
+   buzzvm_function_call(vm, fname, arg >= 0 ? 1 : 0);
+   int32_t r = buzzvm_stack_at(vm, 1)->o.type == BUZZTYPE_INT ?
+      buzzvm_stack_at(vm, 1)->i.value : -1;
+   buzzvm_pop(vm);
+   return r;
+}
+
+#ifdef BUZZ_STATS
+
+/*
+ * Returns the counter of a Buzz function.
+ */
+static struct buzzvm_stats_counter_s fun(buzzvm_t vm, const char* fname) {
+   static const struct buzzvm_stats_counter_s ZERO = { 0, 0 };
+   buzzvm_pushs(vm, buzzvm_string_register(vm, fname, 0));
+   buzzvm_gload(vm);
+   int32_t ref = buzzvm_stack_at(vm, 1)->c.value.ref;
+   buzzvm_pop(vm);
+   const struct buzzvm_stats_counter_s* c =
+      buzzdict_get(vm->stats->funs, &ref, struct buzzvm_stats_counter_s);
+   return c ? *c : ZERO;
+}
+
+static uint64_t cfun_total(buzzvm_t vm) {
+   uint64_t n = 0;
+   uint32_t i;
+   for(i = 0; i < buzzdarray_size(vm->stats->cfuns); ++i)
+      n += buzzdarray_get(vm->stats->cfuns, i, struct buzzvm_stats_counter_s).count;
+   return n;
+}
+
+#endif
+
+/****************************************/
+/****************************************/
+
+int main(int argc, char* argv[]) {
+   if(argc < 2) {
+      fprintf(stderr, "Usage: %s <script.bo>\n", argv[0]);
+      return 1;
+   }
+   /* Read bytecode */
+   FILE* f = fopen(argv[1], "rb");
+   if(!f) { perror(argv[1]); return 1; }
+   fseek(f, 0, SEEK_END);
+   bcode_size = ftell(f);
+   rewind(f);
+   bcode = (uint8_t*)malloc(bcode_size);
+   if(fread(bcode, 1, bcode_size, f) < bcode_size) { perror(argv[1]); return 1; }
+   fclose(f);
+   printf("=== buzzstats ===\n\n");
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, bcode, bcode_size);
+   buzzvm_stats_register(vm);
+   buzzvm_execute_script(vm);
+   struct buzzvm_stats_s s;
+
+   /* Counters are off by default */
+   TEST("disabled",               !buzzvm_stats_get(vm, &s) && call(vm, "stats", -1) == -1);
+#ifndef BUZZ_STATS
+   TEST("compiled out",           !buzzvm_stats_enable(vm, 1) && vm->stats == NULL);
+#else
+   TEST("enable",                 buzzvm_stats_enable(vm, 1) && buzzvm_stats_get(vm, &s));
+
+   /* Functions are counted once per call, including recursion */
+   call(vm, "mid", 100);
+   call(vm, "rec", 5);
+   TEST("functions",              fun(vm, "leaf").count == 2 && fun(vm, "mid").count == 1 &&
+                                  fun(vm, "rec").count == 6);
+   /* Function cycles include the callees */
+   TEST("inclusive",              fun(vm, "leaf").cycles > 0 &&
+                                  fun(vm, "mid").cycles >= fun(vm, "leaf").cycles);
+
+   /* Opcodes: the loop of leaf(100) and leaf(50) runs 150 times */
+   TEST("opcodes",                vm->stats->instr[BUZZVM_INSTR_JUMPZ].count >= 152 &&
+                                  vm->stats->instr[BUZZVM_INSTR_JUMP].count >= 150 &&
+                                  vm->stats->instr[BUZZVM_INSTR_LLOAD].cycles > 0);
+
+   /* C closures are counted by function list index */
+   uint64_t c0 = cfun_total(vm);
+   call(vm, "roots", 20);
+   TEST("cfunctions",             cfun_total(vm) == c0 + 20);
+
+   /* Buzz closures called from C closures are counted too */
+   call(vm, "viac", -1);
+   TEST("nested",                 fun(vm, "leaf").count == 5);
+
+   /* Allocations by type */
+   uint64_t t0 = vm->stats->allocs[BUZZTYPE_TABLE];
+   call(vm, "viac", -1);
+   TEST("allocations",            vm->stats->allocs[BUZZTYPE_TABLE] > t0 &&
+                                  vm->stats->allocs[BUZZTYPE_INT] > 0);
+
+   /* The script sees the counters */
+   TEST("debug.stats",            call(vm, "stats", -1) == 8);
+
+   /* JSON dump */
+   f = tmpfile();
+   int err = buzzvm_stats_write_json(vm, f);
+   size_t size = ftell(f);
+   rewind(f);
+   char* out = (char*)calloc(size + 1, 1);
+   if(fread(out, 1, size, f) < size) err = -1;
+   fclose(f);
+   TEST("json",                   err == 0 &&
+                                  strstr(out, "\"name\": \"leaf\", \"count\": 8") != NULL &&
+                                  strstr(out, "\"name\": \"math.sqrt\", \"count\": 20") != NULL &&
+                                  strstr(out, "\"jumpz\": { \"count\": ") != NULL &&
+                                  strstr(out, "\"table\": ") != NULL);
+   free(out);
+
+   /* Forks do not inherit the counters */
+   buzzvm_snapshot_t snap = buzzvm_snapshot(vm);
+   buzzvm_t fk = buzzvm_fork(snap);
+   TEST("fork",                   fk->stats == NULL);
+   buzzvm_destroy(&fk);
+   buzzvm_snapshot_destroy(&snap);
+
+   /* Reset and disable */
+   buzzvm_stats_reset(vm);
+   TEST("reset",                  fun(vm, "leaf").count == 0 && cfun_total(vm) == 0 &&
+                                  vm->stats->instr[BUZZVM_INSTR_JUMPZ].count == 0);
+   call(vm, "leaf", 10);
+   TEST("after reset",            fun(vm, "leaf").count == 1);
+   buzzvm_stats_enable(vm, 0);
+   call(vm, "leaf", 10);
+   TEST("disable",                vm->stats == NULL && call(vm, "stats", -1) == -1);
+
+   /* Counting starts over when enabled again */
+   buzzvm_stats_enable(vm, 1);
+   call(vm, "rec", 3);
+   TEST("re-enable",              vm->state == BUZZVM_STATE_READY && fun(vm, "rec").count == 4);
+#endif
+
+   buzzvm_destroy(&vm);
+   free(bcode);
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   return n_fail > 0;
+}
@@ -23,6 +23,11 @@ int main() {
    buzzstrman_register(sm, "eh, si tira avanti", 0);
    buzzstrman_print(sm);
 
+   printf("\n=== FINDING STRINGS ===\n\n");
+   printf("'ciao' -> %" PRId32 "\n", buzzstrman_find(sm, "ciao"));
+   printf("'arrivederci' -> %" PRId32 "\n", buzzstrman_find(sm, "arrivederci"));
+   buzzstrman_print(sm);
+
    printf("\n=== GARBAGE COLLECTION ===\n\n");
    buzzstrman_gc_clear(sm);
    buzzstrman_gc_mark(sm, buzzstrman_register(sm, "la famiglia?", 0));
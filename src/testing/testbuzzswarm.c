@@ -0,0 +1,86 @@
+#include <buzz/buzzswarm.h>
+#include <stdio.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzswarm ===\n\n");
+   buzzswarm_members_t m = buzzswarm_members_new();
+   int i, j, ok;
+
+   /* Join and leave */
+   buzzswarm_members_join(m, 3, 10);
+   buzzswarm_members_join(m, 3, 20);
+   buzzswarm_members_join(m, 4, 10);
+   buzzswarm_members_join(m, 4, 10);
+   TEST("join",                 buzzswarm_members_isrobotin(m, 3, 10) &&
+                                buzzswarm_members_isrobotin(m, 3, 20) &&
+                                buzzswarm_members_isrobotin(m, 4, 10) &&
+                                !buzzswarm_members_isrobotin(m, 4, 20));
+   TEST("counts",               buzzswarm_members_count(m, 10) == 2 &&
+                                buzzswarm_members_count(m, 20) == 1 &&
+                                buzzswarm_members_count(m, 30) == 0);
+   TEST("unknown robot",        !buzzswarm_members_isrobotin(m, 1000, 10));
+   buzzswarm_members_leave(m, 3, 20);
+   TEST("leave",                !buzzswarm_members_isrobotin(m, 3, 20) &&
+                                buzzswarm_members_count(m, 20) == 0);
+   buzzswarm_members_leave(m, 4, 10);
+   TEST("last leave forgets",   m->size == 1 && buzzswarm_members_count(m, 10) == 1);
+
+   /* Refresh replaces the swarm list */
+   uint16_t l[] = { 20, 30 };
+   buzzswarm_members_refresh(m, 3, 7, l, 2);
+   TEST("refresh",              !buzzswarm_members_isrobotin(m, 3, 10) &&
+                                buzzswarm_members_isrobotin(m, 3, 20) &&
+                                buzzswarm_members_isrobotin(m, 3, 30) &&
+                                buzzswarm_members_count(m, 10) == 0);
+
+   /* Heartbeats match the version and the hash of the listed swarms */
+   uint32_t h = buzzswarm_hash(30) + buzzswarm_hash(20);
+   TEST("heartbeat up to date", buzzswarm_members_heartbeat(m, 3, 7, h));
+   TEST("heartbeat new version", !buzzswarm_members_heartbeat(m, 3, 8, h));
+   TEST("heartbeat new hash",   !buzzswarm_members_heartbeat(m, 3, 7, h + 1));
+   TEST("heartbeat unknown",    !buzzswarm_members_heartbeat(m, 9, 0, h) &&
+                                buzzswarm_members_heartbeat(m, 9, 0, 0));
+
+   /* Many robots in many swarms */
+   for(i = 0; i < 2000; ++i)
+      for(j = 0; j < 100; j += 1 + i % 7)
+         buzzswarm_members_join(m, i, 1000 + j);
+   for(ok = 1, i = 0; i < 2000 && ok; ++i)
+      for(j = 0; j < 100 && ok; ++j)
+         ok = buzzswarm_members_isrobotin(m, i, 1000 + j) == (j % (1 + i % 7) == 0);
+   TEST("wide bitsets",         ok && m->words == 2);
+   TEST("wide counts",          buzzswarm_members_count(m, 1000) == 2000);
+
+   /* Ageing in one sweep keeps the refreshed robots */
+   for(i = 0; i < 60; ++i) {
+      buzzswarm_members_join(m, 7, 1000);
+      buzzswarm_members_join(m, 1999, 1000);
+      buzzswarm_members_update(m);
+   }
+   TEST("old robots forgotten", m->size == 2 &&
+                                buzzswarm_members_isrobotin(m, 7, 1000) &&
+                                buzzswarm_members_isrobotin(m, 1999, 1000) &&
+                                !buzzswarm_members_isrobotin(m, 3, 20));
+   TEST("counts after ageing",  buzzswarm_members_count(m, 1000) == 2 &&
+                                buzzswarm_members_count(m, 1001) == 1);
+
+   /* Freed columns are reused */
+   uint16_t used = m->used;
+   buzzswarm_members_join(m, 8, 5);
+   TEST("column reuse",         m->used == used && buzzswarm_members_isrobotin(m, 8, 5));
+
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   buzzswarm_members_destroy(&m);
+   return n_fail > 0;
+}
@@ -0,0 +1,153 @@
+#include <buzz/buzzvm.h>
+#include <buzz/buzztransport.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+#define VSID 1
+
+/* An endless empty loop, so that the neighbor structure is set up */
+static const uint8_t BCODE[] = { 0, 0, BUZZVM_INSTR_NOP, BUZZVM_INSTR_JUMP, 2, 0, 0, 0,
+                                 BUZZVM_INSTR_DONE };
+
+/****************************************/
+/****************************************/
+
+static buzzobj_t num(buzzvm_t vm, int32_t i) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
+   o->i.value = i;
+   return o;
+}
+
+static buzzvm_t robot(uint16_t id) {
+   buzzvm_t vm = buzzvm_new(id);
+   buzzvm_set_bcode(vm, BCODE, sizeof(BCODE));
+   uint16_t vsid = VSID;
+   buzzvstig_t vs = buzzvstig_new();
+   buzzdict_set(vm->vstigs, &vsid, &vs);
+   return vm;
+}
+
+/*
+ * Queues a vstig put, as if the robot had written the entry.
+ */
+static void put(buzzvm_t vm, int32_t k, int32_t v, uint16_t ts) {
+   buzzvstig_elem_t e = buzzvstig_elem_new(num(vm, v), ts, vm->robot);
+   buzzoutmsg_queue_append_vstig(vm, BUZZMSG_VSTIG_PUT, VSID, num(vm, k), e);
+   free(e);
+}
+
+static int32_t get(buzzvm_t vm, int32_t k) {
+   uint16_t vsid = VSID;
+   buzzvstig_t vs = *buzzdict_get(vm->vstigs, &vsid, buzzvstig_t);
+   buzzobj_t o = num(vm, k);
+   const buzzvstig_elem_t* e = buzzvstig_fetch(vs, &o);
+   return e ? (*e)->data->i.value : -1;
+}
+
+static float field(buzzvm_t vm, buzzobj_t t, const char* name) {
+   buzzobj_t k = buzzheap_newobj(vm, BUZZTYPE_STRING);
+   k->s.value.sid = buzzvm_string_register(vm, name, 1);
+   k->s.value.str = buzzvm_string_get(vm, k->s.value.sid);
+   const buzzobj_t* v = buzzdict_get(t->t.value, &k, buzzobj_t);
+   return v ? (*v)->f.value : NAN;
+}
+
+/*
+ * A backend that only records the size of the last frame sent
+ */
+static uint32_t last_size = 0;
+
+static int record_send(buzztransport_t t, const uint8_t* frame, uint32_t size) {
+   last_size = size;
+   return 1;
+}
+
+static int near(float a, float b) {
+   return fabsf(a - b) < 1e-4f;
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzztransport ===\n\n");
+   buzztransport_bus_t bus = buzztransport_bus_new();
+   buzzvm_t a = robot(1);
+   buzzvm_t b = robot(2);
+   buzztransport_t ta = buzztransport_loopback_new(bus, 512);
+   buzztransport_t tb = buzztransport_loopback_new(bus, 512);
+   buzztransport_set_position(ta, 0, 0, 0);
+   buzztransport_set_position(tb, 3, 4, 0);
+   int i, ok;
+
+   /* Messages go through a frame and come out intact */
+   put(a, 1, 10, 1);
+   put(a, 2, 20, 1);
+   TEST("frame sent",          buzztransport_send(a, ta));
+   TEST("queue emptied",       buzzoutmsg_queue_size(a) == 0);
+   TEST("one frame received",  buzztransport_receive(b, tb) == 1);
+   TEST("messages delivered",  get(b, 1) == 10 && get(b, 2) == 20);
+   TEST("nothing left",        buzztransport_receive(b, tb) == 0);
+
+   /* The sender becomes a neighbor, located from its advertised position */
+   buzztransport_send(a, ta);
+   buzztransport_receive(b, tb);
+   TEST("neighbor added",      buzzneighbors_store_find(b->neighbors, 1) == 0);
+   buzzobj_t d = buzzneighbors_data(b, 0);
+   TEST("neighbor distance",   near(field(b, d, "distance"), 5.0f));
+   TEST("neighbor azimuth",    near(field(b, d, "azimuth"), atan2f(-4.0f, -3.0f)));
+
+   /* A robot does not receive its own frames */
+   TEST("own frame skipped",   buzztransport_send(b, tb) &&
+                               buzztransport_receive(b, tb) == 0 &&
+                               buzztransport_receive(a, ta) == 1);
+
+   /* Frames are received in the order they were sent */
+   for(i = 0; i < 100; ++i) {
+      put(a, 100, i, i + 1);
+      buzztransport_send(a, ta);
+   }
+   TEST("all frames received", buzztransport_receive(b, tb) == 100);
+   TEST("last frame wins",     get(b, 100) == 99);
+
+   /* Many messages are packed in a frame, the rest waits for the next */
+   for(i = 0; i < 100; ++i) put(a, 1000 + i, i, 1);
+   buzztransport_send(a, ta);
+   TEST("frame filled",        buzzoutmsg_queue_size(a) > 0);
+   int n = 0;
+   while(buzzoutmsg_queue_size(a) > 0 && n < 100) {
+      buzztransport_send(a, ta);
+      ++n;
+   }
+   TEST("frames received",     buzztransport_receive(b, tb) == n + 1);
+   ok = 1;
+   for(i = 0; i < 100; ++i) ok = ok && get(b, 1000 + i) == i;
+   TEST("packed messages",     ok);
+
+   /* Custom backends get the frames built by the transport */
+   buzztransport_t tr = buzztransport_new(512);
+   tr->send = record_send;
+   TEST("empty frame",         buzztransport_send(a, tr) &&
+                               last_size == BUZZTRANSPORT_HEADER_SIZE);
+   put(a, 3, 30, 1);
+   buzztransport_send(a, tr);
+   TEST("frame with message",  last_size > BUZZTRANSPORT_HEADER_SIZE);
+   buzztransport_destroy(&tr);
+
+   buzztransport_destroy(&ta);
+   buzztransport_destroy(&tb);
+   buzztransport_bus_destroy(&bus);
+   buzzvm_destroy(&a);
+   buzzvm_destroy(&b);
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   return n_fail > 0;
+}
@@ -0,0 +1,80 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+/****************************************/
+/****************************************/
+
+static buzzobj_t num(buzzvm_t vm, int32_t i) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
+   o->i.value = i;
+   return o;
+}
+
+static void put(buzzvm_t vm, buzzvstig_t vs, int32_t k, int32_t v) {
+   buzzobj_t o = num(vm, k);
+   buzzvstig_elem_t e = buzzvstig_elem_new(num(vm, v), 1, vm->robot);
+   buzzvstig_store(vm, vs, &o, &e);
+}
+
+static void del(buzzvm_t vm, buzzvstig_t vs, int32_t k) {
+   buzzobj_t o = num(vm, k);
+   buzzvstig_remove(vs, &o);
+}
+
+static uint16_t name(buzzvm_t vm, const char* n) {
+   return buzzvm_string_register(vm, n, 1);
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzvstig aggregates ===\n\n");
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvstig_t vs = buzzvstig_new();
+   int i;
+
+   /* Entries stored before the aggregates are registered count too */
+   for(i = 0; i < 10; ++i) put(vm, vs, i, i);
+   buzzvstig_agg_new(vm, vs, name(vm, "sum"), BUZZVSTIG_AGG_SUM, NULL, 0, 0, 0);
+   buzzvstig_agg_new(vm, vs, name(vm, "hist"), BUZZVSTIG_AGG_HISTOGRAM, NULL, 0, 10, 2);
+   buzzvstig_agg_t a = buzzvstig_agg_get(vs, name(vm, "sum"));
+   TEST("existing entries",      a->count == 10 && a->sum == 45.0);
+   TEST("min and max",           a->min == 0.0f && a->max == 9.0f);
+
+   /* Overwrites and removals */
+   put(vm, vs, 0, 20);
+   del(vm, vs, 9);
+   a = buzzvstig_agg_get(vs, name(vm, "sum"));
+   TEST("overwrite and removal", a->count == 9 && a->sum == 56.0);
+   TEST("extremes recomputed",   a->min == 1.0f && a->max == 20.0f && !a->stale);
+
+   /* Histogram */
+   buzzvstig_agg_t h = buzzvstig_agg_get(vs, name(vm, "hist"));
+   TEST("histogram",             h->hist[0] == 4 && h->hist[1] == 5);
+
+   /* Non-numbers only count */
+   buzzobj_t k = num(vm, 100);
+   buzzvstig_elem_t e = buzzvstig_elem_new(buzzheap_newobj(vm, BUZZTYPE_TABLE), 1, 1);
+   buzzvstig_store(vm, vs, &k, &e);
+   TEST("non-numbers",           a->count == 10 && a->numbers == 9 && a->sum == 56.0);
+
+   /* Emptying resets the aggregate */
+   for(i = 0; i < 9; ++i) del(vm, vs, i);
+   del(vm, vs, 100);
+   TEST("empty",                 a->count == 0 && a->numbers == 0 && a->sum == 0.0);
+   TEST("unknown name",          buzzvstig_agg_get(vs, name(vm, "nope")) == NULL);
+
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   buzzvstig_destroy(&vs);
+   buzzvm_destroy(&vm);
+   return n_fail > 0;
+}
@@ -0,0 +1,68 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+#define VSID 1
+
+/****************************************/
+/****************************************/
+
+static buzzobj_t num(buzzvm_t vm, int32_t i) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
+   o->i.value = i;
+   return o;
+}
+
+/*
+ * Makes this robot (id 1) and robot 2 write the given values on the same
+ * key with the same timestamp, and returns the resolved entry.
+ */
+static buzzvstig_elem_t conflict(buzzvm_t vm,
+                                 buzzvstig_conflict_e policy,
+                                 buzzobj_t local,
+                                 buzzobj_t remote) {
+   uint16_t id = VSID;
+   buzzvstig_t vs = buzzvstig_new();
+   vs->conflict = policy;
+   buzzdict_set(vm->vstigs, &id, &vs);
+   buzzobj_t k = num(vm, 42);
+   buzzvstig_elem_t l = buzzvstig_elem_new(local, 7, 1);
+   buzzvstig_store(vm, vs, &k, &l);
+   buzzvstig_elem_t r = buzzvstig_elem_new(remote, 7, 2);
+   buzzvstig_onconflict_resolve(vm, vs, id, k, r);
+   return *buzzvstig_fetch(vs, &k);
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzvstig conflict ===\n\n");
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvstig_elem_t e;
+
+   e = conflict(vm, BUZZVSTIG_CONFLICT_ROBOT, num(vm, 5), num(vm, 3));
+   TEST("robot: highest id wins",    e->robot == 2 && e->data->i.value == 3);
+   e = conflict(vm, BUZZVSTIG_CONFLICT_ROBOT, num(vm, 5), buzzheap_newobj(vm, BUZZTYPE_NIL));
+   TEST("robot: nil loses",          e->robot == 1 && e->data->i.value == 5);
+   e = conflict(vm, BUZZVSTIG_CONFLICT_ROBOT_STRICT, num(vm, 5), buzzheap_newobj(vm, BUZZTYPE_NIL));
+   TEST("robot_strict: nil can win", e->robot == 2 && e->data->o.type == BUZZTYPE_NIL);
+   e = conflict(vm, BUZZVSTIG_CONFLICT_MAX, num(vm, 5), num(vm, 3));
+   TEST("max: largest wins",         e->robot == 1 && e->data->i.value == 5);
+   e = conflict(vm, BUZZVSTIG_CONFLICT_MIN, num(vm, 5), num(vm, 3));
+   TEST("min: smallest wins",        e->robot == 2 && e->data->i.value == 3);
+   e = conflict(vm, BUZZVSTIG_CONFLICT_MAX, num(vm, 5), buzzheap_newobj(vm, BUZZTYPE_TABLE));
+   TEST("max: non-number -> robot",  e->robot == 2 && e->data->o.type == BUZZTYPE_TABLE);
+   TEST("resolution propagated",     buzzoutmsg_queue_size(vm) > 0);
+
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   buzzvm_destroy(&vm);
+   return n_fail > 0;
+}
@@ -0,0 +1,174 @@
+#include <buzz/buzzvm.h>
+#include <stdio.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+/* An endless empty loop, so that the VM can run the periodic tasks and
+ * call native closures */
+static const uint8_t BCODE[] = { 0, 0, BUZZVM_INSTR_NOP, BUZZVM_INSTR_JUMP, 2, 0, 0, 0,
+                                 BUZZVM_INSTR_DONE };
+
+/****************************************/
+/****************************************/
+
+static buzzobj_t key(buzzvm_t vm, int32_t k) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
+   o->i.value = k;
+   return o;
+}
+
+static void putv(buzzvm_t vm, buzzvstig_t vs, int32_t k, int32_t v) {
+   /* The key and the value are on the stack, so that the garbage
+    * collector keeps them while the priority closure runs */
+   buzzobj_t o = key(vm, k);
+   buzzvm_push(vm, o);
+   buzzvstig_elem_t e = buzzvstig_elem_new(key(vm, v), 1, vm->robot);
+   buzzvm_push(vm, e->data);
+   buzzvstig_store(vm, vs, &o, &e);
+   buzzvm_pop(vm);
+   buzzvm_pop(vm);
+}
+
+static void put(buzzvm_t vm, buzzvstig_t vs, int32_t k) {
+   putv(vm, vs, k, k);
+}
+
+static int has(buzzvm_t vm, buzzvstig_t vs, int32_t k) {
+   buzzobj_t o = key(vm, k);
+   const buzzvstig_elem_t* e = buzzvstig_fetch(vs, &o);
+   return e && (*e)->data->o.type != BUZZTYPE_NIL;
+}
+
+/* Evicted or expired under synchronization: a nil marker of the same version */
+static int dropped(buzzvm_t vm, buzzvstig_t vs, int32_t k) {
+   buzzobj_t o = key(vm, k);
+   const buzzvstig_elem_t* e = buzzvstig_fetch(vs, &o);
+   return e && (*e)->data->o.type == BUZZTYPE_NIL && (*e)->timestamp == 1;
+}
+
+/* The priority of an entry is its value */
+static int priority(buzzvm_t vm) {
+   buzzvm_lload(vm, 2);
+   return buzzvm_ret1(vm);
+}
+
+static buzzvstig_t make(buzzvm_t vm, uint16_t id) {
+   buzzvstig_t vs = buzzvstig_new();
+   buzzdict_set(vm->vstigs, &id, &vs);
+   return vs;
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzvstig limits ===\n\n");
+   buzzvm_t vm = buzzvm_new(1);
+   buzzvm_set_bcode(vm, BCODE, sizeof(BCODE));
+   int i;
+
+   /* --- Least recently used --- */
+   buzzvstig_t lru = make(vm, 1);
+   buzzvstig_limits_set(vm, lru, 3, BUZZVSTIG_EVICT_LRU, 0);
+   put(vm, lru, 1);
+   put(vm, lru, 2);
+   put(vm, lru, 3);
+   /* Rewriting key 1 makes key 2 the least recently used */
+   put(vm, lru, 1);
+   put(vm, lru, 4);
+   TEST("lru: capacity respected",  buzzdict_size(lru->data) == 3);
+   TEST("lru: victim is key 2",     !has(vm, lru, 2) && has(vm, lru, 1) && has(vm, lru, 4));
+   TEST("lru: eviction counted",    lru->limits.evicted == 1);
+
+   /* --- Oldest --- */
+   buzzvstig_t old = make(vm, 2);
+   buzzvstig_limits_set(vm, old, 10, BUZZVSTIG_EVICT_OLDEST, 0);
+   for(i = 0; i < 25; ++i) put(vm, old, i);
+   TEST("oldest: capacity respected", buzzdict_size(old->data) == 10);
+   TEST("oldest: newest kept",        has(vm, old, 15) && has(vm, old, 24) && !has(vm, old, 14));
+   TEST("oldest: evictions counted",  old->limits.evicted == 15);
+
+   /* --- Shrinking --- */
+   buzzvstig_limits_set(vm, old, 4, BUZZVSTIG_EVICT_OLDEST, 0);
+   TEST("shrink: capacity respected", buzzdict_size(old->data) == 4 && has(vm, old, 21));
+
+   /* --- Lifetime --- */
+   buzzvstig_t ttl = make(vm, 3);
+   buzzvstig_limits_set(vm, ttl, 0, BUZZVSTIG_EVICT_LRU, 5);
+   put(vm, ttl, 1);
+   put(vm, ttl, 2);
+   for(i = 0; i < 3; ++i) buzzvm_process_outmsgs(vm);
+   /* Rewriting key 2 gives it a new lifetime */
+   put(vm, ttl, 2);
+   for(i = 0; i < 2; ++i) buzzvm_process_outmsgs(vm);
+   TEST("ttl: expired entry removed", !has(vm, ttl, 1));
+   TEST("ttl: rewritten entry kept",  has(vm, ttl, 2));
+   for(i = 0; i < 3; ++i) buzzvm_process_outmsgs(vm);
+   TEST("ttl: all entries expired",   buzzdict_isempty(ttl->data));
+   TEST("ttl: expiries counted",      ttl->limits.expired == 2 && ttl->limits.evicted == 0);
+
+   /* --- Priority --- */
+   buzzvstig_t pri = make(vm, 5);
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, priority));
+   pri->limits.priority = buzzvm_stack_at(vm, 1);
+   buzzvstig_limits_set(vm, pri, 100, BUZZVSTIG_EVICT_PRIORITY, 0);
+   /* Keys 0..999 with scrambled priorities */
+   for(i = 0; i < 1000; ++i) putv(vm, pri, i, (i * 7919) % 1000);
+   /* A new entry is always stored, so the last one evicts priority 900 */
+   int kept = 1;
+   for(i = 0; i < 1000; ++i)
+      kept = kept && (has(vm, pri, i) == (i == 999 || (i * 7919) % 1000 > 900));
+   TEST("priority: capacity respected", buzzdict_size(pri->data) == 100);
+   TEST("priority: highest kept",       kept);
+   /* Rewriting an entry with a low priority makes it the victim */
+   putv(vm, pri, 0, -1);
+   putv(vm, pri, 2000, 5000);
+   TEST("priority: rewrite reordered",  !has(vm, pri, 0) && has(vm, pri, 2000));
+   /* On a tie, the least recently written entry goes first */
+   buzzvstig_t tie = make(vm, 6);
+   buzzvstig_limits_set(vm, tie, 2, BUZZVSTIG_EVICT_PRIORITY, 0);
+   put(vm, tie, 1);
+   put(vm, tie, 2);
+   put(vm, tie, 1);
+   put(vm, tie, 3);
+   TEST("priority: tie broken by age",  !has(vm, tie, 2) && has(vm, tie, 1) && has(vm, tie, 3));
+
+   /* --- Markers under synchronization --- */
+   buzzvstig_t syn = make(vm, 7);
+   buzzvstig_sync_set(syn, 5, 0);
+   buzzvstig_limits_set(vm, syn, 2, BUZZVSTIG_EVICT_OLDEST, 3);
+   put(vm, syn, 1);
+   put(vm, syn, 2);
+   put(vm, syn, 3);
+   TEST("sync: evicted entry marked",    dropped(vm, syn, 1) && has(vm, syn, 2) && has(vm, syn, 3));
+   put(vm, syn, 4);
+   TEST("sync: markers not counted",     dropped(vm, syn, 2) && syn->tombstones == 2 &&
+                                         buzzdict_size(syn->data) == 4);
+   /* The digests don't change, so neighbors don't send the entries back */
+   uint32_t h3 = syn->sync.hashes[0];
+   for(i = 1; i < BUZZVSTIG_SYNC_LEAVES; ++i) h3 ^= syn->sync.hashes[i] * (i + 1);
+   for(i = 0; i < 3; ++i) buzzvm_process_outmsgs(vm);
+   uint32_t h4 = syn->sync.hashes[0];
+   for(i = 1; i < BUZZVSTIG_SYNC_LEAVES; ++i) h4 ^= syn->sync.hashes[i] * (i + 1);
+   TEST("sync: expired entries marked",  dropped(vm, syn, 3) && dropped(vm, syn, 4) &&
+                                         syn->limits.expired == 2 && syn->tombstones == 4);
+   TEST("sync: digests unchanged",       h3 == h4);
+   put(vm, syn, 1);
+   TEST("sync: marked entry rewritten",  has(vm, syn, 1) && syn->tombstones == 3);
+
+   /* --- Unbounded --- */
+   buzzvstig_t unb = make(vm, 4);
+   for(i = 0; i < 1000; ++i) put(vm, unb, i);
+   for(i = 0; i < 10; ++i) buzzvm_process_outmsgs(vm);
+   TEST("unbounded: nothing removed", buzzdict_size(unb->data) == 1000);
+
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   buzzvm_destroy(&vm);
+   return n_fail > 0;
+}
@@ -0,0 +1,186 @@
+#include <buzz/buzzvm.h>
+#include <buzz/buzzsnapshot.h>
+#include <buzz/buzzvstiglog.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+/****************************************/
+/****************************************/
+
+static buzzobj_t num(buzzvm_t vm, int32_t i) {
+   buzzobj_t o = buzzheap_newobj(vm, BUZZTYPE_INT);
+   o->i.value = i;
+   return o;
+}
+
+static void put(buzzvm_t vm, buzzvstig_t vs, int32_t k, int32_t v) {
+   buzzobj_t o = num(vm, k);
+   buzzvstig_elem_t e = buzzvstig_elem_new(num(vm, v), v, vm->robot);
+   buzzvstig_store(vm, vs, &o, &e);
+}
+
+static void putnil(buzzvm_t vm, buzzvstig_t vs, int32_t k, uint16_t ts) {
+   buzzobj_t o = num(vm, k);
+   buzzvstig_elem_t e = buzzvstig_elem_new(buzzheap_newobj(vm, BUZZTYPE_NIL), ts, vm->robot);
+   buzzvstig_store(vm, vs, &o, &e);
+}
+
+static void del(buzzvm_t vm, buzzvstig_t vs, int32_t k) {
+   buzzobj_t o = num(vm, k);
+   buzzvstig_remove(vs, &o);
+}
+
+/* Returns the value of a key, or -1 if the key is missing */
+static int32_t get(buzzvm_t vm, buzzvstig_t vs, int32_t k) {
+   buzzobj_t o = num(vm, k);
+   const buzzvstig_elem_t* e = buzzvstig_fetch(vs, &o);
+   return e ? (*e)->data->i.value : -1;
+}
+
+/* Returns 1 if a key is a deletion with the given timestamp */
+static int deleted(buzzvm_t vm, buzzvstig_t vs, int32_t k, uint16_t ts) {
+   buzzobj_t o = num(vm, k);
+   const buzzvstig_elem_t* e = buzzvstig_fetch(vs, &o);
+   return e && (*e)->data->o.type == BUZZTYPE_NIL && (*e)->timestamp == ts;
+}
+
+static buzzvstig_t reopen(buzzvm_t vm, const char* fname) {
+   buzzvstig_t vs = buzzvstig_new();
+   vs->log = buzzvstiglog_open(vm, vs, fname, BUZZVSTIGLOG_FSYNC_STEP);
+   return vs;
+}
+
+/* Returns the virtual stigmergy of a VM */
+static buzzvstig_t vstig(buzzvm_t vm) {
+   uint16_t id = 1;
+   return *buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+}
+
+static off_t fsize(const char* fname) {
+   struct stat st;
+   return stat(fname, &st) == 0 ? st.st_size : -1;
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzvstig log ===\n\n");
+   buzzvm_t vm = buzzvm_new(1);
+   char fname[] = "/tmp/testbuzzvstiglog_XXXXXX";
+   int fd = mkstemp(fname);
+   close(fd);
+   unlink(fname);
+   int i;
+
+   /* Writes and removals survive a restart */
+   buzzvstig_t vs = reopen(vm, fname);
+   TEST("new log",              vs->log && buzzdict_isempty(vs->data));
+   for(i = 0; i < 10; ++i) put(vm, vs, i, i);
+   put(vm, vs, 3, 30);
+   del(vm, vs, 5);
+   buzzvstig_destroy(&vs);
+   vs = reopen(vm, fname);
+   TEST("entries restored",     buzzdict_size(vs->data) == 9 && get(vm, vs, 9) == 9);
+   TEST("last write wins",      get(vm, vs, 3) == 30);
+   TEST("removal restored",     get(vm, vs, 5) == -1);
+   buzzobj_t k = num(vm, 3);
+   TEST("metadata restored",    (*buzzvstig_fetch(vs, &k))->timestamp == 30 &&
+                                (*buzzvstig_fetch(vs, &k))->robot == 1);
+   TEST("no records added",     vs->log->records == 12);
+
+   /* Overwriting many times triggers compaction */
+   for(i = 0; i < 1000; ++i) put(vm, vs, 0, i);
+   buzzvstiglog_step(vs->log, vs);
+   TEST("compaction",           vs->log->records == 9);
+   buzzvstig_destroy(&vs);
+   vs = reopen(vm, fname);
+   TEST("compacted log",        buzzdict_size(vs->data) == 9 && get(vm, vs, 0) == 999);
+   buzzvstig_destroy(&vs);
+
+   /* A torn record at the end is dropped */
+   off_t sz = fsize(fname);
+   TEST("truncated on close",   sz > 0 && sz < 65536);
+   if(truncate(fname, sz - 3) == 0) {
+      vs = reopen(vm, fname);
+      TEST("torn record dropped", buzzdict_size(vs->data) == 8);
+      put(vm, vs, 50, 50);
+      buzzvstig_destroy(&vs);
+      vs = reopen(vm, fname);
+      TEST("append after tear",   buzzdict_size(vs->data) == 9 && get(vm, vs, 50) == 50);
+      buzzvstig_destroy(&vs);
+   }
+
+   /* A fork reopens the log and replays it over the snapshot */
+   unlink(fname);
+   buzzvm_t a = buzzvm_new(1);
+   uint16_t id = 1;
+   vs = reopen(a, fname);
+   buzzdict_set(a->vstigs, &id, &vs);
+   put(a, vs, 1, 1);
+   buzzvm_snapshot_t s = buzzvm_snapshot(a);
+   put(a, vs, 2, 2);
+   buzzvm_destroy(&a);
+   buzzvm_t b = buzzvm_fork(s);
+   TEST("fork log open",        vstig(b)->log && vstig(b)->log->map);
+   TEST("fork replays log",     get(b, vstig(b), 1) == 1 && get(b, vstig(b), 2) == 2);
+   put(b, vstig(b), 3, 3);
+   buzzvstig_t other = buzzvstig_new();
+   TEST("log locked",           buzzvstiglog_open(b, other, fname, BUZZVSTIGLOG_FSYNC_NEVER) == NULL &&
+                                buzzdict_isempty(other->data));
+   buzzvstig_destroy(&other);
+   buzzvm_t c = buzzvm_fork(s);
+   TEST("second fork unlogged", vstig(c)->log == NULL && get(c, vstig(c), 1) == 1);
+   buzzvm_destroy(&c);
+   buzzvm_destroy(&b);
+   buzzvm_snapshot_destroy(&s);
+   vs = reopen(vm, fname);
+   TEST("writes kept by fork",  buzzdict_size(vs->data) == 3 && get(vm, vs, 1) == 1 &&
+                                get(vm, vs, 2) == 2 && get(vm, vs, 3) == 3);
+   buzzvstig_destroy(&vs);
+
+   /* Deletions keep their version, removals don't */
+   unlink(fname);
+   vs = reopen(vm, fname);
+   buzzvstig_sync_set(vs, 10, 100);
+   buzzvstig_limits_set(vm, vs, 2, BUZZVSTIG_EVICT_OLDEST, 0);
+   put(vm, vs, 1, 1);
+   put(vm, vs, 2, 2);
+   put(vm, vs, 3, 3);
+   putnil(vm, vs, 2, 7);
+   put(vm, vs, 4, 4);
+   del(vm, vs, 4);
+   TEST("eviction marker",      deleted(vm, vs, 1, 1));
+   buzzvstig_destroy(&vs);
+   vs = reopen(vm, fname);
+   TEST("marker reloaded",      deleted(vm, vs, 1, 1));
+   TEST("nil put reloaded",     deleted(vm, vs, 2, 7));
+   TEST("removal reloaded",     get(vm, vs, 4) == -1 && !deleted(vm, vs, 4, 4));
+   TEST("live entry reloaded",  get(vm, vs, 3) == 3 && vs->tombstones == 2);
+   buzzvstig_destroy(&vs);
+
+   /* Files that are not logs are left alone */
+   FILE* f = fopen(fname, "wb");
+   fputs("not a log", f);
+   fclose(f);
+   vs = buzzvstig_new();
+   TEST("foreign file refused", buzzvstiglog_open(vm, vs, fname, BUZZVSTIGLOG_FSYNC_NEVER) == NULL &&
+                                fsize(fname) == 9);
+   buzzvstig_destroy(&vs);
+
+   unlink(fname);
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   buzzvm_destroy(&vm);
+   return n_fail > 0;
+}
@@ -0,0 +1,234 @@
+#include <buzz/buzzvm.h>
+#include <buzz/buzztransport.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+static int n_pass = 0;
+static int n_fail = 0;
+
+#define TEST(NAME, EXPR) do {                            \
+   if(EXPR) { printf("[PASS] %s\n", NAME); ++n_pass; } \
+   else     { printf("[FAIL] %s\n", NAME); ++n_fail; } \
+} while(0)
+
+#define ROBOTS 3
+#define VSID   1
+
+/* An endless empty loop, so that the VMs can process messages and
+ * call native closures */
+static const uint8_t BCODE[] = { 0, 0, BUZZVM_INSTR_NOP, BUZZVM_INSTR_JUMP, 2, 0, 0, 0,
+                                 BUZZVM_INSTR_DONE };
+
+/****************************************/
+/****************************************/
+
+static buzzvstig_t vstig(buzzvm_t vm) {
+   uint16_t id = VSID;
+   return *buzzdict_get(vm->vstigs, &id, buzzvstig_t);
+}
+
+static void put(buzzvm_t vm, int32_t key, int32_t value, uint16_t timestamp) {
+   buzzobj_t k = buzzheap_newobj(vm, BUZZTYPE_INT);
+   k->i.value = key;
+   buzzobj_t v = buzzheap_newobj(vm, BUZZTYPE_INT);
+   v->i.value = value;
+   buzzvstig_elem_t e = buzzvstig_elem_new(v, timestamp, vm->robot);
+   buzzvstig_store(vm, vstig(vm), &k, &e);
+}
+
+static int32_t get(buzzvm_t vm, int32_t key) {
+   buzzobj_t k = buzzheap_newobj(vm, BUZZTYPE_INT);
+   k->i.value = key;
+   const buzzvstig_elem_t* e = buzzvstig_fetch(vstig(vm), &k);
+   return e ? (*e)->data->i.value : -1;
+}
+
+static void run(buzzvm_t* vms, buzztransport_t* ts, int steps) {
+   int s, i;
+   for(s = 0; s < steps; ++s) {
+      for(i = 0; i < ROBOTS; ++i) {
+         buzztransport_receive(vms[i], ts[i]);
+         buzztransport_send(vms[i], ts[i]);
+      }
+   }
+}
+
+static int same_digest(buzzvm_t a, buzzvm_t b) {
+   return memcmp(vstig(a)->sync.hashes,
+                 vstig(b)->sync.hashes,
+                 BUZZVSTIG_SYNC_LEAVES * sizeof(uint32_t)) == 0;
+}
+
+/*
+ * Checks that the keys of each leaf are the entries counted in the leaf.
+ */
+static int leaves_ok(buzzvm_t vm) {
+   buzzvstig_t vs = vstig(vm);
+   uint32_t leaf, i, total = 0;
+   for(leaf = 0; leaf < BUZZVSTIG_SYNC_LEAVES; ++leaf) {
+      buzzdarray_t ks = vs->sync.keys[leaf];
+      uint32_t n = ks ? buzzdarray_size(ks) : 0;
+      if(n != vs->sync.counts[leaf]) return 0;
+      for(i = 0; i < n; ++i) {
+         buzzobj_t k = buzzdarray_get(ks, i, buzzobj_t);
+         if(!buzzvstig_fetch(vs, &k)) return 0;
+      }
+      total += n;
+   }
+   return total == buzzdict_size(vs->data);
+}
+
+static uint32_t sent(buzzvm_t vm, int type) {
+   return vm->outmsgs->classes[type].sent_msgs;
+}
+
+static int visited = 0;
+
+static int visit(buzzvm_t vm) {
+   ++visited;
+   return buzzvm_ret0(vm);
+}
+
+/* Calls a method of the virtual stigmergy, leaving its result on the stack */
+static buzzobj_t call(buzzvm_t vm, buzzvm_funp fun, int argc, ...) {
+   /* The method reads the id from its self table */
+   buzzvm_pusht(vm);
+   buzzobj_t t = buzzvm_stack_at(vm, 1);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "id", 1));
+   buzzvm_pushi(vm, VSID);
+   buzzvm_tput(vm);
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "method", 1));
+   buzzvm_pushcc(vm, buzzvm_function_register(vm, fun));
+   buzzvm_tput(vm);
+   /* Push the method and its arguments */
+   buzzvm_push(vm, t);
+   buzzvm_pushs(vm, buzzvm_string_register(vm, "method", 1));
+   buzzvm_tget(vm);
+   va_list ap;
+   va_start(ap, argc);
+   int i;
+   for(i = 0; i < argc; ++i) buzzvm_push(vm, va_arg(ap, buzzobj_t));
+   va_end(ap);
+   buzzvm_closure_call(vm, argc);
+   return buzzvm_stack_at(vm, 1);
+}
+
+/****************************************/
+/****************************************/
+
+int main(void) {
+   printf("=== buzzvstig sync ===\n\n");
+   buzztransport_bus_t bus = buzztransport_bus_new();
+   buzzvm_t vms[ROBOTS];
+   buzztransport_t ts[ROBOTS];
+   int i;
+   for(i = 0; i < ROBOTS; ++i) {
+      vms[i] = buzzvm_new(i + 1);
+      buzzvm_set_bcode(vms[i], BCODE, sizeof(BCODE));
+      uint16_t id = VSID;
+      buzzvstig_t vs = buzzvstig_new();
+      buzzdict_set(vms[i]->vstigs, &id, &vs);
+      buzzvstig_sync_set(vs, 5, 0);
+      ts[i] = buzztransport_loopback_new(bus, 512);
+   }
+   /* Robot 1 knows many entries, robot 2 a few newer ones, robot 3 nothing */
+   for(i = 0; i < 2000; ++i) put(vms[0], i, i, 1);
+   for(i = 0; i < 2000; i += 100) put(vms[1], i, -i, 2);
+   put(vms[1], 5000, 5000, 1);
+
+   /* --- Convergence --- */
+   run(vms, ts, 300);
+   TEST("robot 2 caught up",      buzzdict_size(vstig(vms[1])->data) == 2001);
+   TEST("robot 3 caught up",      buzzdict_size(vstig(vms[2])->data) == 2001);
+   TEST("digests agree (1, 2)",   same_digest(vms[0], vms[1]));
+   TEST("digests agree (1, 3)",   same_digest(vms[0], vms[2]));
+   TEST("newer version wins",     get(vms[0], 300) == -300 && get(vms[2], 300) == -300);
+   TEST("older version replaced", get(vms[2], 301) == 301);
+   TEST("missing entry pulled",   get(vms[0], 5000) == 5000);
+
+   /* --- Steady state --- */
+   uint32_t puts = sent(vms[0], BUZZMSG_VSTIG_PUT);
+   uint32_t digests = sent(vms[0], BUZZMSG_VSTIG_DIGEST);
+   run(vms, ts, 50);
+   TEST("no repairs when in sync",  sent(vms[0], BUZZMSG_VSTIG_PUT) == puts);
+   TEST("one digest per period",    sent(vms[0], BUZZMSG_VSTIG_DIGEST) - digests == 10);
+
+   /* --- Bandwidth cap --- */
+   buzzvm_t late = buzzvm_new(4);
+   buzzvm_set_bcode(late, BCODE, sizeof(BCODE));
+   uint16_t id = VSID;
+   buzzvstig_t lvs = buzzvstig_new();
+   buzzdict_set(late->vstigs, &id, &lvs);
+   buzzvstig_sync_set(lvs, 5, 0);
+   buzztransport_t lt = buzztransport_loopback_new(bus, 512);
+   for(i = 0; i < ROBOTS; ++i) buzzvstig_sync_set(vstig(vms[i]), 5, 300);
+   uint64_t before = 0;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i)
+      before += vms[0]->outmsgs->classes[i].sent_bytes;
+   int s;
+   for(s = 0; s < 50; ++s) {
+      run(vms, ts, 1);
+      buzztransport_receive(late, lt);
+      buzztransport_send(late, lt);
+   }
+   uint64_t after = 0;
+   for(i = 0; i < BUZZMSG_TYPE_COUNT; ++i)
+      after += vms[0]->outmsgs->classes[i].sent_bytes;
+   /* 10 periods of 300 bytes, plus one message of overshoot per period */
+   TEST("bandwidth cap",            after - before <= 10 * (300 + 110));
+   TEST("late robot gets data",     buzzdict_size(lvs->data) > 0);
+
+   /* --- Deletions --- */
+   for(i = 0; i < ROBOTS; ++i) buzzvstig_sync_set(vstig(vms[i]), 5, 0);
+   buzzobj_t k = buzzheap_newobj(vms[0], BUZZTYPE_INT);
+   k->i.value = 7;
+   call(vms[0], buzzvstig_put, 2, k, buzzheap_newobj(vms[0], BUZZTYPE_NIL));
+   run(vms, ts, 50);
+   int deleted = 1;
+   for(i = 0; i < ROBOTS; ++i) {
+      k = buzzheap_newobj(vms[i], BUZZTYPE_INT);
+      k->i.value = 7;
+      const buzzvstig_elem_t* e = buzzvstig_fetch(vstig(vms[i]), &k);
+      deleted = deleted && e && (*e)->data->o.type == BUZZTYPE_NIL;
+   }
+   TEST("deletion propagated",      deleted);
+   TEST("size skips deletions",     call(vms[0], buzzvstig_size, 0)->i.value == 2000 &&
+                                    call(vms[2], buzzvstig_size, 0)->i.value == 2000);
+   buzzvm_pushcc(vms[2], buzzvm_function_register(vms[2], visit));
+   call(vms[2], buzzvstig_foreach, 1, buzzvm_stack_at(vms[2], 1));
+   TEST("foreach skips deletions",  visited == 2000);
+   TEST("digests agree on deletion", same_digest(vms[0], vms[2]));
+
+   /* --- Leaf key lists --- */
+   TEST("leaves hold the keys",     leaves_ok(vms[0]) && leaves_ok(vms[1]) &&
+                                    leaves_ok(vms[2]));
+   for(i = 0; i < 100; ++i) {
+      k = buzzheap_newobj(vms[0], BUZZTYPE_INT);
+      k->i.value = i;
+      buzzvstig_remove(vstig(vms[0]), &k);
+      put(vms[0], i + 100, i, 100);
+   }
+   vms[0]->heap->max_objs = 0;
+   buzzheap_gc(vms[0]);
+   TEST("leaves follow writes",     leaves_ok(vms[0]) &&
+                                    buzzdict_size(vstig(vms[0])->data) == 1901);
+   /* A request for a leaf queues the entries of that leaf only */
+   uint32_t leaf = 0;
+   while(vstig(vms[0])->sync.counts[leaf] == 0) ++leaf;
+   uint32_t queued = buzzoutmsg_queue_size(vms[0]);
+   buzzvstig_sync_onrequest(vms[0], VSID, vstig(vms[0]), BUZZVSTIG_SYNC_DEPTH, leaf);
+   TEST("request pushes one leaf",  buzzoutmsg_queue_size(vms[0]) - queued ==
+                                    vstig(vms[0])->sync.counts[leaf]);
+
+   printf("\n%d passed, %d failed\n", n_pass, n_fail);
+   buzzvm_destroy(&late);
+   buzztransport_destroy(&lt);
+   for(i = 0; i < ROBOTS; ++i) {
+      buzzvm_destroy(&vms[i]);
+      buzztransport_destroy(&ts[i]);
+   }
+   buzztransport_bus_destroy(&bus);
+   return n_fail > 0;
+}
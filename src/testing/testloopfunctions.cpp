@@ -43,6 +43,7 @@ void AddTestTable(const std::string& str_id,
 }
 
 void CTestLoopFunctions::PostStep() {
+   CBuzzLoopFunctions::PostStep();
    BuzzForeachVM(AddTestTable);
 }
 
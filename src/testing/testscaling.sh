@@ -0,0 +1,54 @@
+#!/usr/bin/env bash
+
+#
+# ARGoS scaling benchmark.
+# Runs testscaling.bzz on 1k, 5k and 10k foot-bots with 1 to 32 threads
+# and prints the wall-clock time of each run as CSV.
+#
+# Usage: testscaling.sh [build_dir] [length_in_seconds]
+#   build_dir is the directory where testscaling.bo was built
+#   (default: build/testing)
+#
+
+# Stop on any error
+set -e
+
+BUILD=$(cd "${1:-build/testing}" && pwd)
+LENGTH=${2:-30}
+ROBOTS=${ROBOTS:-"1000 5000 10000"}
+THREADS=${THREADS:-"1 2 4 8 16 32"}
+TEMPLATE=$(dirname "$0")/testscaling.argos.in
+
+#
+# Check tools
+#
+command -v argos3 >/dev/null 2>&1 || { echo >&2 "$0: error: can't find argos3"; exit 1; }
+if [[ ! -f "${BUILD}/testscaling.bo" ]]; then
+    echo >&2 "$0: error: can't find ${BUILD}/testscaling.bo"
+    exit 1
+fi
+
+#
+# Run the sweep
+#
+CONF=$(mktemp /tmp/testscalingXXXXXX.argos)
+trap 'rm -f ${CONF}' EXIT
+echo "robots,threads,seconds"
+for N in ${ROBOTS}; do
+    # Keep the density constant: about one robot per square meter
+    ARENA=$(awk "BEGIN { print int(sqrt(${N})) + 2 }")
+    HALF=$(awk "BEGIN { print (${ARENA} - 2) / 2 }")
+    for T in ${THREADS}; do
+        sed -e "s|@ROBOTS@|${N}|g" \
+            -e "s|@THREADS@|${T}|g" \
+            -e "s|@LENGTH@|${LENGTH}|g" \
+            -e "s|@ARENA@|${ARENA}|g" \
+            -e "s|@HALF@|${HALF}|g" \
+            -e "s|@BUILD@|${BUILD}|g" \
+            "${TEMPLATE}" > "${CONF}"
+        START=$(date +%s.%N)
+        argos3 -n -c "${CONF}" > /dev/null
+        END=$(date +%s.%N)
+        echo "${N},${T},$(awk "BEGIN { print ${END} - ${START} }")"
+    done
+done